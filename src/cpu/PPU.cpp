@@ -1,11 +1,16 @@
 #include "PPU.h"
+#include "PPUJit.h"
 #include <kernel/Syscall.h>
+#include <kernel/ModuleManager.h>
+#include <kernel/Modules/CellThread.h>
+#include <kernel/Modules/CellGcm.h>
 
 #include <stdio.h>
 #include <string.h>
 #include <vector>
 #include <csignal>
 #include <stdexcept>
+#include <logging.h>
 
 CellPPU* dump_ppu;
 
@@ -26,20 +31,29 @@ CellPPU::CellPPU(MemoryManager& manager)
 {
     InitInstructionTable();
 
-    dump_ppu = this;
-    std::atexit(atexit_func);
-    std::signal(SIGINT, sigfunc);
+    // Only the first PPU dumps its registers, the others are extra workers
+    if (!dump_ppu)
+    {
+        dump_ppu = this;
+        std::atexit(atexit_func);
+        std::signal(SIGINT, sigfunc);
+    }
 
+	// SPUs are shared by every PPU
 	for (int i = 0; i < 6; i++)
 	{
-		if (!spus[i])
-		{
-			spus[i] = new SPU(&manager);
-			g_spus[i] = spus[i];
-		}
+		if (!g_spus[i])
+			g_spus[i] = new SPU(&manager);
+		spus[i] = g_spus[i];
 	}
 }
 
+void CellPPU::EnableJit()
+{
+    if (!jit)
+        jit = new PPUJit();
+}
+
 void CellPPU::RunSubroutine(uint32_t addr)
 {
     State copy = state;
@@ -47,114 +61,211 @@ void CellPPU::RunSubroutine(uint32_t addr)
 	uint32_t retAddr = state.pc;
 	state.lr = state.pc;
     state.pc = addr;
-    printf("Running callback at 0x%08x, 0x%08x\n", state.pc, retAddr);
+    LOG(PPU, TRACE, "Running callback at 0x%08x, 0x%08x\n", state.pc, retAddr);
 
+    // Anything the callback blocks on waits in place (see SwitchFromBlockedThread), so state stays this thread's
+    subroutineDepth++;
 	while (state.pc != retAddr)
 	{
 		Run();
 	}
+    subroutineDepth--;
 
     state = copy;
 }
 
-void CellPPU::Run()
+CellPPU::InstrHandler CellPPU::Decode(uint32_t opcode)
 {
-    uint32_t opcode = manager.Read32(state.pc);
+    if (opcode == 0x60000000)
+        return &CellPPU::Nop;
+    else if (opcode == 0x44000002)
+        return &CellPPU::Sc;
+	else if (opcode == 0x4c00012c)
+		return &CellPPU::Isync;
 
-    // if (pc == 0x16264)
-    // {
-    //     printf("cellGcmFinish(0x%08x, %d)\n", r[3], r[4]);
-    // }
+    switch ((opcode >> 26) & 0x3F)
+    {
+    case HLE_TRAP_OPCODE: return &CellPPU::HleCall;
+    case 0x04: return Decode04(opcode);
+    case 0x07: return &CellPPU::Mulli;
+    case 0x08: return &CellPPU::Subfic;
+    case 0x0A: return &CellPPU::Cmpli;
+    case 0x0B: return &CellPPU::Cmpi;
+    case 0x0C: return &CellPPU::Addic;
+	case 0x0F: return &CellPPU::Addis;
+    case 0x0E: return &CellPPU::Addi;
+    case 0x10: return &CellPPU::BranchCond;
+    case 0x12: return &CellPPU::Branch;
+    case 0x13: return Decode13(opcode);
+	case 0x14: return &CellPPU::Rlwimi;
+    case 0x15: return &CellPPU::Rlwinm;
+    case 0x17: return &CellPPU::Rlwnm;
+    case 0x18: return &CellPPU::Ori;
+    case 0x19: return &CellPPU::Oris;
+    case 0x1A: return &CellPPU::Xori;
+    case 0x1B: return &CellPPU::Xoris;
+    case 0x1C: return &CellPPU::Andi;
+    case 0x1E: return Decode1E(opcode);
+    case 0x1F: return Decode1F(opcode);
+    case 0x20: return &CellPPU::Lwz;
+    case 0x21: return &CellPPU::Lwzu;
+	case 0x22: return &CellPPU::Lbz;
+    case 0x23: return &CellPPU::Lbzu;
+    case 0x24: return &CellPPU::Stw;
+    case 0x25: return &CellPPU::Stwu;
+    case 0x26: return &CellPPU::Stb;
+    case 0x27: return &CellPPU::Stbu;
+    case 0x28: return &CellPPU::Lhz;
+    case 0x29: return &CellPPU::Lhzu;
+    case 0x2C: return &CellPPU::Sth;
+    case 0x30: return &CellPPU::Lfs;
+    case 0x32: return &CellPPU::Lfd;
+    case 0x34: return &CellPPU::Stfs;
+    case 0x35: return &CellPPU::Stfsu;
+    case 0x36: return &CellPPU::Stfd;
+    case 0x3A: return Decode3A(opcode);
+    case 0x3B: return Decode3B(opcode);
+    case 0x3E: return Decode3E(opcode);
+    case 0x3F: return Decode3F(opcode);
+    default:
+        return &CellPPU::UnknownOpcode;
+    }
+}
+
+static bool IsBlockEnd(uint32_t opcode)
+{
+    switch ((opcode >> 26) & 0x3F)
+    {
+    case HLE_TRAP_OPCODE: // Returns to lr
+    case 0x10: // bc
+    case 0x11: // sc
+    case 0x12: // b
+    case 0x13: // bclr, bcctr
+        return true;
+    }
 
-    // if (pc == 0x162E4)
-    // {
-    //     printf("cellGcmSetReferenceCommand(0x%08x, %d)\n", r[3], r[4]);
-    //     printf("0x%08x\n", manager.Read32(r[3] + 8));
-    //     canDisassemble = true;
-    // }
+    return false;
+}
 
-    // if (pc == 0x16348)
-    // {
-    //     canDisassemble = false;
-    // }
+#define MAX_BLOCK_SIZE 256
 
-    state.pc += 4;
+// Number of times a block has to run before it's handed to the JIT
+#define JIT_THRESHOLD 16
 
-    if (canDisassemble)
-        printf("0x%08x (0x%08lx): ", opcode, state.pc);
+uint64_t CellPPU::SumCodeWrites(uint32_t firstPage, uint32_t lastPage)
+{
+    uint64_t sum = 0;
+    for (uint32_t page = firstPage; page <= lastPage; page++)
+        sum += manager.GetPageWrites(page);
+    return sum;
+}
 
-    if (opcode == 0x60000000)
+CellPPU::Block& CellPPU::GetBlock(uint32_t addr)
+{
+    auto it = blockCache.find(addr);
+    if (it != blockCache.end())
     {
-        if (canDisassemble)
-            printf("nop\n");
-        return;
+        Block& cached = *it->second;
+        if (SumCodeWrites(cached.firstPage, cached.lastPage) == cached.writes)
+            return cached;
+
+        // Kept until Dispatch frees it, it may be running further up the stack. The JIT never frees its code
+        LOG(PPU, INFO, "Block at 0x%08x was written over, decoding it again\n", addr);
+        staleBlocks.push_back(std::move(it->second));
+        blockCache.erase(it);
     }
-    else if (opcode == 0x44000002)
+
+    // Find the end first, so only pages the block actually covers get watched
+    uint32_t count = 1;
+    while (count < MAX_BLOCK_SIZE && !IsBlockEnd(manager.Read32(addr + (count-1)*4)))
+        count++;
+
+    auto block = std::make_unique<Block>();
+
+    // Watch before reading the counts and decoding, so a write that races the decode still invalidates it
+    block->firstPage = addr / HOST_PAGE_SIZE;
+    block->lastPage = (addr + count*4 - 1) / HOST_PAGE_SIZE;
+    manager.WatchWrites(addr, count*4);
+    block->writes = SumCodeWrites(block->firstPage, block->lastPage);
+
+    for (uint32_t i = 0; i < count; i++)
     {
-		if (canDisassemble)
-			printf("syscall\n");
-        Syscalls::DoSyscall(this);
-        return;
+        uint32_t opcode = manager.Read32(addr + i*4);
+        block->instrs.push_back({Decode(opcode), opcode});
     }
-	else if (opcode == 0x4c00012c)
-	{
-		if (canDisassemble)
-			printf("isync\n");
-		return;
-	}
 
-    
-    switch ((opcode >> 26) & 0x3F)
+    return *(blockCache[addr] = std::move(block));
+}
+
+int CellPPU::Run()
+{
+    // Blocks are never modified once decoded, and stale ones are kept alive until Dispatch,
+    // so this stays valid even if a handler re-enters Run() through RunSubroutine
+    Block& block = GetBlock(state.pc);
+
+    // Tracing stays on the interpreter, the compiled code doesn't disassemble
+    if (jit && !LOG_ENABLED(PPU, TRACE))
     {
-    case 0x04: CellPPU::G_04(opcode); break;
-    case 0x07: CellPPU::Mulli(opcode); break;
-    case 0x08: CellPPU::Subfic(opcode); break;
-    case 0x0A: CellPPU::Cmpli(opcode); break;
-    case 0x0B: CellPPU::Cmpi(opcode); break;
-    case 0x0C: CellPPU::Addic(opcode); break;
-	case 0x0F: CellPPU::Addis(opcode); break;
-    case 0x0E: CellPPU::Addi(opcode); break;
-    case 0x10: CellPPU::BranchCond(opcode); break;
-    case 0x12: CellPPU::Branch(opcode); break;
-    case 0x13: CellPPU::G_13(opcode); break;
-	case 0x14: CellPPU::Rlwimi(opcode); break;
-    case 0x15: CellPPU::Rlwinm(opcode); break;
-    case 0x17: CellPPU::Rlwnm(opcode); break;
-    case 0x18: CellPPU::Ori(opcode); break;
-    case 0x19: CellPPU::Oris(opcode); break;
-    case 0x1A: CellPPU::Xori(opcode); break;
-    case 0x1B: CellPPU::Xoris(opcode); break;
-    case 0x1C: CellPPU::Andi(opcode); break;
-    case 0x1E: CellPPU::G_1E(opcode); break;
-    case 0x1F: CellPPU::G_1F(opcode); break;
-    case 0x20: CellPPU::Lwz(opcode); break;
-    case 0x21: CellPPU::Lwzu(opcode); break;
-	case 0x22: CellPPU::Lbz(opcode); break;
-    case 0x23: CellPPU::Lbzu(opcode); break;
-    case 0x24: CellPPU::Stw(opcode); break;
-    case 0x25: CellPPU::Stwu(opcode); break;
-    case 0x26: CellPPU::Stb(opcode); break;
-    case 0x27: CellPPU::Stbu(opcode); break;
-    case 0x28: CellPPU::Lhz(opcode); break;
-    case 0x29: CellPPU::Lhzu(opcode); break;
-    case 0x2C: CellPPU::Sth(opcode); break;
-    case 0x30: CellPPU::Lfs(opcode); break;
-    case 0x32: CellPPU::Lfd(opcode); break;
-    case 0x34: CellPPU::Stfs(opcode); break;
-    case 0x35: CellPPU::Stfsu(opcode); break;
-    case 0x36: CellPPU::Stfd(opcode); break;
-    case 0x3A: CellPPU::G_3A(opcode); break;
-    case 0x3B: CellPPU::G_3B(opcode); break;
-    case 0x3E: CellPPU::G_3E(opcode); break;
-    case 0x3F: CellPPU::G_3F(opcode); break;
-    default:
-        printf("Unknown opcode 0x%08x\n", opcode);
-        throw std::runtime_error("Failed to execute opcode");
+        if (!block.code && ++block.hits == JIT_THRESHOLD)
+            block.code = jit->Compile(state.pc, block.instrs);
+
+        if (block.code)
+        {
+            jit->Execute(this, block.code);
+            return block.instrs.size();
+        }
+    }
+
+    for (auto& instr : block.instrs)
+    {
+        state.pc += 4;
+
+        LOG(PPU, TRACE, "0x%08x (0x%08lx): ", instr.opcode, state.pc);
+
+        (this->*instr.handler)(instr.opcode);
+    }
+
+    return block.instrs.size();
+}
+
+int CellPPU::Dispatch()
+{
+    if (!GetCurrentThread())
+        return WaitForThread(this) ? 0 : PPU_IDLE_INSTRUCTIONS;
+
+    Thread* thread = GetCurrentThread();
+
+    // Between blocks, so the handler runs as if the thread had called it
+    CellGcm::RunPendingFlipHandler(this);
+
+    int executed = Run();
+
+    // Nothing from a stale block is running once the RunSubroutine calls have unwound
+    if (subroutineDepth == 0 && !staleBlocks.empty())
+        staleBlocks.clear();
+
+    // A thread switched in by a blocking HLE call or exit starts on a fresh slice
+    if (GetCurrentThread() != thread)
+    {
+        sliceLeft = quantum;
+        return executed;
     }
+
+    // HLE calls can re-enter Run() through RunSubroutine, so threads are only ever preempted from here
+    sliceLeft -= executed;
+    if (sliceLeft <= 0 || preemptPending)
+    {
+        sliceLeft = quantum;
+        PreemptThread(this);
+    }
+
+    return executed;
 }
 
 void CellPPU::Dump()
 {
+    Log::Flush();
+
     for (int i = 0; i < 32; i++)
         printf("r%d\t->\t0x%08lx\n", i, state.r[i]);
     printf("lr\t->\t0x%08lx\n", state.lr);
@@ -6,6 +6,17 @@
 #include <unordered_map>
 #include <functional>
 #include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <logging.h>
+
+class PPUJit;
+
+// Instructions a thread gets to run before the scheduler looks for another one of the same priority
+#define PPU_DEFAULT_QUANTUM 100000
+// What a millisecond spent idle counts as, at the rate the vblank timer assumes the PPU runs
+#define PPU_IDLE_INSTRUCTIONS 320000
 
 union uint128_t
 {
@@ -93,6 +104,49 @@ private:
 
     std::unordered_map<uint8_t, std::function<void(uint32_t)>> opcodes;
 
+    friend class PPUJit;
+
+    typedef void (CellPPU::*InstrHandler)(uint32_t);
+    typedef void (*CompiledBlock)(CellPPU* ppu, State* state);
+
+    // A run of guest instructions decoded once into handler pointers,
+    // ending at the first branch or syscall
+    struct DecodedInstr
+    {
+        InstrHandler handler;
+        uint32_t opcode;
+    };
+
+    struct Block
+    {
+        std::vector<DecodedInstr> instrs;
+        uint32_t hits = 0;
+        CompiledBlock code = nullptr;
+        // Code pages are write-watched like textures, a changed sum means the guest wrote over the block
+        uint32_t firstPage, lastPage;
+        uint64_t writes;
+    };
+
+    PPUJit* jit = nullptr;
+
+    int quantum = PPU_DEFAULT_QUANTUM;
+    int sliceLeft = PPU_DEFAULT_QUANTUM; // Reset whenever a thread is switched in
+
+    // Taken by lwarx/ldarx, the matching conditional store only goes through while the line is untouched
+    bool hasReservation = false;
+    uint32_t resAddr;
+    uint64_t resVersion;
+    uint64_t resValue;
+
+    std::unordered_map<uint32_t, std::unique_ptr<Block>> blockCache;
+    // Blocks that were written over, kept around since one can still be running further up the stack
+    // and its compiled code points into instrs. Dispatch frees them between blocks
+    std::vector<std::unique_ptr<Block>> staleBlocks;
+
+    Block& GetBlock(uint32_t addr);
+    uint64_t SumCodeWrites(uint32_t firstPage, uint32_t lastPage);
+    InstrHandler Decode(uint32_t opcode);
+
     template<typename T>
     void UpdateCRn(const uint8_t n, const T a, const T b)
     {
@@ -101,7 +155,7 @@ private:
         else if (a == b) SetCR(n, CR_EQ);
         else if ((typeid(T) == typeid(float)) || (typeid(T) == typeid(double)))
         {
-            printf("Float/doubles are not <, >, or ==!\n");
+            LOG(PPU, ERROR, "Float/doubles are not <, >, or ==!\n");
             exit(1);
         }
     }
@@ -140,7 +194,7 @@ private:
         case 0x100: name = "usprg0"; return state.usprg0;
         }
 
-        printf("ERROR: Read from unknown SPR 0x%03x\n", n);
+        LOG(PPU, ERROR, "ERROR: Read from unknown SPR 0x%03x\n", n);
         exit(1);
     }
 
@@ -199,7 +253,12 @@ private:
 
     uint8_t IsCR(const uint32_t bit) const {return (GetCR(bit >> 2) & GetCRBit(bit)) ? 1 : 0;}
 
-    void G_04(uint32_t opcode); // 0x04
+    InstrHandler Decode04(uint32_t opcode); // 0x04
+    void Nop(uint32_t opcode); // 0x60000000
+    void Isync(uint32_t opcode); // 0x4C00012C
+    void Sc(uint32_t opcode); // 0x44000002
+    void HleCall(uint32_t opcode); // 0x01, see HLE_TRAP
+    void UnknownOpcode(uint32_t opcode);
     void Vaddfp(uint32_t opcode); // 0x04 0x0A
 	void Vsel(uint32_t opcode); // 0x04 0x02A
 	void Vperm(uint32_t opcode); // 0x04 0x02B
@@ -224,7 +283,7 @@ private:
     void Addis(uint32_t opcode); // 0x0F
     void BranchCond(uint32_t opcode); // 0x10
     void Branch(uint32_t opcode); // 0x12
-    void G_13(uint32_t opcode); // 0x13
+    InstrHandler Decode13(uint32_t opcode); // 0x13
     void Bclr(uint32_t opcode); // 0x13 0x10
     void Cror(uint32_t opcode); // 0x13 0x1C1
     void Bcctr(uint32_t opcode); // 0x13 0x210
@@ -236,12 +295,12 @@ private:
     void Xori(uint32_t opcode); // 0x1A
     void Xoris(uint32_t opcode); // 0x1B
     void Andi(uint32_t opcode); // 0x1C
-    void G_1E(uint32_t opcode); //0x1E
+    InstrHandler Decode1E(uint32_t opcode); //0x1E
     void Rldicl(uint32_t opcode); // 0x1E 0x00
     void Rldicr(uint32_t opcode); // 0x1E 0x01
     void Rldic(uint32_t opcode); // 0x1E 0x02
     void Rldimi(uint32_t opcode); // 0x1E 0x03
-    void G_1F(uint32_t opcode); // 0x1F
+    InstrHandler Decode1F(uint32_t opcode); // 0x1F
     void Cmp(uint32_t opcode); // 0x1F 0x00
 	void Lvsl(uint32_t opcode); // 0x1F 0x06
 	void Subfc(uint32_t opcode); // 0x1F 0x08
@@ -282,6 +341,7 @@ private:
     void Add(uint32_t opcode); // 0x1F 0x10A
     void Lhzx(uint32_t opcode); // 0x1F 0x117
     void Xor(uint32_t opcode); // 0x1F 0x13C
+    void Dcbt(uint32_t opcode); // 0x1F 0x116
     void Mfspr(uint32_t opcode); // 0x1F 0x153
 	void Mftb(uint32_t opcode); // 0x1F 0x173
     void Or(uint32_t opcode); // 0x1F 0x1BC
@@ -291,6 +351,7 @@ private:
     void Divd(uint32_t opcode); // 0x1F 0x1E9
     void Divw(uint32_t opcode); // 0x1F 0x1EB
     void Lfsx(uint32_t opcode); // 0x1F 0x217
+    void Sync(uint32_t opcode); // 0x1F 0x256
     void Srw(uint32_t opcode); // 0x1F 0x218
 	void Srd(uint32_t opcode); // 0x1F 0x21B
     void Lfdx(uint32_t opcode); // 0x1F 0x257
@@ -298,6 +359,7 @@ private:
     void Sraw(uint32_t opcode); // 0x1F 0x318
     void Srawi(uint32_t opcode); // 0x1F 0x338
     void Sradi(uint32_t opcode); // 0x1F 0x19D & 0x1F 0x33D
+    void Eieio(uint32_t opcode); // 0x1F 0x356
     void Extsh(uint32_t opcode); // 0x1F 0x39A
     void Extsb(uint32_t opcode); // 0x1F 0x3BA
     void Stfiwx(uint32_t opcode); // 0x1F 0x3D7
@@ -319,20 +381,20 @@ private:
     void Stfs(uint32_t opcode); // 0x34
     void Stfsu(uint32_t opcode); // 0x35
     void Stfd(uint32_t opcode); // 0x36
-    void G_3A(uint32_t opcode); // 0x3A
+    InstrHandler Decode3A(uint32_t opcode); // 0x3A
     void Ld(uint32_t opcode); // 0x3A 0x00
     void Ldu(uint32_t opcode); // 0x3A 0x01
-    void G_3B(uint32_t opcode); // 0x3B
+    InstrHandler Decode3B(uint32_t opcode); // 0x3B
     void Fdivs(uint32_t opcode); // 0x3B 0x12
     void Fsubs(uint32_t opcode); // 0x3B 0x14
     void Fadds(uint32_t opcode); // 0x3B 0x15
     void Fmuls(uint32_t opcode); // 0x3B 0x19
     void Fmsubs(uint32_t opcode); // 0x3B 0x1C
     void Fmadds(uint32_t opcode); // 0x3B 0x1D
-    void G_3E(uint32_t opcode); // 0x3E
+    InstrHandler Decode3E(uint32_t opcode); // 0x3E
     void Std(uint32_t opcode); // 0x3E 0x00
     void Stdu(uint32_t opcode); // 0x3E 0x01
-    void G_3F(uint32_t opcode); // 0x3F
+    InstrHandler Decode3F(uint32_t opcode); // 0x3F
     void Fcmpu(uint32_t opcode); // 0x3F 0x000
     void Frsp(uint32_t opcode); // 0x3F 0x00C
     void Fctiwz(uint32_t opcode); // 0x3F 0x00F
@@ -349,8 +411,10 @@ private:
 
     void InitInstructionTable();
 public:
-    bool canDisassemble = false;
     bool threadSwapped = false;
+    bool threadBlocked = false; // Set by HLE calls and syscalls that put the current thread on a sleep queue
+    std::atomic<bool> preemptPending = false; // Set by the scheduler, from any host thread, when a higher priority thread should run here
+    int subroutineDepth = 0; // RunSubroutine calls on the host stack, the thread can't be switched out while it's above 0
 
     uint64_t GetStackAddr() {return state.sp;}
 
@@ -359,12 +423,17 @@ public:
     MemoryManager* GetManager() {return &manager;}
 
 	State& GetState() {return state;}
-	void SetState(State& state) {this->state = state;}
+	void SetState(State& state) {this->state = state; hasReservation = false; sliceLeft = quantum;}
 
     CellPPU(MemoryManager& manager);
+    void EnableJit();
 	void RunSubroutine(uint32_t addr); // Needed for callbacks and cellThreadOnce
 
-    void Run();
+    int Run(); // Runs one block, returns the number of instructions executed
+    // Run() for the top-level loop of a worker, which also switches threads once the quantum is used up
+    // An idle PPU waits for a thread instead, and counts that as PPU_IDLE_INSTRUCTIONS if none came
+    int Dispatch();
+    void SetQuantum(int instructions) {quantum = sliceLeft = instructions;}
     void Dump();
 
 	SPU* spus[6];
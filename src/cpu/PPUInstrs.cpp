@@ -1,6 +1,8 @@
 #include "PPU.h"
 #include <loaders/Elf.h>
 #include <kernel/ModuleManager.h>
+#include <kernel/Syscall.h>
+#include <kernel/Modules/CellThread.h>
 
 #include <stdio.h>
 #include <bit>
@@ -10,6 +12,7 @@
 #include <emmintrin.h>
 #include <math.h>
 #include <tmmintrin.h>
+#include <logging.h>
 
 float rsqrt(float f) 
 {
@@ -82,8 +85,6 @@ uint128_t sll128(uint128_t n, size_t shift)
 	return n;
 }
 
-uint32_t lastBranchTarget = 0;
-
 static uint64_t rotate_mask[64][64];
 void InitRotateMask()
 {
@@ -137,64 +138,97 @@ bool CellPPU::CheckCondition(uint32_t bo, uint32_t bi)
 uint64_t rotl64(const uint64_t x, const uint8_t n) {return (x << n) | (x >> (64-n));}
 uint32_t rotl32(const uint32_t x, const uint8_t n) {return (x << n) | (x >> (32-n));}
 
-void CellPPU::G_04(uint32_t opcode)
+void CellPPU::Nop(uint32_t opcode)
+{
+    LOG(PPU, TRACE, "nop\n");
+}
+
+void CellPPU::Isync(uint32_t opcode)
+{
+	LOG(PPU, TRACE, "isync\n");
+}
+
+void CellPPU::Sc(uint32_t opcode)
+{
+	LOG(PPU, TRACE, "syscall\n");
+    std::lock_guard<std::recursive_mutex> lock(kernelLock);
+    Syscalls::DoSyscall(this);
+
+    if (threadBlocked)
+    {
+        threadBlocked = false;
+        SwitchFromBlockedThread(this);
+    }
+}
+
+void CellPPU::HleCall(uint32_t opcode)
+{
+    LOG(PPU, TRACE, "hle %d\n", opcode & 0x3FFFFFF);
+    std::lock_guard<std::recursive_mutex> lock(kernelLock);
+    Modules::DoHLECall(opcode & 0x3FFFFFF, this);
+
+    // Reached through the import stub's bctr, so lr still holds the caller's return address
+    if (threadSwapped)
+        threadSwapped = false;
+    else
+        state.pc = state.lr;
+
+    // Blocked threads are saved after returning, so they resume in the caller with r3 already set
+    if (threadBlocked)
+    {
+        threadBlocked = false;
+        SwitchFromBlockedThread(this);
+    }
+}
+
+void CellPPU::UnknownOpcode(uint32_t opcode)
+{
+    LOG(PPU, ERROR, "Unknown opcode 0x%08x (primary 0x%02x)\n", opcode, (opcode >> 26) & 0x3F);
+    throw std::runtime_error("Failed to execute opcode");
+}
+
+CellPPU::InstrHandler CellPPU::Decode04(uint32_t opcode)
 {
     switch (opcode & 0x7FF)
     {
     case 0x00A:
-        Vaddfp(opcode);
-        break;
+        return &CellPPU::Vaddfp;
 	case 0x14A:
-		Vrsqrtefp(opcode);
-		break;
+		return &CellPPU::Vrsqrtefp;
 	case 0x28C:
-		Vspltw(opcode);
-		break;
+		return &CellPPU::Vspltw;
 	case 0x484:
-		Vor(opcode);
-		break;
+		return &CellPPU::Vor;
     case 0x4C4:
-        Vxor(opcode);
-        break;
+        return &CellPPU::Vxor;
     default:
 		switch (opcode & 0x3F)
 		{
 		case 0x02A:
-			Vsel(opcode);
-			break;
+			return &CellPPU::Vsel;
 		case 0x2B:
-			Vperm(opcode);
-			break;
+			return &CellPPU::Vperm;
 		case 0x2C:
-			Vsldoi(opcode);
-			break;
+			return &CellPPU::Vsldoi;
 		case 0x2E:
-			Vmaddfp(opcode);
-			break;
+			return &CellPPU::Vmaddfp;
 		case 0x2F:
-			Vnmsubfp(opcode);
-			break;
+			return &CellPPU::Vnmsubfp;
 		default:
 			switch (opcode & 0x7FF)
 			{
 			case 0x04A:
-				Vsubfp(opcode);
-				break;
+				return &CellPPU::Vsubfp;
 			case 0x08C:
-				Vmrghw(opcode);
-				break;
+				return &CellPPU::Vmrghw;
 			case 0x184:
-				Vslw(opcode);
-				break;
+				return &CellPPU::Vslw;
 			case 0x18C:
-				Vmrglw(opcode);
-				break;
+				return &CellPPU::Vmrglw;
 			case 0x38C:
-				Vspltisw(opcode);
-				break;
+				return &CellPPU::Vspltisw;
 			default:
-				printf("Unknown AltiVec instruction 0x%03x (0x%08x)\n", (opcode & 0x7FF), opcode);
-				throw std::runtime_error("Couldn't execute AltiVec instruction");
+				return &CellPPU::UnknownOpcode;
 			}
 		}
     }
@@ -209,8 +243,7 @@ void CellPPU::Vaddfp(uint32_t opcode)
     for (int i = 0; i < 4; i++)
         state.vpr[vd].f[i] = state.vpr[va].f[i] + state.vpr[vb].f[i];
     
-    if (canDisassemble)
-        printf("vaddfp v%d,v%d,v%d\n", vd, va, vb);
+    LOG(PPU, TRACE, "vaddfp v%d,v%d,v%d\n", vd, va, vb);
 }
 
 void CellPPU::Vsel(uint32_t opcode)
@@ -223,8 +256,7 @@ void CellPPU::Vsel(uint32_t opcode)
 	for (int i = 0; i < 2; i++)
 		state.vpr[vd].u64[i] = (state.vpr[vb].u64[i] & state.vpr[vc].u64[i]) | (state.vpr[va].u64[i] & ~state.vpr[vc].u64[i]);
 
-	if (canDisassemble)
-		printf("vsel v%d,v%d,v%d,v%d\n", vd, va, vb, vc);
+	LOG(PPU, TRACE, "vsel v%d,v%d,v%d,v%d\n", vd, va, vb, vc);
 }
 
 void CellPPU::Vperm(uint32_t opcode)
@@ -246,8 +278,7 @@ void CellPPU::Vperm(uint32_t opcode)
 	const auto res = _mm_or_si128(_mm_and_si128(mask, sa), _mm_andnot_si128(mask, sb));
 	memcpy(state.vpr[vd].u8, &res, 16);
 
-	if (canDisassemble)
-		printf("vperm v%d,v%d,v%d,v%d\n", vd, va, vb, vc);
+	LOG(PPU, TRACE, "vperm v%d,v%d,v%d,v%d\n", vd, va, vb, vc);
 }
 
 void CellPPU::Vsldoi(uint32_t opcode)
@@ -266,8 +297,7 @@ void CellPPU::Vsldoi(uint32_t opcode)
 		state.vpr[vd].u8[15 - b] = src[31 - (b + shb)];
 	}
 
-	if (canDisassemble)
-		printf("vsldoi v%d,v%d,v%d,%d\n", vd, va, vb, shb);
+	LOG(PPU, TRACE, "vsldoi v%d,v%d,v%d,%d\n", vd, va, vb, shb);
 }
 
 void CellPPU::Vnmsubfp(uint32_t opcode)
@@ -280,8 +310,7 @@ void CellPPU::Vnmsubfp(uint32_t opcode)
 	for (int i = 0; i < 4; i++)
 		state.vpr[vd].f[i] = -(float)((state.vpr[va].f[i] * state.vpr[vc].f[i]) - state.vpr[vb].f[i]);
 	
-	if (canDisassemble)
-		printf("vnmsubfp v%d,v%d,v%d,v%d\n", vd, va, vc, vb);
+	LOG(PPU, TRACE, "vnmsubfp v%d,v%d,v%d,v%d\n", vd, va, vc, vb);
 }
 
 void CellPPU::Vmaddfp(uint32_t opcode)
@@ -294,8 +323,7 @@ void CellPPU::Vmaddfp(uint32_t opcode)
 	for (int i = 0; i < 4; i++)
 		state.vpr[vd].f[i] = (state.vpr[va].f[i] * state.vpr[vc].f[i]) + state.vpr[vd].f[i];
 	
-	if (canDisassemble)
-		printf("vmaddfp v%d,v%d,v%d,v%d\n", vd, va, vc, vb);
+	LOG(PPU, TRACE, "vmaddfp v%d,v%d,v%d,v%d\n", vd, va, vc, vb);
 }
 
 void CellPPU::Vsubfp(uint32_t opcode)
@@ -307,8 +335,7 @@ void CellPPU::Vsubfp(uint32_t opcode)
 	for (int i = 0; i < 4; i++)
 		state.vpr[vd].f[i] = state.vpr[va].f[i] - state.vpr[vb].f[i];
 	
-	if (canDisassemble)
-		printf("vsubfp v%d,v%d,v%d\n", vd, va, vb);
+	LOG(PPU, TRACE, "vsubfp v%d,v%d,v%d\n", vd, va, vb);
 }
 
 void CellPPU::Vmrghw(uint32_t opcode)
@@ -322,8 +349,7 @@ void CellPPU::Vmrghw(uint32_t opcode)
 	state.vpr[vd].u32[2] = state.vpr[va].u32[1];
 	state.vpr[vd].u32[3] = state.vpr[vb].u32[1];
 
-	if (canDisassemble)
-		printf("vmrghw v%d,v%d,v%d\n", vd, va, vb);
+	LOG(PPU, TRACE, "vmrghw v%d,v%d,v%d\n", vd, va, vb);
 }
 
 void CellPPU::Vrsqrtefp(uint32_t opcode)
@@ -336,8 +362,7 @@ void CellPPU::Vrsqrtefp(uint32_t opcode)
 			state.vpr[vd].f[i] = rsqrt(state.vpr[vb].f[i]);
 	}
 	
-	if (canDisassemble)
-		printf("vrsqrtefp v%d,v%d\n", vd, vb);
+	LOG(PPU, TRACE, "vrsqrtefp v%d,v%d\n", vd, vb);
 }
 
 void CellPPU::Vslw(uint32_t opcode)
@@ -352,8 +377,7 @@ void CellPPU::Vslw(uint32_t opcode)
 		state.vpr[vd].u32[i] = state.vpr[va].u32[i] << sh;
 	}
 
-	if (canDisassemble)
-		printf("vslw v%d,v%d,v%d\n", vd, va, vb);
+	LOG(PPU, TRACE, "vslw v%d,v%d,v%d\n", vd, va, vb);
 }
 
 void CellPPU::Vmrglw(uint32_t opcode)
@@ -367,8 +391,7 @@ void CellPPU::Vmrglw(uint32_t opcode)
 	state.vpr[vd].u32[2] = state.vpr[va].u32[3];
 	state.vpr[vd].u32[3] = state.vpr[vb].u32[3];
 
-	if (canDisassemble)
-		printf("vmrglw v%d,v%d,v%d\n", vd, va, vb);
+	LOG(PPU, TRACE, "vmrglw v%d,v%d,v%d\n", vd, va, vb);
 }
 
 void CellPPU::Vspltw(uint32_t opcode)
@@ -380,8 +403,7 @@ void CellPPU::Vspltw(uint32_t opcode)
 	for (int i = 0; i < 4; i++)
 		state.vpr[vd].u32[i] = state.vpr[vb].u32[uimm];
 	
-	if (canDisassemble)
-		printf("vspltw v%d,v%d,%d\n", vd, vb, uimm);
+	LOG(PPU, TRACE, "vspltw v%d,v%d,%d\n", vd, vb, uimm);
 }
 
 void CellPPU::Vspltisw(uint32_t opcode)
@@ -394,8 +416,7 @@ void CellPPU::Vspltisw(uint32_t opcode)
 	for (int i = 0; i < 4; i++)
 		state.vpr[vd].u32[i] = imm;
 	
-	if (canDisassemble)
-		printf("vspltisw v%d,v%d,0x%08x\n", vd, vb, imm);
+	LOG(PPU, TRACE, "vspltisw v%d,v%d,0x%08x\n", vd, vb, imm);
 }
 
 void CellPPU::Vor(uint32_t opcode)
@@ -409,8 +430,7 @@ void CellPPU::Vor(uint32_t opcode)
     state.vpr[vd].u32[2] = state.vpr[va].u32[2] | state.vpr[vb].u32[2];
     state.vpr[vd].u32[3] = state.vpr[va].u32[3] | state.vpr[vb].u32[3];
 
-    if (canDisassemble)
-        printf("vor v%d, v%d, v%d\n", vd, va, vb);
+    LOG(PPU, TRACE, "vor v%d, v%d, v%d\n", vd, va, vb);
 }
 
 void CellPPU::Vxor(uint32_t opcode)
@@ -424,8 +444,7 @@ void CellPPU::Vxor(uint32_t opcode)
     state.vpr[vd].u32[2] = state.vpr[va].u32[2] ^ state.vpr[vb].u32[2];
     state.vpr[vd].u32[3] = state.vpr[va].u32[3] ^ state.vpr[vb].u32[3];
 
-    if (canDisassemble)
-        printf("vxor v%d, v%d, v%d\n", vd, va, vb);
+    LOG(PPU, TRACE, "vxor v%d, v%d, v%d\n", vd, va, vb);
 }
 
 void CellPPU::Mulli(uint32_t opcode)
@@ -436,8 +455,7 @@ void CellPPU::Mulli(uint32_t opcode)
 
 	state.r[rd] = (int64_t)state.r[ra] * simm16;
 
-	if (canDisassemble)
-		printf("mulli r%d,r%d,%d\n", rd, ra, simm16);
+	LOG(PPU, TRACE, "mulli r%d,r%d,%d\n", rd, ra, simm16);
 }
 
 void CellPPU::Subfic(uint32_t opcode)
@@ -451,8 +469,7 @@ void CellPPU::Subfic(uint32_t opcode)
 	state.r[rt] = res.result;
 	state.xer.ca = res.carry;
 
-    if (canDisassemble)
-        printf("subfic r%d,r%d,%ld\n", rt, ra, si);
+    LOG(PPU, TRACE, "subfic r%d,r%d,%ld\n", rt, ra, si);
 }
 
 void CellPPU::Cmpli(uint32_t opcode)
@@ -464,8 +481,7 @@ void CellPPU::Cmpli(uint32_t opcode)
     
     UpdateCRnU(l, bf, state.r[ra], ui);
 
-    if (canDisassemble)
-        printf("cmpl%si state.cr%d,r%d,%ld\n", l ? "d" : "w", bf, ra, ui);
+    LOG(PPU, TRACE, "cmpl%si state.cr%d,r%d,%ld\n", l ? "d" : "w", bf, ra, ui);
 }
 
 void CellPPU::Cmpi(uint32_t opcode)
@@ -477,8 +493,7 @@ void CellPPU::Cmpi(uint32_t opcode)
     
     UpdateCRnS(l, bf, state.r[ra], si);
 
-    if (canDisassemble)
-        printf("cmp%si state.cr%d,r%d,%ld\n", l ? "d" : "w", bf, ra, si);
+    LOG(PPU, TRACE, "cmp%si state.cr%d,r%d,%ld\n", l ? "d" : "w", bf, ra, si);
 }
 
 void CellPPU::Addic(uint32_t opcode)
@@ -490,12 +505,12 @@ void CellPPU::Addic(uint32_t opcode)
 	state.xer.ca = ((uint32_t)si < !((uint32_t)state.r[ra]));
 	state.r[rt] = state.r[ra] + si;
 
-	if (canDisassemble)
+	if constexpr (LOG_ENABLED(PPU, TRACE))
 	{
 		if ((int16_t)si >= 0)
-            printf("addic r%d, r%d, 0x%04lx\n", rt, ra, si);
+            LOG(PPU, TRACE, "addic r%d, r%d, 0x%04lx\n", rt, ra, si);
         else
-            printf("subic r%d, r%d, 0x%04x\n", rt, ra, -((int16_t)si));
+            LOG(PPU, TRACE, "subic r%d, r%d, 0x%04x\n", rt, ra, -((int16_t)si));
     }
 }
 
@@ -507,14 +522,14 @@ void CellPPU::Addi(uint32_t opcode)
 
     state.r[rt] = ra ? (state.r[ra] + si) : si;
 
-    if (canDisassemble)
+    if constexpr (LOG_ENABLED(PPU, TRACE))
     {
         if (!ra)
-            printf("li r%d, 0x%04lx\n", rt, si);
+            LOG(PPU, TRACE, "li r%d, 0x%04lx\n", rt, si);
         else if ((int16_t)si >= 0)
-            printf("addi r%d, r%d, 0x%04lx\n", rt, ra, si);
+            LOG(PPU, TRACE, "addi r%d, r%d, 0x%04lx\n", rt, ra, si);
         else
-            printf("subi r%d, r%d, 0x%04x\n", rt, ra, -((int16_t)si));
+            LOG(PPU, TRACE, "subi r%d, r%d, 0x%04x\n", rt, ra, -((int16_t)si));
     }
 }
 
@@ -526,8 +541,7 @@ void CellPPU::Addis(uint32_t opcode)
 
     state.r[rt] = (int64_t)(ra ? (state.r[ra] + (si << 16)) :  (int64_t)(int32_t)(si << 16));
 
-    if (canDisassemble)
-        printf("addis r%d,r%d,%d\n", rt, ra, si);
+    LOG(PPU, TRACE, "addis r%d,r%d,%d\n", rt, ra, si);
 }
 
 void CellPPU::BranchCond(uint32_t opcode)
@@ -539,23 +553,19 @@ void CellPPU::BranchCond(uint32_t opcode)
     uint8_t bo = (opcode >> 21) & 0x1F;
     
     uint64_t target = branchTarget((aa ? 0 : state.pc-4), bd);
-    lastBranchTarget = target;
     
 	if (lk) state.lr = state.pc;
 
-    if (canDisassemble)
-        printf("bc 0x%08lx (0x%08lx) ", target, bd);
+    LOG(PPU, TRACE, "bc 0x%08lx (0x%08lx) ", target, bd);
 
     if (!CheckCondition(bo, bi))
     {
-        if (canDisassemble)
-            printf("[passed]\n");
+        LOG(PPU, TRACE, "[passed]\n");
     }
     else
     {
         state.pc = target;
-        if (canDisassemble)
-            printf("[taken]\n");
+        LOG(PPU, TRACE, "[taken]\n");
     }
 }
 
@@ -576,30 +586,23 @@ void CellPPU::Branch(uint32_t opcode)
 
     state.pc = branchTarget(aa ? 0 : state.pc - 4, li);
 
-    if (canDisassemble)
-        printf("b%s%s 0x%08lx\n", lk ? "l" : "", aa ? "a" : "", state.pc);
-
-    lastBranchTarget = state.pc;
+    LOG(PPU, TRACE, "b%s%s 0x%08lx\n", lk ? "l" : "", aa ? "a" : "", state.pc);
 }
 
-void CellPPU::G_13(uint32_t opcode)
+CellPPU::InstrHandler CellPPU::Decode13(uint32_t opcode)
 {
     uint16_t field = (opcode >> 1) & 0x3FF;
 
     switch (field)
     {
     case 0x010:
-        Bclr(opcode);
-        break;
+        return &CellPPU::Bclr;
     case 0x1C1:
-        Cror(opcode);
-        break;
+        return &CellPPU::Cror;
     case 0x210:
-        Bcctr(opcode);
-        break;
+        return &CellPPU::Bcctr;
     default:
-        printf("Unknown opcode 0x%02x (0x%08x)\n", field, opcode);
-        exit(1);
+        return &CellPPU::UnknownOpcode;
     }
 }
 
@@ -610,23 +613,20 @@ void CellPPU::Bclr(uint32_t opcode)
     int bh = (opcode >> 11) & 0x3;
     bool lk = opcode & 1;
 
-    if (canDisassemble)
-        printf("bcstate.lr ");
+    LOG(PPU, TRACE, "bcstate.lr ");
 	
 	uint64_t old_lr = state.lr;
 	if (lk) state.lr = state.pc;
 
     if (!CheckCondition(bo, bi))
     {
-        if (canDisassemble)
-            printf("[passed]\n");
+        LOG(PPU, TRACE, "[passed]\n");
         return;
     }
     else
     {
         state.pc = branchTarget(0, old_lr);
-        if (canDisassemble)
-            printf("[taken]\n");
+        LOG(PPU, TRACE, "[taken]\n");
     }
 }
 
@@ -638,8 +638,7 @@ void CellPPU::Cror(uint32_t opcode)
 
     const uint8_t v = IsCR(crba) | IsCR(crbb);
     SetCRBit2(crbt, v & 1);
-    if (canDisassemble)
-        printf("cror state.cr%d,state.cr%d,state.cr%d\n", crbt, crba, crbb);
+    LOG(PPU, TRACE, "cror state.cr%d,state.cr%d,state.cr%d\n", crbt, crba, crbb);
 }
 
 void CellPPU::Bcctr(uint32_t opcode)
@@ -649,31 +648,17 @@ void CellPPU::Bcctr(uint32_t opcode)
     int bh = (opcode >> 11) & 0x3;
     bool lk = opcode & 1;
 
-    if (canDisassemble)
-        printf("bcctr ");
+    LOG(PPU, TRACE, "bcctr ");
 
     if (bo & 0x10 || IsCR(bi) == (bo & 0x8))
     {
         if (lk) state.lr = state.pc;
 
-        if (syscall_nids.find(state.r[12]) != syscall_nids.end()
-                 && syscall_nids.find(lastBranchTarget) != syscall_nids.end())
-        {
-            Modules::DoHLECall(syscall_nids[state.r[12]], this);
-            if (threadSwapped)
-                threadSwapped = false;
-            else
-                state.pc = state.lr;
-        }
-        else
-        {
-            if (canDisassemble)
-                printf("[taken] (0x%08x)\n", state.lr);
-            state.pc = branchTarget(0, state.ctr);
-        }
+        LOG(PPU, TRACE, "[taken] (0x%08x)\n", state.lr);
+        state.pc = branchTarget(0, state.ctr);
     }
-    else if (canDisassemble)
-        printf("[passed]\n");
+    else
+        LOG(PPU, TRACE, "[passed]\n");
 }
 
 void CellPPU::Rlwimi(uint32_t opcode)
@@ -690,8 +675,7 @@ void CellPPU::Rlwimi(uint32_t opcode)
 	if (rc)
 		UpdateCR0<int32_t>(state.r[ra]);
 	
-	if (canDisassemble)
-		printf("rlwimi r%d,r%d,%d,%d,%d (0x%08x)\n", ra, rs, sh, mb, me, mask);
+	LOG(PPU, TRACE, "rlwimi r%d,r%d,%d,%d,%d (0x%08x)\n", ra, rs, sh, mb, me, mask);
 }
 
 // void CellPPU::BranchCondR(uint32_t opcode)
@@ -721,14 +705,14 @@ void CellPPU::Rlwimi(uint32_t opcode)
 //             else
 //             {
 //                 state.pc = state.ctr;
-//                 printf("bctr%s (0x%08lx)\n", lk ? "l" : "", state.ctr);
+//                 LOG(PPU, TRACE, "bctr%s (0x%08lx)\n", lk ? "l" : "", state.ctr);
 //                 break;
 //             }
 //         }
 //         else
 //             break;
 //     default:
-//         printf("Branch to unknown register 0x%03x\n", (opcode >> 1) & 0x3FF);
+//         LOG(PPU, ERROR, "Branch to unknown register 0x%03x\n", (opcode >> 1) & 0x3FF);
 //         exit(1);
 //     }
 // }
@@ -741,8 +725,7 @@ void CellPPU::Ori(uint32_t opcode)
 
     state.r[ra] = state.r[rs] | ui;
 
-    if (canDisassemble)
-        printf("ori r%d, r%d, 0x%04lx\n", ra, rs, ui);
+    LOG(PPU, TRACE, "ori r%d, r%d, 0x%04lx\n", ra, rs, ui);
 }
 
 void CellPPU::Oris(uint32_t opcode)
@@ -753,8 +736,7 @@ void CellPPU::Oris(uint32_t opcode)
 
     state.r[ra] = state.r[rs] | (ui << 16);
 
-    if (canDisassemble)
-        printf("oris r%d, r%d, 0x%04lx\n", ra, rs, ui);
+    LOG(PPU, TRACE, "oris r%d, r%d, 0x%04lx\n", ra, rs, ui);
 }
 
 void CellPPU::Xori(uint32_t opcode)
@@ -765,8 +747,7 @@ void CellPPU::Xori(uint32_t opcode)
 
     state.r[ra] = state.r[rs] ^ ui;
 
-    if (canDisassemble)
-        printf("xori r%d, r%d, 0x%04lx\n", ra, rs, ui);
+    LOG(PPU, TRACE, "xori r%d, r%d, 0x%04lx\n", ra, rs, ui);
 }
 
 void CellPPU::Xoris(uint32_t opcode)
@@ -777,8 +758,7 @@ void CellPPU::Xoris(uint32_t opcode)
 
     state.r[ra] = state.r[rs] ^ (ui << 16);
 
-    if (canDisassemble)
-        printf("xoris r%d, r%d, 0x%04lx\n", ra, rs, ui << 16);
+    LOG(PPU, TRACE, "xoris r%d, r%d, 0x%04lx\n", ra, rs, ui << 16);
 }
 
 void CellPPU::Andi(uint32_t opcode)
@@ -789,31 +769,25 @@ void CellPPU::Andi(uint32_t opcode)
 
     state.r[ra] = state.r[rs] & ui;
 
-    if (canDisassemble)
-        printf("andi r%d, r%d, 0x%04lx\n", ra, rs, ui);
+    LOG(PPU, TRACE, "andi r%d, r%d, 0x%04lx\n", ra, rs, ui);
 }
 
-void CellPPU::G_1E(uint32_t opcode)
+CellPPU::InstrHandler CellPPU::Decode1E(uint32_t opcode)
 {
     uint8_t field = (opcode >> 2) & 0x7;
 
     switch (field)
     {
     case 0x00:
-        Rldicl(opcode);
-        break;
+        return &CellPPU::Rldicl;
     case 0x01:
-        Rldicr(opcode);
-        break;
+        return &CellPPU::Rldicr;
     case 0x02:
-        Rldic(opcode);
-        break;
+        return &CellPPU::Rldic;
     case 0x03:
-        Rldimi(opcode);
-        break;
+        return &CellPPU::Rldimi;
     default:
-        printf("Unknown opcode (0x%02x) 0x%08x\n", field, opcode);
-        exit(1);
+        return &CellPPU::UnknownOpcode;
     }
 }
 
@@ -828,12 +802,12 @@ void CellPPU::Rldicl(uint32_t opcode)
     state.r[ra] = rotl64(state.r[rs], sh) & rotate_mask[mb][63];
     if (opcode & 1)
         UpdateCR0<int64_t>(state.r[ra]);
-    if (canDisassemble)
+    if constexpr (LOG_ENABLED(PPU, TRACE))
     {
         if (sh == 0)
-            printf("cstate.lrldi r%d,r%d,%d (0x%08lx, 0x%08lx)\n", ra, rs, mb, rotate_mask[mb][63], state.r[ra]);
+            LOG(PPU, TRACE, "cstate.lrldi r%d,r%d,%d (0x%08lx, 0x%08lx)\n", ra, rs, mb, rotate_mask[mb][63], state.r[ra]);
         else
-            printf("rldicl r%d,r%d,%d,%d (0x%08lx)\n", rs, ra, sh, mb, rotate_mask[mb][63]);
+            LOG(PPU, TRACE, "rldicl r%d,r%d,%d,%d (0x%08lx)\n", rs, ra, sh, mb, rotate_mask[mb][63]);
     }
 }
 
@@ -852,8 +826,7 @@ void CellPPU::Rldicr(uint32_t opcode)
     if (rc)
         UpdateCR0<int64_t>(state.r[ra]);
 
-    if (canDisassemble)
-        printf("rldicr%s r%d, r%d, %d, %d (0x%08lx)\n", rc ? "." : "", ra, rs, sh, me, rotate_mask[0][me]);
+    LOG(PPU, TRACE, "rldicr%s r%d, r%d, %d, %d (0x%08lx)\n", rc ? "." : "", ra, rs, sh, me, rotate_mask[0][me]);
 }
 
 void CellPPU::Rldic(uint32_t opcode)
@@ -868,8 +841,7 @@ void CellPPU::Rldic(uint32_t opcode)
     if (opcode & 1)
         UpdateCR0<int64_t>(state.r[ra]);
     
-    if (canDisassemble)
-        printf("rldic r%d,r%d,%d,%d (0x%08lx)\n", rs, ra, sh, mb, rotate_mask[mb][63-sh]);
+    LOG(PPU, TRACE, "rldic r%d,r%d,%d,%d (0x%08lx)\n", rs, ra, sh, mb, rotate_mask[mb][63-sh]);
 }
 
 void CellPPU::Rldimi(uint32_t opcode)
@@ -885,206 +857,140 @@ void CellPPU::Rldimi(uint32_t opcode)
     if (opcode & 1)
         UpdateCR0<int64_t>(state.r[ra]);
     
-    if (canDisassemble)
-        printf("rldimi r%d,r%d,%d,%d (0x%08lx)\n", ra, rs, sh, mb, mask);
+    LOG(PPU, TRACE, "rldimi r%d,r%d,%d,%d (0x%08lx)\n", ra, rs, sh, mb, mask);
 }
 
-void CellPPU::G_1F(uint32_t opcode)
+CellPPU::InstrHandler CellPPU::Decode1F(uint32_t opcode)
 { 
     uint16_t field = (opcode >> 1) & 0x3FF;
 
     switch (field)
     {
     case 0x000:
-        Cmp(opcode);
-        break;
+        return &CellPPU::Cmp;
 	case 0x006:
-		Lvsl(opcode);
-		break;
+		return &CellPPU::Lvsl;
 	case 0x008:
-		Subfc(opcode);
-		break;
+		return &CellPPU::Subfc;
     case 0x009:
-        Mulhdu(opcode);
-        break;
+        return &CellPPU::Mulhdu;
 	case 0x00A:
-		Addc(opcode);
-		break;
+		return &CellPPU::Addc;
     case 0x00B:
-        Mulhwu(opcode);
-        break;
+        return &CellPPU::Mulhwu;
     case 0x013:
-        Mfcr(opcode);
-        break;
+        return &CellPPU::Mfcr;
     case 0x014:
-        Lwarx(opcode);
-        break;
+        return &CellPPU::Lwarx;
     case 0x015:
-        Ldx(opcode);
-        break;
+        return &CellPPU::Ldx;
     case 0x017:
-        Lwzx(opcode);
-        break;
+        return &CellPPU::Lwzx;
     case 0x018:
-        Slw(opcode);
-        break;
+        return &CellPPU::Slw;
     case 0x01A:
-        Cntlzw(opcode);
-        break;
+        return &CellPPU::Cntlzw;
     case 0x01B:
-        Sld(opcode);
-        break;
+        return &CellPPU::Sld;
     case 0x01C:
-        And(opcode);
-        break;
+        return &CellPPU::And;
     case 0x020:
-        Cmpl(opcode);
-        break;
+        return &CellPPU::Cmpl;
 	case 0x026:
-		Lvsr(opcode);
-		break;
+		return &CellPPU::Lvsr;
     case 0x028:
-        Subf(opcode);
-        break;
+        return &CellPPU::Subf;
     case 0x03A:
-        Cntlzd(opcode);
-        break;
+        return &CellPPU::Cntlzd;
     case 0x03C:
-        Andc(opcode);
-        break;
+        return &CellPPU::Andc;
     case 0x049:
-        Mulhd(opcode);
-        break;
+        return &CellPPU::Mulhd;
 	case 0x04B:
-		Mulhw(opcode);
-		break;
+		return &CellPPU::Mulhw;
 	case 0x054:
-		Ldarx(opcode);
-		break;
+		return &CellPPU::Ldarx;
 	case 0x057:
-		Lbzx(opcode);
-		break;
+		return &CellPPU::Lbzx;
 	case 0x067:
-		Lvx(opcode);
-		break;
+		return &CellPPU::Lvx;
     case 0x068:
-        Neg(opcode);
-        break;
+        return &CellPPU::Neg;
     case 0x0D6:
-        Stdcx(opcode);
-        break;
+        return &CellPPU::Stdcx;
     case 0x0D7:
-        Stbx(opcode);
-        break;
+        return &CellPPU::Stbx;
     case 0x0CA:
-        Addze(opcode);
-        break;
+        return &CellPPU::Addze;
     case 0x07C:
-        Nor(opcode);
-        break;
+        return &CellPPU::Nor;
     case 0x090:
-        Mtocrf(opcode);
-        break;
+        return &CellPPU::Mtocrf;
     case 0x095:
-        Stdx(opcode);
-        break;
+        return &CellPPU::Stdx;
     case 0x096:
-        Stwcx(opcode);
-        break;
+        return &CellPPU::Stwcx;
     case 0x097:
-        Stwx(opcode);
-        break;
+        return &CellPPU::Stwx;
     case 0x0E7:
-        Stvx(opcode);
-        break;
+        return &CellPPU::Stvx;
     case 0xE9:
-        Mulld(opcode);
-        break;
+        return &CellPPU::Mulld;
     case 0x0EB:
-        Mullw(opcode);
-        break;
+        return &CellPPU::Mullw;
     case 0x10A:
-        Add(opcode);
-        break;
+        return &CellPPU::Add;
     case 0x116:
-        if (canDisassemble)
-            printf("DCTB\n");
-        break;
+        return &CellPPU::Dcbt;
     case 0x117:
-        Lhzx(opcode);
-        break;
+        return &CellPPU::Lhzx;
     case 0x13C:
-        Xor(opcode);
-        break;
+        return &CellPPU::Xor;
     case 0x153:
-        Mfspr(opcode);
-        break;
+        return &CellPPU::Mfspr;
 	case 0x173:
-		Mftb(opcode);
-		break;
+		return &CellPPU::Mftb;
     case 0x1BC:
-        Or(opcode);
-        break;
+        return &CellPPU::Or;
     case 0x1C9:
-        Divdu(opcode);
-        break;
+        return &CellPPU::Divdu;
     case 0x1CB:
-        Divwu(opcode);
-        break;
+        return &CellPPU::Divwu;
     case 0x1D3:
-        Mtspr(opcode);
-        break;
+        return &CellPPU::Mtspr;
     case 0x1E9:
-        Divd(opcode);
-        break;
+        return &CellPPU::Divd;
     case 0x1EB:
-        Divw(opcode);
-        break;
+        return &CellPPU::Divw;
     case 0x217:
-        Lfsx(opcode);
-        break;
+        return &CellPPU::Lfsx;
     case 0x218:
-        Srw(opcode);
-        break;
+        return &CellPPU::Srw;
 	case 0x21B:
-		Srd(opcode);
-		break;
+		return &CellPPU::Srd;
     case 0x256:
-        if (canDisassemble)
-            printf("sync\n");
-        break;
+        return &CellPPU::Sync;
     case 0x297:
-        Stfsx(opcode);
-        break;
+        return &CellPPU::Stfsx;
     case 0x338:
-        Srawi(opcode);
-        break;
+        return &CellPPU::Srawi;
     case 0x33A:
     case 0x33B:
-        Sradi(opcode);
-        break;
+        return &CellPPU::Sradi;
 	case 0x356:
-		if (canDisassemble)
-			printf("eieio\n");
-		break;
+		return &CellPPU::Eieio;
     case 0x39A:
-        Extsh(opcode);
-        break;
+        return &CellPPU::Extsh;
     case 0x3BA:
-        Extsb(opcode);
-        break;
+        return &CellPPU::Extsb;
     case 0x3D7:
-        Stfiwx(opcode);
-        break;
+        return &CellPPU::Stfiwx;
     case 0x3DA:
-        Extsw(opcode);
-        break;
+        return &CellPPU::Extsw;
     case 0x3F6:
-        Dcbz(opcode);
-        break;
+        return &CellPPU::Dcbz;
     default:
-        printf("Unhandled opcode (0x%02x) (0x%02x)\n", field, opcode);
-        throw std::runtime_error("Unable to execute Group 1F opcode");
+        return &CellPPU::UnknownOpcode;
     }
 }
 
@@ -1097,8 +1003,7 @@ void CellPPU::Cmp(uint32_t opcode)
 
     UpdateCRnS(l, bf, state.r[ra], state.r[rb]);
 
-    if (canDisassemble)
-        printf("cmp%s state.cr%d,r%d,r%d\n", !l ? "w" : "d", bf, ra, rb);
+    LOG(PPU, TRACE, "cmp%s state.cr%d,r%d,r%d\n", !l ? "w" : "d", bf, ra, rb);
 }
 
 #define MAKE_128(x, y) {.u64 = {(x), (y)}}
@@ -1137,8 +1042,7 @@ void CellPPU::Lvsl(uint32_t opcode)
 	
 	state.vpr[vd] = LVSL_SHIFT[sh & 0xF];
 
-	if (canDisassemble)
-		printf("lvsl v%d,r%d,r%d\n", vd, ra, rb);
+	LOG(PPU, TRACE, "lvsl v%d,r%d,r%d\n", vd, ra, rb);
 }
 
 void CellPPU::Subfc(uint32_t opcode)
@@ -1155,8 +1059,7 @@ void CellPPU::Subfc(uint32_t opcode)
 	if (rc)
 		UpdateCR0<int64_t>(state.r[rt]);
 	
-	if (canDisassemble)
-		printf("subfc r%d,r%d,r%d\n", rt, ra, rb);
+	LOG(PPU, TRACE, "subfc r%d,r%d,r%d\n", rt, ra, rb);
 }
 
 uint64_t mulhi64(uint64_t a, uint64_t b) 
@@ -1174,8 +1077,7 @@ void CellPPU::Mulhdu(uint32_t opcode)
     state.r[rt] = mulhi64(state.r[ra], state.r[rb]);
     if (opcode & 1)
         UpdateCR0<int64_t>(state.r[rt]);
-    if (canDisassemble)
-        printf("mulhdu r%d,r%d,r%d\n", rt, ra, rb);
+    LOG(PPU, TRACE, "mulhdu r%d,r%d,r%d\n", rt, ra, rb);
 }
 
 void CellPPU::Addc(uint32_t opcode)
@@ -1195,8 +1097,7 @@ void CellPPU::Addc(uint32_t opcode)
 	if (rc)
 		UpdateCR0<int32_t>(state.r[rt]);
 
-	if (canDisassemble)
-		printf("addc r%d,r%d,r%d\n", rt, ra, rb);
+	LOG(PPU, TRACE, "addc r%d,r%d,r%d\n", rt, ra, rb);
 }
 
 void CellPPU::Mulhwu(uint32_t opcode)
@@ -1211,8 +1112,7 @@ void CellPPU::Mulhwu(uint32_t opcode)
     if (opcode & 1)
         UpdateCR0<int32_t>(state.r[rt]);
     
-    if (canDisassemble)
-        printf("mulhwu r%d,r%d,r%d\n", rt, ra, rb);
+    LOG(PPU, TRACE, "mulhwu r%d,r%d,r%d\n", rt, ra, rb);
 }
 
 void CellPPU::Mfcr(uint32_t opcode)
@@ -1239,14 +1139,12 @@ void CellPPU::Mfcr(uint32_t opcode)
         }
         else
             state.r[rt] = 0;
-        if (canDisassemble)
-            printf("mfocrf r%d,0x%08x (%d)\n", rt, crm, n);
+        LOG(PPU, TRACE, "mfocrf r%d,0x%08x (%d)\n", rt, crm, n);
     }
     else
     {
         state.r[rt] = state.cr.cr;
-        if (canDisassemble)
-            printf("mfcr r%d\n", rt);
+        LOG(PPU, TRACE, "mfcr r%d\n", rt);
     }
 }
 
@@ -1256,10 +1154,13 @@ void CellPPU::Lwarx(uint32_t opcode)
     int ra = ra_d;
     int rb = rb_d;
 
-    state.r[rt] = manager.Read32(ra ? state.r[ra] + state.r[rb] : state.r[rb]);
+    uint32_t ea = ra ? state.r[ra] + state.r[rb] : state.r[rb];
+    resVersion = manager.ReserveLine(ea);
+    state.r[rt] = resValue = manager.Read32(ea);
+    resAddr = ea;
+    hasReservation = true;
 
-    if (canDisassemble)
-        printf("lwarx r%d, r%d(r%d)\n", rt, rb, ra);
+    LOG(PPU, TRACE, "lwarx r%d, r%d(r%d)\n", rt, rb, ra);
 }
 
 void CellPPU::Ldx(uint32_t opcode)
@@ -1270,8 +1171,7 @@ void CellPPU::Ldx(uint32_t opcode)
 
     state.r[rt] = manager.Read64(ra ? state.r[ra] + state.r[rb] : state.r[rb]);
 
-    if (canDisassemble)
-        printf("ldx r%d, r%d(r%d)\n", rt, rb, ra);
+    LOG(PPU, TRACE, "ldx r%d, r%d(r%d)\n", rt, rb, ra);
 }
 
 void CellPPU::Lwzx(uint32_t opcode)
@@ -1282,8 +1182,7 @@ void CellPPU::Lwzx(uint32_t opcode)
 
     state.r[rt] = manager.Read32(ra ? state.r[ra] + state.r[rb] : state.r[rb]);
 
-    if (canDisassemble)
-        printf("lwzx r%d, r%d(r%d)\n", rt, rb, ra);
+    LOG(PPU, TRACE, "lwzx r%d, r%d(r%d)\n", rt, rb, ra);
 }
 
 void CellPPU::Slw(uint32_t opcode)
@@ -1301,8 +1200,7 @@ void CellPPU::Slw(uint32_t opcode)
     if (rc)
         UpdateCR0<int32_t>(state.r[ra]);
 
-    if (canDisassemble)
-        printf("slw r%d,r%d,r%d\n", ra,rs,rb);
+    LOG(PPU, TRACE, "slw r%d,r%d,r%d\n", ra,rs,rb);
 }
 
 void CellPPU::Cntlzw(uint32_t opcode)
@@ -1321,8 +1219,7 @@ void CellPPU::Cntlzw(uint32_t opcode)
     }
 
     state.r[ra] = i;
-    if (canDisassemble)
-        printf("cntlzw r%d,r%d (%d)\n", ra, rs, i);
+    LOG(PPU, TRACE, "cntlzw r%d,r%d (%d)\n", ra, rs, i);
 }
 
 void CellPPU::Sld(uint32_t opcode)
@@ -1337,8 +1234,7 @@ void CellPPU::Sld(uint32_t opcode)
 
     if (rc)
         UpdateCR0<int64_t>(state.r[ra]);
-    if (canDisassemble)
-        printf("sld r%d,r%d,r%d\n", ra, rs, rb);
+    LOG(PPU, TRACE, "sld r%d,r%d,r%d\n", ra, rs, rb);
 }
 
 void CellPPU::And(uint32_t opcode)
@@ -1352,15 +1248,14 @@ void CellPPU::And(uint32_t opcode)
     if (opcode & 1)
         UpdateCR0<int64_t>(state.r[ra]);
 
-    if (canDisassemble)
-        printf("and%s r%d,r%d,r%d\n", (opcode&1) ? "." : "", ra, rs, rb);
+    LOG(PPU, TRACE, "and%s r%d,r%d,r%d\n", (opcode&1) ? "." : "", ra, rs, rb);
 }
 
 void CellPPU::Subf(uint32_t opcode)
 {
     if ((opcode >> 10) & 1)
     {
-        printf("SUBFO!\n");
+        LOG(PPU, ERROR, "SUBFO!\n");
         exit(1);
     }
 
@@ -1374,11 +1269,10 @@ void CellPPU::Subf(uint32_t opcode)
     if (rc)
     {
         UpdateCR0<int64_t>(state.r[rt]);
-        if (canDisassemble)
-            printf("subf. r%d,r%d,r%d\n", rt, rb, ra);
+        LOG(PPU, TRACE, "subf. r%d,r%d,r%d\n", rt, rb, ra);
     }
-    else if (canDisassemble)
-        printf("subf r%d,r%d,r%d\n", rt, rb, ra);
+    else
+        LOG(PPU, TRACE, "subf r%d,r%d,r%d\n", rt, rb, ra);
 }
 
 void CellPPU::Cntlzd(uint32_t opcode)
@@ -1397,8 +1291,7 @@ void CellPPU::Cntlzd(uint32_t opcode)
     }
 
     state.r[ra] = i;
-    if (canDisassemble)
-        printf("cntlzd r%d,r%d (%d)\n", ra, rs, i);
+    LOG(PPU, TRACE, "cntlzd r%d,r%d (%d)\n", ra, rs, i);
 }
 
 void CellPPU::Andc(uint32_t opcode)
@@ -1411,8 +1304,7 @@ void CellPPU::Andc(uint32_t opcode)
 
     if (opcode & 1)
         UpdateCR0<int64_t>(state.r[ra]);
-    if (canDisassemble)
-        printf("andc r%d,r%d,r%d\n", ra, rs, rb);
+    LOG(PPU, TRACE, "andc r%d,r%d,r%d\n", ra, rs, rb);
 }
 
 void CellPPU::Mulhd(uint32_t opcode)
@@ -1426,8 +1318,7 @@ void CellPPU::Mulhd(uint32_t opcode)
 	if (opcode & 1)
 		UpdateCR0<int64_t>(state.r[rt]);
 
-	if (canDisassemble)
-		printf("mulhd r%d,r%d,r%d\n", rt, ra, rb);
+	LOG(PPU, TRACE, "mulhd r%d,r%d,r%d\n", rt, ra, rb);
 }
 
 void CellPPU::Mulhw(uint32_t opcode)
@@ -1441,8 +1332,7 @@ void CellPPU::Mulhw(uint32_t opcode)
 	if (opcode & 1)
 		UpdateCR0<int32_t>(state.r[rt]);
 
-	if (canDisassemble)
-		printf("mulhw r%d,r%d,r%d\n", rt, ra, rb);
+	LOG(PPU, TRACE, "mulhw r%d,r%d,r%d\n", rt, ra, rb);
 }
 
 void CellPPU::Ldarx(uint32_t opcode)
@@ -1451,10 +1341,13 @@ void CellPPU::Ldarx(uint32_t opcode)
     int ra = ra_d;
     int rb = rb_d;
 
-    state.r[rt] = manager.Read64(ra ? state.r[ra] + state.r[rb] : state.r[rb]);
+    uint32_t ea = ra ? state.r[ra] + state.r[rb] : state.r[rb];
+    resVersion = manager.ReserveLine(ea);
+    state.r[rt] = resValue = manager.Read64(ea);
+    resAddr = ea;
+    hasReservation = true;
 
-    if (canDisassemble)
-        printf("ldarx r%d, r%d(r%d)\n", rt, rb, ra);
+    LOG(PPU, TRACE, "ldarx r%d, r%d(r%d)\n", rt, rb, ra);
 }
 
 void CellPPU::Lbzx(uint32_t opcode)
@@ -1465,8 +1358,7 @@ void CellPPU::Lbzx(uint32_t opcode)
 
     state.r[rt] = manager.Read8(ra ? state.r[ra] + state.r[rb] : state.r[rb]);
 
-	if (canDisassemble)
-        printf("lbzx r%d, r%d(r%d)\n", rt, rb, ra);
+	LOG(PPU, TRACE, "lbzx r%d, r%d(r%d)\n", rt, rb, ra);
 }
 
 void CellPPU::Lvx(uint32_t opcode)
@@ -1484,8 +1376,7 @@ void CellPPU::Lvx(uint32_t opcode)
 	state.vpr[vd].u64[0] = manager.Read64(ea);
 	state.vpr[vd].u64[1] = manager.Read64(ea+8);
 
-	if (canDisassemble)
-		printf("lvx v%d, r%d(r%d)\n", vd, ra, rb);
+	LOG(PPU, TRACE, "lvx v%d, r%d(r%d)\n", vd, ra, rb);
 }
 
 void CellPPU::Cmpl(uint32_t opcode)
@@ -1497,8 +1388,7 @@ void CellPPU::Cmpl(uint32_t opcode)
 
     UpdateCRnU(l, bf, state.r[ra], state.r[rb]);
 
-    if (canDisassemble)
-        printf("cmpl%s state.cr%d,r%d,r%d\n", l ? "d" : "w", bf, ra, rb);
+    LOG(PPU, TRACE, "cmpl%s state.cr%d,r%d,r%d\n", l ? "d" : "w", bf, ra, rb);
 }
 
 static uint128_t LVSR_SHIFT[16] = 
@@ -1535,8 +1425,7 @@ void CellPPU::Lvsr(uint32_t opcode)
 	
 	state.vpr[vd] = LVSR_SHIFT[sh & 0xF];
 
-	if (canDisassemble)
-		printf("lvsr v%d,r%d,r%d\n", vd, ra, rb);
+	LOG(PPU, TRACE, "lvsr v%d,r%d,r%d\n", vd, ra, rb);
 }
 
 void CellPPU::Neg(uint32_t opcode)
@@ -1550,15 +1439,14 @@ void CellPPU::Neg(uint32_t opcode)
     
     if (oe)
     {
-        printf("TODO: NEGO/NEGO.\n");
+        LOG(PPU, ERROR, "TODO: NEGO/NEGO.\n");
         exit(1);
     }
 
     if (rc)
         UpdateCR0<int64_t>(state.r[rt]);
     
-    if (canDisassemble)
-        printf("neg r%d,r%d\n", rt, ra);
+    LOG(PPU, TRACE, "neg r%d,r%d\n", rt, ra);
 }
 
 void CellPPU::Nor(uint32_t opcode)
@@ -1572,8 +1460,7 @@ void CellPPU::Nor(uint32_t opcode)
     if (opcode & 1)
         UpdateCR0<int64_t>(state.r[ra]);
     
-    if (canDisassemble)
-        printf("nor r%d,r%d,r%d\n", ra, rs, rb);
+    LOG(PPU, TRACE, "nor r%d,r%d,r%d\n", ra, rs, rb);
 }
 
 void CellPPU::Mtocrf(uint32_t opcode)
@@ -1598,8 +1485,7 @@ void CellPPU::Mtocrf(uint32_t opcode)
             SetCR(n, (state.r[rt] >> (4*n)) & 0xf);
         else
             state.cr.cr = 0;
-        if (canDisassemble)
-            printf("mtocrf r%d\n", rt);
+        LOG(PPU, TRACE, "mtocrf r%d\n", rt);
     }
     else
     {
@@ -1610,8 +1496,7 @@ void CellPPU::Mtocrf(uint32_t opcode)
 				SetCR(i, state.r[rt] & (0xf << i));
 			}
 		}
-        if (canDisassemble)
-            printf("mtcr r%d\n", rt);
+        LOG(PPU, TRACE, "mtcr r%d\n", rt);
     }
 }
 
@@ -1623,8 +1508,7 @@ void CellPPU::Stdx(uint32_t opcode)
 
     manager.Write64((ra ? state.r[ra] + state.r[rb] : state.r[rb]), state.r[rs]);
 
-    if (canDisassemble)
-        printf("stdx r%d, r%d(r%d)\n", rs, ra, rb);
+    LOG(PPU, TRACE, "stdx r%d, r%d(r%d)\n", rs, ra, rb);
 }
 
 void CellPPU::Stwcx(uint32_t opcode)
@@ -1633,11 +1517,12 @@ void CellPPU::Stwcx(uint32_t opcode)
     int ra = ra_d;
     int rb = rb_d;
 
-    manager.Write32((ra ? state.r[ra] + state.r[rb] : state.r[rb]), state.r[rs]);
-	SetCRBit(0, CR_EQ, true);
+    uint32_t ea = ra ? state.r[ra] + state.r[rb] : state.r[rb];
+    bool stored = hasReservation && resAddr == ea && manager.StoreConditional32(ea, resVersion, (uint32_t)resValue, state.r[rs]);
+    hasReservation = false;
+    SetCR(0, stored ? CR_EQ : 0);
 
-    if (canDisassemble)
-        printf("stwcx. r%d, r%d(r%d)\n", rs, ra, rb);
+    LOG(PPU, TRACE, "stwcx. r%d, r%d(r%d)\n", rs, ra, rb);
 }
 
 void CellPPU::Stwx(uint32_t opcode)
@@ -1648,15 +1533,14 @@ void CellPPU::Stwx(uint32_t opcode)
 
     manager.Write32((ra ? state.r[ra] + state.r[rb] : state.r[rb]), state.r[rs]);
 
-    if (canDisassemble)
-        printf("stwx r%d, r%d(r%d)\n", rs, ra, rb);
+    LOG(PPU, TRACE, "stwx r%d, r%d(r%d)\n", rs, ra, rb);
 }
 
 void CellPPU::Addze(uint32_t opcode)
 {
     if ((opcode >> 10) & 1)
     {
-        printf("ADDZEO!\n");
+        LOG(PPU, ERROR, "ADDZEO!\n");
         exit(1);
     }
 
@@ -1672,11 +1556,10 @@ void CellPPU::Addze(uint32_t opcode)
     if (opcode & 1)
     {
         UpdateCR0<int64_t>(state.r[rt]);
-        if (canDisassemble)
-            printf("addze. r%d,r%d\n", rt, ra);
+        LOG(PPU, TRACE, "addze. r%d,r%d\n", rt, ra);
     }
-    else if (canDisassemble)
-        printf("addze r%d,r%d\n", rt, ra);
+    else
+        LOG(PPU, TRACE, "addze r%d,r%d\n", rt, ra);
 }
 
 void CellPPU::Stdcx(uint32_t opcode)
@@ -1685,11 +1568,12 @@ void CellPPU::Stdcx(uint32_t opcode)
     int ra = ra_d;
     int rb = rb_d;
 
-    manager.Write64((ra ? state.r[ra] + state.r[rb] : state.r[rb]), state.r[rs]);
-	SetCRBit(0, CR_EQ, true);
+    uint32_t ea = ra ? state.r[ra] + state.r[rb] : state.r[rb];
+    bool stored = hasReservation && resAddr == ea && manager.StoreConditional64(ea, resVersion, resValue, state.r[rs]);
+    hasReservation = false;
+    SetCR(0, stored ? CR_EQ : 0);
 
-    if (canDisassemble)
-        printf("stdcx. r%d, r%d(r%d)\n", rs, ra, rb);
+    LOG(PPU, TRACE, "stdcx. r%d, r%d(r%d)\n", rs, ra, rb);
 }
 
 void CellPPU::Stbx(uint32_t opcode)
@@ -1700,8 +1584,7 @@ void CellPPU::Stbx(uint32_t opcode)
 
     manager.Write8((ra ? state.r[ra] + state.r[rb] : state.r[rb]), state.r[rs]);
 
-    if (canDisassemble)
-        printf("stbx r%d,r%d,r%d\n", rs, ra, rb);
+    LOG(PPU, TRACE, "stbx r%d,r%d,r%d\n", rs, ra, rb);
 }
 
 void CellPPU::Stvx(uint32_t opcode)
@@ -1713,8 +1596,7 @@ void CellPPU::Stvx(uint32_t opcode)
     manager.Write64((ra ? state.r[ra] + state.r[rb] : state.r[rb]), state.vpr[vs].u64[0]);
     manager.Write64((ra ? state.r[ra] + state.r[rb] : state.r[rb]) + 8, state.vpr[vs].u64[1]);
 
-    if (canDisassemble)
-        printf("stvx v%d,r%d,r%d\n", vs, ra, rb);
+    LOG(PPU, TRACE, "stvx v%d,r%d,r%d\n", vs, ra, rb);
 }
 
 void CellPPU::Mulld(uint32_t opcode)
@@ -1729,15 +1611,14 @@ void CellPPU::Mulld(uint32_t opcode)
 
     if (oe)
     {
-        printf("TODO: Mulldo/Mulldo.\n");
+        LOG(PPU, ERROR, "TODO: Mulldo/Mulldo.\n");
         exit(1);
     }
 
     if (rc)
         UpdateCR0<int64_t>(state.r[rt]);
 
-    if (canDisassemble)
-        printf("mulld%s r%d,r%d,r%d\n", rc ? "." : "", rt, ra, rb);
+    LOG(PPU, TRACE, "mulld%s r%d,r%d,r%d\n", rc ? "." : "", rt, ra, rb);
 }
 
 void CellPPU::Mullw(uint32_t opcode)
@@ -1752,15 +1633,14 @@ void CellPPU::Mullw(uint32_t opcode)
 
     if (oe)
     {
-        printf("TODO: Mullwo/Mullwo.\n");
+        LOG(PPU, ERROR, "TODO: Mullwo/Mullwo.\n");
         exit(1);
     }
 
     if (rc)
         UpdateCR0<int64_t>(state.r[rt]);
 
-    if (canDisassemble)
-        printf("mullw%s r%d,r%d,r%d\n", rc ? "." : "", rt, ra, rb);
+    LOG(PPU, TRACE, "mullw%s r%d,r%d,r%d\n", rc ? "." : "", rt, ra, rb);
 }
 
 void CellPPU::Add(uint32_t opcode)
@@ -1773,7 +1653,7 @@ void CellPPU::Add(uint32_t opcode)
 
     if (oe)
     {
-        printf("ERROR: Unhandled addo[.]\n");
+        LOG(PPU, ERROR, "ERROR: Unhandled addo[.]\n");
         exit(1);
     }
     
@@ -1784,11 +1664,10 @@ void CellPPU::Add(uint32_t opcode)
     if (rc)
     {
         UpdateCR0<int64_t>(state.r[rt]);
-        if (canDisassemble)
-            printf("add. r%d,r%d,r%d", rt, ra, rb);
+        LOG(PPU, TRACE, "add. r%d,r%d,r%d", rt, ra, rb);
     }
-    else if (canDisassemble)
-        printf("add r%d,r%d,r%d\n", rt, ra, rb);
+    else
+        LOG(PPU, TRACE, "add r%d,r%d,r%d\n", rt, ra, rb);
 }
 
 void CellPPU::Lhzx(uint32_t opcode)
@@ -1799,8 +1678,7 @@ void CellPPU::Lhzx(uint32_t opcode)
 
     state.r[rt] = manager.Read16(ra ? state.r[ra] + state.r[rb] : state.r[rb]);
 
-	if (canDisassemble)
-        printf("lhzx r%d, r%d(r%d)\n", rt, rb, ra);
+	LOG(PPU, TRACE, "lhzx r%d, r%d(r%d)\n", rt, rb, ra);
 }
 
 void CellPPU::Xor(uint32_t opcode)
@@ -1814,8 +1692,12 @@ void CellPPU::Xor(uint32_t opcode)
     if (opcode & 1)
         UpdateCR0<int64_t>(state.r[ra]);
 
-    if (canDisassemble)
-        printf("xor%s r%d,r%d,r%d\n", (opcode&1) ? "." : "", ra, rs, rb);
+    LOG(PPU, TRACE, "xor%s r%d,r%d,r%d\n", (opcode&1) ? "." : "", ra, rs, rb);
+}
+
+void CellPPU::Dcbt(uint32_t opcode)
+{
+    LOG(PPU, TRACE, "dcbt\n");
 }
 
 void CellPPU::Mfspr(uint32_t opcode)
@@ -1826,8 +1708,7 @@ void CellPPU::Mfspr(uint32_t opcode)
     std::string name;
     state.r[rt] = GetRegBySPR(spr, name);
 
-    if (canDisassemble)
-        printf("mfspr r%d, %s\n", rt, name.c_str());
+    LOG(PPU, TRACE, "mfspr r%d, %s\n", rt, name.c_str());
 }
 
 uint64_t getTimeBase()
@@ -1854,8 +1735,7 @@ void CellPPU::Mftb(uint32_t opcode)
 	case 0x10D: state.r[rt] = getTimeBase() >> 32; break;
 	}
 
-	if (canDisassemble)
-		printf("mftb r%d\n", rt);
+	LOG(PPU, TRACE, "mftb r%d\n", rt);
 }
 
 void CellPPU::Sradi(uint32_t opcode)
@@ -1873,8 +1753,7 @@ void CellPPU::Sradi(uint32_t opcode)
     if (rc)
         UpdateCR0<int64_t>(state.r[ra]);
 
-    if (canDisassemble)
-        printf("sradi r%d,r%d,%d\n", ra, rs, sh);
+    LOG(PPU, TRACE, "sradi r%d,r%d,%d\n", ra, rs, sh);
 }
 
 void CellPPU::Or(uint32_t opcode)
@@ -1888,12 +1767,12 @@ void CellPPU::Or(uint32_t opcode)
     if (opcode & 1)
         UpdateCR0<int64_t>(state.r[ra]);
     
-    if (canDisassemble)
+    if constexpr (LOG_ENABLED(PPU, TRACE))
     {
         if (rs != rb)
-            printf("or%s r%d, r%d, r%d\n", (opcode & 1) ? "." : "", ra, rs, rb);
+            LOG(PPU, TRACE, "or%s r%d, r%d, r%d\n", (opcode & 1) ? "." : "", ra, rs, rb);
         else
-            printf("mr%s r%d, r%d (0x%08lx)\n", (opcode & 1) ? "." : "", ra, rs, state.r[ra]);
+            LOG(PPU, TRACE, "mr%s r%d, r%d (0x%08lx)\n", (opcode & 1) ? "." : "", ra, rs, state.r[ra]);
     }
 }
 
@@ -1910,7 +1789,7 @@ void CellPPU::Divdu(uint32_t opcode)
 
     if (!RB)
     {
-        if (oe) {printf("divduo\n"); exit(1);}
+        if (oe) {LOG(PPU, TRACE, "divduo\n"); exit(1);}
         state.r[rt] = 0;
     }
     else
@@ -1921,8 +1800,7 @@ void CellPPU::Divdu(uint32_t opcode)
     if (rc)
         UpdateCR0<int64_t>(state.r[rt]);
     
-    if (canDisassemble)
-        printf("divdu r%d,r%d,r%d\n", rt, ra, rb);
+    LOG(PPU, TRACE, "divdu r%d,r%d,r%d\n", rt, ra, rb);
 }
 
 void CellPPU::Divwu(uint32_t opcode)
@@ -1936,13 +1814,13 @@ void CellPPU::Divwu(uint32_t opcode)
 
     if (oe)
     {
-        printf("TODO: DIVWUO/DIVWUO.\n");
+        LOG(PPU, ERROR, "TODO: DIVWUO/DIVWUO.\n");
         exit(1);
     }
 
     if ((uint32_t)state.r[rb] == 0)
     {
-        printf("ERROR: DIVIDE BY ZERO AT 0x%08lX\n", state.pc);
+        LOG(PPU, ERROR, "ERROR: DIVIDE BY ZERO AT 0x%08lX\n", state.pc);
         exit(1);
     }
 
@@ -1950,8 +1828,7 @@ void CellPPU::Divwu(uint32_t opcode)
     if (rc)
         UpdateCR0<int64_t>(state.r[rt]);
 
-    if (canDisassemble)
-        printf("divuw%s r%d,r%d,r%d\n", rc ? "." : "", rt, ra, rb);
+    LOG(PPU, TRACE, "divuw%s r%d,r%d,r%d\n", rc ? "." : "", rt, ra, rb);
 }
 
 void CellPPU::Mtspr(uint32_t opcode)
@@ -1962,8 +1839,7 @@ void CellPPU::Mtspr(uint32_t opcode)
     std::string name;
     GetRegBySPR(spr, name) = state.r[rs];
 
-    if (canDisassemble)
-        printf("mtspr r%d,%s\n", rs, name.c_str());
+    LOG(PPU, TRACE, "mtspr r%d,%s\n", rs, name.c_str());
 }
 
 void CellPPU::Divd(uint32_t opcode)
@@ -1976,7 +1852,7 @@ void CellPPU::Divd(uint32_t opcode)
 
     if (oe)
     {
-        printf("TODO: DIVDO/DIVDO.\n");
+        LOG(PPU, ERROR, "TODO: DIVDO/DIVDO.\n");
         exit(1);
     }
 
@@ -1995,8 +1871,7 @@ void CellPPU::Divd(uint32_t opcode)
     if (rc)
         UpdateCR0<int64_t>(state.r[rt]);
     
-    if (canDisassemble)
-        printf("divd r%d,r%d,r%d\n", rt, ra, rb);
+    LOG(PPU, TRACE, "divd r%d,r%d,r%d\n", rt, ra, rb);
 }
 
 void CellPPU::Divw(uint32_t opcode)
@@ -2009,7 +1884,7 @@ void CellPPU::Divw(uint32_t opcode)
 
     if (oe)
     {
-        printf("TODO: DIVWO/DIVWO.\n");
+        LOG(PPU, ERROR, "TODO: DIVWO/DIVWO.\n");
         exit(1);
     }
 
@@ -2028,8 +1903,7 @@ void CellPPU::Divw(uint32_t opcode)
     if (rc)
         UpdateCR0<int64_t>(state.r[rt]);
     
-    if (canDisassemble)
-        printf("divw r%d,r%d,r%d\n", rt, ra, rb);
+    LOG(PPU, TRACE, "divw r%d,r%d,r%d\n", rt, ra, rb);
 }
 
 void CellPPU::Lfsx(uint32_t opcode)
@@ -2041,8 +1915,12 @@ void CellPPU::Lfsx(uint32_t opcode)
     uint32_t data = manager.Read32(ra ? state.r[ra] + state.r[rb] : state.r[rb]);
 	state.fpr[frt].f = (float&)data;
     
-    if (canDisassemble)
-        printf("lfsx f%d, r%d(r%d)\n", frt, ra, rb);
+    LOG(PPU, TRACE, "lfsx f%d, r%d(r%d)\n", frt, ra, rb);
+}
+
+void CellPPU::Sync(uint32_t opcode)
+{
+    LOG(PPU, TRACE, "sync\n");
 }
 
 void CellPPU::Srw(uint32_t opcode)
@@ -2061,8 +1939,7 @@ void CellPPU::Srw(uint32_t opcode)
     if (rc)
         UpdateCR0<int64_t>(state.r[ra]);
 
-    if (canDisassemble)
-        printf("srw r%d,r%d,r%d\n", ra,rs,rb);
+    LOG(PPU, TRACE, "srw r%d,r%d,r%d\n", ra,rs,rb);
 }
 
 void CellPPU::Srd(uint32_t opcode)
@@ -2081,8 +1958,7 @@ void CellPPU::Srd(uint32_t opcode)
     if (rc)
         UpdateCR0<int64_t>(state.r[ra]);
 
-    if (canDisassemble)
-        printf("srd r%d,r%d,r%d\n", ra,rs,rb);
+    LOG(PPU, TRACE, "srd r%d,r%d,r%d\n", ra,rs,rb);
 }
 
 void CellPPU::Stfsx(uint32_t opcode)
@@ -2092,8 +1968,7 @@ void CellPPU::Stfsx(uint32_t opcode)
     int rb = rb_d;
 
     manager.Write32((ra ? state.r[ra] + state.r[rb] : state.r[rb]), state.fpr[frs].ToU32());
-    if (canDisassemble)
-        printf("stfsx f%d, r%d(r%d)\n", frs, ra, rb);
+    LOG(PPU, TRACE, "stfsx f%d, r%d(r%d)\n", frs, ra, rb);
 }
 
 void CellPPU::Srawi(uint32_t opcode)
@@ -2110,8 +1985,12 @@ void CellPPU::Srawi(uint32_t opcode)
     if (rc)
         UpdateCR0<int64_t>(state.r[ra]);
 
-    if (canDisassemble)
-        printf("srawi r%d,r%d,%d\n", ra, rs, sh);
+    LOG(PPU, TRACE, "srawi r%d,r%d,%d\n", ra, rs, sh);
+}
+
+void CellPPU::Eieio(uint32_t opcode)
+{
+	LOG(PPU, TRACE, "eieio\n");
 }
 
 void CellPPU::Extsh(uint32_t opcode)
@@ -2125,8 +2004,7 @@ void CellPPU::Extsh(uint32_t opcode)
     if (rc)
         UpdateCR0<int64_t>(state.r[ra]);
 
-    if (canDisassemble)
-        printf("extsh%s r%d,r%d\n", rc ? "." : "", ra, rs);
+    LOG(PPU, TRACE, "extsh%s r%d,r%d\n", rc ? "." : "", ra, rs);
 }
 
 void CellPPU::Extsb(uint32_t opcode)
@@ -2138,8 +2016,7 @@ void CellPPU::Extsb(uint32_t opcode)
     state.r[ra] = (int64_t)(int8_t)state.r[rs];
     if (rc) UpdateCR0<int64_t>(state.r[ra]);
 
-    if (canDisassemble)
-        printf("extsb%s r%d,r%d\n", rc ? "." : "", ra, rs);
+    LOG(PPU, TRACE, "extsb%s r%d,r%d\n", rc ? "." : "", ra, rs);
 }
 
 void CellPPU::Stfiwx(uint32_t opcode)
@@ -2150,8 +2027,7 @@ void CellPPU::Stfiwx(uint32_t opcode)
 
     manager.Write32(ra ? state.r[ra] + state.r[rb] : state.r[rb], (uint32_t&)state.fpr[frs].f);
 
-    if (canDisassemble)
-        printf("stfiwx f%d,r%d(r%d)\n", frs, ra, rb);
+    LOG(PPU, TRACE, "stfiwx f%d,r%d(r%d)\n", frs, ra, rb);
 }
 
 void CellPPU::Extsw(uint32_t opcode)
@@ -2163,8 +2039,7 @@ void CellPPU::Extsw(uint32_t opcode)
     state.r[ra] = (int64_t)(int32_t)state.r[rs];
     if (rc) UpdateCR0<int32_t>(state.r[ra]);
 
-    if (canDisassemble)
-        printf("extsw%s r%d,r%d\n", rc ? "." : "", ra, rs);
+    LOG(PPU, TRACE, "extsw%s r%d,r%d\n", rc ? "." : "", ra, rs);
 }
 
 void CellPPU::Dcbz(uint32_t opcode)
@@ -2175,8 +2050,7 @@ void CellPPU::Dcbz(uint32_t opcode)
     auto dst = manager.GetRawPtr((ra ? state.r[ra] + state.r[rb] : state.r[rb]));
     memset(dst, 0, 128);
 
-    if (canDisassemble)
-        printf("dcbz r%d,r%d\n", ra, rb);
+    LOG(PPU, TRACE, "dcbz r%d,r%d\n", ra, rb);
 }
 
 void CellPPU::Lwz(uint32_t opcode)
@@ -2187,8 +2061,7 @@ void CellPPU::Lwz(uint32_t opcode)
 
     state.r[rt] = manager.Read32(ra ? state.r[ra] + d : d);
 
-    if (canDisassemble)
-        printf("lwz r%d, %d(r%d) (0x%08x)\n", rt, d, ra, ra ? state.r[ra] + d : d);
+    LOG(PPU, TRACE, "lwz r%d, %d(r%d) (0x%08x)\n", rt, d, ra, ra ? state.r[ra] + d : d);
 }
 
 void CellPPU::Lwzu(uint32_t opcode)
@@ -2200,8 +2073,7 @@ void CellPPU::Lwzu(uint32_t opcode)
     state.r[rt] = manager.Read32(state.r[ra] + d);
 	state.r[ra] += d;
 
-    if (canDisassemble)
-        printf("lwzu r%d, %d(r%d)\n", rt, d, ra);
+    LOG(PPU, TRACE, "lwzu r%d, %d(r%d)\n", rt, d, ra);
 }
 
 void CellPPU::Lbz(uint32_t opcode)
@@ -2212,8 +2084,7 @@ void CellPPU::Lbz(uint32_t opcode)
 
     state.r[rt] = manager.Read8(ra ? state.r[ra] + d : d);
 
-    if (canDisassemble)
-        printf("lbz r%d, %d(r%d)\n", rt, d, ra);
+    LOG(PPU, TRACE, "lbz r%d, %d(r%d)\n", rt, d, ra);
 }
 
 void CellPPU::Lbzu(uint32_t opcode)
@@ -2225,8 +2096,7 @@ void CellPPU::Lbzu(uint32_t opcode)
     uint64_t addr = state.r[ra] + d;
     state.r[rt] = manager.Read8(addr);
     state.r[ra] = addr;
-    if (canDisassemble)
-        printf("lbzu r%d, %d(r%d)\n", rt, d, ra);
+    LOG(PPU, TRACE, "lbzu r%d, %d(r%d)\n", rt, d, ra);
 }
 
 void CellPPU::Rlwinm(uint32_t opcode)
@@ -2242,8 +2112,7 @@ void CellPPU::Rlwinm(uint32_t opcode)
     if (rc)
         UpdateCR0<int32_t>(state.r[ra]);
     
-    if (canDisassemble)
-        printf("rlwinm r%d,r%d,%d,%d (0x%08lx)\n", ra, rs, mb, me, rotate_mask[32 + mb][32 + me]);
+    LOG(PPU, TRACE, "rlwinm r%d,r%d,%d,%d (0x%08lx)\n", ra, rs, mb, me, rotate_mask[32 + mb][32 + me]);
 }
 
 void CellPPU::Rlwnm(uint32_t opcode)
@@ -2259,8 +2128,7 @@ void CellPPU::Rlwnm(uint32_t opcode)
     if (rc)
         UpdateCR0<int32_t>(state.r[ra]);
 
-    if (canDisassemble)
-        printf("rlwnm r%d,r%d,r%d,%d,%d (0x%08lx)\n", rs, ra, rb, mb, me, rotate_mask[32 + mb][32 + me]);
+    LOG(PPU, TRACE, "rlwnm r%d,r%d,r%d,%d,%d (0x%08lx)\n", rs, ra, rb, mb, me, rotate_mask[32 + mb][32 + me]);
 }
 
 void CellPPU::Stw(uint32_t opcode)
@@ -2271,8 +2139,7 @@ void CellPPU::Stw(uint32_t opcode)
 
     manager.Write32(ra ? state.r[ra] + d : d, state.r[rs]);
 
-    if (canDisassemble)
-        printf("stw r%d, %d(r%d) (0x%08x, 0x%08x)\n", rs, d, ra, state.r[rs], ra ? state.r[ra] + d : d);
+    LOG(PPU, TRACE, "stw r%d, %d(r%d) (0x%08x, 0x%08x)\n", rs, d, ra, state.r[rs], ra ? state.r[ra] + d : d);
 }
 
 void CellPPU::Stwu(uint32_t opcode)
@@ -2285,8 +2152,7 @@ void CellPPU::Stwu(uint32_t opcode)
     manager.Write32(addr, state.r[rs]);
     state.r[ra] = addr;
 
-    if (canDisassemble)
-        printf("stwu r%d, %d(r%d)\n", rs, d, ra);
+    LOG(PPU, TRACE, "stwu r%d, %d(r%d)\n", rs, d, ra);
 }
 
 void CellPPU::Stb(uint32_t opcode)
@@ -2297,10 +2163,7 @@ void CellPPU::Stb(uint32_t opcode)
 
     manager.Write8(ra ? state.r[ra] + ds : ds, state.r[rs]);
 
-    if (canDisassemble)
-    {
-        printf("stb r%d, %d(r%d) (0x%02x -> 0x%08x)\n", rs, ds, ra, state.r[rs], ra ? state.r[ra] + ds : ds);
-    }
+    LOG(PPU, TRACE, "stb r%d, %d(r%d) (0x%02x -> 0x%08x)\n", rs, ds, ra, state.r[rs], ra ? state.r[ra] + ds : ds);
 }
 
 void CellPPU::Stbu(uint32_t opcode)
@@ -2313,10 +2176,7 @@ void CellPPU::Stbu(uint32_t opcode)
     manager.Write8(addr, state.r[rs]);
     state.r[ra] = addr;
 
-    if (canDisassemble)
-    {
-        printf("stbu r%d, %d(r%d)\n", rs, ds, ra);
-    }
+    LOG(PPU, TRACE, "stbu r%d, %d(r%d)\n", rs, ds, ra);
 }
 
 void CellPPU::Lhz(uint32_t opcode)
@@ -2327,8 +2187,7 @@ void CellPPU::Lhz(uint32_t opcode)
 
     state.r[rt] = manager.Read16(ra ? state.r[ra] + ds : ds);
 
-    if (canDisassemble)
-        printf("lhz r%d, %d(r%d)\n", rt, ds, ra);
+    LOG(PPU, TRACE, "lhz r%d, %d(r%d)\n", rt, ds, ra);
 }
 
 void CellPPU::Lhzu(uint32_t opcode)
@@ -2342,8 +2201,7 @@ void CellPPU::Lhzu(uint32_t opcode)
 
 	state.r[ra] = ea;
 
-    if (canDisassemble)
-        printf("lhzu r%d, %d(r%d)\n", rt, ds, ra);
+    LOG(PPU, TRACE, "lhzu r%d, %d(r%d)\n", rt, ds, ra);
 }
 
 void CellPPU::Sth(uint32_t opcode)
@@ -2358,10 +2216,7 @@ void CellPPU::Sth(uint32_t opcode)
     if (u)
         state.r[ra] = state.r[ra] + ds;
 
-    if (canDisassemble)
-    {
-        printf("sth%s r%d, %d(r%d)\n", u ? "u" : "", rs, ds, ra);
-    }
+    LOG(PPU, TRACE, "sth%s r%d, %d(r%d)\n", u ? "u" : "", rs, ds, ra);
 }
 
 void CellPPU::Lfs(uint32_t opcode)
@@ -2373,8 +2228,7 @@ void CellPPU::Lfs(uint32_t opcode)
     uint32_t v = manager.Read32(ra ? state.r[ra] + ds : ds);
     state.fpr[frt].f = (float&)v;
 
-    if (canDisassemble)
-        printf("lfs f%d, %d(r%d) (%f)\n", frt, ds, ra, state.fpr[frt].f);
+    LOG(PPU, TRACE, "lfs f%d, %d(r%d) (%f)\n", frt, ds, ra, state.fpr[frt].f);
 }
 
 void CellPPU::Lfd(uint32_t opcode)
@@ -2385,8 +2239,7 @@ void CellPPU::Lfd(uint32_t opcode)
 
     state.fpr[frt].u = manager.Read64(ra ? state.r[ra] + ds : ds);
 
-    if (canDisassemble)
-        printf("lfd f%d, %d(r%d) (%f)\n", frt, ds, ra, state.fpr[frt].f);
+    LOG(PPU, TRACE, "lfd f%d, %d(r%d) (%f)\n", frt, ds, ra, state.fpr[frt].f);
 }
 
 void CellPPU::Stfs(uint32_t opcode)
@@ -2398,8 +2251,7 @@ void CellPPU::Stfs(uint32_t opcode)
     float f = (float)state.fpr[rs].f;
     manager.Write32(ra ? state.r[ra] + ds : ds, *(uint32_t*)&f);
 
-    if (canDisassemble)
-        printf("stfs f%d, %d(r%d)\n", rs, ds, ra);
+    LOG(PPU, TRACE, "stfs f%d, %d(r%d)\n", rs, ds, ra);
 }
 
 void CellPPU::Stfsu(uint32_t opcode)
@@ -2413,8 +2265,7 @@ void CellPPU::Stfsu(uint32_t opcode)
     manager.Write32(addr, *(uint32_t*)&f);
     state.r[ra] = addr;
 
-    if (canDisassemble)
-        printf("stfsu f%d, %d(r%d)\n", rs, ds, ra);
+    LOG(PPU, TRACE, "stfsu f%d, %d(r%d)\n", rs, ds, ra);
 }
 
 void CellPPU::Stfd(uint32_t opcode)
@@ -2425,28 +2276,24 @@ void CellPPU::Stfd(uint32_t opcode)
     
     manager.Write64(ra ? state.r[ra] + ds : ds, *(uint64_t*)&state.fpr[rs].f);
 
-    if (canDisassemble)
-        printf("stfd f%d, %d(r%d)\n", rs, ds, ra);
+    LOG(PPU, TRACE, "stfd f%d, %d(r%d)\n", rs, ds, ra);
 }
 
-void CellPPU::G_3A(uint32_t opcode)
+CellPPU::InstrHandler CellPPU::Decode3A(uint32_t opcode)
 {
     uint8_t field = (opcode & 0x3);
 
     if (field == 1)
     {
-        Ldu(opcode);
-        return;
+        return &CellPPU::Ldu;
     }
     else if (field == 0)
     {
         // LD
-        Ld(opcode);
-        return;
+        return &CellPPU::Ld;
     }
 
-    printf("ERROR: Unknown G_3A opcode 0x%08x\n", opcode);
-    exit(1);
+    return &CellPPU::UnknownOpcode;
 }
 
 void CellPPU::Ld(uint32_t opcode)
@@ -2457,8 +2304,7 @@ void CellPPU::Ld(uint32_t opcode)
 
     state.r[rt] = manager.Read64(ra ? state.r[ra] + ds : ds);
 
-    if (canDisassemble)
-        printf("ld r%d, %d(r%d) (0x%08x, 0x%08x)\n", rt, ds, ra, ra ? state.r[ra] + ds : ds, state.r[rt]);
+    LOG(PPU, TRACE, "ld r%d, %d(r%d) (0x%08x, 0x%08x)\n", rt, ds, ra, ra ? state.r[ra] + ds : ds, state.r[rt]);
 }
 
 void CellPPU::Ldu(uint32_t opcode)
@@ -2471,37 +2317,29 @@ void CellPPU::Ldu(uint32_t opcode)
     state.r[rt] = manager.Read64(addr);
     state.r[ra] = addr;
 
-    if (canDisassemble)
-        printf("ldu r%d, %d(r%d)\n", rt, ds, ra);
+    LOG(PPU, TRACE, "ldu r%d, %d(r%d)\n", rt, ds, ra);
 }
 
-void CellPPU::G_3B(uint32_t opcode)
+CellPPU::InstrHandler CellPPU::Decode3B(uint32_t opcode)
 {
     uint8_t field = (opcode >> 1) & 0x1F;
 
     switch (field)
     {
     case 0x012:
-        Fdivs(opcode);
-        break;
+        return &CellPPU::Fdivs;
     case 0x014:
-        Fsubs(opcode);
-        break;
+        return &CellPPU::Fsubs;
     case 0x015:
-        Fadds(opcode);
-        break;
+        return &CellPPU::Fadds;
     case 0x019:
-        Fmuls(opcode);
-        break;
+        return &CellPPU::Fmuls;
     case 0x01C:
-        Fmsubs(opcode);
-        break;
+        return &CellPPU::Fmsubs;
     case 0x01D:
-        Fmadds(opcode);
-        break;
+        return &CellPPU::Fmadds;
     default:
-        printf("Unknown opcode (0x%02x) 0x%08x\n", field, opcode);
-        throw std::runtime_error("Couldn't execute opcode\n");
+        return &CellPPU::UnknownOpcode;
     }
 }
 
@@ -2513,8 +2351,7 @@ void CellPPU::Fdivs(uint32_t opcode)
 
     state.fpr[frt].f = (float)(state.fpr[fra].f / state.fpr[frb].f);
 
-    if (canDisassemble)
-        printf("fdivs f%d,f%d,f%d\n", frt, fra, frb);
+    LOG(PPU, TRACE, "fdivs f%d,f%d,f%d\n", frt, fra, frb);
 }
 
 void CellPPU::Fsubs(uint32_t opcode)
@@ -2525,8 +2362,7 @@ void CellPPU::Fsubs(uint32_t opcode)
 
     state.fpr[frt].f = float(state.fpr[fra].f - state.fpr[frb].f);
 
-    if (canDisassemble)
-        printf("fsubs f%d,f%d,f%d\n", frt, fra, frb);
+    LOG(PPU, TRACE, "fsubs f%d,f%d,f%d\n", frt, fra, frb);
 }
 
 void CellPPU::Fadds(uint32_t opcode)
@@ -2537,8 +2373,7 @@ void CellPPU::Fadds(uint32_t opcode)
 
     state.fpr[frt].f = static_cast<float>(state.fpr[fra].f + state.fpr[frb].f);
 
-    if (canDisassemble)
-        printf("fadds f%d,f%d,f%d\n", frt, fra, frb);
+    LOG(PPU, TRACE, "fadds f%d,f%d,f%d\n", frt, fra, frb);
 }
 
 void CellPPU::Fmuls(uint32_t opcode)
@@ -2549,8 +2384,7 @@ void CellPPU::Fmuls(uint32_t opcode)
 
     state.fpr[frt].f = static_cast<float>(state.fpr[fra].f * state.fpr[frc].f);
 
-    if (canDisassemble)
-        printf("fmuls f%d,f%d,f%d\n", frt, fra, frc);
+    LOG(PPU, TRACE, "fmuls f%d,f%d,f%d\n", frt, fra, frc);
 }
 
 void CellPPU::Fmsubs(uint32_t opcode)
@@ -2562,8 +2396,7 @@ void CellPPU::Fmsubs(uint32_t opcode)
 
     state.fpr[frt].f = static_cast<float>((state.fpr[fra].f * state.fpr[frc].f) - state.fpr[frb].f);
 
-    if (canDisassemble)
-        printf("fmsubs f%d,f%d,f%d,f%d\n", frt, fra, frc, frb);
+    LOG(PPU, TRACE, "fmsubs f%d,f%d,f%d,f%d\n", frt, fra, frc, frb);
 }
 
 void CellPPU::Fmadds(uint32_t opcode)
@@ -2575,29 +2408,25 @@ void CellPPU::Fmadds(uint32_t opcode)
 
     state.fpr[frt].f = static_cast<float>((state.fpr[fra].f * state.fpr[frc].f) + state.fpr[frb].f);
 
-    if (canDisassemble)
-        printf("fmadds f%d,f%d,f%d,f%d\n", frt, fra, frc, frb);
+    LOG(PPU, TRACE, "fmadds f%d,f%d,f%d,f%d\n", frt, fra, frc, frb);
 }
 
-void CellPPU::G_3E(uint32_t opcode)
+CellPPU::InstrHandler CellPPU::Decode3E(uint32_t opcode)
 {
     uint8_t field = (opcode & 0x3);
 
     if (field == 1)
     {
         // STDU
-        Stdu(opcode);
-        return;
+        return &CellPPU::Stdu;
     }
     else if (field == 0)
     {
         // STD
-        Std(opcode);
-        return;
+        return &CellPPU::Std;
     }
 
-    printf("ERROR: Unknown G_3E opcode 0x%08x\n", opcode);
-    exit(1);
+    return &CellPPU::UnknownOpcode;
 }
 
 void CellPPU::Std(uint32_t opcode)
@@ -2608,8 +2437,7 @@ void CellPPU::Std(uint32_t opcode)
 
     manager.Write64(ra ? state.r[ra] + ds : ds, state.r[rs]);
 
-    if (canDisassemble)
-        printf("std r%d, %d(r%d) (0x%08x, 0x%08x)\n", rs, ds, ra, ra ? state.r[ra] + ds : ds, state.r[rs]);
+    LOG(PPU, TRACE, "std r%d, %d(r%d) (0x%08x, 0x%08x)\n", rs, ds, ra, ra ? state.r[ra] + ds : ds, state.r[rs]);
 }
 
 void CellPPU::Stdu(uint32_t opcode)
@@ -2622,60 +2450,46 @@ void CellPPU::Stdu(uint32_t opcode)
     manager.Write64(addr, state.r[rs]);
     state.r[ra] = addr;
 
-    if (canDisassemble)
-        printf("stdu r%d, %d(r%d)\n", rs, ds, ra);
+    LOG(PPU, TRACE, "stdu r%d, %d(r%d)\n", rs, ds, ra);
 }
 
-void CellPPU::G_3F(uint32_t opcode)
+CellPPU::InstrHandler CellPPU::Decode3F(uint32_t opcode)
 {
     uint32_t field = (opcode >> 1) & 0x3FF;
 
     switch (field)
     {
     case 0x000:
-        Fcmpu(opcode);
-        break;
+        return &CellPPU::Fcmpu;
     case 0x00C:
-        Frsp(opcode);
-        break;
+        return &CellPPU::Frsp;
     case 0x00F:
-        Fctiwz(opcode);
-        break;
+        return &CellPPU::Fctiwz;
     case 0x012:
-        Fdiv(opcode);
-        break;
+        return &CellPPU::Fdiv;
     case 0x015:
-        Fadd(opcode);
-        break;
+        return &CellPPU::Fadd;
     case 0x019:
-        Fmul(opcode);
-        break;
+        return &CellPPU::Fmul;
     case 0x028:
-        Fneg(opcode);
-        break;
+        return &CellPPU::Fneg;
     case 0x32F:
-        Fctidz(opcode);
-        break;
+        return &CellPPU::Fctidz;
     case 0x048:
-        Fmr(opcode);
-        break;
+        return &CellPPU::Fmr;
     case 0x34E:
-        Fcfid(opcode);
-        break;
+        return &CellPPU::Fcfid;
     case 0x108:
-        Fabs(opcode);
-        break;
+        return &CellPPU::Fabs;
 	default:
 	{
 		// This is hideous
 		switch ((opcode >> 1) & 0x1F)
 		{
 		case 0x01D:
-			Fmadd(opcode);
-			break;
+			return &CellPPU::Fmadd;
 		default:
-			printf("Unknown opcode (0x%03x) 0x%08x\n", field, opcode);
-			exit(1);
+			return &CellPPU::UnknownOpcode;
 		}
 	}
     }
@@ -2689,8 +2503,7 @@ void CellPPU::Fcmpu(uint32_t opcode)
 
     UpdateCRn<double>(bf, state.fpr[fra].f, state.fpr[frb].f);
 
-    if (canDisassemble)
-        printf("fcmpu state.cr%d,f%d,f%d\n", bf, fra, frb);
+    LOG(PPU, TRACE, "fcmpu state.cr%d,f%d,f%d\n", bf, fra, frb);
 }
 
 void CellPPU::Frsp(uint32_t opcode)
@@ -2702,8 +2515,7 @@ void CellPPU::Frsp(uint32_t opcode)
     const double r = static_cast<float>(b);
     state.fpr[frt].f = r;
 
-    if (canDisassemble)
-        printf("frsp r%d,r%d\n", frt, frb);
+    LOG(PPU, TRACE, "frsp r%d,r%d\n", frt, frb);
 }
 
 void CellPPU::Fctiwz(uint32_t opcode)
@@ -2715,8 +2527,7 @@ void CellPPU::Fctiwz(uint32_t opcode)
 	const auto res = _mm_xor_si128(_mm_cvttpd_epi32(b), _mm_castpd_si128(_mm_cmpge_pd(b, _mm_set1_pd(0x80000000))));
 	state.fpr[frt].f = std::bit_cast<double, int64_t>(_mm_cvtsi128_si64(res));
 
-    if (canDisassemble)
-        printf("fctiwz f%d,f%d\n", frt, frb);
+    LOG(PPU, TRACE, "fctiwz f%d,f%d\n", frt, frb);
 }
 
 void CellPPU::Fdiv(uint32_t opcode)
@@ -2727,8 +2538,7 @@ void CellPPU::Fdiv(uint32_t opcode)
 
     state.fpr[frt].f = (state.fpr[fra].f / state.fpr[frb].f);
 
-    if (canDisassemble)
-        printf("fdiv f%d,f%d,f%d\n", frt, fra, frb);
+    LOG(PPU, TRACE, "fdiv f%d,f%d,f%d\n", frt, fra, frb);
 }
 
 void CellPPU::Fadd(uint32_t opcode)
@@ -2739,8 +2549,7 @@ void CellPPU::Fadd(uint32_t opcode)
 
     state.fpr[frt].f = state.fpr[fra].f + state.fpr[frb].f;
 
-    if (canDisassemble)
-        printf("fadd f%d,f%d,f%d\n", frt, fra, frb);
+    LOG(PPU, TRACE, "fadd f%d,f%d,f%d\n", frt, fra, frb);
 }
 
 void CellPPU::Fmul(uint32_t opcode)
@@ -2751,8 +2560,7 @@ void CellPPU::Fmul(uint32_t opcode)
 
     state.fpr[frt].f = state.fpr[fra].f * state.fpr[frc].f;
 
-    if (canDisassemble)
-        printf("fmul f%d,f%d,f%d\n", frt, fra, frc);
+    LOG(PPU, TRACE, "fmul f%d,f%d,f%d\n", frt, fra, frc);
 }
 
 void CellPPU::Fmadd(uint32_t opcode)
@@ -2769,8 +2577,7 @@ void CellPPU::Fmadd(uint32_t opcode)
 	if (rc)
 		UpdateCR0<double>(state.fpr[frt].f);
 	
-	if (canDisassemble)
-		printf("fmadd f%d,f%d,f%d,f%d\n", frt, fra, frc, frb);
+	LOG(PPU, TRACE, "fmadd f%d,f%d,f%d,f%d\n", frt, fra, frc, frb);
 }
 
 void CellPPU::Fneg(uint32_t opcode)
@@ -2779,8 +2586,7 @@ void CellPPU::Fneg(uint32_t opcode)
     int frb = rb_d;
 
     state.fpr[frt].f = -state.fpr[frb].f;
-    if (canDisassemble)
-        printf("fneg f%d,f%d\n", frt, frb);
+    LOG(PPU, TRACE, "fneg f%d,f%d\n", frt, frb);
 }
 
 void CellPPU::Fctidz(uint32_t opcode)
@@ -2792,8 +2598,7 @@ void CellPPU::Fctidz(uint32_t opcode)
 	const auto res = _mm_xor_si128(_mm_set1_epi64x(_mm_cvttsd_si64(b)), _mm_castpd_si128(_mm_cmpge_pd(b, _mm_set1_pd((double)(1ull << 63)))));
 	state.fpr[frt].f = std::bit_cast<double>(_mm_cvtsi128_si64(res));
 
-    if (canDisassemble)
-        printf("fctidz f%d,f%d\n", frt, frb);
+    LOG(PPU, TRACE, "fctidz f%d,f%d\n", frt, frb);
 }
 
 void CellPPU::Fmr(uint32_t opcode)
@@ -2803,8 +2608,7 @@ void CellPPU::Fmr(uint32_t opcode)
 
     state.fpr[frt].f = state.fpr[frb].f;
 
-    if (canDisassemble)
-        printf("fmr f%d,f%d\n", frt, frb);
+    LOG(PPU, TRACE, "fmr f%d,f%d\n", frt, frb);
 }
 
 void CellPPU::Fcfid(uint32_t opcode)
@@ -2814,8 +2618,7 @@ void CellPPU::Fcfid(uint32_t opcode)
 
 	_mm_store_sd(&state.fpr[frt].f, _mm_cvtsi64_sd(_mm_setzero_pd(), std::bit_cast<int64_t>(state.fpr[frt].f)));
 
-    if (canDisassemble)
-        printf("fcfid r%d,r%d (%f)\n", frt, frb, state.fpr[frt].f);
+    LOG(PPU, TRACE, "fcfid r%d,r%d (%f)\n", frt, frb, state.fpr[frt].f);
 }
 
 void CellPPU::Fabs(uint32_t opcode)
@@ -2825,6 +2628,5 @@ void CellPPU::Fabs(uint32_t opcode)
 
     state.fpr[frt].f = std::abs(state.fpr[frb].f);
 
-    if (canDisassemble)
-        printf("fabs f%d,f%d\n", frt, frb);
+    LOG(PPU, TRACE, "fabs f%d,f%d\n", frt, frb);
 }
@@ -0,0 +1,368 @@
+#include "PPUJit.h"
+
+#include <sys/mman.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <logging.h>
+
+// Compiled blocks are never freed or moved, a block can still be running
+// further up the stack (RunSubroutine) when another one gets compiled
+#define CODE_BUFFER_SIZE (16*1024*1024)
+
+// Upper bound on the bytes emitted for a single guest instruction
+#define MAX_INSTR_SIZE 64
+
+#define GPR(n) (offsetof(State, r) + (n)*8)
+
+#define rt_d ((opcode >> 21) & 0x1F)
+#define rs_d rt_d
+#define ra_d ((opcode >> 16) & 0x1F)
+#define rb_d ((opcode >> 11) & 0x1F)
+#define si_d (opcode & 0xFFFF)
+
+static uint64_t RotateMask(uint32_t mb, uint32_t me)
+{
+    const uint64_t mask = ((uint64_t)-1 >> mb) ^ ((me >= 63) ? 0 : (uint64_t)-1 >> (me + 1));
+    return mb > me ? ~mask : mask;
+}
+
+PPUJit::PPUJit()
+{
+    code = (uint8_t*)mmap(NULL, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (code == MAP_FAILED)
+    {
+        LOG(PPU, ERROR, "ERROR: Couldn't map %d bytes for the PPU JIT\n", CODE_BUFFER_SIZE);
+        exit(1);
+    }
+}
+
+PPUJit::~PPUJit()
+{
+    munmap(code, CODE_BUFFER_SIZE);
+}
+
+void PPUJit::Emit32(uint32_t data)
+{
+    for (int i = 0; i < 4; i++)
+        Emit8(data >> (i*8));
+}
+
+void PPUJit::Emit64(uint64_t data)
+{
+    Emit32(data);
+    Emit32(data >> 32);
+}
+
+void PPUJit::LoadRax(size_t offs)
+{
+    // mov rax, [rbx+offs]
+    Emit8(0x48); Emit8(0x8B); Emit8(0x83); Emit32(offs);
+}
+
+void PPUJit::LoadRcx(size_t offs)
+{
+    // mov rcx, [rbx+offs]
+    Emit8(0x48); Emit8(0x8B); Emit8(0x8B); Emit32(offs);
+}
+
+void PPUJit::StoreRax(size_t offs)
+{
+    // mov [rbx+offs], rax
+    Emit8(0x48); Emit8(0x89); Emit8(0x83); Emit32(offs);
+}
+
+void PPUJit::EmitStorePC(uint32_t pc)
+{
+    // mov eax, pc
+    Emit8(0xB8); Emit32(pc);
+    StoreRax(offsetof(State, pc));
+}
+
+bool PPUJit::EmitNative(uint32_t opcode)
+{
+    switch ((opcode >> 26) & 0x3F)
+    {
+    case 0x0E: // addi
+    case 0x0F: // addis
+    {
+        int32_t si = (int16_t)si_d;
+        if (((opcode >> 26) & 0x3F) == 0x0F)
+            si = (int32_t)((uint32_t)si << 16);
+
+        if (ra_d)
+        {
+            LoadRax(GPR(ra_d));
+            // add rax, imm32
+            Emit8(0x48); Emit8(0x05); Emit32(si);
+        }
+        else
+        {
+            // mov rax, imm32
+            Emit8(0x48); Emit8(0xC7); Emit8(0xC0); Emit32(si);
+        }
+        StoreRax(GPR(rt_d));
+        return true;
+    }
+    case 0x15: // rlwinm
+    {
+        if (opcode & 1)
+            return false;
+
+        int sh = rb_d;
+        int mb = (opcode >> 6) & 0x1F;
+        int me = (opcode >> 1) & 0x1F;
+
+        // mov eax, [rbx+rs], upper half of rax is cleared by the 32-bit ops
+        Emit8(0x8B); Emit8(0x83); Emit32(GPR(rs_d));
+        // rol eax, sh
+        Emit8(0xC1); Emit8(0xC0); Emit8(sh);
+        // and eax, mask
+        Emit8(0x25); Emit32(RotateMask(32 + mb, 32 + me));
+        StoreRax(GPR(ra_d));
+        return true;
+    }
+    case 0x18: // ori
+    case 0x19: // oris
+    case 0x1A: // xori
+    case 0x1B: // xoris
+    {
+        uint8_t primary = (opcode >> 26) & 0x3F;
+        uint32_t ui = si_d;
+        if (primary & 1)
+            ui <<= 16;
+
+        LoadRax(GPR(rs_d));
+        // mov ecx, ui (zero-extended, oris can't use a sign-extended imm32)
+        Emit8(0xB9); Emit32(ui);
+        // or/xor rax, rcx
+        Emit8(0x48); Emit8(primary < 0x1A ? 0x09 : 0x31); Emit8(0xC8);
+        StoreRax(GPR(ra_d));
+        return true;
+    }
+    case 0x1E:
+    {
+        if (opcode & 1)
+            return false;
+
+        int sh = rb_d | (((opcode >> 1) & 1) << 5);
+        int m = (opcode >> 5) & 0x3F;
+        m = ((m & 0x3E) >> 1) | ((m & 1) << 5);
+
+        uint64_t mask;
+        switch ((opcode >> 2) & 0x7)
+        {
+        case 0: mask = RotateMask(m, 63); break; // rldicl
+        case 1: mask = RotateMask(0, m); break; // rldicr
+        default: return false;
+        }
+
+        LoadRax(GPR(rs_d));
+        // rol rax, sh
+        Emit8(0x48); Emit8(0xC1); Emit8(0xC0); Emit8(sh);
+        // mov rcx, mask
+        Emit8(0x48); Emit8(0xB9); Emit64(mask);
+        // and rax, rcx
+        Emit8(0x48); Emit8(0x21); Emit8(0xC8);
+        StoreRax(GPR(ra_d));
+        return true;
+    }
+    case 0x1F:
+    {
+        if (opcode & 1)
+            return false;
+
+        switch ((opcode >> 1) & 0x3FF)
+        {
+        case 0x01C: // and
+        case 0x03C: // andc
+        case 0x07C: // nor
+        case 0x13C: // xor
+        case 0x1BC: // or
+        {
+            uint32_t xo = (opcode >> 1) & 0x3FF;
+
+            LoadRax(GPR(rs_d));
+            LoadRcx(GPR(rb_d));
+            if (xo == 0x03C)
+            {
+                // not rcx
+                Emit8(0x48); Emit8(0xF7); Emit8(0xD1);
+            }
+            uint8_t op;
+            switch (xo)
+            {
+            case 0x01C: case 0x03C: op = 0x21; break;
+            case 0x13C: op = 0x31; break;
+            default: op = 0x09; break;
+            }
+            Emit8(0x48); Emit8(op); Emit8(0xC8);
+            if (xo == 0x07C)
+            {
+                // not rax
+                Emit8(0x48); Emit8(0xF7); Emit8(0xD0);
+            }
+            StoreRax(GPR(ra_d));
+            return true;
+        }
+        case 0x028: // subf
+        case 0x10A: // add
+        {
+            bool add = ((opcode >> 1) & 0x3FF) == 0x10A;
+
+            LoadRax(GPR(add ? ra_d : rb_d));
+            LoadRcx(GPR(add ? rb_d : ra_d));
+            // add/sub rax, rcx
+            Emit8(0x48); Emit8(add ? 0x01 : 0x29); Emit8(0xC8);
+            StoreRax(GPR(rt_d));
+            return true;
+        }
+        case 0x068: // neg
+            LoadRax(GPR(ra_d));
+            // neg rax
+            Emit8(0x48); Emit8(0xF7); Emit8(0xD8);
+            StoreRax(GPR(rt_d));
+            return true;
+        case 0x3DA: // extsw
+            // movsxd rax, dword [rbx+rs]
+            Emit8(0x48); Emit8(0x63); Emit8(0x83); Emit32(GPR(rs_d));
+            StoreRax(GPR(ra_d));
+            return true;
+        case 0x39A: // extsh
+        case 0x3BA: // extsb
+            // movsx rax, word/byte [rbx+rs]
+            Emit8(0x48); Emit8(0x0F); Emit8(((opcode >> 1) & 0x3FF) == 0x39A ? 0xBF : 0xBE); Emit8(0x83); Emit32(GPR(rs_d));
+            StoreRax(GPR(ra_d));
+            return true;
+        case 0x153: // mfspr
+        case 0x1D3: // mtspr
+        {
+            uint32_t spr = (opcode >> 11) & 0x3FF;
+            const uint32_t n = (spr >> 5) | ((spr & 0x1f) << 5);
+
+            size_t offs;
+            switch (n)
+            {
+            case 0x008: offs = offsetof(State, lr); break;
+            case 0x009: offs = offsetof(State, ctr); break;
+            default: return false;
+            }
+
+            if (((opcode >> 1) & 0x3FF) == 0x153)
+            {
+                LoadRax(offs);
+                StoreRax(GPR(rt_d));
+            }
+            else
+            {
+                LoadRax(GPR(rs_d));
+                StoreRax(offs);
+            }
+            return true;
+        }
+        }
+        return false;
+    }
+    }
+
+    return false;
+}
+
+uint32_t PPUJit::Fallback(CellPPU* ppu, const CellPPU::DecodedInstr* instr)
+{
+    // Exceptions can't unwind through the generated code, so they're stashed
+    // and rethrown by Execute once we're back out of the block
+    try
+    {
+        (ppu->*instr->handler)(instr->opcode);
+    }
+    catch (...)
+    {
+        ppu->jit->pendingException = std::current_exception();
+        return 1;
+    }
+
+    return 0;
+}
+
+void PPUJit::EmitFallback(uint32_t pc, const CellPPU::DecodedInstr* instr)
+{
+    // The interpreter handlers expect pc to already point past the instruction
+    EmitStorePC(pc + 4);
+
+    // mov rdi, r12
+    Emit8(0x4C); Emit8(0x89); Emit8(0xE7);
+    // mov rsi, instr
+    Emit8(0x48); Emit8(0xBE); Emit64((uint64_t)instr);
+    // mov rax, Fallback
+    Emit8(0x48); Emit8(0xB8); Emit64((uint64_t)&PPUJit::Fallback);
+    // call rax
+    Emit8(0xFF); Emit8(0xD0);
+    // test eax, eax
+    Emit8(0x85); Emit8(0xC0);
+    // jnz exit
+    Emit8(0x0F); Emit8(0x85);
+    exitPatches.push_back(codePos);
+    Emit32(0);
+}
+
+CellPPU::CompiledBlock PPUJit::Compile(uint32_t addr, const std::vector<CellPPU::DecodedInstr>& instrs)
+{
+    if (codePos + (instrs.size() + 1) * MAX_INSTR_SIZE > CODE_BUFFER_SIZE)
+        return nullptr;
+
+    uint8_t* start = code + codePos;
+    exitPatches.clear();
+
+    // void block(CellPPU* rdi, State* rsi)
+    // push rbx; push r12; push rbp (also realigns the stack for calls)
+    Emit8(0x53); Emit8(0x41); Emit8(0x54); Emit8(0x55);
+    // mov rbx, rsi
+    Emit8(0x48); Emit8(0x89); Emit8(0xF3);
+    // mov r12, rdi
+    Emit8(0x49); Emit8(0x89); Emit8(0xFC);
+
+    bool pcWritten = false;
+    for (size_t i = 0; i < instrs.size(); i++)
+    {
+        uint32_t pc = addr + i*4;
+
+        if (EmitNative(instrs[i].opcode))
+        {
+            pcWritten = false;
+            continue;
+        }
+
+        EmitFallback(pc, &instrs[i]);
+        pcWritten = true;
+    }
+
+    // Blocks that end with a fallback leave pc to the handler (branches set their own target)
+    if (!pcWritten)
+        EmitStorePC(addr + instrs.size()*4);
+
+    for (auto patch : exitPatches)
+    {
+        int32_t rel = codePos - (patch + 4);
+        for (int i = 0; i < 4; i++)
+            code[patch + i] = rel >> (i*8);
+    }
+
+    // pop rbp; pop r12; pop rbx; ret
+    Emit8(0x5D); Emit8(0x41); Emit8(0x5C); Emit8(0x5B); Emit8(0xC3);
+
+    return (CellPPU::CompiledBlock)start;
+}
+
+void PPUJit::Execute(CellPPU* ppu, CellPPU::CompiledBlock func)
+{
+    func(ppu, &ppu->state);
+
+    if (pendingException)
+    {
+        std::exception_ptr e = pendingException;
+        pendingException = nullptr;
+        std::rethrow_exception(e);
+    }
+}
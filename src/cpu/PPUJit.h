@@ -0,0 +1,40 @@
+#pragma once
+
+#include "PPU.h"
+
+#include <vector>
+#include <exception>
+
+// Translates hot PPU blocks into x86-64 code that works directly on State
+// Anything without a native translation is emitted as a call back into the interpreter handler
+class PPUJit
+{
+public:
+    PPUJit();
+    ~PPUJit();
+
+    // Returns nullptr once the code buffer is full, in which case the block stays interpreted
+    CellPPU::CompiledBlock Compile(uint32_t addr, const std::vector<CellPPU::DecodedInstr>& instrs);
+    void Execute(CellPPU* ppu, CellPPU::CompiledBlock func);
+private:
+    static uint32_t Fallback(CellPPU* ppu, const CellPPU::DecodedInstr* instr);
+
+    bool EmitNative(uint32_t opcode);
+    void EmitFallback(uint32_t pc, const CellPPU::DecodedInstr* instr);
+    void EmitStorePC(uint32_t pc);
+
+    void Emit8(uint8_t data) {code[codePos++] = data;}
+    void Emit32(uint32_t data);
+    void Emit64(uint64_t data);
+
+    // rax/rcx <-> State members, addressed through rbx
+    void LoadRax(size_t offs);
+    void LoadRcx(size_t offs);
+    void StoreRax(size_t offs);
+
+    uint8_t* code;
+    size_t codePos = 0;
+
+    std::vector<size_t> exitPatches;
+    std::exception_ptr pendingException;
+};
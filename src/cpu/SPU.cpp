@@ -1,4 +1,5 @@
 #include "SPU.h"
+#include "SPUJit.h"
 #include <stdio.h>
 #include <stdexcept>
 #include <mmintrin.h>
@@ -6,15 +7,8 @@
 #include <bit>
 #include <cstring>
 #include <fstream>
-
-#define SPU_DEBUG 1
-
-#if SPU_DEBUG
-#define printf(x, ...) \
-	if (id == 0) { printf(x, ##__VA_ARGS__); }
-#else
-#define printf(x, ...) 0
-#endif
+#include <thread>
+#include <logging.h>
 
 static int g_id = 0;
 
@@ -22,226 +16,209 @@ SPU::SPU(MemoryManager* manager)
 : manager(manager)
 {
 	id = g_id++;
+
+	std::thread(&SPU::ThreadMain, this).detach();
 }
 
+void SPU::ThreadMain()
+{
+	while (true)
+	{
+		if (!running.load(std::memory_order_acquire))
+		{
+			FutexWait(&running, 0);
+			continue;
+		}
+
+		if (useJit)
+			RunBlock();
+		else
+			Run();
+	}
+}
+
+void SPU::SetRunning(bool run)
+{
+	running.store(run, std::memory_order_release);
+	if (run)
+		FutexWake(&running);
+}
+
+constexpr std::array<SPU::InstrHandler, 2048> SPU::BuildDecodeTable()
+{
+	std::array<InstrHandler, 2048> table{};
+	auto fill = [&table](int bits, uint32_t op, InstrHandler handler)
+	{
+		int free = 11 - bits;
+		for (uint32_t i = 0; i < (1u << free); i++)
+			table[(op << free) | i] = handler;
+	};
+
+	for (auto& handler : table)
+		handler = &SPU::unknown;
+
+	// Filled lowest priority first, where two opcode fields overlap the later fill wins
+	fill(4, 0x8, &SPU::selb);
+	fill(4, 0xb, &SPU::shufb);
+
+	fill(11, 0x01, &SPU::lnop);
+	fill(11, 0x0D, &SPU::rdch);
+	fill(11, 0x40, &SPU::sf);
+	fill(11, 0x42, &SPU::bg);
+	fill(11, 0x48, &SPU::sfh);
+	fill(11, 0x79, &SPU::rotmi);
+	fill(11, 0x7A, &SPU::rotmai);
+	fill(11, 0x7b, &SPU::shli);
+	fill(11, 0xC0, &SPU::a);
+	fill(11, 0xC2, &SPU::cg);
+	fill(11, 0x10d, &SPU::wrch);
+	fill(11, 0x144, &SPU::stqx);
+	fill(11, 0x1a8, &SPU::bi);
+	fill(11, 0x1a9, &SPU::bisl);
+	fill(11, 0x1ac, &SPU::hbr);
+	fill(11, 0x1b4, &SPU::fsm);
+	fill(11, 0x1c4, &SPU::lqx);
+	fill(11, 0x1dc, &SPU::rotqby);
+	fill(11, 0x1f4, &SPU::cbd);
+	fill(11, 0x1f6, &SPU::cwd);
+	fill(11, 0x1f7, &SPU::cdd);
+	fill(11, 0x1fc, &SPU::rotqbyi);
+	fill(11, 0x1fd, &SPU::rotqmbyi);
+	fill(11, 0x1ff, &SPU::shlqbyi);
+	fill(11, 0x201, &SPU::nop);
+	fill(11, 0x340, &SPU::addx);
+	fill(11, 0x341, &SPU::sfx);
+	fill(11, 0x3C5, &SPU::mpyh);
+	fill(11, 0x3CC, &SPU::mpyu);
+
+	fill(8, 0x15, &SPU::andhi);
+	fill(8, 0x16, &SPU::andbi);
+	fill(8, 0x1c, &SPU::ai);
+	fill(8, 0x24, &SPU::stqd);
+	fill(8, 0x34, &SPU::lqd);
+	fill(8, 0x4c, &SPU::cgti);
+	fill(8, 0x5c, &SPU::clgti);
+	fill(8, 0x5e, &SPU::clgtbi);
+	fill(8, 0x7c, &SPU::ceqi);
+
+	fill(7, 0x09, &SPU::hbrr);
+	fill(7, 0x21, &SPU::ila);
+
+	fill(9, 0x08, &SPU::ori);
+	fill(9, 0x40, &SPU::brz);
+	fill(9, 0x41, &SPU::stqa);
+	fill(9, 0x42, &SPU::brnz);
+	fill(9, 0x47, &SPU::stqr);
+	fill(9, 0x64, &SPU::br);
+	fill(9, 0x65, &SPU::fsmbi);
+	fill(9, 0x66, &SPU::brsl);
+	fill(9, 0x67, &SPU::lqr);
+	fill(9, 0x81, &SPU::il);
+	fill(9, 0x82, &SPU::ilhu);
+	fill(9, 0x83, &SPU::ilh);
+	fill(9, 0xC1, &SPU::iohl);
+
+	// stop and sync take precedence over everything else
+	fill(11, 0x002, &SPU::sync);
+	fill(11, 0x000, &SPU::stop);
+
+	return table;
+}
+
+constinit const std::array<SPU::InstrHandler, 2048> SPU::decodeTable = SPU::BuildDecodeTable();
+
 void SPU::Run()
 {
-	if (!running)
+	uint32_t instr = Read32(pc);
+	pc += 4;
+
+	(this->*decodeTable[instr >> 21])(instr);
+}
+
+void SPU::EnableJit()
+{
+	if (!g_spuJit)
+		g_spuJit = new SPUJit();
+	useJit = true;
+}
+
+void SPU::RunBlock()
+{
+	if (flushBlocks.exchange(false, std::memory_order_relaxed))
+	{
+		localBlocks.clear();
+		memset(codePages, 0, sizeof(codePages));
+	}
+
+	const SpuBlock* block;
+	auto it = localBlocks.find(pc);
+	if (it != localBlocks.end())
+	{
+		block = it->second;
+	}
+	else
+	{
+		block = g_spuJit->GetBlock(this, pc);
+		localBlocks[pc] = block;
+
+		uint32_t end = pc + block->code.size()*4 - 1;
+		for (uint32_t page = pc >> SPU_CODE_PAGE_SHIFT; page <= (end >> SPU_CODE_PAGE_SHIFT); page++)
+			codePages[page % SPU_CODE_PAGES] = 1;
+	}
+
+	if (block->func)
+	{
+		block->func(this);
 		return;
-	
-	for (int i = 0; i < 4; i++)
+	}
+
+	for (auto& instr : block->instrs)
 	{
-		uint32_t instr = Read32(pc);
 		pc += 4;
+		(this->*instr.handler)(instr.instr);
+	}
+}
 
-		if (instr == 0x00400000)
-		{
-			printf("sync\n");
-			return;
-		}
-		
-		if ((instr & 0xFFE00000) == 0x00000000)
-		{
-			running = false;
-			if (thread)
-			{
-				thread->running = false;
-				thread = nullptr;
-			}
-			printf("stop\n");
-			return;
-		}
-		
-		switch ((instr >> 23) & 0x1FF)
-		{
-		case 0x08:
-			ori(instr);
-			return;
-		case 0x40:
-			brz(instr);
-			return;
-		case 0x41:
-			stqa(instr);
-			return;
-		case 0x42:
-			brnz(instr);
-			return;
-		case 0x47:
-			stqr(instr);
-			return;
-		case 0x64:
-			br(instr);
-			return;
-		case 0x65:
-			fsmbi(instr);
-			return;
-		case 0x66:
-			brsl(instr);
-			return;
-		case 0x67:
-			lqr(instr);
-			return;
-		case 0x81:
-			il(instr);
-			return;
-		case 0x82:
-			ilhu(instr);
-			return;
-		case 0x83:
-			ilh(instr);
-			return;
-		case 0xC1:
-			iohl(instr);
-			return;
-		}
-		
-		switch ((instr >> 25) & 0x7F)
-		{
-		case 0x09:
-			printf("hbrr\n");
-			return;
-		case 0x21:
-			ila(instr);
-			return;
-		}
+void SPU::sync(uint32_t instr)
+{
+	LOG(SPU, TRACE, "sync\n");
+}
 
-		switch ((instr >> 24) & 0xFF)
-		{
-		case 0x15:
-			andhi(instr);
-			return;
-		case 0x16:
-			andbi(instr);
-			return;
-		case 0x1c:
-			ai(instr);
-			return;
-		case 0x24:
-			stqd(instr);
-			return;
-		case 0x34:
-			lqd(instr);
-			return;
-		case 0x4c:
-			cgti(instr);
-			return;
-		case 0x5c:
-			clgti(instr);
-			return;
-		case 0x5e:
-			clgtbi(instr);
-			return;
-		case 0x7c:
-			ceqi(instr);
-			return;
-		}
+void SPU::stop(uint32_t instr)
+{
+	SetRunning(false);
+	if (thread)
+	{
+		SpuThread* stopped = thread;
+		thread->running = false;
+		thread = nullptr;
+		CellSpu::SpuThreadStopped(stopped);
+	}
+	LOG(SPU, TRACE, "stop\n");
+}
 
-		switch ((instr >> 21) & 0x7FF)
-		{
-		case 0x01:
-			printf("lnop\n");
-			return;
-		case 0x0D:
-			rdch(instr);
-			return;
-		case 0x40:
-			sf(instr);
-			return;
-		case 0x42:
-			bg(instr);
-			return;
-		case 0x48:
-			sfh(instr);
-			return;
-		case 0x79:
-			rotmi(instr);
-			return;
-		case 0x7A:
-			rotmai(instr);
-			return;
-		case 0x7b:
-			shli(instr);
-			return;
-		case 0xC0:
-			a(instr);
-			return;
-		case 0xC2:
-			cg(instr);
-			return;
-		case 0x10d:
-			wrch(instr);
-			return;
-		case 0x144:
-			stqx(instr);
-			return;
-		case 0x1a8:
-			bi(instr);
-			return;
-		case 0x1a9:
-			bisl(instr);
-			return;
-		case 0x1ac:
-			hbr(instr);
-			return;
-		case 0x1b4:
-			fsm(instr);
-			return;
-		case 0x1c4:
-			lqx(instr);
-			return;
-		case 0x1dc:
-			rotqby(instr);
-			return;
-		case 0x1f4:
-			cbd(instr);
-			return;
-		case 0x1f6:
-			cwd(instr);
-			return;
-		case 0x1f7:
-			cdd(instr);
-			return;
-		case 0x1fc:
-			rotqbyi(instr);
-			return;
-		case 0x1fd:
-			rotqmbyi(instr);
-			return;
-		case 0x1ff:
-			shlqbyi(instr);
-			return;
-		case 0x201:
-			printf("nop\n");
-			return;
-		case 0x340:
-			addx(instr);
-			return;
-		case 0x341:
-			sfx(instr);
-			return;
-		case 0x3C5:
-			mpyh(instr);
-			return;
-		case 0x3CC:
-			mpyu(instr);
-			return;
-		}
+void SPU::hbrr(uint32_t instr)
+{
+	LOG(SPU, TRACE, "hbrr\n");
+}
 
-		switch ((instr >> 28) & 0xF)
-		{
-		case 0x8:
-			selb(instr);
-			return;
-		case 0xb:
-			shufb(instr);
-			return;
-		default:
-			printf("Unknown instruction 0x%02x, 0x%02x, 0x%02x, 0x%02x, 0x%02x (0x%08x)\n", (instr >> 28) & 0xF, (instr >> 21) & 0x7FF, (instr >> 24) & 0xFF, (instr >> 25) & 0x7F, (instr >> 23) & 0x1FF, instr);
-			exit(1);
-		}
-	}
+void SPU::lnop(uint32_t instr)
+{
+	LOG(SPU, TRACE, "lnop\n");
 }
 
+void SPU::nop(uint32_t instr)
+{
+	LOG(SPU, TRACE, "nop\n");
+}
+
+void SPU::unknown(uint32_t instr)
+{
+	LOG(SPU, ERROR, "Unknown instruction 0x%02x, 0x%02x, 0x%02x, 0x%02x, 0x%02x (0x%08x)\n", (instr >> 28) & 0xF, (instr >> 21) & 0x7FF, (instr >> 24) & 0xFF, (instr >> 25) & 0x7F, (instr >> 23) & 0x1FF, instr);
+	exit(1);
+}
+
+
 void SPU::Dump()
 {
 	std::ofstream lsOut("spu" + std::to_string(id) + "_lsa.bin");
@@ -265,10 +242,10 @@ void SPU::SetThread(SpuThread *thread)
 	gprs[5].u64[1] = thread->arg2;
 	gprs[6].u64[1] = thread->arg3;
 
-	printf("0x%08lx, 0x%08lx, 0x%08lx, 0x%08lx\n", thread->arg0, thread->arg1, thread->arg2, thread->arg3);
+	LOG(SPU, TRACE, "0x%08lx, 0x%08lx, 0x%08lx, 0x%08lx\n", thread->arg0, thread->arg1, thread->arg2, thread->arg3);
 
-	running = true;
 	thread->running = true;
+	SetRunning(true);
 }
 
 void SPU::SetEntry(uint32_t entry)
@@ -278,49 +255,55 @@ void SPU::SetEntry(uint32_t entry)
 
 void SPU::WriteProblemStorage(uint32_t reg, uint32_t data)
 {
+	while (problemLock.test_and_set(std::memory_order_acquire))
+		_mm_pause();
+
 	switch (reg)
 	{
 	case 0x400C:
-	{
-		if (running == false && waitingOnInMbox == true)
-		{
-			running = true;
-			waitingOnInMbox = false;
-		}
-		inMbox.push(data);
+		if (!inMbox.Push(data))
+			LOG(SPU, WARN, "WARNING: SPU %d inbound mailbox full, dropping 0x%08x\n", id, data);
 		break;
-	}
 	case 0x401C:
-		running = data & 1;
+		SetRunning(data & 1);
 		break;
 	case 0x1400C:
-	{
-		if (running == false && waitingForSignal1 == true)
-		{
-			running = true;
-			waitingForSignal1 = false;
-		}
-		signal1.push(data);
+		if (!signal1.Push(data))
+			LOG(SPU, WARN, "WARNING: SPU %d signal notification 1 full, dropping 0x%08x\n", id, data);
 		break;
-	}
 	default:
-		printf("Write to unknown problem storage register 0x%04x\n", reg);
+		problemLock.clear(std::memory_order_release);
+		LOG(SPU, ERROR, "Write to unknown problem storage register 0x%04x\n", reg);
 		throw std::runtime_error("Unknown problem storage register");
 	}
+
+	problemLock.clear(std::memory_order_release);
 }
 
 uint32_t SPU::ReadProblemStorage(uint32_t reg)
 {
+	while (problemLock.test_and_set(std::memory_order_acquire))
+		_mm_pause();
+
+	uint32_t value;
 	switch (reg)
 	{
 	case 0x4004:
-		return spu_out_mbox;
+		outMbox.Pop(lastOutMbox);
+		value = lastOutMbox;
+		break;
 	case 0x4014:
-		return mbox_has_data;
+		// Outbound count in the low byte, free inbound slots in the next one
+		value = outMbox.Size() | (inMbox.Free() << 8);
+		break;
 	default:
-		printf("Read from unknown problem storage register 0x%04x\n", reg);
+		problemLock.clear(std::memory_order_release);
+		LOG(SPU, ERROR, "Read from unknown problem storage register 0x%04x\n", reg);
 		throw std::runtime_error("Unknown problem storage register");
 	}
+
+	problemLock.clear(std::memory_order_release);
+	return value;
 }
 
 void SPU::ori(uint32_t instr)
@@ -340,7 +323,7 @@ void SPU::ori(uint32_t instr)
 	for (int i = 0; i < 4; i++)
 		gprs[rt].u32[i] = gprs[ra].u32[i] | i10;
 	
-	printf("ori $%d, $%d, 0x%08x\n", rt, ra, i10);
+	LOG(SPU, TRACE, "ori $%d, $%d, 0x%08x\n", rt, ra, i10);
 }
 
 void SPU::brz(uint32_t instr)
@@ -348,7 +331,7 @@ void SPU::brz(uint32_t instr)
 	uint8_t rt = instr & 0x7F;
 	int32_t i16 = ((int16_t)((instr >> 7) & 0xFFFF)) << 2;
 
-	printf("brz $%d,0x%08x\n", rt, pc+i16-4);
+	LOG(SPU, TRACE, "brz $%d,0x%08x\n", rt, pc+i16-4);
 
 	if (gprs[rt].u32[3] == 0)
 		pc += i16-4;
@@ -361,7 +344,7 @@ void SPU::stqa(uint32_t instr)
 	i16 &= (256*1024)-1;
 	i16 &= 0xFFFFFFF0;
 
-	printf("stqa $%d,0x%08x\n", rt, i16);
+	LOG(SPU, TRACE, "stqa $%d,0x%08x\n", rt, i16);
 
 	Write128(i16, gprs[rt]);
 }
@@ -371,7 +354,7 @@ void SPU::brnz(uint32_t instr)
 	uint8_t rt = instr & 0x7F;
 	int32_t i16 = ((int16_t)((instr >> 7) & 0xFFFF)) << 2;
 
-	printf("brnz $%d,0x%08x\n", rt, pc+i16-4);
+	LOG(SPU, TRACE, "brnz $%d,0x%08x\n", rt, pc+i16-4);
 
 	if (gprs[rt].u32[3] != 0)
 		pc += i16-4;
@@ -385,7 +368,7 @@ void SPU::stqr(uint32_t instr)
 	uint32_t ea = (i16 + (pc-4)) & 0xFFFFFFF0;
 	uint8_t rt = instr & 0x7F;
 
-	printf("stqr $%d, 0x%08x\n", rt, ea);
+	LOG(SPU, TRACE, "stqr $%d, 0x%08x\n", rt, ea);
 
 	Write128(ea, gprs[rt]);
 }
@@ -396,7 +379,7 @@ void SPU::br(uint32_t instr)
 
 	pc += i16-4;
 
-	printf("br 0x%08x\n", pc);
+	LOG(SPU, TRACE, "br 0x%08x\n", pc);
 }
 
 void SPU::fsmbi(uint32_t instr)
@@ -412,7 +395,7 @@ void SPU::fsmbi(uint32_t instr)
 			gprs[rt].u8[i] = 0xFF;
 	}
 
-	printf("fsmbi $%d, 0x%04x\n", rt, i16);
+	LOG(SPU, TRACE, "fsmbi $%d, 0x%04x\n", rt, i16);
 }
 
 void SPU::brsl(uint32_t instr)
@@ -423,7 +406,7 @@ void SPU::brsl(uint32_t instr)
 	gprs[rt].u32[3] = pc;
 	pc += i16-4;
 
-	printf("brsl $%d,0x%08x\n", rt, pc);
+	LOG(SPU, TRACE, "brsl $%d,0x%08x\n", rt, pc);
 }
 
 void SPU::il(uint32_t instr)
@@ -434,7 +417,7 @@ void SPU::il(uint32_t instr)
 	for (int i = 0; i < 4; i++)
 		gprs[rt].u32[i] = (uint32_t)i16;
 	
-	printf("il $%d, 0x%08x\n", rt, (uint32_t)i16);
+	LOG(SPU, TRACE, "il $%d, 0x%08x\n", rt, (uint32_t)i16);
 }
 
 void SPU::ilhu(uint32_t instr)
@@ -445,7 +428,7 @@ void SPU::ilhu(uint32_t instr)
 	for (int i = 0; i < 4; i++)
 		gprs[rt].u32[i] = (uint32_t)(i16 << 16);
 	
-	printf("ilhu $%d, 0x%08x\n", rt, (uint32_t)i16);
+	LOG(SPU, TRACE, "ilhu $%d, 0x%08x\n", rt, (uint32_t)i16);
 }
 
 void SPU::ilh(uint32_t instr)
@@ -456,7 +439,7 @@ void SPU::ilh(uint32_t instr)
 	for (int i = 0; i < 8; i++)
 		gprs[rt].u16[i] = i16;
 	
-	printf("ilh $%d, 0x%04x\n", rt, i16);
+	LOG(SPU, TRACE, "ilh $%d, 0x%04x\n", rt, i16);
 }
 
 void SPU::iohl(uint32_t instr)
@@ -467,7 +450,7 @@ void SPU::iohl(uint32_t instr)
 	for (int i = 0; i < 4; i++)
 		gprs[rt].u32[i] |= i16;
 	
-	printf("iohl $%d, 0x%08x\n", rt, (uint32_t)i16);
+	LOG(SPU, TRACE, "iohl $%d, 0x%08x\n", rt, (uint32_t)i16);
 }
 
 void SPU::ila(uint32_t instr)
@@ -478,7 +461,7 @@ void SPU::ila(uint32_t instr)
 	for (int i = 0; i < 4; i++)
 		gprs[rt].u32[i] = i18;
 	
-	printf("ila $%d, 0x%08x\n", rt, i18);
+	LOG(SPU, TRACE, "ila $%d, 0x%08x\n", rt, i18);
 }
 
 void SPU::andhi(uint32_t instr)
@@ -494,7 +477,7 @@ void SPU::andhi(uint32_t instr)
 		gprs[rt].u16[i] = gprs[ra].u16[i] & i10;
 	}
 
-	printf("andhi $%d,$%d,%d\n", rt, ra, (int16_t)i10);
+	LOG(SPU, TRACE, "andhi $%d,$%d,%d\n", rt, ra, (int16_t)i10);
 }
 
 void SPU::andbi(uint32_t instr)
@@ -508,7 +491,7 @@ void SPU::andbi(uint32_t instr)
 		gprs[rt].u8[i] = gprs[ra].u8[i] & i10;
 	}
 
-	printf("andbi $%d,$%d,%d\n", rt, ra, i10);
+	LOG(SPU, TRACE, "andbi $%d,$%d,%d\n", rt, ra, i10);
 }
 
 void SPU::ai(uint32_t instr)
@@ -521,7 +504,7 @@ void SPU::ai(uint32_t instr)
 	for (int i = 0; i < 4; i++)
 		gprs[rt].u32[i] = gprs[ra].u32[i] + i10;
 	
-	printf("ai $%d, $%d, %d\n", rt, ra, i10);
+	LOG(SPU, TRACE, "ai $%d, $%d, %d\n", rt, ra, i10);
 }
 
 void SPU::stqd(uint32_t instr)
@@ -537,7 +520,7 @@ void SPU::stqd(uint32_t instr)
 	uint32_t ea = (gprs[ra].u32[3] + i10) & 0xFFFFFFF0;
 	Write128(ea, gprs[rt]);
 
-	printf("stqd $%d, %d($%d)\n", rt, i10, ra);
+	LOG(SPU, TRACE, "stqd $%d, %d($%d)\n", rt, i10, ra);
 }
 
 void SPU::lqd(uint32_t instr)
@@ -553,7 +536,7 @@ void SPU::lqd(uint32_t instr)
 	uint32_t ea = (gprs[ra].u32[3] + i10) & 0xFFFFFFF0;
 	gprs[rt] = Read128(ea);
 
-	printf("lqd $%d, %d($%d)\n", rt, i10, ra);
+	LOG(SPU, TRACE, "lqd $%d, %d($%d)\n", rt, i10, ra);
 }
 
 void SPU::lqr(uint32_t instr)
@@ -565,7 +548,7 @@ void SPU::lqr(uint32_t instr)
 
 	gprs[rt] = Read128(ea);
 
-	printf("lqr $%d, 0x%08x\n", rt, ea);
+	LOG(SPU, TRACE, "lqr $%d, 0x%08x\n", rt, ea);
 }
 
 void SPU::cgti(uint32_t instr)
@@ -580,7 +563,7 @@ void SPU::cgti(uint32_t instr)
 		gprs[rt].u32[i] = (gprs[ra].u32[i] > i10) ? 0xFFFFFFFF : 0x00000000;
 	}
 
-	printf("cgti $%d, $%d, 0x%08x\n", rt, ra, i10);
+	LOG(SPU, TRACE, "cgti $%d, $%d, 0x%08x\n", rt, ra, i10);
 }
 
 void SPU::clgti(uint32_t instr)
@@ -596,7 +579,7 @@ void SPU::clgti(uint32_t instr)
 		gprs[rt].u32[i] = (gprs[ra].u32[i] > i10) ? 0xFFFFFFFF : 0x00000000;
 	}
 
-	printf("clgti $%d,$%d,%d\n", rt, ra, i10);
+	LOG(SPU, TRACE, "clgti $%d,$%d,%d\n", rt, ra, i10);
 }
 
 void SPU::clgtbi(uint32_t instr)
@@ -610,7 +593,7 @@ void SPU::clgtbi(uint32_t instr)
 		gprs[rt].u8[i] = (gprs[ra].u8[i] > i10) ? 0xFF : 0x00;
 	}
 
-	printf("clgtbi $%d,$%d,%d\n", rt, ra, i10);
+	LOG(SPU, TRACE, "clgtbi $%d,$%d,%d\n", rt, ra, i10);
 }
 
 void SPU::ceqi(uint32_t instr)
@@ -625,7 +608,7 @@ void SPU::ceqi(uint32_t instr)
 		gprs[rt].u32[i] = (gprs[ra].u32[i] == i10) ? 0xFFFFFFFF : 0x00000000;
 	}
 
-	printf("ceqi $%d, $%d, 0x%08x\n", rt, ra, i10);
+	LOG(SPU, TRACE, "ceqi $%d, $%d, 0x%08x\n", rt, ra, i10);
 }
 
 void SPU::rdch(uint32_t instr)
@@ -633,49 +616,219 @@ void SPU::rdch(uint32_t instr)
 	uint8_t ca = (instr >> 7) & 0x7F;
 	uint8_t rt = instr & 0x7F;
 	
-	printf("rdch %d, $%d\n", ca, rt);
+	LOG(SPU, TRACE, "rdch %d, $%d\n", ca, rt);
 
 	gprs[rt].u128 = 0;
 
 	switch (ca)
 	{
 	case 3:
-		if (signal1.empty())
-		{
-			running = false;
-			waitingForSignal1 = true;
-			pc -= 4;
-		}
-		else
-		{
-			gprs[rt].u32[3] = signal1.front();
-			signal1.pop();
-		}
+		signal1.WaitNotEmpty();
+		signal1.Pop(gprs[rt].u32[3]);
 		break;
 	case 24:
-		gprs[rt].u32[3] = mfc_tag_mask; // Just tell the SPU that all operations have been completed
+	{
+		uint32_t done = ~PendingTags() & mfc_tag_mask;
+
+		// DMA is carried out on this thread, anything still pending is a list waiting on a stall ack from this SPU.
+		// Blocking would never end, so the tags that did complete are returned and the program can ack and wait again
+		if ((mfc_tag_update == 1 && !done && mfc_tag_mask) || (mfc_tag_update == 2 && done != mfc_tag_mask))
+			LOG(SPU, WARN, "Waiting on DMA tags 0x%08x stalled on stall-and-notify, returning 0x%08x\n", mfc_tag_mask & ~done, done);
+		gprs[rt].u32[3] = done;
+		break;
+	}
+	case 25:
+		gprs[rt].u32[3] = mfcStallNotify;
+		mfcStallNotify = 0;
+		break;
+	case 27:
+		gprs[rt].u32[3] = atomicStatus;
 		break;
 	case 29:
+		inMbox.WaitNotEmpty();
+		inMbox.Pop(gprs[rt].u32[3]);
+		break;
+	default:
+		LOG(SPU, ERROR, "Unknown channel\n");
+		exit(1);
+	}
+}
+
+void SPU::QueueDma(uint8_t cmd)
+{
+	if (mfcQueue.size() >= 16)
+	{
+		LOG(SPU, ERROR, "MFC command queue overflow\n");
+		exit(1);
+	}
+
+	// Atomic commands go straight to the atomic unit rather than through the queue
+	if (cmd == 0xD0 || cmd == 0xB4 || cmd == 0xB0 || cmd == 0xB8)
+	{
+		RunAtomic(cmd);
+		return;
+	}
+
+	mfcQueue.push_back({cmd, (uint8_t)mfc_tag, mfc_lsa, mfc_ea.ea, mfc_len, false});
+	ProcessDma();
+}
+
+void SPU::RunAtomic(uint8_t cmd)
+{
+	uint32_t ea = mfc_ea.lo & ~(RESERVATION_LINE_SIZE - 1);
+	uint32_t lsa = mfc_lsa & (sizeof(localStore) - RESERVATION_LINE_SIZE);
+	uint8_t* line = manager->GetRawPtr(ea);
+
+	switch (cmd)
 	{
-		if (inMbox.empty())
+	case 0xD0: // getllar
+		// Retry until the copy isn't torn by a store landing half way through it
+		do
 		{
-			running = false;
-			waitingOnInMbox = true;
-			pc -= 4;
-		}
-		else
+			resVersion = manager->ReserveLine(ea);
+			memcpy(resData, line, RESERVATION_LINE_SIZE);
+		} while (manager->ReserveLine(ea) != resVersion);
+
+		InvalidateCode(lsa, RESERVATION_LINE_SIZE);
+		memcpy(&localStore[lsa], resData, RESERVATION_LINE_SIZE);
+		hasReservation = true;
+		resAddr = ea;
+		atomicStatus = 4;
+		break;
+	case 0xB4: // putllc
+	{
+		bool stored = false;
+		if (hasReservation && resAddr == ea && manager->LockLine(ea, resVersion))
 		{
-			gprs[rt].u32[3] = inMbox.front();
-			inMbox.pop();
+			// Plain stores don't bump the version, so they're caught by comparing the data
+			stored = !memcmp(line, resData, RESERVATION_LINE_SIZE);
+			if (stored)
+				memcpy(line, &localStore[lsa], RESERVATION_LINE_SIZE);
+			manager->UnlockLine(ea, stored);
 		}
+		hasReservation = false;
+		atomicStatus = stored ? 0 : 1;
+		break;
+	}
+	case 0xB0: // putlluc
+	case 0xB8: // putqlluc
+		manager->LockLine(ea);
+		memcpy(line, &localStore[lsa], RESERVATION_LINE_SIZE);
+		manager->UnlockLine(ea, true);
+		atomicStatus = 2;
 		break;
 	}
+
+	LOG(SPU, TRACE, "Ran mfc atomic command 0x%02x on line 0x%08x (status %d)\n", cmd, ea, atomicStatus);
+}
+
+void SPU::ProcessDma()
+{
+	uint32_t pendingTags = 0; // Tags of earlier commands that are still queued
+	uint32_t barrierTags = 0;
+	bool barrierAll = false;
+
+	for (size_t i = 0; i < mfcQueue.size();)
+	{
+		MfcCommand& cmd = mfcQueue[i];
+		uint32_t tag = 1 << cmd.tag;
+		bool sync = (cmd.cmd & 0xC0) == 0xC0; // barrier, mfceieio, mfcsync
+		bool fenced = !sync && (cmd.cmd & 0x3); // b and f variants wait on everything before them in their tag group
+
+		bool blocked = cmd.stalled || barrierAll || (barrierTags & tag) || (fenced && (pendingTags & tag)) || (sync && pendingTags);
+		if (!blocked && RunDma(cmd))
+		{
+			mfcQueue.erase(mfcQueue.begin() + i);
+			continue;
+		}
+
+		pendingTags |= tag;
+		if (sync)
+			barrierAll = true;
+		else if (cmd.cmd & 0x1)
+			barrierTags |= tag;
+		i++;
+	}
+}
+
+bool SPU::RunDma(MfcCommand& cmd)
+{
+	switch (cmd.cmd & 0xFC)
+	{
+	case 0x20: // put
+	case 0x30: // putr
+	case 0x40: // get
+		DmaCopy(cmd.cmd & 0x40, cmd.lsa, cmd.ea, cmd.size);
+		LOG(SPU, TRACE, "Ran mfc dma command 0x%02x (transferred %d bytes between 0x%08x and 0x%08lx)\n", cmd.cmd, cmd.size, cmd.lsa, cmd.ea);
+		return true;
+	case 0x24: // putl
+	case 0x34: // putrl
+	case 0x44: // getl
+		while (cmd.size >= 8)
+		{
+			uint32_t listAddr = cmd.ea & 0x3FFF8;
+			uint32_t elem = Read32(listAddr);
+			uint32_t eal = Read32(listAddr + 4);
+			uint32_t size = elem & 0x7FFF;
+
+			// Elements are laid out back to back in local store, each starting at the same offset into a quadword as its ea
+			cmd.lsa = (cmd.lsa & 0x3FFF0) | (eal & 0xF);
+			DmaCopy(cmd.cmd & 0x40, cmd.lsa, (cmd.ea & 0xFFFFFFFF00000000) | eal, size);
+			LOG(SPU, TRACE, "Ran mfc list element (transferred %d bytes between 0x%08x and 0x%08x)\n", size, cmd.lsa, eal);
+
+			cmd.lsa += (size + 15) & ~15;
+			cmd.ea += 8;
+			cmd.size -= 8;
+
+			if ((elem & 0x80000000) && cmd.size >= 8)
+			{
+				cmd.stalled = true;
+				mfcStallNotify |= 1 << cmd.tag;
+				return false;
+			}
+		}
+		return true;
+	case 0xC0: // barrier
+	case 0xC8: // mfceieio
+	case 0xCC: // mfcsync
+		return true;
 	default:
-		printf("Unknown channel\n");
+		LOG(SPU, ERROR, "Unknown mfc command 0x%02x\n", cmd.cmd);
 		exit(1);
 	}
 }
 
+void SPU::DmaCopy(bool get, uint32_t lsa, uint64_t ea, uint32_t size)
+{
+	lsa &= sizeof(localStore) - 1;
+
+	// Local store wraps around
+	if (lsa + size > sizeof(localStore))
+	{
+		uint32_t first = sizeof(localStore) - lsa;
+		DmaCopy(get, lsa, ea, first);
+		DmaCopy(get, 0, ea + first, size - first);
+		return;
+	}
+
+	// Local store and guest memory are both big-endian, so it's a straight copy either way
+	if (get)
+	{
+		InvalidateCode(lsa, size);
+		memcpy(&localStore[lsa], manager->GetRawPtr(ea), size);
+	}
+	else
+		memcpy(manager->GetRawPtr(ea), &localStore[lsa], size);
+}
+
+uint32_t SPU::PendingTags()
+{
+	uint32_t tags = 0;
+	for (auto& cmd : mfcQueue)
+		tags |= 1 << cmd.tag;
+	return tags;
+}
+
 void SPU::sf(uint32_t instr)
 {
 	uint8_t rb = (instr >> 14) & 0x7F;
@@ -685,7 +838,7 @@ void SPU::sf(uint32_t instr)
 	for (int i = 0; i < 4; i++)
 		gprs[rt].u32[i] = gprs[rb].u32[i] - gprs[ra].u32[i];
 	
-	printf("sf $%d, $%d, $%d\n", rt, ra, rb);
+	LOG(SPU, TRACE, "sf $%d, $%d, $%d\n", rt, ra, rb);
 }
 
 void SPU::bg(uint32_t instr)
@@ -697,7 +850,7 @@ void SPU::bg(uint32_t instr)
 	for (int i = 0; i < 4; i++)
 		gprs[rt].u32[i] = (gprs[rb].u32[i] > gprs[ra].u32[i]) ? 1 : 0;
 	
-	printf("bg $%d,$%d,$%d\n", rt, ra, rb);
+	LOG(SPU, TRACE, "bg $%d,$%d,$%d\n", rt, ra, rb);
 }
 
 void SPU::sfh(uint32_t instr)
@@ -709,7 +862,7 @@ void SPU::sfh(uint32_t instr)
 	for (int i = 0; i < 8; i++)
 		gprs[rt].u16[i] = gprs[rb].u16[i] - gprs[ra].u16[i];
 	
-	printf("sfh $%d, $%d, $%d\n", rt, ra, rb);
+	LOG(SPU, TRACE, "sfh $%d, $%d, $%d\n", rt, ra, rb);
 }
 
 void SPU::a(uint32_t instr)
@@ -721,7 +874,7 @@ void SPU::a(uint32_t instr)
 	for (int i = 0; i < 4; i++)
 		gprs[rt].u32[i] = (int32_t)gprs[ra].u32[i] + (int32_t)gprs[rb].u32[i];
 	
-	printf("a $%d, $%d, $%d\n", rt, ra, rb);
+	LOG(SPU, TRACE, "a $%d, $%d, $%d\n", rt, ra, rb);
 }
 
 void SPU::cg(uint32_t instr)
@@ -737,7 +890,7 @@ void SPU::cg(uint32_t instr)
 		gprs[rt].u32[i] = (((uint64_t)(op1 + op2)) > UINT32_MAX) ? 1 : 0;
 	}
 
-	printf("cg $%d,$%d,$%d\n", rt, ra, rb);
+	LOG(SPU, TRACE, "cg $%d,$%d,$%d\n", rt, ra, rb);
 }
 
 void SPU::rotmi(uint32_t instr)
@@ -758,7 +911,7 @@ void SPU::rotmi(uint32_t instr)
 	else
 		memset(&gprs[rt], 0, sizeof(SpuReg));
 	
-	printf("rotmi $%d,$%d,%d\n", rt, ra, (int8_t)i7);
+	LOG(SPU, TRACE, "rotmi $%d,$%d,%d\n", rt, ra, (int8_t)i7);
 }
 
 void SPU::rotmai(uint32_t instr)
@@ -779,7 +932,7 @@ void SPU::rotmai(uint32_t instr)
 	else
 		memset(&gprs[rt], 0, sizeof(SpuReg));
 	
-	printf("rotmai $%d,$%d,%d\n", rt, ra, (int8_t)i7);
+	LOG(SPU, TRACE, "rotmai $%d,$%d,%d\n", rt, ra, (int8_t)i7);
 }
 
 void SPU::shli(uint32_t instr)
@@ -790,7 +943,7 @@ void SPU::shli(uint32_t instr)
 
 	gprs[rt].vi = _mm_slli_epi32(gprs[ra].vi, i7 & 0x3f);
 
-	printf("shli $%d,$%d,%d\n", rt, ra, i7);
+	LOG(SPU, TRACE, "shli $%d,$%d,%d\n", rt, ra, i7);
 }
 
 void SPU::wrch(uint32_t instr)
@@ -798,70 +951,53 @@ void SPU::wrch(uint32_t instr)
 	uint8_t ca = (instr >> 7) & 0x7F;
 	uint8_t rt = instr & 0x7F;
 	
-	printf("wrch %d, $%d\n", ca, rt);
+	LOG(SPU, TRACE, "wrch %d, $%d\n", ca, rt);
 
 	switch (ca)
 	{
 	case 16:
-		printf("0x%08x -> mfc_lsa\n", gprs[rt].u32[3]);
+		LOG(SPU, TRACE, "0x%08x -> mfc_lsa\n", gprs[rt].u32[3]);
 		mfc_lsa = gprs[rt].u32[3];
 		break;
 	case 17:
-		printf("0x%08x -> mfc_eah\n", gprs[rt].u32[3]);
+		LOG(SPU, TRACE, "0x%08x -> mfc_eah\n", gprs[rt].u32[3]);
 		mfc_ea.hi = gprs[rt].u32[3];
 		break;
 	case 18:
-		printf("0x%08x -> mfc_eal\n", gprs[rt].u32[3]);
+		LOG(SPU, TRACE, "0x%08x -> mfc_eal\n", gprs[rt].u32[3]);
 		mfc_ea.lo = gprs[rt].u32[3];
 		break;
 	case 19:
-		printf("0x%08x -> mfc_len\n", gprs[rt].u32[3]);
+		LOG(SPU, TRACE, "0x%08x -> mfc_len\n", gprs[rt].u32[3]);
 		mfc_len = gprs[rt].u32[3];
 		break;
 	case 20:
-		printf("0x%08x -> mfc_tag\n", gprs[rt].u32[3]);
+		LOG(SPU, TRACE, "0x%08x -> mfc_tag\n", gprs[rt].u32[3]);
+		mfc_tag = gprs[rt].u32[3] & 0x1F;
 		break;
 	case 21:
-	{
-		uint8_t cmd = gprs[rt].u32[3];
-		if (cmd == 0x40)
-		{
-			// TODO: Maybe don't make DMA stuff instant?
-			for (int i = 0; i < mfc_len; i++)
-			{
-				localStore[mfc_lsa++] = manager->Read8(mfc_ea.ea++);
-			}
-			printf("Ran mfc dma command 0x%02x (transferred %d bytes from 0x%08lx -> 0x%08x\n", gprs[rt].u32[3], mfc_len, mfc_ea.ea-mfc_len, mfc_lsa-mfc_len);
-		}
-		// putf is normally a fence to ensure DMA completes in-order
-		// But we do DMA instantly, so it's essentially just another put
-		else if (cmd == 0x20 || cmd == 0x22)
-		{
-			// TODO: Maybe don't make DMA stuff instant?
-			for (int i = 0; i < mfc_len; i++)
-			{
-				manager->Write8(mfc_ea.ea++, localStore[mfc_lsa++]);
-			}
-			printf("Ran mfc dma command 0x%02x (transferred %d bytes from 0x%08x -> 0x%08lx\n", gprs[rt].u32[3], mfc_len, mfc_lsa-mfc_len, mfc_ea.ea-mfc_len);
-		}
-		else
-		{
-			printf("Unknown mfc command 0x%02x\n", cmd);
-			exit(1);
-		}
+		QueueDma(gprs[rt].u32[3]);
 		break;
-	}
 	case 22:
 		mfc_tag_mask = gprs[rt].u32[3];
 		break;
 	case 23:
+		mfc_tag_update = gprs[rt].u32[3];
+		break;
+	case 26:
+		for (auto& cmd : mfcQueue)
+		{
+			if (cmd.tag == (gprs[rt].u32[3] & 0x1F))
+				cmd.stalled = false;
+		}
+		ProcessDma();
 		break;
 	case 28:
-		spu_out_mbox = gprs[rt].u32[3];
-		mbox_has_data = true;
+		outMbox.WaitNotFull();
+		outMbox.Push(gprs[rt].u32[3]);
 		break;
 	default:
-		printf("Unknown channel\n");
+		LOG(SPU, ERROR, "Unknown channel\n");
 		exit(1);
 	}
 }
@@ -876,7 +1012,7 @@ void SPU::stqx(uint32_t instr)
 
 	Write128(ea, gprs[rt]);
 
-	printf("stqx $%d,$%d,$%d\n", rt, ra, rb);
+	LOG(SPU, TRACE, "stqx $%d,$%d,$%d\n", rt, ra, rb);
 }
 
 void SPU::bi(uint32_t instr)
@@ -884,24 +1020,24 @@ void SPU::bi(uint32_t instr)
 	uint8_t ra = (instr >> 7) & 0x7F;
 	pc = gprs[ra].u32[3];
 
-	printf("bi $%d\n", ra);
+	LOG(SPU, TRACE, "bi $%d\n", ra);
 }
 
 void SPU::bisl(uint32_t instr)
 {
-	printf("0x%08x\n", pc);
+	LOG(SPU, TRACE, "0x%08x\n", pc);
 	uint8_t rt = instr & 0x7F;
 	uint8_t ra = (instr >> 7) & 0x7F;
 	uint32_t addr = gprs[ra].u32[3];
 	gprs[rt].u32[3] = pc;
 	pc = addr;
 
-	printf("0x%08x: bisl $%d,$%d\n", pc, rt, ra);
+	LOG(SPU, TRACE, "0x%08x: bisl $%d,$%d\n", pc, rt, ra);
 }
 
 void SPU::hbr(uint32_t instr)
 {
-	printf("hbr\n");
+	LOG(SPU, TRACE, "hbr\n");
 }
 
 void SPU::fsm(uint32_t instr)
@@ -913,7 +1049,7 @@ void SPU::fsm(uint32_t instr)
 	const auto mask = _mm_set_epi32(8, 4, 2, 1);
 	gprs[rt].vi = _mm_cmpeq_epi32(_mm_and_si128(bits, mask), mask);
 	
-	printf("fsm $%d,$%d\n", rt, ra);
+	LOG(SPU, TRACE, "fsm $%d,$%d\n", rt, ra);
 }
 
 void SPU::lqx(uint32_t instr)
@@ -926,7 +1062,7 @@ void SPU::lqx(uint32_t instr)
 
 	gprs[rt] = Read128(ea);
 
-	printf("lqx $%d,$%d,$%d (0x%08x)\n", rt, ra, rb, ea);
+	LOG(SPU, TRACE, "lqx $%d,$%d,$%d (0x%08x)\n", rt, ra, rb, ea);
 }
 
 void SPU::rotqby(uint32_t instr)
@@ -939,7 +1075,7 @@ void SPU::rotqby(uint32_t instr)
 	alignas(32) const __m128i buf[2]{a, a};
 	gprs[rt].vi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(reinterpret_cast<const uint8_t*>(buf) + (16 - (gprs[rb].u32[3] & 0xf))));
 	
-	printf("rotqby $%d, $%d, $%d\n", rt, ra, rb);	
+	LOG(SPU, TRACE, "rotqby $%d, $%d, $%d\n", rt, ra, rb);	
 }
 
 void SPU::cbd(uint32_t instr)
@@ -954,7 +1090,7 @@ void SPU::cbd(uint32_t instr)
 	gprs[rt].u64[1] = 0x1011121314151617ULL;
 	gprs[rt].u8[t] = 0x03;
 
-	printf("cbd $%d,$%d,%d\n", rt, ra, i7);
+	LOG(SPU, TRACE, "cbd $%d,$%d,%d\n", rt, ra, i7);
 }
 
 void SPU::cwd(uint32_t instr)
@@ -969,7 +1105,7 @@ void SPU::cwd(uint32_t instr)
 	gprs[rt].u64[1] = 0x1011121314151617ULL;
 	gprs[rt].u32[t] = 0x00010203;
 
-	printf("cwd $%d, %d($%d)\n", rt, i7, ra);
+	LOG(SPU, TRACE, "cwd $%d, %d($%d)\n", rt, i7, ra);
 }
 
 void SPU::cdd(uint32_t instr)
@@ -984,7 +1120,7 @@ void SPU::cdd(uint32_t instr)
 	gprs[rt].u64[1] = 0x1011121314151617ULL;
 	gprs[rt].u64[t] = 0x0001020304050607;
 
-	printf("cdd $%d, %d($%d)\n", rt, i7, ra);
+	LOG(SPU, TRACE, "cdd $%d, %d($%d)\n", rt, i7, ra);
 }
 
 void SPU::rotqbyi(uint32_t instr)
@@ -1019,7 +1155,7 @@ void SPU::rotqbyi(uint32_t instr)
 
 	gprs[rt] = res;
 
-	printf("rotqbyi $%d, $%d, %d\n", rt, ra, i7);
+	LOG(SPU, TRACE, "rotqbyi $%d, $%d, %d\n", rt, ra, i7);
 }
 
 void SPU::rotqmbyi(uint32_t instr)
@@ -1043,7 +1179,7 @@ void SPU::rotqmbyi(uint32_t instr)
 		gprs[rt].u8[15 - i] = gprs[ra].u8[15 - (i - shiftCount)];
 	}
 
-	printf("rotqmbyi $%d,$%d,%d\n", rt, ra, i7);
+	LOG(SPU, TRACE, "rotqmbyi $%d,$%d,%d\n", rt, ra, i7);
 }
 
 void SPU::shlqbyi(uint32_t instr)
@@ -1058,7 +1194,7 @@ void SPU::shlqbyi(uint32_t instr)
 		else gprs[rt].u8[15 - i] = gprs[ra].u8[15 - (i + i7)];
 	}
 
-	printf("shlqbyi $%d,$%d,%d\n", rt, ra, i7);
+	LOG(SPU, TRACE, "shlqbyi $%d,$%d,%d\n", rt, ra, i7);
 }
 
 void SPU::addx(uint32_t instr)
@@ -1070,7 +1206,7 @@ void SPU::addx(uint32_t instr)
 	for (int i = 0; i < 4; i++)
 		gprs[rt].u32[i] = gprs[ra].u32[i] + gprs[rb].u32[i] + (gprs[rt].u32[i] & 1);
 	
-	printf("addx $%d,$%d,$%d\n", rt, ra, rb);
+	LOG(SPU, TRACE, "addx $%d,$%d,$%d\n", rt, ra, rb);
 }
 
 void SPU::sfx(uint32_t instr)
@@ -1082,7 +1218,7 @@ void SPU::sfx(uint32_t instr)
 	for (int i = 0; i < 4; i++)
 		gprs[rt].u32[i] = gprs[rb].u32[i] + (~gprs[ra].u32[i]) + (gprs[rt].u32[i] & 1);
 	
-	printf("sfx $%d,$%d,$%d\n", rt, ra, rb);
+	LOG(SPU, TRACE, "sfx $%d,$%d,$%d\n", rt, ra, rb);
 }
 
 void SPU::mpyh(uint32_t instr)
@@ -1111,7 +1247,7 @@ void SPU::mpyh(uint32_t instr)
 	}
 #endif
 
-	printf("mpyh $%d,$%d,$%d\n", rt, ra, rb);
+	LOG(SPU, TRACE, "mpyh $%d,$%d,$%d\n", rt, ra, rb);
 }
 
 void SPU::mpyu(uint32_t instr)
@@ -1125,7 +1261,7 @@ void SPU::mpyu(uint32_t instr)
 	gprs[rt].u32[1] = gprs[ra].u16[2]*gprs[rb].u16[2];
 	gprs[rt].u32[0] = gprs[ra].u16[0]*gprs[rb].u16[0];
 
-	printf("mpyu $%d,$%d,$%d\n", rt, ra, rb);
+	LOG(SPU, TRACE, "mpyu $%d,$%d,$%d\n", rt, ra, rb);
 }
 
 void SPU::selb(uint32_t instr)
@@ -1137,7 +1273,7 @@ void SPU::selb(uint32_t instr)
 
 	gprs[rt].u128 = (gprs[rc].u128 & gprs[rb].u128) | ((~gprs[rc].u128) & gprs[ra].u128);
 
-	printf("selb $%d,$%d,$%d,$%d\n", rt, ra, rb, rc);
+	LOG(SPU, TRACE, "selb $%d,$%d,$%d,$%d\n", rt, ra, rb, rc);
 }
 
 void SPU::shufb(uint32_t instr)
@@ -1165,5 +1301,5 @@ void SPU::shufb(uint32_t instr)
 	const auto cmp2 = _mm_cmpeq_epi8(_mm_and_si128(c.vi, xe0), xc0);
 	gprs[rt].vi = _mm_or_si128(_mm_andnot_si128(cmp0, res.vi), _mm_avg_epu8(cmp1, cmp2));
 
-	printf("shufb $%d,$%d,$%d,$%d\n", rt, ra, rb, rc);
+	LOG(SPU, TRACE, "shufb $%d,$%d,$%d,$%d\n", rt, ra, rb, rc);
 }
@@ -2,11 +2,15 @@
 
 #include <stdint.h>
 #include <stdio.h>
-#include <queue>
+#include <array>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
 #include <inttypes.h>
 #include <emmintrin.h>
 #include <kernel/Modules/CellSpurs.h>
 #include <kernel/Memory.h>
+#include "SpscRing.h"
 
 union SpuReg
 {
@@ -39,13 +43,25 @@ inline SpuReg operator|(const SpuReg& left, const SpuReg& right)
 	return ret;
 }
 
+class SPUJit;
+struct SpuBlock;
+
+// Granularity at which local store writes invalidate recompiled code
+#define SPU_CODE_PAGE_SHIFT 12
+#define SPU_CODE_PAGES ((256*1024) >> SPU_CODE_PAGE_SHIFT)
+
 class SPU
 {
+	friend class SPUJit;
+	friend struct SpuBlock;
 public:
 	SPU(MemoryManager* manager);
-	void Run();
+	void Run(); // Steps one instruction, called in a loop by the SPU's host thread
+	void RunBlock(); // Runs one recompiled block
 	void Dump();
 
+	void EnableJit();
+
 	void SetThread(SpuThread* thread);
 
 	void SetEntry(uint32_t entry);
@@ -55,10 +71,12 @@ public:
 	void Write8(uint32_t offs, uint8_t data)
 	{
 		localStore[offs] = data;
+		InvalidateCode(offs, 1);
 	}
 
 	void Write128(uint32_t offs, SpuReg data)
 	{
+		InvalidateCode(offs, 16);
 		for (int i = 15; i >= 0; i--)
 			localStore[offs++] = data.u8[i];
 	}
@@ -80,8 +98,35 @@ private:
 	SpuThread* thread;
 
 	uint8_t localStore[256*1024];
-	bool running = false;
-	bool waitingForSignal1 = true;
+	// Futex word, the host thread sleeps on it while the SPU is stopped
+	std::atomic<uint32_t> running{0};
+
+	void SetRunning(bool run);
+	void ThreadMain();
+
+	typedef void (SPU::*InstrHandler)(uint32_t);
+
+	// Indexed by the top 11 bits of an instruction, shorter opcodes fill every slot they prefix
+	static const std::array<InstrHandler, 2048> decodeTable;
+	static constexpr std::array<InstrHandler, 2048> BuildDecodeTable();
+	InstrHandler Decode(uint32_t instr) {return decodeTable[instr >> 21];}
+
+	// Recompiled blocks this SPU has looked up, valid until something writes over a page they came from
+	bool useJit = false;
+	std::unordered_map<uint32_t, const SpuBlock*> localBlocks;
+	uint8_t codePages[SPU_CODE_PAGES] = {};
+	std::atomic<bool> flushBlocks{false};
+
+	void InvalidateCode(uint32_t offs, uint32_t len)
+	{
+		if (!len)
+			return;
+		for (uint32_t page = offs >> SPU_CODE_PAGE_SHIFT; page <= ((offs + len - 1) >> SPU_CODE_PAGE_SHIFT); page++)
+		{
+			if (codePages[page % SPU_CODE_PAGES])
+				flushBlocks.store(true, std::memory_order_relaxed);
+		}
+	}
 
 	uint32_t pc;
 	int id;
@@ -89,8 +134,8 @@ private:
 	SpuReg gprs[128];
 
 	// Channels
-	uint32_t spu_out_mbox;
-	bool mbox_has_data = false;
+	SpscRing<uint32_t, 1> outMbox;
+	uint32_t lastOutMbox = 0; // Reading an empty mailbox gives back the last value
 	// Local store address
 	uint32_t mfc_lsa = 0;
 	// Main memory address
@@ -105,13 +150,54 @@ private:
 	} mfc_ea;
 	// mfc dma length
 	uint32_t mfc_len;
+	// mfc tag id
+	uint32_t mfc_tag = 0;
 	// mfc tag mask
 	uint32_t mfc_tag_mask;
+	// mfc tag status update condition, 0 = immediate, 1 = any, 2 = all
+	uint32_t mfc_tag_update = 0;
+
+	struct MfcCommand
+	{
+		uint8_t cmd;
+		uint8_t tag;
+		uint32_t lsa;
+		uint64_t ea; // For lists, eah plus the local store address of the next list element
+		uint32_t size; // For lists, the bytes of list left
+		bool stalled; // List element had stall-and-notify set, waits for an ack on channel 26
+	};
+
+	// Commands run as soon as nothing orders them behind an earlier one,
+	// so all that's ever left queued are stalled lists and commands fenced behind them
+	std::vector<MfcCommand> mfcQueue;
+	uint32_t mfcStallNotify = 0;
+
+	// Lock line taken by getllar, putllc only stores if nobody has written to it since
+	bool hasReservation = false;
+	uint32_t resAddr;
+	uint64_t resVersion;
+	uint8_t resData[RESERVATION_LINE_SIZE];
+	uint32_t atomicStatus = 0;
+
+	void QueueDma(uint8_t cmd);
+	void RunAtomic(uint8_t cmd);
+	void ProcessDma();
+	bool RunDma(MfcCommand& cmd); // false if a list stalled part way through
+	void DmaCopy(bool get, uint32_t lsa, uint64_t ea, uint32_t size);
+	uint32_t PendingTags();
 	// signal1
-	std::queue<uint32_t> signal1;
-	// in mbox
-	bool waitingOnInMbox = false;
-	std::queue<uint32_t> inMbox;
+	SpscRing<uint32_t, 4> signal1;
+	// in mbox, 4 entries deep like the real thing
+	SpscRing<uint32_t, 4> inMbox;
+	// Any PPU worker can hit problem storage, this makes them one producer (inMbox, signal1) and one consumer (outMbox)
+	std::atomic_flag problemLock = ATOMIC_FLAG_INIT;
+
+	void sync(uint32_t instr); // 0x00400000
+	void stop(uint32_t instr); // 0x000
+	void hbrr(uint32_t instr); // 0x09
+	void lnop(uint32_t instr); // 0x01
+	void nop(uint32_t instr); // 0x201
+	void unknown(uint32_t instr);
 
 	void ori(uint32_t instr); // 0x08
 	void brz(uint32_t instr); // 0x40
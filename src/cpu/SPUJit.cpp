@@ -0,0 +1,355 @@
+#include "SPUJit.h"
+
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <logging.h>
+
+#define CODE_BUFFER_SIZE (16*1024*1024)
+
+// Upper bound on the bytes emitted for a single SPU instruction
+#define MAX_INSTR_SIZE 80
+
+#define MAX_BLOCK_SIZE 256
+
+// pshufb mask at the start of the code buffer, local store is big-endian and registers are stored byte-reversed
+#define BSWAP_MASK_OFFS 0
+
+SPUJit* g_spuJit;
+
+SPUJit::SPUJit()
+{
+	code = (uint8_t*)mmap(NULL, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (code == MAP_FAILED)
+	{
+		LOG(SPU, ERROR, "ERROR: Couldn't map %d bytes for the SPU JIT\n", CODE_BUFFER_SIZE);
+		exit(1);
+	}
+
+	for (int i = 0; i < 16; i++)
+		Emit8(15 - i);
+}
+
+SPUJit::~SPUJit()
+{
+	munmap(code, CODE_BUFFER_SIZE);
+}
+
+void SPUJit::Emit32(uint32_t data)
+{
+	for (int i = 0; i < 4; i++)
+		Emit8(data >> (i*8));
+}
+
+void SPUJit::Emit64(uint64_t data)
+{
+	Emit32(data);
+	Emit32(data >> 32);
+}
+
+void SPUJit::EmitR12(uint8_t reg, int32_t disp)
+{
+	Emit8(0x84 | ((reg & 7) << 3));
+	Emit8(0x24);
+	Emit32(disp);
+}
+
+void SPUJit::LoadXmm(uint8_t xmm, uint8_t gpr)
+{
+	// movdqu xmm, [r12+gprs+gpr*16]
+	Emit8(0xF3); Emit8(0x41); Emit8(0x0F); Emit8(0x6F);
+	EmitR12(xmm, gprsOffs + gpr*16);
+}
+
+void SPUJit::StoreXmm(uint8_t xmm, uint8_t gpr)
+{
+	// movdqu [r12+gprs+gpr*16], xmm
+	Emit8(0xF3); Emit8(0x41); Emit8(0x0F); Emit8(0x7F);
+	EmitR12(xmm, gprsOffs + gpr*16);
+}
+
+void SPUJit::XmmOp(uint8_t op, uint8_t dst, uint8_t src)
+{
+	Emit8(0x66); Emit8(0x0F); Emit8(op); Emit8(0xC0 | (dst << 3) | src);
+}
+
+void SPUJit::SplatXmm(uint8_t xmm, uint32_t imm)
+{
+	// mov eax, imm
+	Emit8(0xB8); Emit32(imm);
+	// movd xmm, eax
+	Emit8(0x66); Emit8(0x0F); Emit8(0x6E); Emit8(0xC0 | (xmm << 3));
+	// pshufd xmm, xmm, 0
+	Emit8(0x66); Emit8(0x0F); Emit8(0x70); Emit8(0xC0 | (xmm << 3) | xmm); Emit8(0x00);
+}
+
+void SPUJit::LoadPreferred(uint8_t gpr)
+{
+	// mov eax, [r12+gprs+gpr*16+12]
+	Emit8(0x41); Emit8(0x8B);
+	EmitR12(0, gprsOffs + gpr*16 + 12);
+}
+
+void SPUJit::ByteSwapXmm0()
+{
+	// pshufb xmm0, [rip+mask]
+	Emit8(0x66); Emit8(0x0F); Emit8(0x38); Emit8(0x00); Emit8(0x05);
+	Emit32((int32_t)(BSWAP_MASK_OFFS - (int64_t)(codePos + 4)));
+}
+
+void SPUJit::EmitLsAddress(const SpuBlock::Instr& instr)
+{
+	uint8_t ra = (instr.instr >> 7) & 0x7F;
+	uint8_t rb = (instr.instr >> 14) & 0x7F;
+
+	LoadPreferred(ra);
+	if (instr.handler == &SPU::lqd || instr.handler == &SPU::stqd)
+	{
+		int32_t i10 = (int32_t)(((instr.instr >> 14) & 0x3FF) << 22) >> 18;
+		// add eax, i10
+		Emit8(0x05); Emit32(i10);
+	}
+	else
+	{
+		// add eax, [r12+gprs+rb*16+12]
+		Emit8(0x41); Emit8(0x03);
+		EmitR12(0, gprsOffs + rb*16 + 12);
+	}
+	// and eax, 0x3FFF0 (local store wraps)
+	Emit8(0x25); Emit32(0x3FFF0);
+}
+
+void SPUJit::EmitStorePC(uint32_t pc)
+{
+	// mov dword [r12+pc], imm
+	Emit8(0x41); Emit8(0xC7);
+	EmitR12(0, pcOffs);
+	Emit32(pc);
+}
+
+bool SPUJit::EmitNative(const SpuBlock::Instr& instr)
+{
+	uint32_t op = instr.instr;
+	auto handler = instr.handler;
+
+	uint8_t rt = op & 0x7F;
+	uint8_t ra = (op >> 7) & 0x7F;
+	uint8_t rb = (op >> 14) & 0x7F;
+	int32_t i16 = (int16_t)((op >> 7) & 0xFFFF);
+	int32_t i10 = (int32_t)(((op >> 14) & 0x3FF) << 22) >> 22;
+
+	if (handler == &SPU::il)
+	{
+		SplatXmm(0, (uint32_t)i16);
+		StoreXmm(0, rt);
+	}
+	else if (handler == &SPU::ilhu)
+	{
+		SplatXmm(0, (uint32_t)i16 << 16);
+		StoreXmm(0, rt);
+	}
+	else if (handler == &SPU::ilh)
+	{
+		SplatXmm(0, ((uint32_t)i16 & 0xFFFF) * 0x10001);
+		StoreXmm(0, rt);
+	}
+	else if (handler == &SPU::ila)
+	{
+		SplatXmm(0, (op >> 7) & 0x3FFFF);
+		StoreXmm(0, rt);
+	}
+	else if (handler == &SPU::iohl)
+	{
+		LoadXmm(0, rt);
+		SplatXmm(1, (op >> 7) & 0xFFFF);
+		XmmOp(0xEB, 0, 1); // por
+		StoreXmm(0, rt);
+	}
+	else if (handler == &SPU::ori || handler == &SPU::ai || handler == &SPU::ceqi)
+	{
+		LoadXmm(0, ra);
+		SplatXmm(1, i10);
+		if (handler == &SPU::ori)
+			XmmOp(0xEB, 0, 1); // por
+		else if (handler == &SPU::ai)
+			XmmOp(0xFE, 0, 1); // paddd
+		else
+			XmmOp(0x76, 0, 1); // pcmpeqd
+		StoreXmm(0, rt);
+	}
+	else if (handler == &SPU::a)
+	{
+		LoadXmm(0, ra);
+		LoadXmm(1, rb);
+		XmmOp(0xFE, 0, 1); // paddd
+		StoreXmm(0, rt);
+	}
+	else if (handler == &SPU::sf)
+	{
+		LoadXmm(0, rb);
+		LoadXmm(1, ra);
+		XmmOp(0xFA, 0, 1); // psubd
+		StoreXmm(0, rt);
+	}
+	else if (handler == &SPU::shli)
+	{
+		LoadXmm(0, ra);
+		// pslld xmm0, i7
+		Emit8(0x66); Emit8(0x0F); Emit8(0x72); Emit8(0xF0); Emit8((op >> 14) & 0x3F);
+		StoreXmm(0, rt);
+	}
+	else if (handler == &SPU::selb)
+	{
+		uint8_t rc = op & 0x7F;
+		rt = (op >> 21) & 0x7F;
+
+		LoadXmm(0, rc);
+		LoadXmm(1, rb);
+		LoadXmm(2, ra);
+		XmmOp(0xDB, 1, 0); // pand xmm1, xmm0
+		XmmOp(0xDF, 0, 2); // pandn xmm0, xmm2
+		XmmOp(0xEB, 0, 1); // por
+		StoreXmm(0, rt);
+	}
+	else if (handler == &SPU::lqd || handler == &SPU::lqx)
+	{
+		EmitLsAddress(instr);
+		// movdqu xmm0, [r12+rax+ls]
+		Emit8(0xF3); Emit8(0x41); Emit8(0x0F); Emit8(0x6F); Emit8(0x84); Emit8(0x04); Emit32(lsOffs);
+		ByteSwapXmm0();
+		StoreXmm(0, rt);
+	}
+	else if (handler == &SPU::stqd || handler == &SPU::stqx)
+	{
+		EmitLsAddress(instr);
+		LoadXmm(0, rt);
+		ByteSwapXmm0();
+		// movdqu [r12+rax+ls], xmm0
+		Emit8(0xF3); Emit8(0x41); Emit8(0x0F); Emit8(0x7F); Emit8(0x84); Emit8(0x04); Emit32(lsOffs);
+
+		// Stores over recompiled code flush the SPU's block lookup before its next block
+		// mov ecx, eax; shr ecx, SPU_CODE_PAGE_SHIFT
+		Emit8(0x89); Emit8(0xC1);
+		Emit8(0xC1); Emit8(0xE9); Emit8(SPU_CODE_PAGE_SHIFT);
+		// cmp byte [r12+rcx+codePages], 0
+		Emit8(0x41); Emit8(0x80); Emit8(0xBC); Emit8(0x0C); Emit32(codePagesOffs); Emit8(0x00);
+		// je skip
+		Emit8(0x74); Emit8(0x09);
+		// mov byte [r12+flushBlocks], 1
+		Emit8(0x41); Emit8(0xC6);
+		EmitR12(0, flushOffs);
+		Emit8(0x01);
+	}
+	else
+		return false;
+
+	return true;
+}
+
+void SPUJit::Fallback(SPU* spu, const SpuBlock::Instr* instr)
+{
+	(spu->*instr->handler)(instr->instr);
+}
+
+void SPUJit::EmitFallback(uint32_t pc, const SpuBlock::Instr* instr)
+{
+	// Handlers expect pc to already point past the instruction
+	EmitStorePC(pc + 4);
+
+	// mov rdi, r12
+	Emit8(0x4C); Emit8(0x89); Emit8(0xE7);
+	// mov rsi, instr
+	Emit8(0x48); Emit8(0xBE); Emit64((uint64_t)instr);
+	// mov rax, Fallback
+	Emit8(0x48); Emit8(0xB8); Emit64((uint64_t)&SPUJit::Fallback);
+	// call rax
+	Emit8(0xFF); Emit8(0xD0);
+}
+
+void SPUJit::Compile(SPU* spu, SpuBlock* block)
+{
+	if (codePos + (block->instrs.size() + 1) * MAX_INSTR_SIZE > CODE_BUFFER_SIZE)
+		return;
+
+	gprsOffs = (uint8_t*)spu->gprs - (uint8_t*)spu;
+	pcOffs = (uint8_t*)&spu->pc - (uint8_t*)spu;
+	lsOffs = (uint8_t*)spu->localStore - (uint8_t*)spu;
+	codePagesOffs = (uint8_t*)spu->codePages - (uint8_t*)spu;
+	flushOffs = (uint8_t*)&spu->flushBlocks - (uint8_t*)spu;
+
+	uint8_t* start = code + codePos;
+
+	// void block(SPU* rdi)
+	// push r12 (also realigns the stack for calls)
+	Emit8(0x41); Emit8(0x54);
+	// mov r12, rdi
+	Emit8(0x49); Emit8(0x89); Emit8(0xFC);
+
+	bool pcWritten = false;
+	for (size_t i = 0; i < block->instrs.size(); i++)
+	{
+		uint32_t pc = block->addr + i*4;
+
+		if (EmitNative(block->instrs[i]))
+		{
+			pcWritten = false;
+			continue;
+		}
+
+		EmitFallback(pc, &block->instrs[i]);
+		pcWritten = true;
+	}
+
+	// A block ending on a fallback leaves pc to the handler (branches set their own target)
+	if (!pcWritten)
+		EmitStorePC(block->addr + block->instrs.size()*4);
+
+	// pop r12; ret
+	Emit8(0x41); Emit8(0x5C); Emit8(0xC3);
+
+	block->func = (void (*)(SPU*))start;
+}
+
+bool SPUJit::IsBlockEnd(SPU::InstrHandler handler)
+{
+	return handler == &SPU::br || handler == &SPU::brz || handler == &SPU::brnz || handler == &SPU::brsl
+		|| handler == &SPU::bi || handler == &SPU::bisl || handler == &SPU::stop || handler == &SPU::unknown;
+}
+
+const SpuBlock* SPUJit::GetBlock(SPU* spu, uint32_t addr)
+{
+	std::vector<uint32_t> instrs;
+	for (uint32_t pc = addr; pc < 256*1024 && instrs.size() < MAX_BLOCK_SIZE; pc += 4)
+	{
+		uint32_t instr = spu->Read32(pc);
+		instrs.push_back(instr);
+
+		if (IsBlockEnd(spu->Decode(instr)))
+			break;
+	}
+
+	// FNV-1a over the address and code
+	uint64_t hash = 0xcbf29ce484222325ULL ^ addr;
+	for (auto instr : instrs)
+		hash = (hash ^ instr) * 0x100000001b3ULL;
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	auto it = blocks.find(hash);
+	if (it != blocks.end() && it->second->addr == addr && it->second->code == instrs)
+		return it->second;
+
+	SpuBlock* block = new SpuBlock();
+	block->addr = addr;
+	block->code = std::move(instrs);
+	for (auto instr : block->code)
+		block->instrs.push_back({spu->Decode(instr), instr});
+
+	Compile(spu, block);
+
+	// Blocks are never freed, generated code can still reference one that's been replaced here
+	blocks[hash] = block;
+	return block;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "SPU.h"
+
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+struct SpuBlock
+{
+	struct Instr
+	{
+		SPU::InstrHandler handler;
+		uint32_t instr;
+	};
+
+	uint32_t addr;
+	std::vector<uint32_t> code; // Raw instructions, compared against local store when the hash matches
+	std::vector<Instr> instrs;
+	void (*func)(SPU* spu) = nullptr; // nullptr once the code buffer is full, the block gets interpreted instead
+};
+
+// Translates SPU blocks into SSE code, the register file and local store are addressed through the SPU pointer
+// Blocks are shared between all SPUs and keyed on their local store address plus a hash of their code,
+// so reloading the same image (or loading it on another SPU) reuses whatever's already compiled
+class SPUJit
+{
+public:
+	SPUJit();
+	~SPUJit();
+
+	const SpuBlock* GetBlock(SPU* spu, uint32_t addr);
+private:
+	static void Fallback(SPU* spu, const SpuBlock::Instr* instr);
+	static bool IsBlockEnd(SPU::InstrHandler handler);
+
+	void Compile(SPU* spu, SpuBlock* block);
+	bool EmitNative(const SpuBlock::Instr& instr);
+	void EmitFallback(uint32_t pc, const SpuBlock::Instr* instr);
+	void EmitStorePC(uint32_t pc);
+
+	void Emit8(uint8_t data) {code[codePos++] = data;}
+	void Emit32(uint32_t data);
+	void Emit64(uint64_t data);
+
+	// [r12+disp32] operand, r12 holds the SPU pointer
+	void EmitR12(uint8_t reg, int32_t disp);
+	void LoadXmm(uint8_t xmm, uint8_t gpr);
+	void StoreXmm(uint8_t xmm, uint8_t gpr);
+	void XmmOp(uint8_t op, uint8_t dst, uint8_t src);
+	void SplatXmm(uint8_t xmm, uint32_t imm);
+	void LoadPreferred(uint8_t gpr); // eax = preferred slot of gpr
+	void ByteSwapXmm0();
+	void EmitLsAddress(const SpuBlock::Instr& instr); // eax = local store address for a quadword load/store
+
+	std::mutex lock;
+	std::unordered_map<uint64_t, SpuBlock*> blocks;
+
+	uint8_t* code;
+	size_t codePos = 0;
+
+	// Offsets of the SPU members the generated code touches, the same for every SPU
+	int32_t gprsOffs, pcOffs, lsOffs, codePagesOffs, flushOffs;
+};
+
+extern SPUJit* g_spuJit;
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+inline void FutexWait(std::atomic<uint32_t>* word, uint32_t expected)
+{
+	syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+inline void FutexWake(std::atomic<uint32_t>* word)
+{
+	syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+}
+
+// Bounded single-producer single-consumer ring for the SPU channels
+// head/tail double as futex words, so either side can sleep until the other makes progress
+template<typename T, uint32_t N>
+class SpscRing
+{
+public:
+	bool Push(const T& val)
+	{
+		uint32_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == N)
+			return false;
+
+		data[t % N] = val;
+		tail.store(t + 1, std::memory_order_seq_cst);
+		if (waiting.load(std::memory_order_seq_cst))
+			FutexWake(&tail);
+		return true;
+	}
+
+	bool Pop(T& val)
+	{
+		uint32_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+			return false;
+
+		val = data[h % N];
+		head.store(h + 1, std::memory_order_seq_cst);
+		if (waiting.load(std::memory_order_seq_cst))
+			FutexWake(&head);
+		return true;
+	}
+
+	// Consumer side, sleeps until there's something to pop
+	void WaitNotEmpty()
+	{
+		uint32_t t;
+		while ((t = tail.load(std::memory_order_acquire)) == head.load(std::memory_order_relaxed))
+		{
+			waiting.store(1, std::memory_order_seq_cst);
+			if (tail.load(std::memory_order_seq_cst) == t)
+				FutexWait(&tail, t);
+			waiting.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	// Producer side, sleeps until there's room to push
+	void WaitNotFull()
+	{
+		uint32_t h;
+		while (tail.load(std::memory_order_relaxed) - (h = head.load(std::memory_order_acquire)) == N)
+		{
+			waiting.store(1, std::memory_order_seq_cst);
+			if (head.load(std::memory_order_seq_cst) == h)
+				FutexWait(&head, h);
+			waiting.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	uint32_t Size() const {return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);}
+	uint32_t Free() const {return N - Size();}
+private:
+	std::atomic<uint32_t> head{0};
+	std::atomic<uint32_t> tail{0};
+	std::atomic<uint32_t> waiting{0};
+	T data[N];
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <kernel/types.h>
+#include <unordered_map>
+
+class KernelObject
+{
+public:
+    KernelObject()
+    {
+        id = kernel_id++;
+    }
+
+    virtual ~KernelObject() = default;
+
+    enum Type
+    {
+        KERNEL_OBJECT_NONE = 0,
+        KERNEL_OBJECT_KEVENTQUEUE,
+        KERNEL_OBJECT_KEVENTPORT,
+        KERNEL_OBJECT_KEVENTFLAG,
+        KERNEL_OBJECT_LWMUTEX,
+        KERNEL_OBJECT_LWCOND,
+    } type;
+
+    uint32_t id;
+};
+
+// Guarded by kernelLock, like everything else HLE calls and syscalls touch
+extern std::unordered_map<uint32_t, KernelObject*> kObjects;
+
+// Returns nullptr if there's no object with that ID, or it isn't a T
+template<typename T>
+T* GetKernelObject(uint32_t id, KernelObject::Type type)
+{
+    auto it = kObjects.find(id);
+    if (it == kObjects.end() || it->second->type != type)
+        return nullptr;
+    return static_cast<T*>(it->second);
+}
@@ -6,18 +6,274 @@
 #include <stdexcept>
 #include <cstring>
 #include <fstream>
+#include <algorithm>
+#include <cassert>
 #include <rsx/rsx.h>
 #include <kernel/Modules/CellGcm.h>
 #include <cpu/SPU.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <immintrin.h>
+#include <logging.h>
 
-#define PAGE_SIZE (64*1024)
+// Guest addresses are offsets into one 4 GiB reservation, blocks are made accessible as they're created
+#define ADDRESS_SPACE_SIZE 0x100000000ULL
+
+MemoryManager* fastmem_manager;
+
+// MMIO accesses fault, get their host instruction decoded, and are emulated right in the handler
+// The page is never opened up, so a second worker touching it at the same time just faults and gets emulated too
+// Only the plain moves the compiler emits for MemoryManager::Read*/Write* are understood
+struct HostAccess
+{
+    int size; // Bytes of memory touched
+    bool write;
+    bool swap; // movbe
+    int destSize; // Register bytes a load writes, wider than size for movzx
+    int reg; // gregs index, -1 for an immediate store
+    int shift; // 8 for ah/ch/dh/bh
+    uint64_t imm;
+    int length;
+};
+
+static const int gregIndex[16] =
+{
+    REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+    REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15,
+};
+
+static bool DecodeAccess(const uint8_t* ip, HostAccess& acc)
+{
+    const uint8_t* p = ip;
+    bool opsize = false;
+
+    for (;; p++)
+    {
+        if (*p == 0x66)
+            opsize = true;
+        else if (*p != 0x67 && *p != 0x2E && *p != 0x3E && *p != 0x26 && *p != 0x36 && *p != 0x64 && *p != 0x65)
+            break;
+    }
+
+    uint8_t rex = (*p & 0xF0) == 0x40 ? *p++ : 0;
+    int wide = (rex & 8) ? 8 : opsize ? 2 : 4;
+    int immSize = 0;
+
+    acc.swap = false;
+    acc.reg = 0;
+    acc.destSize = 0;
+    switch (*p++)
+    {
+    case 0x88: acc.write = true; acc.size = 1; break;
+    case 0x89: acc.write = true; acc.size = wide; break;
+    case 0x8A: acc.write = false; acc.size = 1; break;
+    case 0x8B: acc.write = false; acc.size = wide; break;
+    case 0xC6: acc.write = true; acc.size = 1; acc.reg = -1; immSize = 1; break;
+    case 0xC7: acc.write = true; acc.size = wide; acc.reg = -1; immSize = wide == 2 ? 2 : 4; break;
+    case 0x0F:
+        switch (*p++)
+        {
+        case 0xB6: acc.write = false; acc.size = 1; acc.destSize = wide; break;
+        case 0xB7: acc.write = false; acc.size = 2; acc.destSize = wide; break;
+        case 0x38:
+            if (*p != 0xF0 && *p != 0xF1)
+                return false;
+            acc.write = *p++ == 0xF1;
+            acc.size = wide;
+            acc.swap = true;
+            break;
+        default:
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+    if (!acc.destSize)
+        acc.destSize = acc.size;
+
+    uint8_t modrm = *p++;
+    int mod = modrm >> 6;
+    int regField = ((modrm >> 3) & 7) | ((rex & 4) << 1);
+    int rm = modrm & 7;
+
+    if (mod == 3)
+        return false;
+    if (rm == 4 && (*p++ & 7) == 5 && mod == 0)
+        p += 4;
+    else if (rm == 5 && mod == 0)
+        p += 4;
+    p += mod == 1 ? 1 : mod == 2 ? 4 : 0;
+
+    if (acc.reg < 0)
+    {
+        acc.imm = 0;
+        memcpy(&acc.imm, p, immSize);
+        // imm32 is sign extended into a 64-bit store
+        if (acc.size == 8)
+            acc.imm = (int64_t)(int32_t)acc.imm;
+        p += immSize;
+    }
+    else
+    {
+        acc.shift = 0;
+        // Without a REX prefix, byte registers 4-7 are the high halves of a-d
+        if (acc.size == 1 && acc.destSize == 1 && !rex && regField >= 4)
+        {
+            regField -= 4;
+            acc.shift = 8;
+        }
+        acc.reg = gregIndex[regField];
+    }
+
+    acc.length = p - ip;
+    return true;
+}
+
+// Moves the emulated access between the memory bytes and the host register it names
+static void StoreBytes(const HostAccess& acc, ucontext_t* uc, uint8_t* bytes)
+{
+    uint64_t value = acc.reg < 0 ? acc.imm : (uint64_t)uc->uc_mcontext.gregs[acc.reg] >> acc.shift;
+    if (acc.swap)
+        value = __bswap_64(value) >> (64 - acc.size * 8);
+    memcpy(bytes, &value, acc.size);
+}
+
+static void LoadBytes(const HostAccess& acc, ucontext_t* uc, const uint8_t* bytes)
+{
+    uint64_t value = 0;
+    memcpy(&value, bytes, acc.size);
+    if (acc.swap)
+        value = __bswap_64(value) >> (64 - acc.size * 8);
+
+    uint64_t& reg = (uint64_t&)uc->uc_mcontext.gregs[acc.reg];
+    switch (acc.destSize)
+    {
+    case 1: reg = (reg & ~(0xFFULL << acc.shift)) | (value << acc.shift); break;
+    case 2: reg = (reg & ~0xFFFFULL) | value; break;
+    default: reg = value; break; // 32-bit moves zero the upper half
+    }
+}
+
+static bool EmulateSpuAccess(MemoryManager* m, uint32_t addr, const HostAccess& acc, uint8_t* bytes)
+{
+    auto spu = g_spus[(addr >> 20) & 0xF];
+    uint32_t reg = addr & 0x1FFFF;
+
+    if (acc.write)
+    {
+        LOG(MEM, TRACE, "Write to problem storage register 0x%04x on SPU %d\n", reg, (addr >> 20) & 0xF);
+        if (acc.size != 4 || (reg & 3))
+            return false;
+        uint32_t data;
+        memcpy(&data, bytes, 4);
+        spu->WriteProblemStorage(reg, __bswap_32(data));
+    }
+    else
+    {
+        LOG(MEM, TRACE, "Read from problem storage register 0x%04x on SPU %d\n", reg, (addr >> 20) & 0xF);
+        if ((reg & 3) + acc.size > 4)
+            return false;
+        uint32_t data = __bswap_32(spu->ReadProblemStorage(reg & ~3));
+        memcpy(bytes, (uint8_t*)&data + (reg & 3), acc.size);
+    }
+    return true;
+}
+
+void FastmemFault(int, siginfo_t* info, void* ctx)
+{
+    ucontext_t* uc = (ucontext_t*)ctx;
+    MemoryManager* m = fastmem_manager;
+    uint8_t* host = (uint8_t*)info->si_addr;
+
+    if (host < m->base || host >= m->base + ADDRESS_SPACE_SIZE)
+    {
+        LOG(MEM, ERROR, "Segmentation fault at host address %p\n", host);
+        m->DumpRam();
+        exit(1);
+    }
+
+    uint32_t addr = host - m->base;
+    bool write = uc->uc_mcontext.gregs[REG_ERR] & 2;
+    uint32_t page = addr / HOST_PAGE_SIZE;
+    bool spuRegs = addr >= 0xE0000000 && addr < 0xE0600000 && (addr & 0xF0000);
+    bool rsxControl = write && m->rsx_control_addr && page == m->rsx_control_addr / HOST_PAGE_SIZE;
+
+    if (addr >= 0xE0000000 && addr < 0xE0600000 && !spuRegs)
+        LOG(MEM, ERROR, "Access to SPU %d local store\n", (addr >> 20) & 0xF);
+    else if (write && !rsxControl && (m->UnwatchPage(page) || m->IsMapped(addr)))
+    {
+        // The page is writable again, so just let the access retry
+        // If another thread's write unwatched it first, it was already writable by the time UnwatchPage took the lock
+        return;
+    }
+    else if (spuRegs || rsxControl)
+    {
+        HostAccess acc;
+        uint8_t* ip = (uint8_t*)uc->uc_mcontext.gregs[REG_RIP];
+        if (!DecodeAccess(ip, acc) || acc.write != write)
+        {
+            LOG(MEM, ERROR, "Error: can't emulate MMIO access to 0x%08x from host instruction %02x %02x %02x %02x %02x\n", addr, ip[0], ip[1], ip[2], ip[3], ip[4]);
+            exit(1);
+        }
+
+        uint8_t bytes[8];
+        if (write)
+            StoreBytes(acc, uc, bytes);
+
+        // Nothing can be thrown out of here, so errors are fatal like any other bad access
+        try
+        {
+            if (rsxControl)
+            {
+                // Goes through the writable alias, the FIFO thread's own get/ref updates land here too, only put wakes it
+                memcpy(m->rsx_control_alias + (addr & (HOST_PAGE_SIZE-1)), bytes, acc.size);
+                if (addr < m->rsx_control_addr + 4 && addr + acc.size > m->rsx_control_addr)
+                    rsx->Kick();
+            }
+            else if (!EmulateSpuAccess(m, addr, acc, bytes))
+            {
+                LOG(MEM, ERROR, "Error: unsupported %d byte access to problem storage at 0x%08x\n", acc.size, addr);
+                exit(1);
+            }
+        }
+        catch (std::exception& e)
+        {
+            LOG(MEM, ERROR, "Received error: %s\n", e.what());
+            exit(1);
+        }
+
+        if (!write)
+            LoadBytes(acc, uc, bytes);
+        uc->uc_mcontext.gregs[REG_RIP] += acc.length;
+        return;
+    }
+
+    LOG(MEM, ERROR, "Error: %s unknown addr 0x%08x\n", write ? "Write to" : "Read from", addr);
+    m->DumpRam();
+    exit(1);
+}
 
 MemoryManager::MemoryManager()
 {
-    pages = new uint8_t*[0x100000000ULL / PAGE_SIZE];
+    base = (uint8_t*)mmap(NULL, ADDRESS_SPACE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
 
-    memset(pages, 0, (0x100000000ULL / PAGE_SIZE) * sizeof(uint8_t*));
-    memset(pages, 0, (0x100000000ULL / PAGE_SIZE) * sizeof(uint8_t*));
+    if (base == MAP_FAILED)
+    {
+        LOG(MEM, ERROR, "ERROR: Couldn't reserve the guest address space\n");
+        exit(1);
+    }
+
+    fastmem_manager = this;
+
+    reservations = new std::atomic<uint64_t>[RESERVATION_SLOTS]();
+    pageWrites = new std::atomic<uint32_t>[GUEST_PAGE_COUNT]();
+    watchedPages = new std::atomic<uint8_t>[GUEST_PAGE_COUNT]();
+
+    struct sigaction sa = {};
+    sa.sa_flags = SA_SIGINFO;
+    sa.sa_sigaction = FastmemFault;
+    sigaction(SIGSEGV, &sa, nullptr);
 
     stack = new MemoryBlock(0xD0000000ULL, 0xE0000000ULL, this);
     main_mem = new MemoryBlock(0x00010000, 0x2FFF0000, this);
@@ -28,9 +284,13 @@ MemoryManager::MemoryManager()
 
 MemoryManager::~MemoryManager()
 {
-    printf("[Mem]: Unmapping memory...\n");
+    LOG(MEM, INFO, "[Mem]: Unmapping memory...\n");
+    PrintMemoryUsage();
     DumpRam();
-    delete[] pages;
+    munmap(base, ADDRESS_SPACE_SIZE);
+    delete[] reservations;
+    delete[] pageWrites;
+    delete[] watchedPages;
 }
 
 void MemoryManager::MarkMemoryRegion(uint64_t, uint64_t, int)
@@ -48,295 +308,314 @@ void MemoryManager::MarkMemoryRegion(uint64_t, uint64_t, int)
     // }
 }
 
-void MemoryManager::MapMemory(uint64_t start, uint64_t end, uint8_t *ptr)
+uint8_t* MemoryManager::MapMemory(uint64_t start, uint64_t end)
 {
-    printf("Mapping memory from 0x%08lx -> 0x%08lx\n", start, end);
-    for (size_t i = 0; i < (end-start); i += PAGE_SIZE)
+    LOG(MEM, INFO, "Mapping memory from 0x%08lx -> 0x%08lx\n", start, end);
+    if (mprotect(base + start, end - start, PROT_READ | PROT_WRITE) < 0)
     {
-        pages[(i+start) / PAGE_SIZE] = (ptr + i);
+        LOG(MEM, ERROR, "ERROR: Couldn't map 0x%08lx -> 0x%08lx\n", start, end);
+        exit(1);
     }
+    return base + start;
 }
 
 void MemoryManager::SetRSXControlReg(uint32_t addr)
 {
-    rsx_control_addr = addr;
-}
+    // Every store to the page faults, anything else living there would be emulated access by access
+    uint64_t pageStart = addr & ~(HOST_PAGE_SIZE-1);
+    for (MemoryBlock* block : {main_mem, stack, prx_mem, RSXCmdMem, RSXFBMem})
+    {
+        if (pageStart >= block->GetStart() && pageStart - block->GetStart() < block->GetSize()
+            && block->CountAllocations(pageStart, pageStart + HOST_PAGE_SIZE) > 1)
+        {
+            LOG(MEM, ERROR, "RSX control register 0x%08x shares its page with other allocations\n", addr);
+            throw std::runtime_error("RSX control register page isn't exclusive");
+        }
+    }
 
-uint8_t* MemoryManager::GetRawPtr(uint64_t offs)
-{
-    return pages[offs / PAGE_SIZE] + (offs % PAGE_SIZE);
-}
+    if (rsx_control_addr)
+    {
+        // Back to plain anonymous memory
+        uint8_t* page = base + (rsx_control_addr & ~(HOST_PAGE_SIZE-1));
+        mmap(page, HOST_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        memcpy(page, rsx_control_alias, HOST_PAGE_SIZE);
+        munmap(rsx_control_alias, HOST_PAGE_SIZE);
+    }
 
-void MemoryManager::DumpRam()
-{
-    std::ofstream out("mem.bin");
-    out.write((char*)main_mem->data, 0x2FFE0000);
-    out.close();
-    
-    out.open("stack.bin");
-    out.write((char*)stack->data, 0x10000000);
-    out.close();
+    rsx_control_addr = addr;
 
-    out.open("rsx_cmd.bin");
-    out.write((char*)main_mem->data+0x00200000, 0x7000);
-    out.close();
+    // Writes to put need to kick the RSX, so the page they live in traps on write
+    // The fault handler can't open it up without racing other threads, so it's backed by a memfd with a second, writable mapping
+    uint8_t* page = base + (addr & ~(HOST_PAGE_SIZE-1));
+    int fd = memfd_create("rsx_control", 0);
+    if (fd < 0 || ftruncate(fd, HOST_PAGE_SIZE) < 0 || write(fd, page, HOST_PAGE_SIZE) != HOST_PAGE_SIZE)
+    {
+        LOG(MEM, ERROR, "ERROR: Couldn't create the RSX control page\n");
+        exit(1);
+    }
 
-    out.open("rsxfbmem.bin");
-    out.write((char*)RSXFBMem->data, 0x10000000);
-    out.close();
+    rsx_control_alias = (uint8_t*)mmap(NULL, HOST_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (rsx_control_alias == MAP_FAILED || mmap(page, HOST_PAGE_SIZE, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        LOG(MEM, ERROR, "ERROR: Couldn't map the RSX control page\n");
+        exit(1);
+    }
+    close(fd);
+
+    watchedPages[addr / HOST_PAGE_SIZE].store(0, std::memory_order_relaxed);
 }
 
-void MemoryManager::Write8(uint32_t addr, uint8_t data, bool slow)
+bool MemoryManager::IsMapped(uint32_t addr)
 {
-    if (!slow)
+    for (MemoryBlock* block : {main_mem, stack, prx_mem, RSXCmdMem, RSXFBMem})
     {
-        auto page = addr / PAGE_SIZE;
-        auto page_offs = addr % PAGE_SIZE;
-
-        if (!pages[page])
-        {
-            
-            Write8(addr, data, true);
-        }
-        
-        pages[page][page_offs] = data;
-    }
-    else
-    {
-        printf("Error: Write 0x%04x to unknown addr 0x%08x", data, addr);
-        throw std::runtime_error("Error: Write to unknown addr");
+        if (addr >= block->GetStart() && addr - block->GetStart() < block->GetSize())
+            return true;
     }
+    return false;
 }
 
-void MemoryManager::Write16(uint32_t addr, uint16_t data, bool slow)
+void MemoryManager::WatchWrites(uint32_t addr, uint32_t size)
 {
-    if (!slow)
-    {
-        auto page = addr / PAGE_SIZE;
-        auto page_offs = addr % PAGE_SIZE;
+    if (!size)
+        return;
 
-        if (!pages[page])
-        {
-            
-            Write16(addr, data, true);
-        }
+    while (watchLock.test_and_set(std::memory_order_acquire));
 
-        *(uint16_t*)&pages[page][page_offs] = __bswap_16(data);
-    }
-    else
+    for (uint64_t page = addr / HOST_PAGE_SIZE; page <= ((uint64_t)addr + size - 1) / HOST_PAGE_SIZE; page++)
     {
-        printf("Error: Write16 0x%04x to unknown addr 0x%08x", data, addr);
-        throw std::runtime_error("Error: Write16 to unknown addr");
+        // The control register page already traps writes for the RSX
+        if (rsx_control_addr && page == rsx_control_addr / HOST_PAGE_SIZE)
+            continue;
+
+        if (!watchedPages[page].exchange(1, std::memory_order_relaxed))
+            mprotect(base + page * HOST_PAGE_SIZE, HOST_PAGE_SIZE, PROT_READ);
     }
+
+    watchLock.clear(std::memory_order_release);
 }
 
-void MemoryManager::Write32(uint32_t addr, uint32_t data, bool slow)
+bool MemoryManager::UnwatchPage(uint32_t page)
 {
-    if (!slow)
-    {
-        auto page = addr / PAGE_SIZE;
-        auto page_offs = addr % PAGE_SIZE;
+    while (watchLock.test_and_set(std::memory_order_acquire));
 
-        if (!pages[page])
-        {
-            
-            Write32(addr, data, true);
-			return;
-        }
-
-        *(uint32_t*)&pages[page][page_offs] = __bswap_32(data);
-    }
-    else
+    bool watched = watchedPages[page].exchange(0, std::memory_order_relaxed);
+    if (watched)
     {
-		if (addr >= 0xE0000000 && addr < 0xE0600000)
-		{
-			auto spu = (addr >> 20) & 0xF;
-			assert(spu < 6);
-
-			if (addr & 0xF0000)
-			{
-				printf("Write to problem storage register 0x%04x on SPU %d\n", addr & 0xFFFF, spu);
-				g_spus[spu]->WriteProblemStorage(addr & 0x1FFFF, data);
-				return;
-			}
-			else
-			{
-				printf("Write to SPU %d local store\n", spu);
-			}
-		}
-        
-        printf("Error: Write32 0x%04x to unknown addr 0x%08x", data, addr);
-        throw std::runtime_error("Error: Write32 to unknown addr");
-    }
-    
-    if (rsx_control_addr && addr == rsx_control_addr)
-    {
-        uint32_t get = Read32(addr+4);
-        if (data != get)
-            rsx->DoCommands(GetRawPtr(CellGcm::GetIOAddres() + get), data - get);
-        return;
+        pageWrites[page].fetch_add(1, std::memory_order_release);
+        mprotect(base + (uint64_t)page * HOST_PAGE_SIZE, HOST_PAGE_SIZE, PROT_READ | PROT_WRITE);
     }
+
+    watchLock.clear(std::memory_order_release);
+    return watched;
 }
 
-void MemoryManager::Write64(uint32_t addr, uint64_t data, bool slow)
+uint64_t MemoryManager::ReserveLine(uint32_t addr)
 {
-    if (!slow)
-    {
-        auto page = addr / PAGE_SIZE;
-        auto page_offs = addr % PAGE_SIZE;
+    auto& slot = ReservationSlot(addr);
 
-        if (!pages[page])
-        {
-            
-            Write64(addr, data, true);
-        }
-
-        *(uint64_t*)&pages[page][page_offs] = __bswap_64(data);
-    }
-    else
-    {
-        printf("Error: Write64 0x%08lx to unknown addr 0x%08x", data, addr);
-        throw std::runtime_error("Error: Write64 to unknown addr");
-    }
+    uint64_t version;
+    while ((version = slot.load(std::memory_order_acquire)) & 1)
+        _mm_pause();
+    return version;
 }
 
-uint8_t MemoryManager::Read8(uint32_t addr, bool slow)
+bool MemoryManager::LockLine(uint32_t addr, uint64_t version)
 {
-    if (!slow)
-    {
-        auto page = addr / PAGE_SIZE;
-        auto page_offs = addr % PAGE_SIZE;
+    return ReservationSlot(addr).compare_exchange_strong(version, version | 1, std::memory_order_acquire);
+}
 
-        if (!pages[page])
-        {
-            
-            return Read8(addr, true);
-        }
+void MemoryManager::LockLine(uint32_t addr)
+{
+    auto& slot = ReservationSlot(addr);
 
-        return pages[page][page_offs];
-    }
-    else
+    uint64_t version = slot.load(std::memory_order_relaxed);
+    while ((version & 1) || !slot.compare_exchange_weak(version, version | 1, std::memory_order_acquire))
     {
-        printf("Error: Read8 from unknown addr 0x%08x\n", addr);
-        throw std::runtime_error("Error: Read8 from unknown addr");
+        _mm_pause();
+        version = slot.load(std::memory_order_relaxed);
     }
 }
 
-uint16_t MemoryManager::Read16(uint32_t addr, bool slow)
+void MemoryManager::UnlockLine(uint32_t addr, bool stored)
 {
-    if (!slow)
-    {
-        auto page = addr / PAGE_SIZE;
-        auto page_offs = addr % PAGE_SIZE;
+    auto& slot = ReservationSlot(addr);
 
-        if (!pages[page])
-        {
-            
-            return Read16(addr, true);
-        }
+    // Bumping the version kills every other reservation on the line
+    uint64_t version = slot.load(std::memory_order_relaxed) & ~1ULL;
+    slot.store(stored ? version + 2 : version, std::memory_order_release);
+}
 
-        return __bswap_16(*(uint16_t*)&pages[page][page_offs]);
-    }
-    else
-    {
-        printf("Error: Read16 from unknown addr 0x%08x", addr);
-        throw std::runtime_error("Error: Read16 from unknown addr");
-    }
+// Plain stores don't touch the version, so the store itself is a CAS against the value the reservation saw
+bool MemoryManager::StoreConditional32(uint32_t addr, uint64_t version, uint32_t expected, uint32_t data)
+{
+    if (!LockLine(addr, version))
+        return false;
+
+    expected = __bswap_32(expected);
+    bool stored = __atomic_compare_exchange_n((uint32_t*)&base[addr], &expected, __bswap_32(data), false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    UnlockLine(addr, stored);
+    return stored;
 }
 
-uint32_t MemoryManager::Read32(uint32_t addr, bool slow)
+bool MemoryManager::StoreConditional64(uint32_t addr, uint64_t version, uint64_t expected, uint64_t data)
 {
-    if (!slow)
-    {
-        auto page = addr / PAGE_SIZE;
-        auto page_offs = addr % PAGE_SIZE;
+    if (!LockLine(addr, version))
+        return false;
 
-        if (!pages[page])
-        {
-            
-            return Read32(addr, true);
-        }
+    expected = __bswap_64(expected);
+    bool stored = __atomic_compare_exchange_n((uint64_t*)&base[addr], &expected, __bswap_64(data), false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    UnlockLine(addr, stored);
+    return stored;
+}
 
-        return __bswap_32(*(uint32_t*)&pages[page][page_offs]);
-    }
-    else
+void MemoryManager::PrintMemoryUsage()
+{
+    struct
+    {
+        const char* name;
+        MemoryBlock* block;
+    } blocks[] =
+    {
+        {"main_mem", main_mem},
+        {"stack", stack},
+        {"prx_mem", prx_mem},
+        {"RSXCmdMem", RSXCmdMem},
+        {"RSXFBMem", RSXFBMem},
+    };
+
+    uint64_t totalResident = 0, totalReserved = 0;
+    for (auto& b : blocks)
     {
-		if (addr >= 0xE0000000 && addr < 0xE0600000)
-		{
-			auto spu = (addr >> 20) & 0xF;
-			assert(spu < 6);
-
-			if (addr & 0xF0000)
-			{
-				printf("Read from problem storage register 0x%04x on SPU %d\n", addr & 0xFFFF, spu);
-				return g_spus[spu]->ReadProblemStorage(addr & 0xFFFF);
-			}
-			else
-			{
-				printf("Read from SPU %d local store\n", spu);
-			}
-		}
-        
-        printf("Error: Read from unknown addr 0x%08x", addr);
-        throw std::runtime_error("Error: Read32 from unknown addr");
+        uint64_t resident = b.block->GetResident();
+        printf("[Mem]: %-10s 0x%08lx -> 0x%08lx: %8ld KiB resident / %8ld KiB reserved\n", b.name, b.block->GetStart(), b.block->GetStart() + b.block->GetSize(), resident / 1024, b.block->GetSize() / 1024);
+        totalResident += resident;
+        totalReserved += b.block->GetSize();
     }
+    printf("[Mem]: total %ld KiB resident / %ld KiB reserved\n", totalResident / 1024, totalReserved / 1024);
 }
 
-uint64_t MemoryManager::Read64(uint32_t addr, bool slow)
+void MemoryManager::DumpRam()
 {
-    if (!slow)
-    {
-        auto page = addr / PAGE_SIZE;
-        auto page_offs = addr % PAGE_SIZE;
+    std::ofstream out("mem.bin");
+    out.write((char*)main_mem->data, 0x2FFE0000);
+    out.close();
+    
+    out.open("stack.bin");
+    out.write((char*)stack->data, 0x10000000);
+    out.close();
 
-        if (!pages[page])
-        {
-            
-            return Read64(addr, true);
-        }
+    out.open("rsx_cmd.bin");
+    out.write((char*)main_mem->data+0x00200000, 0x7000);
+    out.close();
 
-        return __bswap_64(*(uint64_t*)&pages[page][page_offs]);
-    }
-    else
-    {
-        printf("Unmapped addr 0x%08x!\n", addr);
-        throw std::runtime_error("Error: Read64 from unknown addr");
-    }
+    out.open("rsxfbmem.bin");
+    out.write((char*)RSXFBMem->data, 0x10000000);
+    out.close();
 }
 
 MemoryBlock::MemoryBlock(uint64_t start, uint64_t end, MemoryManager* manager, bool map)
 {
     begin = start;
     len = (end - start);
-    data = new uint8_t[len];
     if (map)
-        manager->MapMemory(start, end, data);
+        data = manager->MapMemory(start, end);
+    else
+        data = (uint8_t*)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (data == MAP_FAILED)
+    {
+        LOG(MEM, ERROR, "ERROR: Couldn't map memory block 0x%08lx -> 0x%08lx\n", start, end);
+        exit(1);
+    }
+
+    AddFree(begin, len);
 }
 
-uint64_t MemoryBlock::Alloc(uint64_t size)
+uint64_t MemoryBlock::GetResident() const
 {
-    for (uint32_t addr = begin; addr < (begin+len) - size;)
+    std::vector<unsigned char> vec((len + HOST_PAGE_SIZE - 1) / HOST_PAGE_SIZE);
+    if (mincore(data, len, vec.data()) < 0)
+        return 0;
+
+    uint64_t resident = 0;
+    for (auto page : vec)
+        if (page & 1)
+            resident += HOST_PAGE_SIZE;
+    return resident;
+}
+
+#define ALLOC_GRANULE 16
+
+void MemoryBlock::AddFree(uint64_t addr, uint64_t size)
+{
+    freeByAddr[addr] = size;
+    freeBySize.insert({size, addr});
+}
+
+void MemoryBlock::RemoveFree(std::map<uint64_t, uint64_t>::iterator it)
+{
+    freeBySize.erase({it->second, it->first});
+    freeByAddr.erase(it);
+}
+
+// Carves [addr, addr+size) out of the free ranges, handing back whatever is left on either side
+void MemoryBlock::Take(uint64_t addr, uint64_t size)
+{
+    uint64_t end = addr + size;
+
+    auto it = freeByAddr.upper_bound(addr);
+    if (it != freeByAddr.begin())
+        --it;
+
+    while (it != freeByAddr.end() && it->first < end)
     {
-        bool is_good_addr = true;
+        uint64_t freeStart = it->first;
+        uint64_t freeEnd = it->first + it->second;
+        auto next = std::next(it);
 
-        for (uint32_t i = 0; i < used_mem.size(); i++)
+        if (freeEnd > addr)
         {
-            if ((addr >= used_mem[i].addr && addr < used_mem[i].end)
-                || (used_mem[i].addr >= addr && used_mem[i].addr < addr + size))
-            {
-                is_good_addr = false;
-                addr = used_mem[i].end;
-                break;
-            }
+            RemoveFree(it);
+            if (freeStart < addr)
+                AddFree(freeStart, addr - freeStart);
+            if (freeEnd > end)
+                AddFree(end, freeEnd - end);
+            usedBytes += std::min(freeEnd, end) - std::max(freeStart, addr);
         }
 
-        if (!is_good_addr) continue;
+        it = next;
+    }
 
-        MarkUsed(addr, size);
+    highWater = std::max(highWater, usedBytes);
+}
 
+uint64_t MemoryBlock::Alloc(uint64_t size, uint64_t align)
+{
+    size = std::max<uint64_t>((size + ALLOC_GRANULE - 1) & ~(uint64_t)(ALLOC_GRANULE - 1), ALLOC_GRANULE);
+    align = std::max<uint64_t>(align, ALLOC_GRANULE);
+
+    auto aligned = [align](uint64_t addr) {return (addr + align - 1) & ~(align - 1);};
+    auto fits = [&](const std::pair<uint64_t, uint64_t>& range) {return aligned(range.second) + size <= range.second + range.first;};
+
+    // Free ranges normally start on a granule, so any range of size + align - ALLOC_GRANULE bytes fits once aligned.
+    // The smallest range that's big enough is tried first, it fits whenever it happens to be aligned already
+    auto it = freeBySize.lower_bound({size, 0});
+    if (it != freeBySize.end() && !fits(*it))
+        it = freeBySize.lower_bound({size + align - ALLOC_GRANULE, 0});
+    // Only when that misses (nothing that large is left, or MarkUsed left an unaligned range) is every range searched
+    if (it == freeBySize.end() || !fits(*it))
+        it = std::find_if(freeBySize.lower_bound({size, 0}), freeBySize.end(), fits);
+
+    if (it != freeBySize.end())
+    {
+        uint64_t addr = aligned(it->second);
+        Take(addr, size);
+        used[addr] = size;
         return addr;
     }
 
+    LOG(MEM, ERROR, "Couldn't allocate 0x%08lx bytes (%ld bytes available, largest free range %ld bytes)\n", size, GetAvailable(), GetLargestFree());
     throw std::runtime_error("OOM Error!");
 }
 
@@ -344,31 +623,53 @@ void MemoryBlock::Free(uint64_t addr)
 {
     assert(addr >= begin && addr < (begin+len));
 
-    // Find the block corresponding with addr
-    bool found_addr = false;
+    auto it = used.find(addr);
+    if (it == used.end())
+    {
+        LOG(MEM, ERROR, "Could not free: no such address 0x%08lx\n", addr);
+        exit(1);
+    }
+
+    uint64_t size = it->second;
+    used.erase(it);
+    usedBytes -= size;
+
+    // Merge with the neighbouring free ranges
+    auto next = freeByAddr.lower_bound(addr);
+    if (next != freeByAddr.end() && next->first == addr + size)
+    {
+        size += next->second;
+        RemoveFree(next);
+    }
 
-    for (int i = 0; i < used_mem.size(); i++)
+    auto prev = freeByAddr.lower_bound(addr);
+    if (prev != freeByAddr.begin())
     {
-        printf("0x%08lx\n", used_mem[i].addr);
-        if (used_mem[i].addr == addr)
+        --prev;
+        if (prev->first + prev->second == addr)
         {
-            used_mem.erase(used_mem.begin()+i);
-            found_addr = true;
-            break;
+            addr = prev->first;
+            size += prev->second;
+            RemoveFree(prev);
         }
     }
 
-    if (!found_addr)
+    AddFree(addr, size);
+}
+
+uint32_t MemoryBlock::CountAllocations(uint64_t start, uint64_t end) const
+{
+    uint32_t count = 0;
+    for (auto& [addr, size] : used)
     {
-        printf("Could not free: no such address 0x%08lx\n", addr);
-        exit(1);
+        if (addr < end && addr + size > start)
+            count++;
     }
+    return count;
 }
 
 void MemoryBlock::MarkUsed(uint32_t addr, uint64_t size)
 {
-    Block block;
-    block.addr = addr;
-    block.end = addr+size;
-    used_mem.push_back(block);
+    // Never freed, so it only needs to come off the free list
+    Take(addr, size);
 }
@@ -2,11 +2,23 @@
 
 #include <stdint.h>
 #include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <atomic>
 #include <stddef.h>
+#include <byteswap.h>
+#include <signal.h>
 
 #define FLAG_R 1
 #define FLAG_W 2
 
+#define RESERVATION_LINE_SIZE 128
+#define RESERVATION_SLOTS 65536
+
+#define HOST_PAGE_SIZE 4096
+#define GUEST_PAGE_COUNT (0x100000000ULL / HOST_PAGE_SIZE)
+
 class MemoryManager;
 
 // To keep track 
@@ -18,28 +30,36 @@ private:
     size_t len;
     uint64_t begin;
 
-    struct Block
-    {
-        uint32_t addr;
-        uint64_t end;
-    };
+    // Free ranges are kept both by address (for coalescing on Free) and by size (for best-fit on Alloc)
+    std::map<uint64_t, uint64_t> freeByAddr; // addr -> size
+    std::set<std::pair<uint64_t, uint64_t>> freeBySize; // (size, addr)
+    std::unordered_map<uint64_t, uint64_t> used; // addr -> size
 
-    std::vector<Block> used_mem;
+    uint64_t usedBytes = 0;
+    uint64_t highWater = 0;
+
+    void AddFree(uint64_t addr, uint64_t size);
+    void RemoveFree(std::map<uint64_t, uint64_t>::iterator it);
+    void Take(uint64_t addr, uint64_t size);
 public:
     MemoryBlock(uint64_t start, uint64_t end, MemoryManager* manager, bool map = true);
 
-    uint64_t Alloc(uint64_t size);
+    uint64_t Alloc(uint64_t size, uint64_t align = 16);
     void Free(uint64_t addr);
     void MarkUsed(uint32_t addr, uint64_t size);
+    uint32_t CountAllocations(uint64_t start, uint64_t end) const; // Allocations overlapping [start, end)
 
     uint64_t GetStart() const {return begin;}
     uint64_t GetSize() const {return len;}
-    uint64_t GetAvailable() const
+    uint64_t GetResident() const; // Bytes actually backed by host memory, pages are only committed on first touch
+    uint64_t GetAvailable() const {return GetSize() - usedBytes;}
+    uint64_t GetHighWater() const {return highWater;} // Most bytes ever allocated at once
+    uint64_t GetLargestFree() const {return freeBySize.empty() ? 0 : freeBySize.rbegin()->first;}
+    // 0 when all free memory is one contiguous range, approaching 1 as it gets split up
+    double GetFragmentation() const
     {
-        uint64_t used = 0;
-        for (auto& b : used_mem)
-            used += b.end - b.addr;
-        return GetSize() - used;
+        uint64_t available = GetAvailable();
+        return available ? 1.0 - (double)GetLargestFree() / available : 0.0;
     }
 };
 
@@ -49,24 +69,43 @@ public:
     MemoryManager();
     ~MemoryManager();
 
-    void Write8(uint32_t addr, uint8_t data, bool slow = false);
-    void Write16(uint32_t addr, uint16_t data, bool slow = false);
-    void Write32(uint32_t addr, uint32_t data, bool slow = false);
-    void Write64(uint32_t addr, uint64_t data, bool slow = false);
+    // The whole 32-bit guest address space is one host reservation, so accesses are a plain offset from base
+    // Anything unmapped (MMIO included) faults and is sorted out by the SIGSEGV handler in Memory.cpp
+    void Write8(uint32_t addr, uint8_t data) {base[addr] = data;}
+    void Write16(uint32_t addr, uint16_t data) {*(uint16_t*)&base[addr] = __bswap_16(data);}
+    void Write32(uint32_t addr, uint32_t data) {*(uint32_t*)&base[addr] = __bswap_32(data);}
+    void Write64(uint32_t addr, uint64_t data) {*(uint64_t*)&base[addr] = __bswap_64(data);}
 
-    uint8_t Read8(uint32_t addr, bool slow = false);
-    uint16_t Read16(uint32_t addr, bool slow = false);
-    uint32_t Read32(uint32_t addr, bool slow = false);
-    uint64_t Read64(uint32_t addr, bool slow = false);
+    uint8_t Read8(uint32_t addr) {return base[addr];}
+    uint16_t Read16(uint32_t addr) {return __bswap_16(*(uint16_t*)&base[addr]);}
+    uint32_t Read32(uint32_t addr) {return __bswap_32(*(uint32_t*)&base[addr]);}
+    uint64_t Read64(uint32_t addr) {return __bswap_64(*(uint64_t*)&base[addr]);}
 
     void MarkMemoryRegion(uint64_t start, uint64_t end, int flags); // 1 = R, 2 = W
-    uint8_t* GetRawPtr(uint64_t offset);
+    uint8_t* GetRawPtr(uint64_t offset) {return base + offset;}
 
-    void MapMemory(uint64_t start, uint64_t end, uint8_t* ptr);
+    uint8_t* MapMemory(uint64_t start, uint64_t end);
     
+    // addr's page gets trapped, so it has to belong to one allocation of its own
     void SetRSXControlReg(uint32_t addr);
 
     void DumpRam();
+    void PrintMemoryUsage();
+
+    // Lock-line reservations, shared by lwarx/stwcx. on the PPU and the MFC atomic commands
+    // Each 128-byte line hashes to a version word that's odd while someone holds the line for a store,
+    // lines sharing a slot just make the odd conditional store fail spuriously
+    uint64_t ReserveLine(uint32_t addr); // Version to hand back to a conditional store, waits out any store in progress
+    bool LockLine(uint32_t addr, uint64_t version); // Fails if the line has been stored to since version
+    void LockLine(uint32_t addr);
+    void UnlockLine(uint32_t addr, bool stored);
+    bool StoreConditional32(uint32_t addr, uint64_t version, uint32_t expected, uint32_t data);
+    bool StoreConditional64(uint32_t addr, uint64_t version, uint64_t expected, uint64_t data);
+
+    // Write tracking for caches built from guest memory (RSX textures)
+    // Watched pages are read-only until the next write to them, which bumps the page's write count and opens it back up
+    void WatchWrites(uint32_t addr, uint32_t size);
+    uint32_t GetPageWrites(uint32_t page) {return pageWrites[page].load(std::memory_order_acquire);}
 
     MemoryBlock* stack;
     MemoryBlock* main_mem;
@@ -74,6 +113,18 @@ public:
     MemoryBlock* RSXCmdMem;
     MemoryBlock* RSXFBMem;
 private:
-    uint64_t rsx_control_addr;
-    uint8_t** pages;
+    friend void FastmemFault(int sig, siginfo_t* info, void* ctx);
+
+    uint64_t rsx_control_addr = 0;
+    uint8_t* rsx_control_alias = nullptr; // Writable view of the control page, which is read-only at its guest address
+    uint8_t* base;
+
+    std::atomic<uint64_t>* reservations;
+
+    std::atomic<uint32_t>* pageWrites;
+    std::atomic<uint8_t>* watchedPages;
+    std::atomic_flag watchLock = ATOMIC_FLAG_INIT; // Taken by the fault handler too, never held across a guest memory access
+    bool UnwatchPage(uint32_t page); // Called on a write fault, false if the page wasn't being watched
+    bool IsMapped(uint32_t addr); // Inside one of the blocks, which are read/write unless watched
+    std::atomic<uint64_t>& ReservationSlot(uint32_t addr) {return reservations[(addr / RESERVATION_LINE_SIZE) % RESERVATION_SLOTS];}
 };
\ No newline at end of file
@@ -20,6 +20,10 @@
 #include <stdexcept>
 #include <string.h>
 #include <kernel/types.h>
+#include <logging.h>
+#include <algorithm>
+#include <array>
+#include <vector>
 
 #define ARG0 ppu->GetReg(3)
 #define ARG1 ppu->GetReg(4)
@@ -38,7 +42,7 @@
 
 uint64_t GetSystemTime()
 {
-    printf("sysGetSystemTime()\n");
+    LOG(HLE, TRACE, "sysGetSystemTime()\n");
     while (true)
     {
         struct timespec ts;
@@ -54,11 +58,11 @@ uint64_t GetSystemTime()
 
 uint64_t timestamp = 0;
 
-std::unordered_map<uint32_t, memory_map_info> mapInfo;
+std::unordered_map<uint32_t, memory_map_info> mapInfo; // Guarded by kernelLock
 
 uint32_t sysMMapperAllocateMemory(size_t size, uint64_t flags, uint32_t ptrAddr, CellPPU* ppu)
 {
-    printf("sysMMapperAllocateMemory(0x%08lx, 0x%08lx, 0x%08x)\n", size, flags, ptrAddr);
+    LOG(HLE, TRACE, "sysMMapperAllocateMemory(0x%08lx, 0x%08lx, 0x%08x)\n", size, flags, ptrAddr);
 
     uint32_t addr;
     switch (flags & 0xf00)
@@ -80,366 +84,421 @@ uint32_t sysMMapperAllocateMemory(size_t size, uint64_t flags, uint32_t ptrAddr,
         return CELL_EINVAL;
     }
 
-    addr = ppu->GetManager()->main_mem->Alloc(size);
+    addr = ppu->GetManager()->main_mem->Alloc(size, (flags & 0xf00) == 0x200 ? 0x10000 : 0x100000);
 
     mapInfo[kernel_id] = {addr, size};
 
-    printf("Map info with start=0x%08x, id=%d\n", addr, kernel_id);
+    LOG(HLE, TRACE, "Map info with start=0x%08x, id=%d\n", addr, kernel_id);
 
     ppu->GetManager()->Write32(ptrAddr, kernel_id++);
     return CELL_OK;
 }
 
-void Modules::DoHLECall(uint32_t nid, CellPPU* ppu)
+template<size_t N>
+static constexpr std::array<Modules::HleEntry, N> SortByNid(std::array<Modules::HleEntry, N> table)
 {
-    // TODO: This is terrible and will get massive
-    // TODO: Change this to a lookup table
+    std::sort(table.begin(), table.end(), [](const auto& a, const auto& b) {return a.nid < b.nid;});
+    return table;
+}
 
-    switch (nid)
-    {
-    case 0x011ee38b:
-        printf("_cellSpursLFQueueInitialize()\n");
-    case 0x1656d49f:
+// Sorted by NID at compile time, only the ELF loader looks NIDs up, once per import
+static constexpr auto hleFunctions = SortByNid(std::to_array<Modules::HleEntry>({
+    {0x011ee38b, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "_cellSpursLFQueueInitialize()\n");
         RETURN(CELL_OK);
-        break;
-    case 0x01220224:
-        printf("cellGcmSurface2RescSurface(0x%08lx, 0x%08lx)\n", ARG0, ARG1);
+    }},
+    {0x1656d49f, [](CellPPU* ppu) {
         RETURN(CELL_OK);
-        break;
-    case 0x02ff3c1b:
-        printf("cellSysutilUnregisterCallback(%ld)\n", ARG0);
+    }},
+    {0x01220224, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellGcmSurface2RescSurface(0x%08lx, 0x%08lx)\n", ARG0, ARG1);
         RETURN(CELL_OK);
-        break;
-    case 0x055bd74d:
+    }},
+    {0x02ff3c1b, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellSysutilUnregisterCallback(%ld)\n", ARG0);
+        RETURN(CELL_OK);
+    }},
+    {0x055bd74d, [](CellPPU* ppu) {
         RETURN(CellGcm::cellGcmGetTiledPitchSize(ARG0));
-        break;
-    case 0x07529113:
+    }},
+    {0x07529113, [](CellPPU* ppu) {
         RETURN(CellSpu::cellSpursAttributeSetNamePrefix(ARG0, ARG1, ARG2, ppu));
-        break;
-    case 0x0b168f92:
-        printf("cellAudioInit()\n");
+    }},
+    {0x0b168f92, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellAudioInit()\n");
         RETURN(CELL_OK);
-        break;
-    case 0x0bae8772:
+    }},
+    {0x0bae8772, [](CellPPU* ppu) {
         RETURN(CellGcm::cellVideoOutConfigure(ARG0, ARG1));
-        break;
-	case 0x1051d134:
-		RETURN(CellSpu::cellSpursAttributeEnableSpuPrintfIfAvailable(ARG0, ppu));
-		break;
-	case 0x10db5b1a:
-		printf("cellRescSetDsts(%ld, 0x%08lx)\n", ARG0, ARG1);
-		RETURN(CELL_OK);
-		break;
-    case 0x1573dc3f:
+    }},
+    {0x1051d134, [](CellPPU* ppu) {
+        RETURN(CellSpu::cellSpursAttributeEnableSpuPrintfIfAvailable(ARG0, ppu));
+    }},
+    {0x10db5b1a, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellRescSetDsts(%ld, 0x%08lx)\n", ARG0, ARG1);
+        RETURN(CELL_OK);
+    }},
+    {0x1573dc3f, [](CellPPU* ppu) {
         RETURN(MutexModule::sysLwMutexLock(ARG0, ARG1, ppu));
-        break;
-    case 0x15bae46b:
+    }},
+    {0x15bae46b, [](CellPPU* ppu) {
         RETURN(CellGcm::cellGcmInitBody(ARG0, ARG1, ARG2, ARG3, ppu));
-        break;
-    case 0x16394a4e:
+    }},
+    {0x16394a4e, [](CellPPU* ppu) {
         RETURN(CellSpu::cellSpursTasksetAttributeInitialize(ARG0, ARG1, ARG2, ARG3, ARG4, ARG5, ppu));
-        break;
-    case 0x189a74da:
+    }},
+    {0x189a74da, [](CellPPU* ppu) {
         RETURN(CellSysUtil::cellSysutilCheckCallback(ppu));
-        break;
-    case 0x1bc200f4:
+    }},
+    {0x1bc200f4, [](CellPPU* ppu) {
         RETURN(MutexModule::sysLwMutexUnlock(ARG0, ppu));
-        break;
-    case 0x1c25470d:
-        printf("sysTrophyCreateHandle(0x%08lx)\n", ARG0);
+    }},
+    {0x1c25470d, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "sysTrophyCreateHandle(0x%08lx)\n", ARG0);
         RETURN(CELL_OK);
-        break;
-	case 0x1cf98800:
-		RETURN(CellPad::cellPadInit(ARG0));
-		break;
-    case 0x1d46fedf:
-        printf("cellSpursCreateTaskWithAttribute()\n");
+    }},
+    {0x1c9a942c, [](CellPPU* ppu) {
+        RETURN(MutexModule::sysLwCondDestroy(ARG0, ppu));
+    }},
+    {0x1cf98800, [](CellPPU* ppu) {
+        RETURN(CellPad::cellPadInit(ARG0));
+    }},
+    {0x1d46fedf, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellSpursCreateTaskWithAttribute()\n");
         RETURN(CELL_OK);
-        break;
-    case 0x1e7bff94:
+    }},
+    {0x1e7bff94, [](CellPPU* ppu) {
         RETURN(CellGame::cellSysCacheMount(ARG0, ppu));
-        break;
-    case 0x1f402f8f:
+    }},
+    {0x1f402f8f, [](CellPPU* ppu) {
         RETURN(CellSpu::cellSpursGetInfo(ARG0, ARG1, ppu));
-        break;
-    case 0x21397818:
+    }},
+    {0x21397818, [](CellPPU* ppu) {
         RETURN(CellGcm::cellGcmSetFlipCommand(ARG0, ARG1, ppu));
-        break;
-    case 0x21ac3697:
+    }},
+    {0x21ac3697, [](CellPPU* ppu) {
         RETURN(CellGcm::cellGcmAddressToOffset(ARG0, ARG1, ppu));
-        break;
-    case 0x220894e3:
-        printf("cellSysutilEnableBGMPlayback()\n");
+    }},
+    {0x220894e3, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellSysutilEnableBGMPlayback()\n");
         RETURN(CELL_OK);
-        break;
-	case 0x23134710:
-		printf("cellRescSetDisplayMode(%ld)\n", ARG0);
-		RETURN(CELL_OK);
-		break;
-	case 0x24a1ea07:
-		CellThread::sysPPUThreadCreate(ARG0, ARG1, ARG2, ARG3, ARG4, ARG5, ARG6, ppu);
-		break;
-    case 0x2c847572:
-        printf("sysProcessAtExitSpawn(0x%08lx)\n", ARG0);
+    }},
+    {0x23134710, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellRescSetDisplayMode(%ld)\n", ARG0);
         RETURN(CELL_OK);
-        break;
-    case 0x2CB51F0D:
+    }},
+    {0x24a1ea07, [](CellPPU* ppu) {
+        RETURN(CellThread::sysPPUThreadCreate(ARG0, ARG1, ARG2, ARG3, ARG4, ARG5, ARG6, ppu));
+    }},
+    {0x2a6d9d51, [](CellPPU* ppu) {
+        RETURN(MutexModule::sysLwCondWait(ARG0, ARG1, ppu));
+    }},
+    {0x2c847572, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "sysProcessAtExitSpawn(0x%08lx)\n", ARG0);
+        RETURN(CELL_OK);
+    }},
+    {0x2cb51f0d, [](CellPPU* ppu) {
         RETURN(VFS::cellFsClose(ARG0));
-        break;
-    case 0x2d36462b:
-        printf("sysStrlen(0x%08lx)\n", ARG0);
+    }},
+    {0x2d36462b, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "sysStrlen(0x%08lx)\n", ARG0);
         RETURN(strlen((char*)ppu->GetManager()->GetRawPtr(ARG0)));
-        break;
-    case 0x2f85c0ef:
+    }},
+    {0x2f85c0ef, [](CellPPU* ppu) {
         RETURN(MutexModule::sysLwMutexCreate(ARG0, ARG1, ppu));
-        break;
-    case 0x30aa96c4:
+    }},
+    {0x30aa96c4, [](CellPPU* ppu) {
         RETURN(CellSpu::cellSpursInitializeWithAttribute2(ARG0, ARG1, ppu));
-        break;
-	case 0x32267a31:
-		printf("cellLoadSysmodule(0x%02lx)\n", ARG0);
-		RETURN(CELL_OK);
-		break;
-    case 0x350d454e:
+    }},
+    {0x32267a31, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellLoadSysmodule(0x%02lx)\n", ARG0);
+        RETURN(CELL_OK);
+    }},
+    {0x350d454e, [](CellPPU* ppu) {
         RETURN(CellThread::sysGetThreadId(ARG0, ppu));
-        break;
-    case 0x370136fe:
-        printf("cellSysTrophyGetRequiredDiskSpace(%d, %d, 0x%08lx, 0x%08lx)\n", ARG0, ARG1, ARG2, ARG3);
+    }},
+    {0x370136fe, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellSysTrophyGetRequiredDiskSpace(%d, %d, 0x%08lx, 0x%08lx)\n", ARG0, ARG1, ARG2, ARG3);
         RETURN(CELL_OK);
-        break;
-    case 0x39567781:
-        printf("cellSysTrophyInit(0x%08lx, %lu, %d, 0x%08lx)\n", ARG0, ARG1, (int)ARG2, ARG3);
+    }},
+    {0x39567781, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellSysTrophyInit(0x%08lx, %lu, %d, 0x%08lx)\n", ARG0, ARG1, (int)ARG2, ARG3);
         RETURN(CELL_OK);
-        break;
-	case 0x3aaad464:
-		RETURN(CellPad::cellGetPadInfo(ARG0, ppu));
-		break;
-	case 0x40e895d3:
-		RETURN(CellSysUtil::sysUtilGetSystemParamInt(ARG0, ARG1, ppu));
-		break;
-    case 0x4524cccd:
+    }},
+    {0x3aaad464, [](CellPPU* ppu) {
+        RETURN(CellPad::cellGetPadInfo(ARG0, ppu));
+    }},
+    {0x40e895d3, [](CellPPU* ppu) {
+        RETURN(CellSysUtil::sysUtilGetSystemParamInt(ARG0, ARG1, ppu));
+    }},
+    {0x4524cccd, [](CellPPU* ppu) {
         RETURN(CellGcm::cellGcmBindTile(ARG0));
-        break;
-    case 0x4ae8d215:
+    }},
+    {0x4ae8d215, [](CellPPU* ppu) {
         RETURN(CellGcm::cellGcmSetFlipMode(ARG0));
-        break;
-	case 0x516ee89e:
-		RETURN(CellResc::cellRescInit(ARG0, ppu));
-		break;
-    case 0x51c9d62b:
-        printf("cellGcmSetDebugOutputLevel(%ld)\n", ARG0);
-        break;
-    case 0x5267cb35:
+    }},
+    {0x516ee89e, [](CellPPU* ppu) {
+        RETURN(CellResc::cellRescInit(ARG0, ppu));
+    }},
+    {0x51c9d62b, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellGcmSetDebugOutputLevel(%ld)\n", ARG0);
+    }},
+    {0x5267cb35, [](CellPPU* ppu) {
         SpinlockModule::sysSpinlockUnlock(ARG0, ppu);
         RETURN(CELL_OK);
-        break;
-	case 0x5a338cdb:
-		printf("cellRescGetBufferSize(0x%08lx, 0x%08lx, 0x%08lx)\n", ARG0, ARG1, ARG2);
-		RETURN(0);
-		break;
-    case 0x5a41c10f:
-        printf("cellGcmGetTimeStamp(%ld)\n", ARG0);
+    }},
+    {0x52aadadf, [](CellPPU* ppu) {
+        RETURN(MutexModule::sysLwCondSignalTo(ARG0, ARG1, ppu));
+    }},
+    {0x5a338cdb, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellRescGetBufferSize(0x%08lx, 0x%08lx, 0x%08lx)\n", ARG0, ARG1, ARG2);
+        RETURN(0);
+    }},
+    {0x5a41c10f, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellGcmGetTimeStamp(%ld)\n", ARG0);
         RETURN(timestamp);
         timestamp += 0x1000;
-        break;
-    case 0x5a59e258:
-        printf("cellSysmoduleIsLoaded(0x%lx)\n", ARG0);
+    }},
+    {0x5a59e258, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellSysmoduleIsLoaded(0x%lx)\n", ARG0);
         RETURN(CELL_OK);
-        break;
-    case 0x5ef96465:
-        printf("cellSpursEventFlagInitialize()\n");
+    }},
+    {0x5ef96465, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellSpursEventFlagInitialize()\n");
         RETURN(CELL_OK);
-        break;
-    case 0x63ff6ff9:
-        printf("cellSysmoduleInitialize()\n");
+    }},
+    {0x63ff6ff9, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellSysmoduleInitialize()\n");
         RETURN(CELL_OK);
-        break;
-    case 0x652b70e2:
+    }},
+    {0x652b70e2, [](CellPPU* ppu) {
         RETURN(CellSpu::cellSpursTasksetAttributeSetName(ARG0, ARG1, ppu));
-        break;
-	case 0x6cd0f95f:
-		printf("cellRescSetSrc(%ld, 0x%08lx)\n", ARG0, ARG1);
-		RETURN(CELL_OK);
-		break;
-    case 0x70acec67:
+    }},
+    {0x6cd0f95f, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellRescSetSrc(%ld, 0x%08lx)\n", ARG0, ARG1);
+        RETURN(CELL_OK);
+    }},
+    {0x70acec67, [](CellPPU* ppu) {
         RETURN(CellGame::cellGameContentPermit(ARG0, ARG1, ppu));
-        break;
-    case 0x718bf5f8:
+    }},
+    {0x718bf5f8, [](CellPPU* ppu) {
         RETURN(VFS::cellFsOpen(ARG0, ARG1, ARG2, ppu));
-        break;
-    case 0x72a577ce:
+    }},
+    {0x722a0254, [](CellPPU* ppu) {
+        RETURN(SpinlockModule::sysSpinlockTryLock(ARG0, ppu));
+    }},
+    {0x72a577ce, [](CellPPU* ppu) {
         RETURN(CellGcm::cellGcmGetFlipStatus());
-        break;
-    case 0x744680a2:
+    }},
+    {0x744680a2, [](CellPPU* ppu) {
         CellThread::sysInitializeTLS(ARG0, ARG1, ARG2, ARG3, ppu);
         RETURN(CELL_OK);
-        break;
-    case 0x7de6dced:
+    }},
+    {0x7de6dced, [](CellPPU* ppu) {
         RETURN(VFS::cellVfsFstat(ARG0, ARG1, ppu));
-        break;
-	case 0x8107277c:
-		printf("cellRescSetBufferAddress(0x%08lx, 0x%08lx, 0x%08lx)\n", ARG0, ARG1, ARG2);
-		RETURN(CELL_OK);
-		break;
-    case 0x8461e528:
+    }},
+    {0x8107277c, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellRescSetBufferAddress(0x%08lx, 0x%08lx, 0x%08lx)\n", ARG0, ARG1, ARG2);
+        RETURN(CELL_OK);
+    }},
+    {0x8461e528, [](CellPPU* ppu) {
         RETURN(GetSystemTime());
-        break;
-    case 0x87630976:
-        printf("cellSpursEventFlagAttachLv2EventQueue()\n");
+    }},
+    {0x87630976, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellSpursEventFlagAttachLv2EventQueue()\n");
         RETURN(CELL_OK);
-        break;
-    case 0x887572d5:
+    }},
+    {0x887572d5, [](CellPPU* ppu) {
         RETURN(CellGcm::cellVideOutGetState(ARG0, ARG1, ARG2, ppu));
-        break;
-	case 0x8b72cda1:
-		RETURN(CellPad::cellGetPadData(ARG0, ARG1, ppu));
-		break;
-    case 0x8c2bb498:
+    }},
+    {0x8b72cda1, [](CellPPU* ppu) {
+        RETURN(CellPad::cellGetPadData(ARG0, ARG1, ppu));
+    }},
+    {0x8c2bb498, [](CellPPU* ppu) {
         SpinlockModule::sysSpinlockInitialize(ARG0, ppu);
         RETURN(CELL_OK);
-        break;
-    case 0x938013a0:
+    }},
+    {0x938013a0, [](CellPPU* ppu) {
         RETURN(CellSysUtil::cellSysutilGetSystemParamString(ARG0, ARG1, ppu));
-        break;
-	case 0x95180230:
-		RETURN(CellSpu::cellSpursAttributeInitialize(ARG0, ARG1, ARG2, ARG3, ARG4, ARG5, ARG6, ppu));
-		break;
-    case 0x96328741:
-        printf("sysProcessAt_ExitSpawn(0x%08lx)\n", ARG0);
+    }},
+    {0x95180230, [](CellPPU* ppu) {
+        RETURN(CellSpu::cellSpursAttributeInitialize(ARG0, ARG1, ARG2, ARG3, ARG4, ARG5, ARG6, ppu));
+    }},
+    {0x96328741, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "sysProcessAt_ExitSpawn(0x%08lx)\n", ARG0);
         RETURN(CELL_OK);
-        break;
-    case 0x983fb9aa:
+    }},
+    {0x983fb9aa, [](CellPPU* ppu) {
         ppu->GetManager()->Write32(CellGcm::GetControlAddress(), ppu->GetManager()->Read32(CellGcm::gcm_info.context_addr+8));
         RETURN(CELL_OK);
-        break;
-    case 0x9d98afa0:
+    }},
+    {0x9d98afa0, [](CellPPU* ppu) {
         RETURN(CellSysUtil::cellSysutilRegisterCallback(ARG0, ARG1, ARG2, ppu));
-        break;
-	case 0x9dc04436:
-		RETURN(CELL_OK);
-		break;
-    case 0xa285139d:
+    }},
+    {0x9dc04436, [](CellPPU* ppu) {
+        RETURN(CELL_OK);
+    }},
+    {0xa285139d, [](CellPPU* ppu) {
         SpinlockModule::sysSpinlockLock(ARG0, ppu);
         RETURN(CELL_OK);
-        break;
-	case 0xa2c7ba64:
-		printf("sys_prx_exitspawn_with_level()\n");
-		RETURN(CELL_OK);
-		break;
-    case 0xa322db75:
+    }},
+    {0xa2c7ba64, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "sys_prx_exitspawn_with_level()\n");
+        RETURN(CELL_OK);
+    }},
+    {0xa322db75, [](CellPPU* ppu) {
         RETURN(CellGcm::cellVideoOutGetResolutionAvailability(ARG0, ARG1, ARG2, ppu));
-        break;
-    case 0xa397d042:
+    }},
+    {0xa397d042, [](CellPPU* ppu) {
         RETURN(VFS::cellFsSeek(ARG0, ARG1, ARG2, ARG3, ppu));
-        break;
-	case 0xa3e3be68:
-		RETURN(CellThread::sysPPUThreadOnce(ARG0, ARG1, ppu));
-		break;
-    case 0xa41ef7e8:
+    }},
+    {0xa3e3be68, [](CellPPU* ppu) {
+        RETURN(CellThread::sysPPUThreadOnce(ARG0, ARG1, ppu));
+    }},
+    {0xa41ef7e8, [](CellPPU* ppu) {
         CellGcm::cellGcmSetFlipHandler(ARG0, ppu);
-        break;
-    case 0xa53d12ae:
+    }},
+    {0xa53d12ae, [](CellPPU* ppu) {
         RETURN(CellGcm::cellGcmSetDisplayBuffer(ARG0, ARG1, ARG2, ARG3, ARG4, ppu));
-        break;
-    case 0xa547adde:
+    }},
+    {0xa547adde, [](CellPPU* ppu) {
         RETURN(CellGcm::cellGcmGetControlRegister(ppu));
-        break;
-    case 0xa839a4d9:
-        printf("cellSpursAttributeSetSpuThreadGroupType()\n");
+    }},
+    {0xa839a4d9, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellSpursAttributeSetSpuThreadGroupType()\n");
         RETURN(CELL_OK);
-        break;
-    case 0xacfc8dbc:
+    }},
+    {0xacfc8dbc, [](CellPPU* ppu) {
         RETURN(CellSpu::cellSpursInitialize(ARG0, ARG1, ARG2, ARG3, ARG4, ppu));
-        break;
-    case 0xaff080a4:
-        RETURN(CellThread::sysPPUThreadExit(ARG0, ppu));
-        break;
-    case 0xb257540b:
+    }},
+    {0xaeb78725, [](CellPPU* ppu) {
+        RETURN(MutexModule::sysLwMutexTryLock(ARG0, ppu));
+    }},
+    {0xaff080a4, [](CellPPU* ppu) {
+        // r3 belongs to whichever thread runs next
+        CellThread::sysPPUThreadExit(ARG0, ppu);
+    }},
+    {0xb257540b, [](CellPPU* ppu) {
         RETURN(sysMMapperAllocateMemory(ARG0, ARG1, ARG2, ppu));
-        break;
-    case 0xb2e761d4:
+    }},
+    {0xb2e761d4, [](CellPPU* ppu) {
         CellGcm::cellGcmResetFlipStatus();
         RETURN(CELL_OK);
-        break;
-    case 0xb2fcf2c8:
+    }},
+    {0xb2fcf2c8, [](CellPPU* ppu) {
         RETURN(CellHeap::sys_heap_create_heap(ARG0, ARG1, ARG2));
-        break;
-    case 0xb72bc4e6:
+    }},
+    {0xb72bc4e6, [](CellPPU* ppu) {
         RETURN(CellGame::cellDiscGameGetBootDiscInfo(ARG0, ppu));
-        break;
-    case 0xb8474eff:
-        printf("cellSpursTaskAttributeInitialize()\n");
+    }},
+    {0xb8474eff, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellSpursTaskAttributeInitialize()\n");
         RETURN(CELL_OK);
-        break;
-	case 0xb995662e:
-		RETURN(CellSpu::sysSpuImageLoad(ARG0, ARG1, ppu));
-		break;
-    case 0xb9bc6207:
+    }},
+    {0xb995662e, [](CellPPU* ppu) {
+        RETURN(CellSpu::sysSpuImageLoad(ARG0, ARG1, ppu));
+    }},
+    {0xb9bc6207, [](CellPPU* ppu) {
         RETURN(CellSpu::cellSpursAttachLV2EventQueue(ARG0, ARG1, ARG2, ARG3, ppu));
-        break;
-    case 0xbd100dbc:
+    }},
+    {0xbd100dbc, [](CellPPU* ppu) {
         CellGcm::cellGcmSetTileInfo(ARG0, ARG1, ARG2, ARG3, ARG4, ARG5, ARG6, ARG7, ppu);
-        break;
-    case 0xc10931cb:
-        printf("cellSpursCreateTasksetWithAttribute(0x%08lx, 0x%08lx, 0x%08lx)\n", ARG0, ARG1, ARG2);
-        RETURN(CELL_OK);
-        break;
-    case 0xc3476d0c:
-        printf("sys_lwmutex_destroy(%d)\n", (int)ARG0);
+    }},
+    {0xc10931cb, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellSpursCreateTasksetWithAttribute(0x%08lx, 0x%08lx, 0x%08lx)\n", ARG0, ARG1, ARG2);
         RETURN(CELL_OK);
-        break;
-    case 0xc9645c41:
+    }},
+    {0xc3476d0c, [](CellPPU* ppu) {
+        RETURN(MutexModule::sysLwMutexDestroy(ARG0, ppu));
+    }},
+    {0xc9645c41, [](CellPPU* ppu) {
         RETURN(CellGame::cellGameDataCheckCreate2(ARG0, ARG1, ARG2, ARG3, ARG4, ppu));
-        break;
-    case 0xce4374f6:
+    }},
+    {0xce4374f6, [](CellPPU* ppu) {
         RETURN(CellGame::cellGamePatchCheck(ARG0, ppu));
-        break;
-	case 0xd1ca0503:
-		RETURN(CellResc::cellRescVideoResId2RescBufferMode(ARG0, ARG1, ppu));
-		break;
-	case 0xda0eb71a:
-		MutexModule::sysLwCondCreate(ARG0, ARG1, ARG2, ppu);
-		RETURN(CELL_OK);
-		break;
-    case 0xdc09357e:
+    }},
+    {0xd1ca0503, [](CellPPU* ppu) {
+        RETURN(CellResc::cellRescVideoResId2RescBufferMode(ARG0, ARG1, ppu));
+    }},
+    {0xda0eb71a, [](CellPPU* ppu) {
+        RETURN(MutexModule::sysLwCondCreate(ARG0, ARG1, ARG2, ppu));
+    }},
+    {0xdc09357e, [](CellPPU* ppu) {
         RETURN(CELL_OK);
-        break;
-    case 0xdc578057:
-        printf("sysMMapperMapMemory(0x%08lx, %ld, 0x%08lx)\n", ARG0, ARG1, ARG2);
+    }},
+    {0xdc578057, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "sysMMapperMapMemory(0x%08lx, %ld, 0x%08lx)\n", ARG0, ARG1, ARG2);
         RETURN(CELL_OK);
-        break;
-	case 0xe0da8efd:
-		RETURN(CellSpu::sysSpuImageClose(ARG0, ppu));
-		break;
-    case 0xe315a0b2:
+    }},
+    {0xe0da8efd, [](CellPPU* ppu) {
+        RETURN(CellSpu::sysSpuImageClose(ARG0, ppu));
+    }},
+    {0xe315a0b2, [](CellPPU* ppu) {
         RETURN(CellGcm::cellGcmGetConfiguration(ARG0, ppu));
-        break;
-    case 0xe3bf9a28:
-        printf("sysTrophyCreateContext(0x%08lx, 0x%08lx, 0x%08lx, 0x%08lx)\n", ARG0, ARG1, ARG2, ARG3);
+    }},
+    {0xe3bf9a28, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "sysTrophyCreateContext(0x%08lx, 0x%08lx, 0x%08lx, 0x%08lx)\n", ARG0, ARG1, ARG2, ARG3);
         RETURN(CELL_OK);
-        break;
-    case 0xe558748d:
+    }},
+    {0xe558748d, [](CellPPU* ppu) {
         RETURN(CellGcm::cellGetResolution(ARG0, ARG1, ppu));
-        break;
-	case 0xebe5f72f:
-		RETURN(CellSpu::sysSpuImageImport(ARG0, ARG1, ARG2, ARG3, ppu));
-		break;
-    case 0xecdcf2ab:
+    }},
+    {0xe9a1bd84, [](CellPPU* ppu) {
+        RETURN(MutexModule::sysLwCondSignalAll(ARG0, ppu));
+    }},
+    {0xebe5f72f, [](CellPPU* ppu) {
+        RETURN(CellSpu::sysSpuImageImport(ARG0, ARG1, ARG2, ARG3, ppu));
+    }},
+    {0xecdcf2ab, [](CellPPU* ppu) {
         RETURN(VFS::cellFsWrite(ARG0, ARG1, ARG2, ARG3, ppu));
-        break;
-    case 0xf52639ea:
+    }},
+    {0xef87a695, [](CellPPU* ppu) {
+        RETURN(MutexModule::sysLwCondSignal(ARG0, ppu));
+    }},
+    {0xf52639ea, [](CellPPU* ppu) {
         RETURN(CellGame::cellGameBootCheck(ARG0, ARG1, ARG2, ARG3, ppu));
-        break;
-    case 0xf80196c1:
-        printf("cellGcmGetLabelAddress(0x%02lx)\n", ARG0);
+    }},
+    {0xf80196c1, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellGcmGetLabelAddress(0x%02lx)\n", ARG0);
         RETURN(ppu->GetManager()->RSXCmdMem->GetStart() + (ARG0 << 4));
-        break;
-    case 0xfbd5c856:
-        printf("cellSaveDataAutoLoad2(%ld, 0x%08lx, %ld, 0x%08lx, 0x%08lx, 0x%08lx, %ld, 0x%08lx)\n", ARG0, ARG1, ARG2, ARG3, ARG4, ARG5, ARG6, ARG7);
+    }},
+    {0xfbd5c856, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "cellSaveDataAutoLoad2(%ld, 0x%08lx, %ld, 0x%08lx, 0x%08lx, 0x%08lx, %ld, 0x%08lx)\n", ARG0, ARG1, ARG2, ARG3, ARG4, ARG5, ARG6, ARG7);
         RETURN(CELL_OK);
-        break;
-    default:
-        printf("Called unknown function with nid 0x%08x\n", nid);
+    }},
+}));
+
+static_assert(std::adjacent_find(hleFunctions.begin(), hleFunctions.end(), [](const auto& a, const auto& b) {return a.nid == b.nid;}) == hleFunctions.end(),
+              "NIDs in the HLE table have to be unique");
+
+// Imports in load order, the HLE trap in each import's stub carries its index
+static std::vector<Modules::HleEntry> imports;
+
+uint32_t Modules::RegisterImport(uint32_t nid)
+{
+    auto it = std::lower_bound(hleFunctions.begin(), hleFunctions.end(), nid, [](const HleEntry& entry, uint32_t nid) {return entry.nid < nid;});
+    HleFunction func = (it != hleFunctions.end() && it->nid == nid) ? it->func : nullptr;
+
+    // Unknown NIDs still get an entry, games import plenty they never call
+    imports.push_back({nid, func});
+    return imports.size() - 1;
+}
+
+void Modules::DoHLECall(uint32_t index, CellPPU* ppu)
+{
+    // A trap opcode the guest made up itself can carry any index
+    if (index >= imports.size())
+    {
+        LOG(HLE, ERROR, "Called unknown function with import index %d\n", index);
         throw std::runtime_error("Unknown function NID");
     }
-}
\ No newline at end of file
+
+    const HleEntry& import = imports[index];
+    if (!import.func)
+    {
+        LOG(HLE, ERROR, "Called unknown function with nid 0x%08x\n", import.nid);
+        throw std::runtime_error("Unknown function NID");
+    }
+
+    import.func(ppu);
+}
@@ -4,9 +4,24 @@
 
 class CellPPU;
 
+// Import stubs get patched to this primary opcode (unused on the Cell), the low 26 bits are the import's index
+#define HLE_TRAP_OPCODE 0x01
+#define HLE_TRAP(index) ((HLE_TRAP_OPCODE << 26) | (index))
+
 namespace Modules
 {
 
-void DoHLECall(uint32_t nid, CellPPU* ppu);
+using HleFunction = void (*)(CellPPU* ppu);
+
+struct HleEntry
+{
+    uint32_t nid;
+    HleFunction func;
+};
+
+// Resolves an import once at load time, returns the index its HLE trap carries
+uint32_t RegisterImport(uint32_t nid);
+
+void DoHLECall(uint32_t index, CellPPU* ppu);
 
-}
\ No newline at end of file
+}
@@ -4,15 +4,16 @@
 
 #include <string.h>
 #include <filesystem>
+#include <logging.h>
 
 uint32_t CellGame::cellGameBootCheck(uint32_t typePtr, uint32_t attribPtr, uint32_t sizePtr, uint32_t dirNamePtr, CellPPU *ppu)
 {
-    printf("cellGameBootCheck(type=*0x%x, attributes=*0x%x, size=*0x%x, dirName=*0x%x)\n", typePtr, attribPtr, sizePtr, dirNamePtr);
+    LOG(HLE, TRACE, "cellGameBootCheck(type=*0x%x, attributes=*0x%x, size=*0x%x, dirName=*0x%x)\n", typePtr, attribPtr, sizePtr, dirNamePtr);
 
     char dirName[32+1] = {0};
     memcpy(dirName, ppu->GetManager()->GetRawPtr(dirNamePtr), 32);
 
-    printf("DirName = %s\n", dirName);
+    LOG(HLE, TRACE, "DirName = %s\n", dirName);
 
     ppu->GetManager()->Write32(typePtr, 1);
     ppu->GetManager()->Write32(attribPtr, 1);
@@ -28,7 +29,7 @@ uint32_t CellGame::cellGameBootCheck(uint32_t typePtr, uint32_t attribPtr, uint3
 
 uint32_t CellGame::cellGameContentPermit(uint32_t contentInfoPtr, uint32_t usrdirPtr, CellPPU* ppu)
 {
-    printf("cellGameContentPermit(0x%08x, 0x%08x)\n", contentInfoPtr, usrdirPtr);
+    LOG(HLE, TRACE, "cellGameContentPermit(0x%08x, 0x%08x)\n", contentInfoPtr, usrdirPtr);
 
     std::string dir = "/dev_bdvd/PS3_GAME";
     strncpy((char*)ppu->GetManager()->GetRawPtr(contentInfoPtr), dir.c_str(), 128);
@@ -50,7 +51,7 @@ uint32_t CellGame::cellGamePatchCheck(uint32_t sizePtr, CellPPU *ppu)
 
 uint32_t CellGame::cellDiscGameGetBootDiscInfo(uint32_t infoPtr, CellPPU* ppu)
 {
-    printf("cellDiscGameGetBootDiscInfo(0x%08x)\n", infoPtr);
+    LOG(HLE, TRACE, "cellDiscGameGetBootDiscInfo(0x%08x)\n", infoPtr);
 
     if (!infoPtr)
     {
@@ -68,14 +69,14 @@ uint32_t CellGame::cellDiscGameGetBootDiscInfo(uint32_t infoPtr, CellPPU* ppu)
 
 uint32_t CellGame::cellSysCacheMount(uint32_t infoPtr, CellPPU *ppu)
 {
-    printf("cellSysCacheMount(0x%08x)\n", infoPtr);
+    LOG(HLE, TRACE, "cellSysCacheMount(0x%08x)\n", infoPtr);
 
     auto path = std::string("dev_hdd1/caches");
 
     auto title = gSFO->GetEntry("TITLE_ID");
     path += "/" + title.strValue + "_" + std::string((const char*)ppu->GetManager()->GetRawPtr(infoPtr));
     
-    printf("Cache path is %s\n", path.c_str());
+    LOG(HLE, TRACE, "Cache path is %s\n", path.c_str());
     
     auto fullPath = std::string(VFS::GetbasePath()) + "/" + path;
     if (!std::filesystem::exists(fullPath))
@@ -97,7 +98,7 @@ uint32_t CellGame::cellGameDataCheckCreate2(uint32_t version, uint32_t dirNamePt
 
     const std::string usrdir = dir + "/USRDIR";
 
-    printf("cellGameDataCheckCreate2(%d, \"%s\", %d, 0x%08x, 0x%08x, 0x%08x)\n", version, dir.c_str(), errDialog, callback, container);
+    LOG(HLE, TRACE, "cellGameDataCheckCreate2(%d, \"%s\", %d, 0x%08x, 0x%08x, 0x%08x)\n", version, dir.c_str(), errDialog, callback, container);
 
     return CELL_OK;
 }
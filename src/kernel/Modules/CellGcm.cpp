@@ -1,7 +1,10 @@
 #include "CellGcm.h"
+#include "CellThread.h"
 #include <rsx/rsx.h>
 
 #include <stdexcept>
+#include <atomic>
+#include <logging.h>
 
 struct CellGcmConfig
 {
@@ -53,12 +56,12 @@ struct GcmTileInfo
     }
 } tiles[15];
 
-uint32_t flipHandler;
-CellPPU* gGcmPPU;
+std::atomic<uint32_t> flipHandler{0};
+static std::atomic<bool> flipHandlerPending{false};
 
 uint32_t CellGcm::cellGcmInitBody(uint32_t ctxtPtr, uint32_t cmdSize, uint32_t ioSize, uint32_t ioAddrPtr, CellPPU *ppu)
 {
-    printf("cellGcmInitBody(0x%08x, 0x%08x, 0x%08x, 0x%08x)\n", ctxtPtr, cmdSize, ioSize, ioAddrPtr);
+    LOG(HLE, TRACE, "cellGcmInitBody(0x%08x, 0x%08x, 0x%08x, 0x%08x)\n", ctxtPtr, cmdSize, ioSize, ioAddrPtr);
     
     const uint32_t local_size = 0xf900000;
     const uint32_t local_addr = ppu->GetManager()->RSXFBMem->GetStart();
@@ -88,7 +91,8 @@ uint32_t CellGcm::cellGcmInitBody(uint32_t ctxtPtr, uint32_t cmdSize, uint32_t i
     context.callback = rsxCallback-4;
 
     gcm_info.context_addr = ppu->GetManager()->main_mem->Alloc(0x1000);
-    gcm_info.control_addr = gcm_info.context_addr + 0x40;
+    // Stores to the control register's page trap, so it gets a page to itself
+    gcm_info.control_addr = ppu->GetManager()->main_mem->Alloc(HOST_PAGE_SIZE, HOST_PAGE_SIZE);
     ppu->GetManager()->SetRSXControlReg(gcm_info.control_addr);
     gcm_info.tiles_addr = ppu->GetManager()->main_mem->Alloc(sizeof(CellGcmTileInfo) * 15);
 
@@ -99,7 +103,7 @@ uint32_t CellGcm::cellGcmInitBody(uint32_t ctxtPtr, uint32_t cmdSize, uint32_t i
     ppu->GetManager()->Write32(gcm_info.context_addr+0x8, context.current);
     ppu->GetManager()->Write32(gcm_info.context_addr+0xC, context.callback);
 
-    printf("GCM context at 0x%08x (wrote to 0x%08x)\n", gcm_info.context_addr, ctxtPtr);
+    LOG(HLE, TRACE, "GCM context at 0x%08x (wrote to 0x%08x)\n", gcm_info.context_addr, ctxtPtr);
 
     return CELL_OK;
 }
@@ -124,7 +128,7 @@ struct VideoOutState
 
 uint32_t CellGcm::cellVideOutGetState(uint32_t videoOut, uint32_t deviceIndex, uint32_t statePtr, CellPPU* ppu)
 {
-    printf("cellVideoOutGetState(%d, %d, 0x%08x)\n", videoOut, deviceIndex, statePtr);
+    LOG(HLE, TRACE, "cellVideoOutGetState(%d, %d, 0x%08x)\n", videoOut, deviceIndex, statePtr);
 
     if (!statePtr)
     {
@@ -162,7 +166,7 @@ uint32_t CellGcm::cellGetResolution(uint32_t resId, uint32_t resPtr, CellPPU* pp
 {
     uint16_t width, height;
 
-    printf("cellVideoOutGetResolution(%d, 0x%08x)\n", resId, resPtr);
+    LOG(HLE, TRACE, "cellVideoOutGetResolution(%d, 0x%08x)\n", resId, resPtr);
 
     if (!resPtr)
     {
@@ -180,7 +184,7 @@ uint32_t CellGcm::cellGetResolution(uint32_t resId, uint32_t resPtr, CellPPU* pp
         height = 720;
         break;
     default:
-        printf("Unknown resolution ID 0x%08x\n", resId);
+        LOG(HLE, ERROR, "Unknown resolution ID 0x%08x\n", resId);
         throw std::runtime_error("Couldn't get resolution\n");
     }
 
@@ -192,20 +196,20 @@ uint32_t CellGcm::cellGetResolution(uint32_t resId, uint32_t resPtr, CellPPU* pp
 
 uint32_t CellGcm::cellVideoOutConfigure(uint32_t videoOut, uint32_t configPtr)
 {
-    printf("TODO: cellVideoOutConfigure(0x%08x, 0x%08x)\n", videoOut, configPtr);
+    LOG(HLE, WARN, "TODO: cellVideoOutConfigure(0x%08x, 0x%08x)\n", videoOut, configPtr);
     return CELL_OK;
 }
 
 uint32_t CellGcm::cellGcmSetFlipMode(int mode)
 {
-    printf("cellGcmSetFlipMode(%d)\n", mode);
+    LOG(HLE, TRACE, "cellGcmSetFlipMode(%d)\n", mode);
 
     return CELL_OK;
 }
 
 uint32_t CellGcm::cellGcmGetConfiguration(uint32_t configPtr, CellPPU* ppu)
 {
-    printf("cellGcmGetConfiguration(0x%08x)\n", configPtr);
+    LOG(HLE, TRACE, "cellGcmGetConfiguration(0x%08x)\n", configPtr);
 
     ppu->GetManager()->Write32(configPtr, config.localAddress);
     ppu->GetManager()->Write32(configPtr+4, config.ioAddress);
@@ -219,7 +223,7 @@ uint32_t CellGcm::cellGcmGetConfiguration(uint32_t configPtr, CellPPU* ppu)
 
 uint32_t CellGcm::cellGcmAddressToOffset(uint32_t address, uint32_t offsPtr, CellPPU* ppu)
 {
-    printf("cellGcmAddressToOffset(0x%08x, 0x%08x)\n", address, offsPtr);
+    LOG(HLE, TRACE, "cellGcmAddressToOffset(0x%08x, 0x%08x)\n", address, offsPtr);
 
     uint64_t base;
 
@@ -242,7 +246,7 @@ uint32_t CellGcm::cellGcmAddressToOffset(uint32_t address, uint32_t offsPtr, Cel
 
 uint32_t CellGcm::cellGcmSetDisplayBuffer(uint8_t bufId, uint32_t offset, uint32_t pitch, uint32_t width, uint32_t height, CellPPU *ppu)
 {
-    printf("cellGcmSetDisplayBuffer(%d, 0x%08x, 0x%08x, %d, %d)\n", bufId, offset, pitch, width, height);
+    LOG(HLE, TRACE, "cellGcmSetDisplayBuffer(%d, 0x%08x, 0x%08x, %d, %d)\n", bufId, offset, pitch, width, height);
     rsx->SetFramebuffer(bufId, offset, pitch, width, height);
     return CELL_OK;
 }
@@ -268,7 +272,7 @@ int CellGcm::cellGcmSetFlipCommand(uint32_t contextPtr, uint32_t id, CellPPU *pp
 
     if (current+4 >= end)
     {
-        printf("bad flip!\n");
+        LOG(HLE, ERROR, "bad flip!\n");
         throw std::runtime_error("bad flip");
     }
 
@@ -288,13 +292,13 @@ uint32_t CellGcm::cellGcmGetControlRegister(CellPPU* ppu)
 
 uint32_t CellGcm::cellGcmGetFlipStatus()
 {
-    // printf("cellGcmGetFlipStatus() = %d\n", rsx->GetFlipped());
+    // LOG(HLE, TRACE, "cellGcmGetFlipStatus() = %d\n", rsx->GetFlipped());
     return !rsx->GetFlipped();
 }
 
 void CellGcm::cellGcmResetFlipStatus()
 {
-    printf("cellGcmResetFlipStatus()\n");
+    LOG(HLE, TRACE, "cellGcmResetFlipStatus()\n");
     rsx->GetFlipped() = false;
 }
 
@@ -313,7 +317,7 @@ const uint32_t tiled_pitches[] =
 
 uint32_t CellGcm::cellGcmGetTiledPitchSize(uint32_t size)
 {
-    printf("cellGcmGetTiledPitchSize(%d)\n", size);
+    LOG(HLE, TRACE, "cellGcmGetTiledPitchSize(%d)\n", size);
 
     for (size_t i = 0; i < std::size(tiled_pitches) - 1; i++)
     {
@@ -326,7 +330,7 @@ uint32_t CellGcm::cellGcmGetTiledPitchSize(uint32_t size)
 
 uint32_t CellGcm::cellGcmSetTileInfo(uint8_t index, uint8_t location, uint32_t offset, uint32_t size, uint32_t pitch, uint8_t comp, uint16_t base, uint8_t bank, CellPPU* ppu)
 {
-    printf("cellGcmSetTileInfo(%d, %d, 0x%08x, 0x%08x, %d, %d, %d, %d)\n", index, location, offset, size, pitch, comp, base, bank);
+    LOG(HLE, TRACE, "cellGcmSetTileInfo(%d, %d, 0x%08x, 0x%08x, %d, %d, %d, %d)\n", index, location, offset, size, pitch, comp, base, bank);
     
     if (index >= 15 || base >= 800 || bank >= 4)
         return CELL_GCM_ERROR_INVALID_VALUE;
@@ -339,7 +343,7 @@ uint32_t CellGcm::cellGcmSetTileInfo(uint8_t index, uint8_t location, uint32_t o
     
     if (comp)
     {
-        printf("TODO: Compression of tile info!\n");
+        LOG(HLE, WARN, "TODO: Compression of tile info!\n");
     }
 
     auto& tile = tiles[index];
@@ -362,7 +366,7 @@ uint32_t CellGcm::cellGcmSetTileInfo(uint8_t index, uint8_t location, uint32_t o
 
 uint32_t CellGcm::cellGcmBindTile(uint8_t index)
 {
-    printf("cellGcmBindTile(%d)\n", index);
+    LOG(HLE, TRACE, "cellGcmBindTile(%d)\n", index);
 
     if (index >= 15)
         return CELL_GCM_ERROR_INVALID_VALUE;
@@ -373,7 +377,7 @@ uint32_t CellGcm::cellGcmBindTile(uint8_t index)
 
 uint32_t CellGcm::cellVideoOutGetResolutionAvailability(uint32_t videoOut, uint32_t resolutionId, uint32_t aspect, CellPPU *ppu)
 {
-    printf("cellVideoOutGetResolutionAvailability(%d, %d, %d)\n", videoOut, resolutionId, aspect);
+    LOG(HLE, TRACE, "cellVideoOutGetResolutionAvailability(%d, %d, %d)\n", videoOut, resolutionId, aspect);
 
     switch (videoOut)
     {
@@ -388,10 +392,9 @@ uint32_t CellGcm::cellVideoOutGetResolutionAvailability(uint32_t videoOut, uint3
 
 void CellGcm::cellGcmSetFlipHandler(uint32_t handlerPtr, CellPPU* ppu)
 {
-    printf("cellGcmSetFlipHandler(handler=*0x%08x)\n", handlerPtr);
+    LOG(HLE, TRACE, "cellGcmSetFlipHandler(handler=*0x%08x)\n", handlerPtr);
 
     flipHandler = ppu->GetManager()->Read32(handlerPtr);
-    gGcmPPU = ppu;
 }
 
 void CellGcm::cellGcmCallback(CellPPU* ppu)
@@ -411,9 +414,18 @@ void CellGcm::cellGcmCallback(CellPPU* ppu)
     ppu->GetManager()->Write32(gcm_info.control_addr+4, 0);
 }
 
-void CellGcm::RunFlipHandler()
+void CellGcm::QueueFlipHandler()
 {
-    gGcmPPU->RunSubroutine(flipHandler);
+    if (flipHandler)
+        flipHandlerPending.store(true, std::memory_order_release);
+}
+
+void CellGcm::RunPendingFlipHandler(CellPPU* ppu)
+{
+    // Whichever PPU gets back to its dispatch loop with a thread first takes it,
+    // so it isn't skipped just because the PPU driving vblank is idle
+    if (flipHandlerPending.load(std::memory_order_relaxed) && flipHandlerPending.exchange(false, std::memory_order_acquire))
+        ppu->RunSubroutine(flipHandler);
 }
 
 uint32_t CellGcm::GetIOAddres()
@@ -425,3 +437,9 @@ uint32_t CellGcm::GetControlAddress()
 {
     return gcm_info.control_addr;
 }
+
+void CellGcm::SetAddresses(uint32_t ioAddress, uint32_t controlAddress)
+{
+    config.ioAddress = ioAddress;
+    gcm_info.control_addr = controlAddress;
+}
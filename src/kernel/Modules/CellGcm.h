@@ -60,11 +60,15 @@ void cellGcmSetFlipHandler(uint32_t handlerPtr, CellPPU* ppu);
 // System call (custom)
 void cellGcmCallback(CellPPU* ppu);
 
-void RunFlipHandler();
+// Marks the flip handler as due, once per vblank
+void QueueFlipHandler();
+// Called from a PPU's dispatch loop while it has a guest thread, runs a due flip handler on that thread's stack
+void RunPendingFlipHandler(CellPPU* ppu);
 
 // Utility
 uint32_t GetIOAddres();
 uint32_t GetControlAddress();
+void SetAddresses(uint32_t ioAddress, uint32_t controlAddress); // For replaying captures, where cellGcmInit never runs
 
 struct GcmInfo
 {
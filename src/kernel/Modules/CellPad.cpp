@@ -1,8 +1,9 @@
 #include "CellPad.h"
+#include <logging.h>
 
 uint32_t CellPad::cellPadInit(uint32_t max_pads)
 {
-	printf("cellPadInit(%d)\n", max_pads);
+	LOG(HLE, TRACE, "cellPadInit(%d)\n", max_pads);
 	return CELL_OK;
 }
 
@@ -17,7 +18,7 @@ uint32_t CellPad::cellGetPadInfo(uint32_t infoPtr, CellPPU* ppu)
 	ppu->GetManager()->Write16(infoPtr+0x10A, 0x0268); // DS3 Controller
 	ppu->GetManager()->Write16(infoPtr+0x208, 1); // Connected
 
-	printf("cellGetPadInfo(0x%08x)\n", infoPtr);
+	LOG(HLE, TRACE, "cellGetPadInfo(0x%08x)\n", infoPtr);
 
 	return 0;
 }
@@ -25,6 +26,6 @@ uint32_t CellPad::cellGetPadInfo(uint32_t infoPtr, CellPPU* ppu)
 uint32_t CellPad::cellGetPadData(uint32_t port, uint32_t dataPtr, CellPPU *ppu)
 {
 	// TODO: Actually fill out data structure
-	printf("cellGetPadData(%d, 0x%08x)\n", port, dataPtr);
+	LOG(HLE, TRACE, "cellGetPadData(%d, 0x%08x)\n", port, dataPtr);
 	return 0;
 }
@@ -1,4 +1,5 @@
 #include "CellResc.h"
+#include <logging.h>
 
 struct RescInitCfg
 {
@@ -13,7 +14,7 @@ struct RescInitCfg
 
 uint32_t CellResc::cellRescInit(uint32_t initCfgPtr, CellPPU *ppu)
 {
-	printf("cellRescInit(0x%08x)\n", initCfgPtr);
+	LOG(HLE, TRACE, "cellRescInit(0x%08x)\n", initCfgPtr);
 
 	rescConfig.size = ppu->GetManager()->Read32(initCfgPtr+0x00);
 	rescConfig.resource_policy = ppu->GetManager()->Read32(initCfgPtr+0x04);
@@ -28,14 +29,14 @@ uint32_t CellResc::cellRescInit(uint32_t initCfgPtr, CellPPU *ppu)
 
 uint32_t CellResc::cellRescVideoResId2RescBufferMode(uint32_t id, uint32_t outPtr, CellPPU *ppu)
 {
-	printf("cellRescVideoResId2RescBufferMode(0x%08x, 0x%08x)\n", id, outPtr);
+	LOG(HLE, TRACE, "cellRescVideoResId2RescBufferMode(0x%08x, 0x%08x)\n", id, outPtr);
 
 	uint32_t resId = 0;
 	switch (id)
 	{
 	case 2: resId = 4; break;
 	default:
-		printf("[CellResc]: Unknown resolution ID %d\n", id);
+		LOG(HLE, ERROR, "[CellResc]: Unknown resolution ID %d\n", id);
 		exit(1);
 	}
 
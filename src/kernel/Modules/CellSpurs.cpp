@@ -2,9 +2,11 @@
 #include "util.h"
 #include <string.h>
 #include <cpu/PPU.h>
+#include <kernel/Modules/CellThread.h>
 #include <stdexcept>
 #include <cassert>
 #include <fstream>
+#include <logging.h>
 
 BEGIN_BE_STRUCT(Elf32Header)
     uint8_t e_ident[16];
@@ -49,8 +51,8 @@ public:
 		if (ehdr.e_ident[1] != 'E' || ehdr.e_ident[2] != 'L'
 			|| ehdr.e_ident[3] != 'F')
 		{
-			printf("MALFORMED SPU ELF\n");
-			printf("%c%c%c\n", ehdr.e_ident[1], ehdr.e_ident[2], ehdr.e_ident[3]);
+			LOG(HLE, ERROR, "MALFORMED SPU ELF\n");
+			LOG(HLE, ERROR, "%c%c%c\n", ehdr.e_ident[1], ehdr.e_ident[2], ehdr.e_ident[3]);
 			throw std::runtime_error("Invalid SPU ELF");
 		}
 
@@ -68,7 +70,7 @@ public:
 		ehdr.Read_e_shnum(ptr);
 		ehdr.Read_e_shstrndx(ptr);
 
-		printf("Loading SPU ELF with %d program headers, entry 0x%08x\n", ehdr.e_phnum, ehdr.e_entry);
+		LOG(HLE, TRACE, "Loading SPU ELF with %d program headers, entry 0x%08x\n", ehdr.e_phnum, ehdr.e_entry);
 
 		for (int i = 0; i < ehdr.e_phnum; i++)
 		{
@@ -88,7 +90,7 @@ public:
 				continue;
 			
 			phdrs.push_back(phdr);
-			printf("Marking phdr to load: offs: 0x%08x, vaddr: 0x%08x, paddr: 0x%08x, flags: 0x%x\n", phdr.p_offset, phdr.p_vaddr, phdr.p_paddr, phdr.p_flags);
+			LOG(HLE, TRACE, "Marking phdr to load: offs: 0x%08x, vaddr: 0x%08x, paddr: 0x%08x, flags: 0x%x\n", phdr.p_offset, phdr.p_vaddr, phdr.p_paddr, phdr.p_flags);
 		}
 	}
 
@@ -102,7 +104,7 @@ public:
 		if (index >= phdrs.size())
 			return NULL;
 		
-		printf("Getting phdr at offset 0x%08x\n", phdrs[index].p_offset);
+		LOG(HLE, TRACE, "Getting phdr at offset 0x%08x\n", phdrs[index].p_offset);
 		return basePtr+phdrs[index].p_offset;
 	}
 
@@ -143,6 +145,7 @@ public:
 	int priority;
 
 	SpuThread* threads[6];
+	SleepQueue joiners; // PPU threads in sys_spu_thread_group_join
 };
 
 std::unordered_map<int, SpuThreadGroup*> spuGroups;
@@ -158,7 +161,7 @@ uint32_t CellSpu::sysSpuThreadGroupCreate(uint64_t idPtr, int num, int prio, uin
 
 	ppu->GetManager()->Write32(idPtr, group->id);
 
-	printf("sysSpuThreadGroupCreate(id=*0x%08lx, num=%d, prio=%d, attr=*0x%08lx)\n", idPtr, num, prio, attrPtr);
+	LOG(HLE, TRACE, "sysSpuThreadGroupCreate(id=*0x%08lx, num=%d, prio=%d, attr=*0x%08lx)\n", idPtr, num, prio, attrPtr);
 	return CELL_OK;
 }
 
@@ -248,7 +251,7 @@ uint32_t initSpurs(uint32_t spursAddr, uint32_t revision, uint32_t sdkVersion, i
 	}
 	if ((flags & 4) != 0)
 	{
-		printf("TODO: Spurs2\n");
+		LOG(HLE, ERROR, "TODO: Spurs2\n");
 		exit(1);
 	}
 	// TODO: Create srv sema and assign it here
@@ -273,6 +276,7 @@ uint32_t initSpurs(uint32_t spursAddr, uint32_t revision, uint32_t sdkVersion, i
 	{
 		spursThreadGroup->threads[i] = new SpuThread();
 		auto& t = spursThreadGroup->threads[i];
+		t->group = spursThreadGroup->id;
 		t->arg0 = (uint64_t)i << 0x20;
 		t->arg1 = spursAddr;
 		t->entry = loader.GetEntry();
@@ -301,7 +305,7 @@ uint32_t CellSpu::cellSpursAttributeInitialize(uint32_t attrPtr, uint32_t revisi
 													int32_t spuPriority, int32_t ppuPriority, 
 													bool exitIfNoWork, CellPPU* ppu)
 {
-	printf("_cellSpursAttributeInitialize(attr=*0x%x, revision=%d, sdkVersion=0x%x, nSpus=%d, spuPriority=%d, ppuPriority=%d, exitIfNoWork=%d)\n",
+	LOG(HLE, TRACE, "_cellSpursAttributeInitialize(attr=*0x%x, revision=%d, sdkVersion=0x%x, nSpus=%d, spuPriority=%d, ppuPriority=%d, exitIfNoWork=%d)\n",
 		attrPtr, revision, sdkVersion, nSpus, spuPriority, ppuPriority, exitIfNoWork);
 	
 	if (!attrPtr)
@@ -326,14 +330,14 @@ uint32_t CellSpu::cellSpursAttributeInitialize(uint32_t attrPtr, uint32_t revisi
 
 uint32_t CellSpu::cellSpursAttributeEnableSpuPrintfIfAvailable(uint32_t attrPtr, CellPPU* ppu)
 {
-	printf("cellSpursAttributeEnableSpuPrintfIfAvailable(attr=*0x%08x)\n", attrPtr);
+	LOG(HLE, TRACE, "cellSpursAttributeEnableSpuPrintfIfAvailable(attr=*0x%08x)\n", attrPtr);
 	ppu->GetManager()->Write32(attrPtr+0x28, ppu->GetManager()->Read32(attrPtr+0x28) | 0x10000000);
 	return CELL_OK;
 }
 
 uint32_t CellSpu::cellSpursAttributeSetNamePrefix(uint32_t attrPtr, uint32_t namePtr, uint64_t size, CellPPU* ppu)
 {
-	printf("cellSpursAttributeSetNamePrefix(0x%08x, %s)\n", attrPtr, ppu->GetManager()->GetRawPtr(namePtr));
+	LOG(HLE, TRACE, "cellSpursAttributeSetNamePrefix(0x%08x, %s)\n", attrPtr, ppu->GetManager()->GetRawPtr(namePtr));
 	memcpy(ppu->GetManager()->GetRawPtr(attrPtr+0x15), ppu->GetManager()->GetRawPtr(namePtr), size);
 
 	return CELL_OK;
@@ -341,7 +345,7 @@ uint32_t CellSpu::cellSpursAttributeSetNamePrefix(uint32_t attrPtr, uint32_t nam
 
 uint32_t CellSpu::cellSpursInitializeWithAttribute2(uint32_t spursPtr, uint32_t attrPtr, CellPPU *ppu)
 {
-	printf("cellSpursInitializeWithAttribute2(0x%08x, 0x%08x)\n", spursPtr, attrPtr);
+	LOG(HLE, TRACE, "cellSpursInitializeWithAttribute2(0x%08x, 0x%08x)\n", spursPtr, attrPtr);
 
 	// TODO: Write out the massive structure that holds all SPURS information
 
@@ -350,7 +354,7 @@ uint32_t CellSpu::cellSpursInitializeWithAttribute2(uint32_t spursPtr, uint32_t
 
 uint32_t CellSpu::cellSpursTasksetAttributeInitialize(uint32_t attrPtr, uint32_t revision, uint32_t sdkVersion, uint64_t args, uint32_t priorityPtr, uint32_t maxContention, CellPPU *ppu)
 {
-	printf("cellSpursTasksetAttributeInitialize(0x%08x, 0x%08x, 0x%08x, 0x%08lx, 0x%08x, 0x%08x)\n", attrPtr, revision, sdkVersion, args, priorityPtr);
+	LOG(HLE, TRACE, "cellSpursTasksetAttributeInitialize(0x%08x, 0x%08x, 0x%08x, 0x%08lx, 0x%08x, 0x%08x)\n", attrPtr, revision, sdkVersion, args, priorityPtr);
 
 	if (!attrPtr)
 	{
@@ -382,7 +386,7 @@ uint32_t CellSpu::cellSpursTasksetAttributeSetName(uint32_t attrPtr, uint32_t na
 {
 	const char* name = (const char*)ppu->GetManager()->GetRawPtr(namePtr);
 
-	printf("cellSpursTasksetAttributeSetName(0x%08x, \"%s\")\n", attrPtr, name);
+	LOG(HLE, TRACE, "cellSpursTasksetAttributeSetName(0x%08x, \"%s\")\n", attrPtr, name);
 
 	ppu->GetManager()->Write32(attrPtr+0x1C, namePtr);
 
@@ -396,13 +400,13 @@ uint32_t CellSpu::cellSpursInitialize(uint32_t spursPtr, int nSpus, int spuPrior
 
 uint32_t sys_spu_thread_group_connect_event_all_threads(uint32_t id, uint32_t eq, uint64_t req, uint32_t spuPtr, CellPPU* ppu)
 {
-	printf("sys_spu_thread_group_connect_event_all_threads(%d, %d, 0x%08lx, 0x%08x)\n", id, eq, req, spuPtr);
+	LOG(HLE, TRACE, "sys_spu_thread_group_connect_event_all_threads(%d, %d, 0x%08lx, 0x%08x)\n", id, eq, req, spuPtr);
 
 	uint8_t port = 0;
 
 	if (!spuGroups[id])
 	{
-		printf("Tried to connect event to non-existant thread queue");
+		LOG(HLE, ERROR, "Tried to connect event to non-existant thread queue");
 		exit(1);
 	}
 
@@ -438,7 +442,7 @@ uint32_t sys_spu_thread_group_connect_event_all_threads(uint32_t id, uint32_t eq
 
 	if (port == 64)
 	{
-		printf("CELL_EISCONN\n");
+		LOG(HLE, ERROR, "CELL_EISCONN\n");
 		exit(1);
 	}
 
@@ -461,7 +465,7 @@ uint32_t sys_spu_thread_group_connect_event_all_threads(uint32_t id, uint32_t eq
 
 uint32_t CellSpu::cellSpursAttachLV2EventQueue(uint32_t spursPtr, uint32_t queueId, uint32_t portPtr, int isDynamic, CellPPU* ppu)
 {
-	printf("cellSpursAttachLV2EventQueue(0x%08x, %d, 0x%08x, %d)\n", spursPtr, queueId, portPtr, isDynamic);
+	LOG(HLE, TRACE, "cellSpursAttachLV2EventQueue(0x%08x, %d, 0x%08x, %d)\n", spursPtr, queueId, portPtr, isDynamic);
 
 	if (!spursPtr || !portPtr)
 	{
@@ -500,7 +504,7 @@ uint32_t CellSpu::cellSpursAttachLV2EventQueue(uint32_t spursPtr, uint32_t queue
 
 uint32_t CellSpu::cellSpursGetInfo(uint32_t spurs, uint32_t info, CellPPU* ppu)
 {
-	printf("cellSpursGetInfo(0x%08x, 0x%08x)\n", spurs, info);
+	LOG(HLE, TRACE, "cellSpursGetInfo(0x%08x, 0x%08x)\n", spurs, info);
 
 	if (!spurs || !info)
 	{
@@ -546,7 +550,7 @@ uint32_t CellSpu::sysSpuImageImport(uint64_t imagePtr, uint32_t src, uint32_t si
 	// This doesn't follow the struct layout, but it's convenient and no game should touch it anyway
 	ppu->GetManager()->Write64(imagePtr+0x08, (uintptr_t)loader);
 
-	printf("sysSpuImageImport(image=*0x%08lx, src=*0x%08x, size=0x%08x, arg4=0x%08x)\n", imagePtr, src, size, arg4);
+	LOG(HLE, TRACE, "sysSpuImageImport(image=*0x%08lx, src=*0x%08x, size=0x%08x, arg4=0x%08x)\n", imagePtr, src, size, arg4);
 	return CELL_OK;
 }
 
@@ -568,7 +572,7 @@ uint32_t CellSpu::sysSpuImageLoad(uint32_t spuIndex, uint64_t imagePtr, CellPPU
 
 	ppu->spus[spuIndex]->SetEntry(elf->GetEntry());
 
-	printf("ELF Loaded\n");
+	LOG(HLE, TRACE, "ELF Loaded\n");
 	return CELL_OK;
 }
 
@@ -578,7 +582,7 @@ uint32_t CellSpu::sysSpuImageClose(uint64_t imagePtr, CellPPU *ppu)
 
 	delete elf;
 
-	printf("sysSpuImageClose(image=*0x%08lx)\n", imagePtr);
+	LOG(HLE, TRACE, "sysSpuImageClose(image=*0x%08lx)\n", imagePtr);
 
 	return CELL_OK;
 }
@@ -590,8 +594,8 @@ uint32_t CellSpu::sysSpuThreadInitialize(uint64_t idPtr, uint32_t groupId, uint3
 
 	std::string name((const char*)ppu->GetManager()->GetRawPtr(namePtr), nameLen);
 
-	printf("sysSpuThreadInitialize(id=*0x%08lx, group=%d, spuNum=%d, imagePtr=*0x%08lx, attrPtr=*0x%08lx, argPtr=*0x%08lx)\n", idPtr, groupId, spuNum, imagePtr, attrPtr, argPtr);
-	printf("name = %s\n", name.c_str());
+	LOG(HLE, TRACE, "sysSpuThreadInitialize(id=*0x%08lx, group=%d, spuNum=%d, imagePtr=*0x%08lx, attrPtr=*0x%08lx, argPtr=*0x%08lx)\n", idPtr, groupId, spuNum, imagePtr, attrPtr, argPtr);
+	LOG(HLE, TRACE, "name = %s\n", name.c_str());
 
 	SpuThreadGroup* group = spuGroups[groupId];
 
@@ -636,6 +640,7 @@ uint32_t CellSpu::sysSpuThreadInitialize(uint64_t idPtr, uint32_t groupId, uint3
 	t->arg3 = arg3;
 
 	t->spu = spuNum;
+	t->group = groupId;
 
 	group->threads[spuNum] = t;
 	spuThreads[t->id] = t;
@@ -649,7 +654,7 @@ uint32_t CellSpu::sysSpuThreadGroupStart(uint32_t groupId)
 {
 	SpuThreadGroup* group = spuGroups[groupId];
 
-	printf("Found group with id=%d\n", group->id);
+	LOG(HLE, TRACE, "Found group with id=%d\n", group->id);
 
 	if (!group)
 	{
@@ -658,7 +663,7 @@ uint32_t CellSpu::sysSpuThreadGroupStart(uint32_t groupId)
 
 	for (int i = 0; i < 6; i++)
 	{
-		printf("%p\n", group->threads[i]);
+		LOG(HLE, TRACE, "%p\n", group->threads[i]);
 		if (group->threads[i])
 			g_spus[i]->SetThread(group->threads[i]);
 	}
@@ -670,40 +675,65 @@ uint32_t CellSpu::sysSpuThreadGroupJoin(uint32_t groupId, uint64_t causePtr, uin
 {
 	if (!spuGroups.contains(groupId))
 	{
-		printf("WARNING: Invalid thread group id\n");
+		LOG(HLE, WARN, "WARNING: Invalid thread group id\n");
 		return CELL_EINVAL;
 	}
 
 	SpuThreadGroup* group = spuGroups[groupId];
 
+	LOG(HLE, TRACE, "sysSpuThreadGroupJoin(groupId=%d, cause=*0x%08lx, status=*0x%08lx)\n", groupId, causePtr, statusPtr);
+
+	// Nothing on the way out depends on how the group stopped, so the results can go in before sleeping
+	ppu->GetManager()->Write32(causePtr, 1);
+	ppu->GetManager()->Write32(statusPtr, 0);
+
 	for (int i = 0; i < 6; i++)
 	{
 		if (group->threads[i] && group->threads[i]->running)
 		{
-			printf("TODO: Putting PPU to sleep waiting on SPU\n");
-			exit(1);
+			// kernelLock is held from here until the thread is queued, so a stop in between still finds it
+			group->joiners.Sleep(ppu);
+			hostWaiters++;
+			break;
 		}
 	}
 
-	ppu->GetManager()->Write32(causePtr, 1);
-	ppu->GetManager()->Write32(statusPtr, 0);
+	return CELL_OK;
+}
 
-	printf("sysSpuThreadGroupJoin(groupId=%d, cause=*0x%08lx, status=*0x%08lx)\n", groupId, causePtr, statusPtr);
+void CellSpu::SpuThreadStopped(SpuThread* thread)
+{
+	std::lock_guard<std::recursive_mutex> lock(kernelLock);
 
-	return CELL_OK;
+	auto it = spuGroups.find(thread->group);
+	if (it == spuGroups.end())
+		return;
+
+	SpuThreadGroup* group = it->second;
+	for (int i = 0; i < 6; i++)
+	{
+		if (group->threads[i] && group->threads[i]->running)
+			return;
+	}
+
+	while (!group->joiners.Empty())
+	{
+		WakeThread(group->joiners.Pop().thread);
+		hostWaiters--;
+	}
 }
 
 uint32_t CellSpu::sysSpuThreadSetSpuCfg(uint32_t threadId, uint64_t value)
 {
 	if (!spuThreads.contains(threadId))
 	{
-		printf("sysSpuThreadSetSpuCfg: Invalid thread ID\n");
+		LOG(HLE, WARN, "sysSpuThreadSetSpuCfg: Invalid thread ID 0x%x\n", threadId);
 		return CELL_EINVAL;
 	}
 
 	spuThreads[threadId]->cfg = value;
 
-	printf("sysSpuThreadSetSpuCfg(threadId=*%d, value=*0x%08lx)\n", threadId, value);
+	LOG(HLE, TRACE, "sysSpuThreadSetSpuCfg(threadId=*%d, value=*0x%08lx)\n", threadId, value);
 	return CELL_OK;
 }
 
@@ -713,14 +743,14 @@ uint32_t CellSpu::sysSpuThreadWriteSnr(uint32_t id, int number, uint32_t value)
 
 	if (!spuThreads.contains(id))
 	{
-		printf("sysSpuThreadWriteSnr: Invalid thread ID\n");
+		LOG(HLE, WARN, "sysSpuThreadWriteSnr: Invalid thread ID 0x%x\n", id);
 		return CELL_EINVAL;
 	}
 
 	int spuNum = spuThreads[id]->spu;
 	g_spus[spuNum]->WriteProblemStorage(0x1400C, value);
 
-	printf("sysSpuThreadWriteSnr(id=0x%08x, number=%d, value=0x%08x)\n", id, number, value);
+	LOG(HLE, TRACE, "sysSpuThreadWriteSnr(id=0x%08x, number=%d, value=0x%08x)\n", id, number, value);
 
 	return CELL_OK;
 }
@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <string>
 #include <cstring>
+#include <atomic>
 #include <kernel/types.h>
 
 class CellPPU;
@@ -15,7 +16,8 @@ public:
 	uint32_t id;
 	static uint32_t curId;
 	std::string name;
-	bool running;
+	std::atomic<bool> running; // Cleared by the SPU's host thread on stop
+	int group = -1;
 	uint64_t cfg;
 	int spu;
 	uint64_t spup[64];
@@ -52,6 +54,8 @@ uint32_t sysSpuThreadGroupCreate(uint64_t idPtr, int num, int prio, uint64_t att
 uint32_t sysSpuThreadInitialize(uint64_t idPtr, uint32_t groupId, uint32_t spuNum, uint64_t imagePtr, uint64_t attrPtr, uint64_t argPtr, CellPPU* ppu);
 uint32_t sysSpuThreadGroupStart(uint32_t groupId);
 uint32_t sysSpuThreadGroupJoin(uint32_t groupId, uint64_t causePtr, uint64_t statusPtr, CellPPU* ppu);
+// Called on the SPU's host thread after thread stopped, wakes anything joining its group once the whole group has. Takes kernelLock
+void SpuThreadStopped(SpuThread* thread);
 uint32_t sysSpuThreadSetSpuCfg(uint32_t threadId, uint64_t value);
 uint32_t sysSpuThreadWriteSnr(uint32_t id, int number, uint32_t value);
 
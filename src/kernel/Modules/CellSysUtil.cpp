@@ -1,7 +1,9 @@
 #include "CellSysUtil.h"
+#include "CellThread.h"
 
 #include <string.h>
 #include <string>
+#include <logging.h>
 
 class CallbackManager
 {
@@ -17,7 +19,7 @@ public:
 
 int32_t CellSysUtil::sysUtilGetSystemParamInt(int32_t id, uint64_t paramPtr, CellPPU* ppu)
 {
-	printf("sysUtilGetSystemParamInt(0x%03x, 0x%08lx)\n", id, paramPtr);
+	LOG(HLE, TRACE, "sysUtilGetSystemParamInt(0x%03x, 0x%08lx)\n", id, paramPtr);
 
 	uint32_t value = 0;
 
@@ -32,7 +34,7 @@ int32_t CellSysUtil::sysUtilGetSystemParamInt(int32_t id, uint64_t paramPtr, Cel
 	case 0x122:
 		return 0x8002b102;
 	default:
-		printf("Unknown sysutil parameter id 0x%03x\n", id);
+		LOG(HLE, ERROR, "Unknown sysutil parameter id 0x%03x\n", id);
 		exit(1);
 	}
 
@@ -42,7 +44,7 @@ int32_t CellSysUtil::sysUtilGetSystemParamInt(int32_t id, uint64_t paramPtr, Cel
 
 uint32_t CellSysUtil::cellSysutilRegisterCallback(uint32_t slot, uint32_t funcAddr, uint32_t userdata, CellPPU* ppu)
 {
-	printf("0x%08lx: cellSysutilRegisterCallback(%d, 0x%08x, 0x%08x)\n", ppu->GetState().lr, slot, funcAddr, userdata);
+	LOG(HLE, TRACE, "0x%08lx: cellSysutilRegisterCallback(%d, 0x%08x, 0x%08x)\n", ppu->GetState().lr, slot, funcAddr, userdata);
 
 	if (slot >= 4)
 	{
@@ -60,12 +62,12 @@ uint32_t CellSysUtil::cellSysutilCheckCallback(CellPPU *ppu)
 	{
 		if (cbManager.callbacks[i].callback != 0)
 		{
-			printf("Running callback\n");
+			LOG(HLE, TRACE, "Running callback\n");
 			ppu->SetReg(3, cbManager.callbacks[i].userdata);
 			ppu->SetReg(2, ppu->GetManager()->Read32(cbManager.callbacks[i].callback+4));
-			ppu->RunSubroutine(ppu->GetManager()->Read32(cbManager.callbacks[i].callback));
+			RunGuestSubroutine(ppu, ppu->GetManager()->Read32(cbManager.callbacks[i].callback));
 			cbManager.callbacks[i].callback = 0;
-			printf("Done\n");
+			LOG(HLE, TRACE, "Done\n");
 		}
 	}
 
@@ -82,7 +84,7 @@ uint32_t CellSysUtil::cellSysutilGetSystemParamString(int32_t id, uint32_t param
 		value = "user"; // default username. TODO: Make this customizable
 		break;
 	default:
-		printf("Unknown system string parameter id 0x%03x!\n", id);
+		LOG(HLE, ERROR, "Unknown system string parameter id 0x%03x!\n", id);
 		exit(1);
 	}
 
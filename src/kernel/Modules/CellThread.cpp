@@ -2,9 +2,34 @@
 #include <cstring>
 #include <vector>
 #include <memory>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <logging.h>
+
+std::recursive_mutex kernelLock;
 
-size_t curThreadIndex = 0;
 std::vector<Thread*> threads;
+static uint32_t nextThreadId = 0x24;
+
+// A CellPPU running guest threads on one host thread
+struct Worker
+{
+	CellPPU* ppu;
+	Thread* thread = nullptr; // nullptr while it's idle
+};
+
+static std::vector<Worker*> workers;
+static thread_local Worker* worker = nullptr;
+static size_t idleWorkers = 0;
+static std::condition_variable_any threadReady;
+static std::condition_variable_any threadWoken; // For threads waiting in place inside a callback
+size_t hostWaiters = 0;
+
+// Runnable threads by priority, 0 being the highest. Running and waiting threads aren't in here,
+// so threads blocked on something cost nothing until they're woken
+static std::map<int32_t, std::deque<Thread*>> runQueues;
 
 static uint32_t tls_addr = 0;
 static uint32_t tls_file = 0;
@@ -14,22 +39,207 @@ static uint32_t tls_area = 0;
 static uint32_t tls_max = 0;
 static std::unique_ptr<bool[]> tls_map;
 
+static void MakeReady(Thread* thread)
+{
+	thread->threadState = Thread::Sleeping;
+
+	// Still on its PPU, it only has to notice
+	if (thread->waitingInPlace)
+	{
+		threadWoken.notify_all();
+		return;
+	}
+
+	runQueues[thread->GetPriority()].push_back(thread);
+
+	if (idleWorkers)
+	{
+		threadReady.notify_one();
+		return;
+	}
+
+	// Otherwise it takes over from the lowest priority thread below it, once that one's PPU is back in its dispatch loop
+	Worker* lowest = nullptr;
+	for (auto w : workers)
+	{
+		if (w->thread && w->thread->GetPriority() > thread->GetPriority() && (!lowest || w->thread->GetPriority() > lowest->thread->GetPriority()))
+			lowest = w;
+	}
+	if (lowest)
+		lowest->ppu->preemptPending = true;
+}
+
+static void RemoveFromRunQueue(Thread* thread)
+{
+	auto it = runQueues.find(thread->GetPriority());
+	if (it == runQueues.end())
+		return;
+
+	std::erase(it->second, thread);
+	if (it->second.empty())
+		runQueues.erase(it);
+}
+
+static Thread* FindThread(uint32_t id)
+{
+	for (auto t : threads)
+		if (t->GetID() == id)
+			return t;
+	return nullptr;
+}
+
 Thread* GetCurrentThread()
 {
-	return threads[curThreadIndex];
+	return worker ? worker->thread : nullptr;
 }
 
+// Takes the first thread of the highest priority off its run queue, the caller has to requeue the current one
 Thread *Reschedule()
 {
-	while (true)
+	worker->ppu->preemptPending = false;
+
+	if (runQueues.empty())
 	{
-		curThreadIndex++;
-		if (curThreadIndex >= threads.size())
-			curThreadIndex = 0;
-		if (threads[curThreadIndex]->threadState == Thread::Waiting)
-			continue;
-		return threads[curThreadIndex];
+		worker->thread = nullptr;
+
+		// Short of an SPU, nothing but another guest thread can wake a waiting one, so if no PPU is running one they wait forever
+		if (++idleWorkers == workers.size() && !hostWaiters)
+		{
+			LOG(HLE, ERROR, "Deadlock: every thread is waiting\n");
+			exit(1);
+		}
+		return nullptr;
 	}
+
+	auto it = runQueues.begin();
+	worker->thread = it->second.front();
+	it->second.pop_front();
+	if (it->second.empty())
+		runQueues.erase(it);
+
+	return worker->thread;
+}
+
+static void SwitchToNextThread(CellPPU* ppu)
+{
+	if (Thread* next = Reschedule())
+		next->Switch(ppu);
+}
+
+void AddWorker(CellPPU* ppu)
+{
+	std::lock_guard<std::recursive_mutex> lock(kernelLock);
+
+	worker = new Worker{ppu};
+	workers.push_back(worker);
+	SwitchToNextThread(ppu);
+}
+
+bool WaitForThread(CellPPU* ppu)
+{
+	std::unique_lock<std::recursive_mutex> lock(kernelLock);
+
+	if (!threadReady.wait_for(lock, std::chrono::milliseconds(1), [] {return !runQueues.empty();}))
+		return false;
+
+	idleWorkers--;
+	SwitchToNextThread(ppu);
+	return true;
+}
+
+void SwitchFromBlockedThread(CellPPU* ppu)
+{
+	if (ppu->subroutineDepth)
+	{
+		Thread* current = worker->thread;
+		current->waitingInPlace = true;
+		while (current->threadState == Thread::Waiting)
+		{
+			// This PPU is taken, so the waker has to run on another one or be an SPU
+			if (!hostWaiters && (workers.size() == 1 || (idleWorkers == workers.size() - 1 && runQueues.empty())))
+			{
+				LOG(HLE, ERROR, "Deadlock: thread 0x%x blocked inside a callback and no other PPU can wake it\n", current->GetID());
+				exit(1);
+			}
+			threadWoken.wait_for(kernelLock, std::chrono::milliseconds(1));
+		}
+		current->waitingInPlace = false;
+		current->threadState = Thread::Running;
+		return;
+	}
+
+	worker->thread->Save(ppu);
+	SwitchToNextThread(ppu);
+}
+
+void PreemptThread(CellPPU* ppu)
+{
+	std::lock_guard<std::recursive_mutex> lock(kernelLock);
+
+	ppu->preemptPending = false;
+
+	// The thread may have exited or gone to sleep since the dispatch loop last looked
+	Thread* current = worker->thread;
+	if (!current || current->threadState != Thread::Running)
+		return;
+
+	// Lower priority threads only get to run when everything above them is waiting or running elsewhere
+	if (runQueues.empty() || runQueues.begin()->first > current->GetPriority())
+		return;
+
+	current->Save(ppu);
+	MakeReady(current);
+	SwitchToNextThread(ppu);
+}
+
+void RunGuestSubroutine(CellPPU* ppu, uint32_t addr)
+{
+	kernelLock.unlock();
+	try
+	{
+		ppu->RunSubroutine(addr);
+	}
+	catch (...)
+	{
+		kernelLock.lock();
+		throw;
+	}
+	kernelLock.lock();
+}
+
+void SleepQueue::Sleep(CellPPU* ppu, uint32_t data)
+{
+	Thread* thread = GetCurrentThread();
+	thread->threadState = Thread::Waiting;
+	sleepers.push_back({thread, data});
+	ppu->threadBlocked = true;
+}
+
+Sleeper SleepQueue::Pop()
+{
+	Sleeper sleeper = sleepers.front();
+	sleepers.pop_front();
+	return sleeper;
+}
+
+bool SleepQueue::Remove(uint32_t threadId, Sleeper& sleeper)
+{
+	for (auto it = sleepers.begin(); it != sleepers.end(); ++it)
+	{
+		if (it->thread->GetID() == threadId)
+		{
+			sleeper = *it;
+			sleepers.erase(it);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void WakeThread(Thread* thread)
+{
+	MakeReady(thread);
 }
 
 static uint32_t ppu_alloc_tls(MemoryManager& manager)
@@ -58,11 +268,11 @@ static uint32_t ppu_alloc_tls(MemoryManager& manager)
 
 void CellThread::sysInitializeTLS(uint64_t mainThreadID, uint32_t tlsSegAddr, uint32_t tlsSegSize, uint32_t tlsMemSize, CellPPU* ppu)
 {
-	printf("sysInitializeTLS(0x%08lx, 0x%08x, 0x%08x, 0x%08x)\n", mainThreadID, tlsSegAddr, tlsSegSize, tlsMemSize);
+	LOG(HLE, TRACE, "sysInitializeTLS(0x%08lx, 0x%08x, 0x%08x, 0x%08x)\n", mainThreadID, tlsSegAddr, tlsSegSize, tlsMemSize);
 
 	if (ppu->GetReg(13) != 0)
 	{
-		printf("Non-zero r13!\n");
+		LOG(HLE, TRACE, "Non-zero r13!\n");
 		return;
 	}
 
@@ -80,7 +290,7 @@ void CellThread::sysInitializeTLS(uint64_t mainThreadID, uint32_t tlsSegAddr, ui
 uint32_t CellThread::sysGetThreadId(uint32_t ptr, CellPPU *ppu)
 {
     ppu->GetManager()->Write64(ptr, GetCurrentThread()->GetID());
-    // printf("sysThreadGetId(0x%08lx)\n", ptr);
+    // LOG(HLE, TRACE, "sysThreadGetId(0x%08lx)\n", ptr);
     return CELL_OK;
 }
 
@@ -89,7 +299,7 @@ uint32_t CellThread::sysPPUGetThreadStackInformation(uint32_t ptr, CellPPU *ppu)
     ppu->GetManager()->Write32(ptr, ppu->GetStackAddr());
     ppu->GetManager()->Write32(ptr+4, 0x10000);
 
-    printf("sysPPUGetThreadStackInformation(0x%08x)\n", ptr);
+    LOG(HLE, TRACE, "sysPPUGetThreadStackInformation(0x%08x)\n", ptr);
 
     return CELL_OK;
 }
@@ -104,70 +314,120 @@ uint32_t CellThread::sysPPUThreadCreate(uint32_t threadIdPtr, uint32_t paramPtr,
 	uint32_t entry = ppu->GetManager()->Read32(paramPtr);
 	const char* name = (const char*)ppu->GetManager()->GetRawPtr(namePtr);
 
-	printf("0x%08lx: sysThreadCreateEx(0x%08x, %s, 0x%08lx, %d, 0x%08x, 0x%08lx)\n", ppu->GetState().lr, entry, name, arg, prio, stackSize, flags);
-	
-	Thread* t = new Thread(entry, globalRetAddr, stackSize, arg, namePtr, *ppu->GetManager(), false, paramPtr+4);
+	LOG(HLE, TRACE, "0x%08lx: sysThreadCreateEx(0x%08x, %s, 0x%08lx, %d, 0x%08x, 0x%08lx)\n", ppu->GetState().lr, entry, name, arg, prio, stackSize, flags);
 	
+	Thread* t = new Thread(entry, globalRetAddr, stackSize, arg, namePtr, *ppu->GetManager(), false, paramPtr+4, prio);
+	ppu->GetManager()->Write64(threadIdPtr, t->GetID());
+
+	// Interrupt threads only run once they're connected to an interrupt, which isn't supported yet
 	if (flags & 0x2)
 	{
-		return CELL_OK;
+		RemoveFromRunQueue(t);
+		t->threadState = Thread::Waiting;
 	}
 
-	printf("Switching to newly-created thread\n");
-	threads[curThreadIndex]->Save(ppu);
-	curThreadIndex = threads.size()-1;
-	t->Switch(ppu);
-	ppu->threadSwapped = true;
-
 	return CELL_OK;
 }
 
+// Once controls whose init function is running, threads that get there meanwhile sleep until it's done
+static std::map<uint32_t, SleepQueue> onceWaiters;
+
 uint32_t CellThread::sysPPUThreadOnce(uint64_t onceCtrlPtr, uint64_t initFuncPtr, CellPPU *ppu)
 {
 	int32_t ctrl = ppu->GetManager()->Read32(onceCtrlPtr);
-	printf("%d\n", ctrl);
+	LOG(HLE, TRACE, "%d\n", ctrl);
 
-	if (ctrl == 0)
-	{
-		ppu->RunSubroutine(initFuncPtr);
+	if (ctrl != 0)
+		return CELL_OK;
 
-		ppu->GetManager()->Write32(onceCtrlPtr, 1);
+	auto it = onceWaiters.find(onceCtrlPtr);
+	if (it != onceWaiters.end())
+	{
+		it->second.Sleep(ppu);
+		return CELL_OK;
 	}
 
+	// The init function is guest code, so it runs without kernelLock like any other
+	onceWaiters[onceCtrlPtr];
+	RunGuestSubroutine(ppu, initFuncPtr);
+	ppu->GetManager()->Write32(onceCtrlPtr, 1);
+
+	SleepQueue& waiters = onceWaiters[onceCtrlPtr];
+	while (!waiters.Empty())
+		WakeThread(waiters.Pop().thread);
+	onceWaiters.erase(onceCtrlPtr);
+
 	return CELL_OK;
 }
 
 uint32_t CellThread::sysPPUThreadGetPriority(uint32_t threadId, uint32_t prioPtr, CellPPU* ppu)
 {
-	ppu->GetManager()->Write32(prioPtr, 1001);
-	printf("sysPPUThreadGetPriority(id=%d, priop=*0x%08x)\n", threadId, prioPtr);
+	LOG(HLE, TRACE, "sysPPUThreadGetPriority(id=%d, priop=*0x%08x)\n", threadId, prioPtr);
+
+	Thread* t = FindThread(threadId);
+	if (!t)
+		return CELL_ESRCH;
+
+	ppu->GetManager()->Write32(prioPtr, t->GetPriority());
+	return CELL_OK;
+}
+
+uint32_t CellThread::sysPPUThreadSetPriority(uint32_t threadId, int32_t prio, CellPPU* ppu)
+{
+	LOG(HLE, TRACE, "sysPPUThreadSetPriority(id=%d, prio=%d)\n", threadId, prio);
+
+	Thread* t = FindThread(threadId);
+	if (!t)
+		return CELL_ESRCH;
+	if (prio < 0 || prio > 3071)
+		return CELL_EINVAL;
+
+	if (t->threadState == Thread::Sleeping)
+	{
+		RemoveFromRunQueue(t);
+		t->SetPriority(prio);
+		MakeReady(t);
+	}
+	else
+	{
+		t->SetPriority(prio);
+		if (!runQueues.empty() && runQueues.begin()->first < prio)
+		{
+			for (auto w : workers)
+				if (w->thread == t)
+					w->ppu->preemptPending = true;
+		}
+	}
+
 	return CELL_OK;
 }
 
 uint32_t CellThread::sysPPUThreadExit(uint32_t exitCode, CellPPU* ppu)
 {
-	printf("sysPPUThreadExit(%d)\n", exitCode);
+	LOG(HLE, TRACE, "sysPPUThreadExit(%d)\n", exitCode);
 
-	auto t = GetCurrentThread();
+	auto t = worker->thread;
 
-	threads.erase(threads.begin()+curThreadIndex);
+	std::erase(threads, t);
 
 	if (!threads.size())
 	{
-		printf("Main thread exited!\n");
+		LOG(HLE, ERROR, "Main thread exited!\n");
 		exit(1);
 	}
 
 	delete t;
 
-	t = Reschedule();
-	t->Switch(ppu);
+	// The next thread resumes wherever it was, not at our lr
+	SwitchToNextThread(ppu);
+	ppu->threadSwapped = true;
 
 	return CELL_OK;
 }
 
-Thread::Thread(uint64_t entry, uint64_t ret_addr, uint64_t stackSize, uint64_t argPtr, uint64_t namePtr, MemoryManager &manager, bool isModule, uint64_t tls)
-: manager(manager)
+Thread::Thread(uint64_t entry, uint64_t ret_addr, uint64_t stackSize, uint64_t argPtr, uint64_t namePtr, MemoryManager &manager, bool isModule, uint64_t tls, int32_t priority)
+: priority(priority),
+manager(manager)
 {
 	 memset(&state, 0, sizeof(state));
 
@@ -236,15 +496,15 @@ Thread::Thread(uint64_t entry, uint64_t ret_addr, uint64_t stackSize, uint64_t a
 	else
 		name.clear();
 
-    printf("Stack for thread is at 0x%08lx\n", state.r[1]);
-    printf("Entry is at 0x%08lx, return address 0x%08lx\n", state.r[0], ret_addr);
+    LOG(HLE, TRACE, "Stack for thread is at 0x%08lx\n", state.r[1]);
+    LOG(HLE, TRACE, "Entry is at 0x%08lx, return address 0x%08lx\n", state.r[0], ret_addr);
 	if (!name.empty())
-		printf("Name: %s\n", name.c_str());
+		LOG(HLE, TRACE, "Name: %s\n", name.c_str());
 	
-	id = threads.size()+0x24;
+	id = nextThreadId++;
 	threads.push_back(this);
 
-	threadState = Sleeping;
+	MakeReady(this);
 }
 
 Thread::~Thread()
@@ -258,9 +518,9 @@ Thread::~Thread()
 void Thread::Switch(CellPPU *ppu)
 {
 	if (!name.empty())
-		printf("Switching to thread %s (0x%08lx)\n", name.c_str(), state.pc);
+		LOG(HLE, TRACE, "Switching to thread %s (0x%08lx)\n", name.c_str(), state.pc);
 	else
-		printf("Switching to thread %d (0x%08lx)\n", id, state.pc);
+		LOG(HLE, TRACE, "Switching to thread %d (0x%08lx)\n", id, state.pc);
 	ppu->SetState(state);
 	threadState = Running;
 }
@@ -3,24 +3,33 @@
 #include <kernel/types.h>
 #include <kernel/Memory.h>
 #include <cpu/PPU.h>
+#include <deque>
+#include <mutex>
+
+// What the main thread runs at, lower numbers are higher priorities
+#define THREAD_DEFAULT_PRIORITY 1001
 
 class Thread
 {
 public:
-	Thread(uint64_t entry, uint64_t ret_addr, uint64_t stackSize, uint64_t argPtr, uint64_t namePtr, MemoryManager& manager, bool readEntry = true, uint64_t tls = 0);
+	Thread(uint64_t entry, uint64_t ret_addr, uint64_t stackSize, uint64_t argPtr, uint64_t namePtr, MemoryManager& manager, bool readEntry = true, uint64_t tls = 0, int32_t priority = THREAD_DEFAULT_PRIORITY);
 	~Thread();
 
 	void Switch(CellPPU* ppu);
 	void Save(CellPPU* ppu);
 
 	uint32_t GetID() {return id;}
+	int32_t GetPriority() {return priority;}
+	// Only for the scheduler, which has to move the thread to another run queue
+	void SetPriority(int32_t priority) {this->priority = priority;}
 
 	enum ThreadState
 	{
 		Running,
-		Sleeping,
-		Waiting
+		Sleeping, // Runnable, sitting in a run queue
+		Waiting // Blocked until something wakes it
 	} threadState;
+	bool waitingInPlace = false; // Blocked inside a callback, it keeps its PPU and isn't queued when woken
 private:
 	State state;
 	std::string name;
@@ -33,9 +42,61 @@ private:
 	MemoryManager& manager;
 };
 
+// Held through every HLE call and syscall, which covers all kernel state (threads, run queues, kObjects, mapInfo, fds)
+// Guest code runs outside of it, so PPU threads only run in parallel until they call into the kernel
+extern std::recursive_mutex kernelLock;
+
+// Everything below is called with kernelLock held, unless it says otherwise
+
+// The thread running on the calling host thread's PPU, nullptr if it's idle
 Thread* GetCurrentThread();
+// Picks the next thread for the calling host thread's PPU, nullptr if there's nothing to run
 Thread* Reschedule();
 
+// Makes the calling host thread run guest threads on ppu, and switches in the first runnable one. Takes kernelLock
+void AddWorker(CellPPU* ppu);
+// Called from the dispatch loop of an idle PPU. Waits a bit for a thread to become runnable and
+// switches it in, returns false if there still isn't one. Takes kernelLock
+bool WaitForThread(CellPPU* ppu);
+// Called from the dispatch loop when the quantum is used up or preemptPending is set, switches
+// to the next thread of the same or higher priority if there is one. Takes kernelLock
+void PreemptThread(CellPPU* ppu);
+// Saves the current thread once the HLE call that blocked it has returned, and runs the next one
+// Inside RunSubroutine the rest of the HLE call that ran the callback is on the host stack, so the thread
+// can't be switched out, it keeps the PPU and waits to be woken instead
+void SwitchFromBlockedThread(CellPPU* ppu);
+// Runs guest code from an HLE call with kernelLock released, HLE calls hold it exactly once
+void RunGuestSubroutine(CellPPU* ppu, uint32_t addr);
+
+struct Sleeper
+{
+	Thread* thread;
+	uint32_t data; // Whatever the primitive needs back on wakeup, like an lwcond waiter's recursion count
+};
+
+// Threads blocked on a lock or condition, woken in the order they went to sleep
+class SleepQueue
+{
+public:
+	// Takes the current thread off the run queue, it keeps running until the HLE call returns
+	void Sleep(CellPPU* ppu, uint32_t data = 0);
+	// Queues a thread that's already waiting, without waking it
+	void Push(const Sleeper& sleeper) {sleepers.push_back(sleeper);}
+	Sleeper Pop();
+	bool Remove(uint32_t threadId, Sleeper& sleeper);
+	bool Empty() const {return sleepers.empty();}
+	size_t Size() const {return sleepers.size();}
+private:
+	std::deque<Sleeper> sleepers;
+};
+
+// Makes a thread taken off a sleep queue runnable again
+void WakeThread(Thread* thread);
+
+// Threads waiting on something outside the PPUs (an SPU thread group to stop), which keeps
+// every PPU going idle from counting as a deadlock
+extern size_t hostWaiters;
+
 namespace CellThread
 {
 
@@ -45,6 +106,7 @@ uint32_t sysPPUGetThreadStackInformation(uint32_t ptr, CellPPU* ppu);
 uint32_t sysPPUThreadCreate(uint32_t threadIdPtr, uint32_t paramPtr, uint64_t arg, int32_t prio, uint32_t stackSize, uint64_t flags, uint32_t namePtr, CellPPU* ppu);
 uint32_t sysPPUThreadOnce(uint64_t onceCtrlPtr, uint64_t initFuncPtr, CellPPU* ppu);
 uint32_t sysPPUThreadGetPriority(uint32_t threadId, uint32_t prioPtr, CellPPU* ppu);
+uint32_t sysPPUThreadSetPriority(uint32_t threadId, int32_t prio, CellPPU* ppu);
 uint32_t sysPPUThreadExit(uint32_t exitCode, CellPPU* ppu);
 
 }
\ No newline at end of file
@@ -1,15 +1,22 @@
 #include "Mutex.h"
+#include "CellThread.h"
 
 #include <stdio.h>
+#include <kernel/KernelObject.h>
+#include <logging.h>
 
-typedef struct sys_lwmutex
-{
-    uint64_t lock_var;
-    uint32_t attribute;
-    uint32_t recursive_count;
-    uint32_t sleep_queue;
-    uint32_t _pad;
-} sys_lwmutex_t;
+// Offsets into sys_lwmutex_t, the owner and waiter count together make up the 64-bit lock_var
+#define LWMUTEX_OWNER 0 // ID of the owning thread, 0 when it's free
+#define LWMUTEX_WAITERS 4
+#define LWMUTEX_ATTRIBUTE 8
+#define LWMUTEX_RECURSIVE_COUNT 12
+#define LWMUTEX_SLEEP_QUEUE 16 // Kernel ID of the LwSleepQueue, only looked up under contention
+
+// Offsets into sys_lwcond_t
+#define LWCOND_MUTEX 0
+#define LWCOND_QUEUE 4
+
+#define SYS_SYNC_RECURSIVE 0x10
 
 struct sys_lwmutex_attr
 {
@@ -18,53 +25,282 @@ struct sys_lwmutex_attr
     char name[8];
 };
 
+class LwSleepQueue : public KernelObject
+{
+public:
+    LwSleepQueue(Type type)
+    {
+        this->type = type;
+    }
+
+    SleepQueue sleepers;
+};
+
+static LwSleepQueue* GetSleepQueue(MemoryManager* manager, uint64_t ptr, KernelObject::Type type)
+{
+    uint32_t offset = type == KernelObject::KERNEL_OBJECT_LWMUTEX ? LWMUTEX_SLEEP_QUEUE : LWCOND_QUEUE;
+    return GetKernelObject<LwSleepQueue>(manager->Read32(ptr + offset), type);
+}
+
+// Gives the mutex to a thread that's been waiting for it, recursion count and all
+static void HandOff(MemoryManager* manager, uint64_t mutexptr, const Sleeper& sleeper)
+{
+    manager->Write32(mutexptr+LWMUTEX_OWNER, sleeper.thread->GetID());
+    manager->Write32(mutexptr+LWMUTEX_RECURSIVE_COUNT, sleeper.data ? sleeper.data : 1);
+    WakeThread(sleeper.thread);
+}
+
+// Frees the mutex, or passes it straight to the first waiter so it can't be stolen before that one runs
+static void Release(MemoryManager* manager, uint64_t mutexptr)
+{
+    uint32_t waiters = manager->Read32(mutexptr+LWMUTEX_WAITERS);
+    LwSleepQueue* queue = waiters ? GetSleepQueue(manager, mutexptr, KernelObject::KERNEL_OBJECT_LWMUTEX) : nullptr;
+    if (!queue || queue->sleepers.Empty())
+    {
+        manager->Write32(mutexptr+LWMUTEX_OWNER, 0);
+        manager->Write32(mutexptr+LWMUTEX_RECURSIVE_COUNT, 0);
+        return;
+    }
+
+    manager->Write32(mutexptr+LWMUTEX_WAITERS, waiters-1);
+    HandOff(manager, mutexptr, queue->sleepers.Pop());
+}
+
+// Takes a thread woken up from an lwcond and makes it wait on the mutex instead, unless it's free
+static void Requeue(MemoryManager* manager, uint64_t mutexptr, const Sleeper& sleeper)
+{
+    if (!manager->Read32(mutexptr+LWMUTEX_OWNER))
+    {
+        HandOff(manager, mutexptr, sleeper);
+        return;
+    }
+
+    LwSleepQueue* queue = GetSleepQueue(manager, mutexptr, KernelObject::KERNEL_OBJECT_LWMUTEX);
+    if (!queue)
+    {
+        LOG(HLE, ERROR, "lwmutex 0x%08lx has no sleep queue\n", mutexptr);
+        exit(1);
+    }
+
+    manager->Write32(mutexptr+LWMUTEX_WAITERS, manager->Read32(mutexptr+LWMUTEX_WAITERS)+1);
+    queue->sleepers.Push(sleeper);
+}
+
 uint32_t MutexModule::sysLwMutexCreate(uint64_t mutexptr, uint64_t attrptr, CellPPU *ppu)
 {
     char name[9] = {0};
     for (int i = 0; i < 8; i++)
         name[i] = ppu->GetManager()->Read8(attrptr+8+i);
-    printf("Initialized mutex \"%s\": lwmutex* = 0x%08lx, lwmutex_attr* = 0x%08lx\n", name, mutexptr, attrptr);
+    LOG(HLE, TRACE, "Initialized mutex \"%s\": lwmutex* = 0x%08lx, lwmutex_attr* = 0x%08lx\n", name, mutexptr, attrptr);
 
     uint32_t protocol = ppu->GetManager()->Read32(attrptr);
     uint32_t recursive = ppu->GetManager()->Read32(attrptr+4);
-    
+
+    LwSleepQueue* queue = new LwSleepQueue(KernelObject::KERNEL_OBJECT_LWMUTEX);
+    kObjects[queue->id] = queue;
+
     // Initialize lwmutex structure
-    ppu->GetManager()->Write64(mutexptr, 0);
-    ppu->GetManager()->Write32(mutexptr+8, recursive | protocol);
-    ppu->GetManager()->Write32(mutexptr+12, 0);
-    ppu->GetManager()->Write32(mutexptr+16, 0);
+    ppu->GetManager()->Write32(mutexptr+LWMUTEX_OWNER, 0);
+    ppu->GetManager()->Write32(mutexptr+LWMUTEX_WAITERS, 0);
+    ppu->GetManager()->Write32(mutexptr+LWMUTEX_ATTRIBUTE, recursive | protocol);
+    ppu->GetManager()->Write32(mutexptr+LWMUTEX_RECURSIVE_COUNT, 0);
+    ppu->GetManager()->Write32(mutexptr+LWMUTEX_SLEEP_QUEUE, queue->id);
 
     return CELL_OK;
 }
 
-uint32_t MutexModule::sysLwCondCreate(uint64_t condptr, uint32_t lwid_ptr, uint32_t lwid, CellPPU *ppu)
+uint32_t MutexModule::sysLwMutexDestroy(uint64_t mutexptr, CellPPU *ppu)
 {
-	printf("sysLwMutexCreate(0x%08lx, 0x%08x)\n", condptr, lwid_ptr);
+    LOG(HLE, TRACE, "sysLwMutexDestroy(0x%08lx)\n", mutexptr);
+
+    auto manager = ppu->GetManager();
+    LwSleepQueue* queue = GetSleepQueue(manager, mutexptr, KernelObject::KERNEL_OBJECT_LWMUTEX);
+    if (!queue)
+        return CELL_ESRCH;
+    if (manager->Read32(mutexptr+LWMUTEX_OWNER) || !queue->sleepers.Empty())
+        return CELL_EBUSY;
 
-    ppu->GetManager()->Write64(condptr, lwid+1);
-    
-	return CELL_OK;
+    kObjects.erase(queue->id);
+    delete queue;
+    manager->Write32(mutexptr+LWMUTEX_SLEEP_QUEUE, 0);
+
+    return CELL_OK;
 }
 
 uint32_t MutexModule::sysLwMutexLock(uint64_t mutexptr, uint64_t timeout, CellPPU *ppu)
 {
-    if (ppu->GetManager()->Read64(mutexptr) && !(ppu->GetManager()->Read32(mutexptr+8) & 0x10))
+    // LOG(HLE, TRACE, "sysLwMutexLock(0x%08lx, 0x%08lx)\n", mutexptr, timeout);
+
+    auto manager = ppu->GetManager();
+    uint32_t id = GetCurrentThread()->GetID();
+    uint32_t owner = manager->Read32(mutexptr+LWMUTEX_OWNER);
+
+    if (!owner)
+    {
+        manager->Write32(mutexptr+LWMUTEX_OWNER, id);
+        manager->Write32(mutexptr+LWMUTEX_RECURSIVE_COUNT, 1);
+        return CELL_OK;
+    }
+
+    if (owner == id)
     {
-        printf("TODO: Tried to lock a locked mutex!\n");
+        if (!(manager->Read32(mutexptr+LWMUTEX_ATTRIBUTE) & SYS_SYNC_RECURSIVE))
+            return CELL_EDEADLK;
+        manager->Write32(mutexptr+LWMUTEX_RECURSIVE_COUNT, manager->Read32(mutexptr+LWMUTEX_RECURSIVE_COUNT)+1);
+        return CELL_OK;
     }
 
-    ppu->GetManager()->Write64(mutexptr, 1);
+    LwSleepQueue* queue = GetSleepQueue(manager, mutexptr, KernelObject::KERNEL_OBJECT_LWMUTEX);
+    if (!queue)
+        return CELL_ESRCH;
+
+    // There's no timer to wake us up, so timeouts wait until the mutex is handed over like any other lock
+    // and never return ETIMEDOUT
+    if (timeout)
+        LOG(HLE, WARN, "sysLwMutexLock: timeout of %ld us not supported, waiting until the mutex is free\n", timeout);
 
-    // printf("sysLwMutexLock(0x%08lx, 0x%08lx)\n", mutexptr, timeout);
+    manager->Write32(mutexptr+LWMUTEX_WAITERS, manager->Read32(mutexptr+LWMUTEX_WAITERS)+1);
+    queue->sleepers.Sleep(ppu);
 
+    // What the thread sees once it's been given the mutex
     return CELL_OK;
 }
 
+uint32_t MutexModule::sysLwMutexTryLock(uint64_t mutexptr, CellPPU *ppu)
+{
+    auto manager = ppu->GetManager();
+    uint32_t id = GetCurrentThread()->GetID();
+    uint32_t owner = manager->Read32(mutexptr+LWMUTEX_OWNER);
+
+    if (!owner)
+    {
+        manager->Write32(mutexptr+LWMUTEX_OWNER, id);
+        manager->Write32(mutexptr+LWMUTEX_RECURSIVE_COUNT, 1);
+        return CELL_OK;
+    }
+
+    if (owner == id && (manager->Read32(mutexptr+LWMUTEX_ATTRIBUTE) & SYS_SYNC_RECURSIVE))
+    {
+        manager->Write32(mutexptr+LWMUTEX_RECURSIVE_COUNT, manager->Read32(mutexptr+LWMUTEX_RECURSIVE_COUNT)+1);
+        return CELL_OK;
+    }
+
+    return CELL_EBUSY;
+}
+
 uint32_t MutexModule::sysLwMutexUnlock(uint64_t mutexptr, CellPPU *ppu)
 {
-    ppu->GetManager()->Write64(mutexptr, 0);
+    // LOG(HLE, TRACE, "sysLwMutexUnlock(0x%08lx)\n", mutexptr);
+
+    auto manager = ppu->GetManager();
+    if (manager->Read32(mutexptr+LWMUTEX_OWNER) != GetCurrentThread()->GetID())
+        return CELL_EPERM;
+
+    uint32_t count = manager->Read32(mutexptr+LWMUTEX_RECURSIVE_COUNT);
+    if (count > 1)
+    {
+        manager->Write32(mutexptr+LWMUTEX_RECURSIVE_COUNT, count-1);
+        return CELL_OK;
+    }
+
+    Release(manager, mutexptr);
+
+    return CELL_OK;
+}
+
+uint32_t MutexModule::sysLwCondCreate(uint64_t condptr, uint64_t mutexptr, uint64_t attrptr, CellPPU *ppu)
+{
+    LOG(HLE, TRACE, "sysLwCondCreate(0x%08lx, 0x%08lx, 0x%08lx)\n", condptr, mutexptr, attrptr);
+
+    LwSleepQueue* queue = new LwSleepQueue(KernelObject::KERNEL_OBJECT_LWCOND);
+    kObjects[queue->id] = queue;
+
+    ppu->GetManager()->Write32(condptr+LWCOND_MUTEX, mutexptr);
+    ppu->GetManager()->Write32(condptr+LWCOND_QUEUE, queue->id);
+
+    return CELL_OK;
+}
+
+uint32_t MutexModule::sysLwCondDestroy(uint64_t condptr, CellPPU *ppu)
+{
+    LOG(HLE, TRACE, "sysLwCondDestroy(0x%08lx)\n", condptr);
+
+    auto manager = ppu->GetManager();
+    LwSleepQueue* queue = GetSleepQueue(manager, condptr, KernelObject::KERNEL_OBJECT_LWCOND);
+    if (!queue)
+        return CELL_ESRCH;
+    if (!queue->sleepers.Empty())
+        return CELL_EBUSY;
+
+    kObjects.erase(queue->id);
+    delete queue;
+    manager->Write32(condptr+LWCOND_QUEUE, 0);
+
+    return CELL_OK;
+}
+
+uint32_t MutexModule::sysLwCondWait(uint64_t condptr, uint64_t timeout, CellPPU *ppu)
+{
+    auto manager = ppu->GetManager();
+    uint32_t mutexptr = manager->Read32(condptr+LWCOND_MUTEX);
+
+    LwSleepQueue* queue = GetSleepQueue(manager, condptr, KernelObject::KERNEL_OBJECT_LWCOND);
+    if (!queue)
+        return CELL_ESRCH;
+    if (manager->Read32(mutexptr+LWMUTEX_OWNER) != GetCurrentThread()->GetID())
+        return CELL_EPERM;
+
+    // Same as sysLwMutexLock, nothing wakes the thread when the timeout runs out
+    if (timeout)
+        LOG(HLE, WARN, "sysLwCondWait: timeout of %ld us not supported, waiting until signalled\n", timeout);
+
+    // The whole recursion count is given up, and comes back along with the mutex
+    uint32_t count = manager->Read32(mutexptr+LWMUTEX_RECURSIVE_COUNT);
+    Release(manager, mutexptr);
+    queue->sleepers.Sleep(ppu, count);
+
+    return CELL_OK;
+}
+
+uint32_t MutexModule::sysLwCondSignal(uint64_t condptr, CellPPU *ppu)
+{
+    auto manager = ppu->GetManager();
+    LwSleepQueue* queue = GetSleepQueue(manager, condptr, KernelObject::KERNEL_OBJECT_LWCOND);
+    if (!queue)
+        return CELL_ESRCH;
+
+    if (!queue->sleepers.Empty())
+        Requeue(manager, manager->Read32(condptr+LWCOND_MUTEX), queue->sleepers.Pop());
+
+    return CELL_OK;
+}
+
+uint32_t MutexModule::sysLwCondSignalAll(uint64_t condptr, CellPPU *ppu)
+{
+    auto manager = ppu->GetManager();
+    LwSleepQueue* queue = GetSleepQueue(manager, condptr, KernelObject::KERNEL_OBJECT_LWCOND);
+    if (!queue)
+        return CELL_ESRCH;
+
+    uint32_t mutexptr = manager->Read32(condptr+LWCOND_MUTEX);
+    while (!queue->sleepers.Empty())
+        Requeue(manager, mutexptr, queue->sleepers.Pop());
+
+    return CELL_OK;
+}
+
+uint32_t MutexModule::sysLwCondSignalTo(uint64_t condptr, uint32_t threadId, CellPPU *ppu)
+{
+    auto manager = ppu->GetManager();
+    LwSleepQueue* queue = GetSleepQueue(manager, condptr, KernelObject::KERNEL_OBJECT_LWCOND);
+    if (!queue)
+        return CELL_ESRCH;
+
+    Sleeper sleeper;
+    if (!queue->sleepers.Remove(threadId, sleeper))
+        return CELL_EPERM;
 
-    // printf("sysLwMutexUnlock(0x%08lx)\n", mutexptr);
+    Requeue(manager, manager->Read32(condptr+LWCOND_MUTEX), sleeper);
 
     return CELL_OK;
 }
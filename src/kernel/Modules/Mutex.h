@@ -8,8 +8,16 @@ namespace MutexModule
 {
 
 uint32_t sysLwMutexCreate(uint64_t mutexptr, uint64_t attrptr, CellPPU* ppu);
-uint32_t sysLwCondCreate(uint64_t condptr, uint32_t lwid_ptr, uint32_t lwid, CellPPU* ppu);
+uint32_t sysLwMutexDestroy(uint64_t mutexptr, CellPPU* ppu);
 uint32_t sysLwMutexLock(uint64_t mutexptr, uint64_t timeout, CellPPU* ppu);
+uint32_t sysLwMutexTryLock(uint64_t mutexptr, CellPPU* ppu);
 uint32_t sysLwMutexUnlock(uint64_t mutexptr, CellPPU* ppu);
 
-}
\ No newline at end of file
+uint32_t sysLwCondCreate(uint64_t condptr, uint64_t mutexptr, uint64_t attrptr, CellPPU* ppu);
+uint32_t sysLwCondDestroy(uint64_t condptr, CellPPU* ppu);
+uint32_t sysLwCondWait(uint64_t condptr, uint64_t timeout, CellPPU* ppu);
+uint32_t sysLwCondSignal(uint64_t condptr, CellPPU* ppu);
+uint32_t sysLwCondSignalAll(uint64_t condptr, CellPPU* ppu);
+uint32_t sysLwCondSignalTo(uint64_t condptr, uint32_t threadId, CellPPU* ppu);
+
+}
@@ -1,10 +1,20 @@
 #include "Spinlock.h"
+#include "CellThread.h"
 
 #include <stdio.h>
+#include <unordered_map>
+#include <kernel/types.h>
+#include <logging.h>
+
+// The lock word holds the owner's thread ID, with the top bit set while anyone's waiting for it
+#define SPINLOCK_WAITERS 0x80000000
+
+// Spinlocks have no kernel object, so contended ones are looked up by address
+static std::unordered_map<uint32_t, SleepQueue> spinlockQueues;
 
 void SpinlockModule::sysSpinlockInitialize(uint64_t lockPtr, CellPPU* ppu)
 {
-    printf("[sysPrxForUser]: sysSpinlockInitialize(0x%08lx)\n", lockPtr);
+    LOG(HLE, TRACE, "[sysPrxForUser]: sysSpinlockInitialize(0x%08lx)\n", lockPtr);
 
     if (lockPtr)
     {
@@ -14,20 +24,48 @@ void SpinlockModule::sysSpinlockInitialize(uint64_t lockPtr, CellPPU* ppu)
 
 void SpinlockModule::sysSpinlockLock(uint64_t lockPtr, CellPPU *ppu)
 {
-    printf("[sysPrxForUser]: sysSpinlockLock(0x%08lx)\n", lockPtr);
+    LOG(HLE, TRACE, "[sysPrxForUser]: sysSpinlockLock(0x%08lx)\n", lockPtr);
 
-    if (ppu->GetManager()->Read32(lockPtr))
+    uint32_t value = ppu->GetManager()->Read32(lockPtr);
+    if (!value)
     {
-        printf("TODO: Lock already locked spinlock\n");
-        exit(1);
+        ppu->GetManager()->Write32(lockPtr, GetCurrentThread()->GetID());
+        return;
     }
 
-    ppu->GetManager()->Write32(lockPtr, 1);
+    // Spinning would never end, the owner can't run until we give up the PPU
+    ppu->GetManager()->Write32(lockPtr, value | SPINLOCK_WAITERS);
+    spinlockQueues[lockPtr].Sleep(ppu);
+}
+
+uint32_t SpinlockModule::sysSpinlockTryLock(uint64_t lockPtr, CellPPU *ppu)
+{
+    LOG(HLE, TRACE, "[sysPrxForUser]: sysSpinlockTryLock(0x%08lx)\n", lockPtr);
+
+    if (ppu->GetManager()->Read32(lockPtr))
+        return CELL_EBUSY;
+
+    ppu->GetManager()->Write32(lockPtr, GetCurrentThread()->GetID());
+    return CELL_OK;
 }
 
 void SpinlockModule::sysSpinlockUnlock(uint64_t lockPtr, CellPPU *ppu)
 {
-    printf("[sysPrxForUser]: sysSpinlockUnlock(0x%08lx)\n", lockPtr);
+    LOG(HLE, TRACE, "[sysPrxForUser]: sysSpinlockUnlock(0x%08lx)\n", lockPtr);
+
+    // The waiters bit lives in guest memory, so a stray write can set it with nobody queued
+    auto it = spinlockQueues.find(lockPtr);
+    if (!(ppu->GetManager()->Read32(lockPtr) & SPINLOCK_WAITERS) || it == spinlockQueues.end())
+    {
+        ppu->GetManager()->Write32(lockPtr, 0);
+        return;
+    }
+
+    Sleeper sleeper = it->second.Pop();
+    bool waiters = !it->second.Empty();
+    if (!waiters)
+        spinlockQueues.erase(it);
 
-    ppu->GetManager()->Write32(lockPtr, 0);
+    ppu->GetManager()->Write32(lockPtr, sleeper.thread->GetID() | (waiters ? SPINLOCK_WAITERS : 0));
+    WakeThread(sleeper.thread);
 }
@@ -8,6 +8,7 @@ namespace SpinlockModule
 
 void sysSpinlockInitialize(uint64_t lockPtr, CellPPU* ppu);
 void sysSpinlockLock(uint64_t lockPtr, CellPPU* ppu);
+uint32_t sysSpinlockTryLock(uint64_t lockPtr, CellPPU* ppu);
 void sysSpinlockUnlock(uint64_t lockPtr, CellPPU* ppu);
 
-}
\ No newline at end of file
+}
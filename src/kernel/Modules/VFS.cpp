@@ -7,6 +7,7 @@
 #include <string.h>
 #include <cerrno>
 #include <cassert>
+#include <logging.h>
 
 static std::string basePath = "";
 
@@ -16,7 +17,7 @@ struct MountPoint
 };
 
 std::vector<MountPoint> mntPoints;
-std::unordered_map<int, FILE*> fds;
+std::unordered_map<int, FILE*> fds; // Guarded by kernelLock
 
 static int curFd = 4;
 
@@ -34,7 +35,7 @@ void VFS::InitVFS()
 
 void VFS::Mount(const char *base, const char *mnt)
 {
-    printf("Mounting %s on %s\n", (basePath + "/" + base).c_str(), mnt);
+    LOG(VFS, TRACE, "Mounting %s on %s\n", (basePath + "/" + base).c_str(), mnt);
     if (!std::filesystem::exists(basePath + "/" + base))
         std::filesystem::create_directories(basePath + "/" + base);
     mntPoints.push_back({basePath + "/" + base, mnt});
@@ -51,7 +52,7 @@ const char* VFS::GetMountPoint(const char*& path)
 
     if (index == -1)
     {
-        printf("Unknown mp for \"%s\"\n", path);
+        LOG(VFS, WARN, "Unknown mp for \"%s\"\n", path);
         return ".";
     }
 
@@ -68,7 +69,7 @@ uint32_t VFS::cellFsOpen(uint32_t namePtr, int32_t oflags, uint32_t fdPtr, CellP
 {
     const char* name = (char*)ppu->GetManager()->GetRawPtr(namePtr);
     
-    printf("cellFsOpen(\"%s\", %d, 0x%08x)\n", name, oflags, fdPtr);
+    LOG(VFS, TRACE, "cellFsOpen(\"%s\", %d, 0x%08x)\n", name, oflags, fdPtr);
     
     std::string fullPath = std::string(GetMountPoint(name));
     fullPath += name;
@@ -87,7 +88,7 @@ uint32_t VFS::cellFsOpen(uint32_t namePtr, int32_t oflags, uint32_t fdPtr, CellP
 
     if (fds[fd] == NULL)
     {
-        printf("ERROR: Couldn't open file \"%s\": %s\n", fullPath.c_str(), strerror(errno));
+        LOG(VFS, ERROR, "ERROR: Couldn't open file \"%s\": %s\n", fullPath.c_str(), strerror(errno));
         fd = -1;
         ppu->GetManager()->Write32(fdPtr, fd);
         return CELL_ENOENT;
@@ -99,7 +100,7 @@ uint32_t VFS::cellFsOpen(uint32_t namePtr, int32_t oflags, uint32_t fdPtr, CellP
 
 uint32_t VFS::cellFsSeek(uint32_t fd, uint32_t offs, uint32_t whence, uint32_t offsPtr, CellPPU* ppu)
 {
-    printf("cellFsSeekl(%d, %d, %d, 0x%08x)\n", fd, offs, whence, offsPtr);
+    LOG(VFS, TRACE, "cellFsSeekl(%d, %d, %d, 0x%08x)\n", fd, offs, whence, offsPtr);
 
     fseek(fds[fd], offs, whence);
     auto filePos = ftell(fds[fd]);
@@ -109,7 +110,7 @@ uint32_t VFS::cellFsSeek(uint32_t fd, uint32_t offs, uint32_t whence, uint32_t o
 
 uint32_t VFS::cellFsWrite(uint32_t fd, uint32_t bufPtr, uint32_t size, uint32_t writtenPtr, CellPPU *ppu)
 {
-    printf("cellFsWrite(%d, 0x%08x, %d, 0x%08x)\n", fd, bufPtr, size, writtenPtr);
+    LOG(VFS, TRACE, "cellFsWrite(%d, 0x%08x, %d, 0x%08x)\n", fd, bufPtr, size, writtenPtr);
 
     size_t size_written = fwrite(ppu->GetManager()->GetRawPtr(bufPtr), 1, size, fds[fd]);
 	assert(size_written == size);
@@ -118,7 +119,7 @@ uint32_t VFS::cellFsWrite(uint32_t fd, uint32_t bufPtr, uint32_t size, uint32_t
 
 uint32_t VFS::cellFsClose(uint32_t fd)
 {
-    printf("cellFsClose(%d)\n", fd);
+    LOG(VFS, TRACE, "cellFsClose(%d)\n", fd);
     fds[fd] = NULL;
     return CELL_OK;
 }
@@ -145,7 +146,7 @@ enum
 
 uint32_t VFS::cellFsFstat(uint32_t fd, uint32_t statPtr, CellPPU* ppu)
 {
-    printf("cellFsFstat(%d, 0x%08x)\n", fd, statPtr);
+    LOG(VFS, TRACE, "cellFsFstat(%d, 0x%08x)\n", fd, statPtr);
     if (fd == 1)
     {
         ppu->GetManager()->Write32(statPtr+0x00, CELL_FS_S_IRUSR | CELL_FS_S_IWUSR | CELL_FS_S_IXUSR |
@@ -162,12 +163,12 @@ uint32_t VFS::cellFsFstat(uint32_t fd, uint32_t statPtr, CellPPU* ppu)
     }
     else if (fds.find(fd) != fds.end())
     {
-        printf("Error: Couldn't stat unknown fd (which exists) %d!\n", fd);
+        LOG(VFS, ERROR, "Error: Couldn't stat unknown fd (which exists) %d!\n", fd);
         exit(1);
     }
     else
     {
-        printf("Error: Couldn't stat unknown fd %d!\n", fd);
+        LOG(VFS, ERROR, "Error: Couldn't stat unknown fd %d!\n", fd);
         return CELL_ENOENT;
     }
 
@@ -178,17 +179,17 @@ uint32_t VFS::cellVfsFstat(uint32_t namePtr, uint32_t statPtr, CellPPU *ppu)
 {
     const char* name = (char*)ppu->GetManager()->GetRawPtr(namePtr);
     
-    printf("cellFsStat(\"%s\", 0x%08x)\n", name, statPtr);
+    LOG(VFS, TRACE, "cellFsStat(\"%s\", 0x%08x)\n", name, statPtr);
     
     std::string fullPath = std::string(GetMountPoint(name));
     fullPath += name;
     
     if (!std::filesystem::exists(fullPath))
     {
-        printf("Failed to stat file\n");
+        LOG(VFS, WARN, "Failed to stat file\n");
         return CELL_ENOENT;
     }
 
-    printf("TODO: stat file!\n");
+    LOG(VFS, ERROR, "TODO: stat file!\n");
     exit(1);
 }
@@ -4,20 +4,26 @@
 #include "Modules/VFS.h"
 #include "Modules/CellSpurs.h"
 #include "types.h"
+#include "KernelObject.h"
 
 #include <stdio.h>
+#include <cstring>
 #include <ctime>
 #include <queue>
+#include <logging.h>
+#include <chrono>
+#include <csignal>
+#include <unistd.h>
 
 uint32_t sysProcessGetParamSFO(uint32_t bufPtr)
 {
-	printf("sysProcessGetParamSFO(0x%08x)\n", bufPtr);
+	LOG(HLE, TRACE, "sysProcessGetParamSFO(0x%08x)\n", bufPtr);
 	return CELL_ENOENT;
 }
 
 uint32_t sysTimeGetCurrentTime(uint64_t secPtr, uint64_t nSecPtr, CellPPU* ppu)
 {
-    printf("sysTimeGetCurrentTime(secPtr=*0x%08x, nSecPtr=*0x%08x)\n", secPtr, nSecPtr);
+    LOG(HLE, TRACE, "sysTimeGetCurrentTime(secPtr=*0x%08x, nSecPtr=*0x%08x)\n", secPtr, nSecPtr);
 
     if (!secPtr)
     {
@@ -41,14 +47,14 @@ uint32_t sysTimeGetCurrentTime(uint64_t secPtr, uint64_t nSecPtr, CellPPU* ppu)
 
 uint32_t sysMMapperAllocateAddress(size_t size, uint64_t flags, size_t alignment, uint64_t ptrAddr, CellPPU* ppu)
 {
-    printf("sysMMapperAllocateAddress(0x%08lx, 0x%08lx, 0x%08lx, 0x%08lx)\n", size, flags, alignment, ptrAddr);
+    LOG(HLE, TRACE, "sysMMapperAllocateAddress(0x%08lx, 0x%08lx, 0x%08lx, 0x%08lx)\n", size, flags, alignment, ptrAddr);
 
     if (size == 0)
     {
         return CELL_EALIGN;
     }
 
-    uint64_t addr = ppu->GetManager()->main_mem->Alloc(size);
+    uint64_t addr = ppu->GetManager()->main_mem->Alloc(size, alignment ? alignment : 16);
 
     ppu->GetManager()->Write64(addr, ptrAddr);
     return CELL_OK;
@@ -59,24 +65,25 @@ uint32_t sysGetUserMemorySize(uint64_t mem_info_addr, CellPPU* ppu)
     ppu->GetManager()->Write32(mem_info_addr, ppu->GetManager()->main_mem->GetSize());
     ppu->GetManager()->Write32(mem_info_addr+0x4, ppu->GetManager()->main_mem->GetAvailable());
 
-    printf("sysGetUserMemorySize(0x%08lx)\n", mem_info_addr);
+    MemoryBlock* mem = ppu->GetManager()->main_mem;
+    LOG(HLE, TRACE, "sysGetUserMemorySize(0x%08lx) [%ld KiB free, high water %ld KiB, largest free range %ld KiB, %.1f%% fragmented]\n", mem_info_addr, mem->GetAvailable() / 1024, mem->GetHighWater() / 1024, mem->GetLargestFree() / 1024, mem->GetFragmentation() * 100);
     return CELL_OK;
 }
 
 uint32_t sysMMapperAllocate(uint32_t size, uint32_t flags, uint32_t alloc_addr, CellPPU* ppu)
 {
-    printf("sysMMapperAllocate(0x%08x, 0x%08x, 0x%08x)\n", size, flags, alloc_addr);
+    LOG(HLE, TRACE, "sysMMapperAllocate(0x%08x, 0x%08x, 0x%08x)\n", size, flags, alloc_addr);
 
     uint32_t addr;
     switch (flags)
     {
     case 0x400:
         if (size & 0xfffff) return CELL_EALIGN;
-        addr = ppu->GetManager()->main_mem->Alloc(size);
+        addr = ppu->GetManager()->main_mem->Alloc(size, 0x100000);
         break;
     case 0x200:
         if (size & 0xffff) return CELL_EALIGN;
-        addr = ppu->GetManager()->main_mem->Alloc(size);
+        addr = ppu->GetManager()->main_mem->Alloc(size, 0x10000);
         break;
     default:
         return CELL_EINVAL;
@@ -84,7 +91,7 @@ uint32_t sysMMapperAllocate(uint32_t size, uint32_t flags, uint32_t alloc_addr,
 
     if (!addr) return CELL_ENOMEM;
 
-    printf("Memory allocated [addr 0x%x, size 0x%x]\n", addr, size);
+    LOG(HLE, TRACE, "Memory allocated [addr 0x%x, size 0x%x]\n", addr, size);
     ppu->GetManager()->Write32(alloc_addr, addr);
 
     return CELL_OK;
@@ -92,7 +99,7 @@ uint32_t sysMMapperAllocate(uint32_t size, uint32_t flags, uint32_t alloc_addr,
 
 uint32_t sysMMapperSearchAndMapMemory(uint32_t start_addr, uint32_t mem_id, uint64_t flags, uint32_t allocAddr, CellPPU* ppu)
 {
-    printf("sysMMapperSearchAndMapMemory(0x%08x, 0x%08x, 0x%08lx, 0x%08x)\n", start_addr, mem_id, flags, allocAddr);
+    LOG(HLE, TRACE, "sysMMapperSearchAndMapMemory(0x%08x, 0x%08x, 0x%08lx, 0x%08x)\n", start_addr, mem_id, flags, allocAddr);
     ppu->GetManager()->Write32(allocAddr, mapInfo[mem_id].start);
     return CELL_OK;
 }
@@ -112,27 +119,9 @@ uint32_t sys_raw_spu_create(uint64_t spuIdPtr, CellPPU* ppu)
 #define ARG5 ppu->GetReg(8)
 #define RETURN(x) ppu->SetReg(3, x)
 
+// Both only touched with kernelLock held
 uint32_t kernel_id = 1;
 
-class KernelObject
-{
-public:
-    KernelObject()
-    {
-        id = kernel_id++;
-    }
-
-    enum Type
-    {
-        KERNEL_OBJECT_NONE = 0,
-        KERNEL_OBJECT_KEVENTQUEUE,
-        KERNEL_OBJECT_KEVENTPORT,
-        KERNEL_OBJECT_KEVENTFLAG,
-    } type;
-
-    uint32_t id;
-};
-
 std::unordered_map<uint32_t, KernelObject*> kObjects;
 
 struct EventQueueData
@@ -143,12 +132,6 @@ struct EventQueueData
     uint64_t data2;
 };
 
-struct EvtQWaitingThread
-{
-    Thread* thread;
-    uint64_t dataPtr;
-};
-
 class EventQueue : public KernelObject
 {
 public:
@@ -160,19 +143,19 @@ public:
     std::queue<EventQueueData> queue;
     uint64_t ipcKey;
     int size;
-    std::vector<EvtQWaitingThread> waitingThreads;
+    SleepQueue waitingThreads; // Each one's data is where its event goes
 };
 
 uint32_t sysEventQueueCreate(uint32_t queueIdPtr, uint32_t attrPtr, uint64_t ipc_key, int32_t size, CellPPU* ppu)
 {
-    printf("sysEventQueueCreate(0x%08x, 0x%08x, 0x%08lx, %d)\n", queueIdPtr, attrPtr, ipc_key, size);
+    LOG(HLE, TRACE, "sysEventQueueCreate(0x%08x, 0x%08x, 0x%08lx, %d)\n", queueIdPtr, attrPtr, ipc_key, size);
 
     EventQueue* queue = new EventQueue();
     queue->ipcKey = ipc_key;
     queue->size = size;
 
     if (kObjects.contains(queue->id))
-        printf("Duplicate ID!\n");
+        LOG(HLE, WARN, "sysEventQueueCreate: Duplicate ID 0x%x!\n", queue->id);
     kObjects[queue->id] = queue;
 
     ppu->GetManager()->Write32(queueIdPtr, queue->id);
@@ -182,11 +165,11 @@ uint32_t sysEventQueueCreate(uint32_t queueIdPtr, uint32_t attrPtr, uint64_t ipc
 
 uint32_t sysEventQueueReceive(uint32_t eventQueueId, uint64_t dataPtr, uint64_t timeout, CellPPU* ppu)
 {
-    printf("sysEventQueueReceive(0x%08x, 0x%08lx, 0x%08lx)\n", eventQueueId, dataPtr, timeout);
+    LOG(HLE, TRACE, "sysEventQueueReceive(0x%08x, 0x%08lx, 0x%08lx)\n", eventQueueId, dataPtr, timeout);
 
     if (!kObjects.contains(eventQueueId))
     {
-        printf("No such event queue\n");
+        LOG(HLE, WARN, "sysEventQueueReceive: No such event queue 0x%x\n", eventQueueId);
         return CELL_EINVAL;
     }
 
@@ -194,25 +177,18 @@ uint32_t sysEventQueueReceive(uint32_t eventQueueId, uint64_t dataPtr, uint64_t
 
     if (queue->type != KernelObject::KERNEL_OBJECT_KEVENTQUEUE)
     {
-        printf("Invalid kernel object ID\n");
+        LOG(HLE, TRACE, "Invalid kernel object ID\n");
         return CELL_EINVAL;
     }
 
     if (queue->queue.empty())
     {
         // Put thread to sleep
-        EvtQWaitingThread wait;
-        wait.thread = GetCurrentThread();
-        wait.dataPtr = dataPtr;
-        queue->waitingThreads.push_back(wait);
-        GetCurrentThread()->threadState = Thread::Waiting;
-        GetCurrentThread()->Save(ppu);
-        Reschedule()->Switch(ppu);
-        ppu->GetState().pc = ppu->GetState().lr;
+        queue->waitingThreads.Sleep(ppu, dataPtr);
     }
     else
     {
-        printf("TODO: Actual data\n");
+        LOG(HLE, ERROR, "TODO: Actual data\n");
         exit(1);
     }
 
@@ -234,14 +210,14 @@ public:
 
 uint32_t sysEventPortCreate(uint32_t idPtr, int portType, uint64_t name, CellPPU* ppu)
 {
-    printf("sysEventPortCreate(0x%08x, %d, 0x%08lx)\n", idPtr, portType, name);
+    LOG(HLE, TRACE, "sysEventPortCreate(0x%08x, %d, 0x%08lx)\n", idPtr, portType, name);
 
     EventPort* port = new EventPort();
     port->name = name;
     port->type = portType;
 
     if (kObjects.contains(port->id))
-        printf("Duplicate kernel ID detected\n");
+        LOG(HLE, TRACE, "Duplicate kernel ID detected\n");
 
     kObjects[port->id] = port;
 
@@ -252,11 +228,11 @@ uint32_t sysEventPortCreate(uint32_t idPtr, int portType, uint64_t name, CellPPU
 
 uint32_t sysEventPortConnectLocal(uint32_t portId, uint32_t queueId)
 {
-    printf("sysEventPortConnect(%d, %d)\n", portId, queueId);
+    LOG(HLE, TRACE, "sysEventPortConnect(%d, %d)\n", portId, queueId);
 
     if (!kObjects.contains(portId) || !kObjects.contains(queueId))
     {
-        printf("No such port/queue\n");
+        LOG(HLE, TRACE, "No such port/queue\n");
         return CELL_EINVAL;
     }
 
@@ -285,7 +261,7 @@ public:
 
 uint32_t sysEventFlagCreate(uint32_t idPtr, uint32_t attrPtr, uint64_t initial, CellPPU* ppu)
 {
-    printf("sysEventFlagCreate(0x%08x, 0x%08x, 0x%08lx)\n", idPtr, attrPtr, initial);
+    LOG(HLE, TRACE, "sysEventFlagCreate(0x%08x, 0x%08x, 0x%08lx)\n", idPtr, attrPtr, initial);
 
     uint32_t protocol = ppu->GetManager()->Read32(attrPtr);
     uint32_t flags = ppu->GetManager()->Read32(attrPtr+16);
@@ -299,125 +275,134 @@ uint32_t sysEventFlagCreate(uint32_t idPtr, uint32_t attrPtr, uint64_t initial,
     return CELL_OK;
 }
 
-void Syscalls::DoSyscall(CellPPU *ppu)
+struct SyscallEntry
 {
-    switch (ppu->GetReg(11))
-    {
-	case 0x01E:
-		RETURN(sysProcessGetParamSFO(ARG0));
-		break;
-    case 0x030:
+    uint32_t number;
+    const char* name;
+    uint8_t argc;
+    uint32_t flags;
+    Syscalls::SyscallFunction func;
+};
+
+static constexpr SyscallEntry syscallList[] =
+{
+    {0x01E, "sys_process_get_paramsfo", 1, 0, [](CellPPU* ppu) {
+        RETURN(sysProcessGetParamSFO(ARG0));
+    }},
+    {0x02F, "sys_ppu_thread_set_priority", 2, 0, [](CellPPU* ppu) {
+        RETURN(CellThread::sysPPUThreadSetPriority(ARG0, ARG1, ppu));
+    }},
+    {0x030, "sys_ppu_thread_get_priority", 2, 0, [](CellPPU* ppu) {
         RETURN(CellThread::sysPPUThreadGetPriority(ARG0, ARG1, ppu));
-        break;
-    case 0x031:
+    }},
+    {0x031, "sys_ppu_thread_get_stack_information", 1, 0, [](CellPPU* ppu) {
         RETURN(CellThread::sysPPUGetThreadStackInformation(ARG0, ppu));
-        break;
-    case 0x052:
+    }},
+    {0x052, "sys_event_flag_create", 3, 0, [](CellPPU* ppu) {
         RETURN(sysEventFlagCreate(ARG0, ARG1, ARG2, ppu));
-        break;
-    case 0x05F:
-        printf("_sys_lwmutex_create(0x%08lx, %ld, 0x%08lx, %ld, 0x%08lx)\n", ARG0, ARG1, ARG2, ARG3, ARG4);
+    }},
+    {0x05F, "_sys_lwmutex_create", 5, SYSCALL_STUB, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "_sys_lwmutex_create(0x%08lx, %ld, 0x%08lx, %ld, 0x%08lx)\n", ARG0, ARG1, ARG2, ARG3, ARG4);
         ppu->GetManager()->Write32(ARG0, kernel_id++);
         RETURN(CELL_OK);
-        break;
-    case 0x064:
-        printf("sys_mutex_create(0x%08lx, 0x%08lx)\n", ARG0, ARG1);
+    }},
+    {0x064, "sys_mutex_create", 2, SYSCALL_STUB, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "sys_mutex_create(0x%08lx, 0x%08lx)\n", ARG0, ARG1);
         ppu->GetManager()->Write32(ARG0, kernel_id++);
         RETURN(CELL_OK);
-        break;
-    case 0x066:
-        // printf("sys_mutex_lock(%d)\n", ARG0);
+    }},
+    {0x066, "sys_mutex_lock", 2, SYSCALL_STUB, [](CellPPU* ppu) {
+        // LOG(HLE, TRACE, "sys_mutex_lock(%d)\n", ARG0);
         RETURN(CELL_OK);
-        break;
-    case 0x068:
-        // printf("sys_mutex_unlock(%d)\n", ARG0);
+    }},
+    {0x068, "sys_mutex_unlock", 1, SYSCALL_STUB, [](CellPPU* ppu) {
+        // LOG(HLE, TRACE, "sys_mutex_unlock(%d)\n", ARG0);
         RETURN(CELL_OK);
-        break;
-    case 0x069:
-        printf("sys_cond_create(0x%08lx, %ld, 0x%08lx)\n", ARG0, ARG1, ARG2);
+    }},
+    {0x069, "sys_cond_create", 3, SYSCALL_STUB, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "sys_cond_create(0x%08lx, %ld, 0x%08lx)\n", ARG0, ARG1, ARG2);
         ppu->GetManager()->Write32(ARG0, kernel_id++);
         RETURN(CELL_OK);
-        break;
-    case 0x078:
-        printf("_sys_rwlock_create(0x%08lx, 0x%08lx)\n", ARG0, ARG1);
+    }},
+    {0x078, "_sys_rwlock_create", 2, SYSCALL_STUB, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "_sys_rwlock_create(0x%08lx, 0x%08lx)\n", ARG0, ARG1);
         ppu->GetManager()->Write32(ARG0, kernel_id++);
         RETURN(CELL_OK);
-        break;
-    case 0x080:
+    }},
+    {0x080, "sys_event_queue_create", 4, 0, [](CellPPU* ppu) {
         RETURN(sysEventQueueCreate(ARG0, ARG1, ARG2, ARG3, ppu));
-        break;
-    case 0x082:
+    }},
+    {0x082, "sys_event_queue_receive", 3, SYSCALL_BLOCKS, [](CellPPU* ppu) {
         RETURN(sysEventQueueReceive(ARG0, ARG1, ARG2, ppu));
-        break;
-    case 0x086:
+    }},
+    {0x086, "sys_event_port_create", 3, 0, [](CellPPU* ppu) {
         RETURN(sysEventPortCreate(ARG0, ARG1, ARG2, ppu));
-        break;
-    case 0x088:
+    }},
+    {0x088, "sys_event_port_connect_local", 2, 0, [](CellPPU* ppu) {
         RETURN(sysEventPortConnectLocal(ARG0, ARG1));
-        break;
-    case 0x08C:
-        printf("sys_event_port_connect_ipc(%d, %d)\n", (int32_t)ARG0, (int32_t)ARG1);
+    }},
+    {0x08C, "sys_event_port_connect_ipc", 2, SYSCALL_STUB, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "sys_event_port_connect_ipc(%d, %d)\n", (int32_t)ARG0, (int32_t)ARG1);
         RETURN(CELL_OK);
-        break;
-    case 0x08D:
-        // printf("sleep_timer_usleep(%d)\n", ARG0);
+    }},
+    {0x08D, "sys_timer_usleep", 1, SYSCALL_STUB, [](CellPPU* ppu) {
+        // LOG(HLE, TRACE, "sleep_timer_usleep(%d)\n", ARG0);
         RETURN(CELL_OK);
-        break;
-    case 0x091:
+    }},
+    {0x091, "sys_time_get_current_time", 2, 0, [](CellPPU* ppu) {
         RETURN(sysTimeGetCurrentTime(ARG0, ARG1, ppu));
-        break;
-	case 0x093:
-		printf("sys_time_get_timebase_frequency()\n");
-		RETURN(80000000ull);
-		break;
-	case 0x0A0:
-		RETURN(sys_raw_spu_create(ARG0, ppu));
-		break;
-	case 0x0A9:
-		printf("sys_util_initialize(%ld, %ld)\n", ARG0, ARG1);
-		RETURN(CELL_OK);
-		break;
-	case 0x0AA:
-		RETURN(CellSpu::sysSpuThreadGroupCreate(ARG0, ARG1, ARG2, ARG3, ppu));
-		break;
-	case 0x0AC:
-		RETURN(CellSpu::sysSpuThreadInitialize(ARG0, ARG1, ARG2, ARG3, ARG4, ARG5, ppu));
-		break;
-	case 0x0AD:
-		RETURN(CellSpu::sysSpuThreadGroupStart(ARG0));
-		break;
-	case 0x0B2:
-		RETURN(CellSpu::sysSpuThreadGroupJoin(ARG0, ARG1, ARG2, ppu));
-		break;
-	case 0x0B8:
-		RETURN(CellSpu::sysSpuThreadWriteSnr(ARG0, ARG1, ARG2));
-		break;
-	case 0x0BB:
-		RETURN(CellSpu::sysSpuThreadSetSpuCfg(ARG0, ARG1));
-		break;
-    case 0x14A:
+    }},
+    {0x093, "sys_time_get_timebase_frequency", 0, 0, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "sys_time_get_timebase_frequency()\n");
+        RETURN(80000000ull);
+    }},
+    {0x0A0, "sys_raw_spu_create", 2, 0, [](CellPPU* ppu) {
+        RETURN(sys_raw_spu_create(ARG0, ppu));
+    }},
+    {0x0A9, "sys_spu_initialize", 2, SYSCALL_STUB, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "sys_util_initialize(%ld, %ld)\n", ARG0, ARG1);
+        RETURN(CELL_OK);
+    }},
+    {0x0AA, "sys_spu_thread_group_create", 4, 0, [](CellPPU* ppu) {
+        RETURN(CellSpu::sysSpuThreadGroupCreate(ARG0, ARG1, ARG2, ARG3, ppu));
+    }},
+    {0x0AC, "sys_spu_thread_initialize", 6, 0, [](CellPPU* ppu) {
+        RETURN(CellSpu::sysSpuThreadInitialize(ARG0, ARG1, ARG2, ARG3, ARG4, ARG5, ppu));
+    }},
+    {0x0AD, "sys_spu_thread_group_start", 1, 0, [](CellPPU* ppu) {
+        RETURN(CellSpu::sysSpuThreadGroupStart(ARG0));
+    }},
+    {0x0B2, "sys_spu_thread_group_join", 3, SYSCALL_BLOCKS, [](CellPPU* ppu) {
+        RETURN(CellSpu::sysSpuThreadGroupJoin(ARG0, ARG1, ARG2, ppu));
+    }},
+    {0x0B8, "sys_spu_thread_write_snr", 3, 0, [](CellPPU* ppu) {
+        RETURN(CellSpu::sysSpuThreadWriteSnr(ARG0, ARG1, ARG2));
+    }},
+    {0x0BB, "sys_spu_thread_set_spu_cfg", 2, 0, [](CellPPU* ppu) {
+        RETURN(CellSpu::sysSpuThreadSetSpuCfg(ARG0, ARG1));
+    }},
+    {0x14A, "sys_mmapper_allocate_address", 4, 0, [](CellPPU* ppu) {
         RETURN(sysMMapperAllocateAddress(ARG0, ARG1, ARG2, ARG3, ppu));
-        break;
-    case 0x151:
+    }},
+    {0x151, "sys_mmapper_search_and_map", 4, 0, [](CellPPU* ppu) {
         RETURN(sysMMapperSearchAndMapMemory(ARG0, ARG1, ARG2, ARG3, ppu));
-        break;
-    case 0x155:
-        printf("sys_memory_container_create(0x%08lx, 0x%08lx)\n", ARG0, ARG1);
+    }},
+    {0x155, "sys_memory_container_create", 2, SYSCALL_STUB, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "sys_memory_container_create(0x%08lx, 0x%08lx)\n", ARG0, ARG1);
         ppu->GetManager()->Write32(ARG0, kernel_id++);
         RETURN(CELL_OK);
-        break;
-    case 0x156:
-        printf("sys_memory_container_destroy(0x%08lx)\n", ARG0);
+    }},
+    {0x156, "sys_memory_container_destroy", 1, SYSCALL_STUB, [](CellPPU* ppu) {
+        LOG(HLE, TRACE, "sys_memory_container_destroy(0x%08lx)\n", ARG0);
         RETURN(CELL_OK);
-        break;
-    case 0x15C:
+    }},
+    {0x15C, "sys_memory_allocate", 3, 0, [](CellPPU* ppu) {
         RETURN(sysMMapperAllocate(ARG0, ARG1, ARG2, ppu));
-        break;
-    case 0x160:
+    }},
+    {0x160, "sys_memory_get_user_memory_size", 1, 0, [](CellPPU* ppu) {
         RETURN(sysGetUserMemorySize(ARG0, ppu));
-        break;
-    case 0x193:
-    {
+    }},
+    {0x193, "sys_tty_write", 4, 0, [](CellPPU* ppu) {
         char* buf = (char*)ppu->GetManager()->GetRawPtr(ARG1);
         for (int i = 0; buf[i]; i++)
         {
@@ -427,28 +412,149 @@ void Syscalls::DoSyscall(CellPPU *ppu)
                 break;
             }
         }
-        printf("%s\n", buf);
+        LOG(TTY, INFO, "%s\n", buf);
         RETURN(CELL_OK);
-        break;
-    }
-    case 0x321:
+    }},
+    {0x321, "sys_fs_open", 3, 0, [](CellPPU* ppu) {
         RETURN(VFS::cellFsOpen(ARG0, ARG1, ARG2, ppu));
-        break;
-	case 0x323:
-		RETURN(VFS::cellFsWrite(ARG0, ARG1, ARG2, ARG3, ppu));
-		break;
-    case 0x329:
+    }},
+    {0x323, "sys_fs_write", 4, 0, [](CellPPU* ppu) {
+        RETURN(VFS::cellFsWrite(ARG0, ARG1, ARG2, ARG3, ppu));
+    }},
+    {0x329, "sys_fs_fstat", 2, 0, [](CellPPU* ppu) {
         RETURN(VFS::cellFsFstat(ARG0, ARG1, ppu));
-        break;
-    case 0x3DC:
-        break;
-    case 0x3FF:
+    }},
+    {0x3DC, "sys_0x3dc", 0, SYSCALL_STUB, [](CellPPU*) {
+        // Ignored, r3 is left as it was
+    }},
+    {0x3FF, "gcm_callback", 0, SYSCALL_CUSTOM, [](CellPPU* ppu) {
         CellGcm::cellGcmCallback(ppu);
         RETURN(CELL_OK);
-        break;
-    default:
+    }},
+};
+
+Syscalls::Syscall Syscalls::syscalls[SYSCALL_COUNT];
+
+// Fills the table before main runs, the counters start out zeroed
+static struct SyscallTableInit
+{
+    SyscallTableInit()
+    {
+        for (auto& entry : syscallList)
+        {
+            auto& syscall = Syscalls::syscalls[entry.number];
+            syscall.func = entry.func;
+            syscall.name = entry.name;
+            syscall.argc = entry.argc;
+            syscall.flags = entry.flags;
+        }
+    }
+} syscallTableInit;
+
+void Syscalls::DoSyscall(CellPPU *ppu)
+{
+    uint64_t number = ppu->GetReg(11);
+    if (number >= SYSCALL_COUNT || !syscalls[number].func)
+    {
 		ppu->GetManager()->DumpRam();
-        printf("[LV2]: unknown syscall 0x%04lx\n", ppu->GetReg(11));
+        LOG(HLE, ERROR, "[LV2]: unknown syscall 0x%04lx\n", number);
         exit(1);
     }
-}
\ No newline at end of file
+
+    Syscall& syscall = syscalls[number];
+    auto start = std::chrono::steady_clock::now();
+
+    syscall.func(ppu);
+
+    // Blocking syscalls are counted until they return, which includes whatever ran on the host meanwhile
+    auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    syscall.calls.fetch_add(1, std::memory_order_relaxed);
+    syscall.hostTime.fetch_add(time, std::memory_order_relaxed);
+}
+
+// snprintf isn't async-signal-safe, so the stats are formatted by hand into a stack buffer
+// Every field is padded to width, text on the left, numbers on the right
+static char* AppendField(char* out, const char* text, int len, int width, bool left)
+{
+    for (int i = len; !left && i < width; i++)
+        *out++ = ' ';
+    memcpy(out, text, len);
+    out += len;
+    for (int i = len; left && i < width; i++)
+        *out++ = ' ';
+    return out;
+}
+
+static char* AppendText(char* out, const char* text, int width)
+{
+    return AppendField(out, text, strlen(text), width, true);
+}
+
+// Three decimals, value is in thousandths
+static char* AppendFixed(char* out, uint64_t value, int width)
+{
+    char digits[24];
+    int pos = sizeof(digits);
+    for (int i = 0; i < 3; i++, value /= 10)
+        digits[--pos] = '0' + value % 10;
+    digits[--pos] = '.';
+    do
+        digits[--pos] = '0' + value % 10;
+    while (value /= 10);
+    return AppendField(out, &digits[pos], sizeof(digits) - pos, width, false);
+}
+
+static char* AppendNumber(char* out, uint64_t value, int width)
+{
+    char digits[24];
+    int pos = sizeof(digits);
+    do
+        digits[--pos] = '0' + value % 10;
+    while (value /= 10);
+    return AppendField(out, &digits[pos], sizeof(digits) - pos, width, false);
+}
+
+void Syscalls::DumpStats(int fd)
+{
+    // Only writes to the stack and fd, so it's safe to call from the signal handler
+    char buf[256];
+    char* out = AppendText(buf, "syscall", 40);
+    *out++ = ' ';
+    out = AppendField(out, "calls", 5, 12, false);
+    *out++ = ' ';
+    out = AppendField(out, "host ms", 7, 14, false);
+    *out++ = ' ';
+    out = AppendField(out, "avg us", 6, 12, false);
+    *out++ = '\n';
+    write(fd, buf, out - buf);
+
+    for (auto& entry : syscallList)
+    {
+        const Syscall& syscall = syscalls[entry.number];
+        uint64_t calls = syscall.calls.load(std::memory_order_relaxed);
+        if (!calls)
+            continue;
+
+        uint64_t time = syscall.hostTime.load(std::memory_order_relaxed);
+        out = AppendText(buf, syscall.name, 40);
+        *out++ = ' ';
+        out = AppendNumber(out, calls, 12);
+        *out++ = ' ';
+        out = AppendFixed(out, time / 1000, 14);
+        *out++ = ' ';
+        out = AppendFixed(out, time / calls, 12);
+        *out++ = '\n';
+        write(fd, buf, out - buf);
+    }
+}
+
+static void DumpStatsOnSignal(int)
+{
+    Syscalls::DumpStats(STDERR_FILENO);
+}
+
+void Syscalls::InstallStatsDump()
+{
+    atexit([] {DumpStats(STDERR_FILENO);});
+    signal(SIGUSR1, DumpStatsOnSignal);
+}
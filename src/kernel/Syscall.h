@@ -1,10 +1,41 @@
 #pragma once
 
 #include <cpu/PPU.h>
+#include <atomic>
+
+// Syscall numbers come from r11, LV2 doesn't have any above this
+#define SYSCALL_COUNT 1024
+
+enum SyscallFlags : uint32_t
+{
+    SYSCALL_STUB = 1 << 0, // Returns without doing what the real kernel would
+    SYSCALL_BLOCKS = 1 << 1, // Can switch to another thread before returning
+    SYSCALL_CUSTOM = 1 << 2, // Not a real LV2 syscall, used by our own HLE code
+};
 
 namespace Syscalls
 {
 
+using SyscallFunction = void (*)(CellPPU* ppu);
+
+// Call counts and host time are always collected, they're only relaxed atomic adds
+struct Syscall
+{
+    SyscallFunction func = nullptr;
+    const char* name = nullptr;
+    uint8_t argc = 0;
+    uint32_t flags = 0;
+    std::atomic<uint64_t> calls = 0;
+    std::atomic<uint64_t> hostTime = 0; // In nanoseconds
+};
+
+extern Syscall syscalls[SYSCALL_COUNT];
+
 void DoSyscall(CellPPU* ppu);
 
-}
\ No newline at end of file
+// Writes the counters of every syscall that was called to fd
+void DumpStats(int fd);
+// Dumps the counters to stderr on exit and on SIGUSR1
+void InstallStatsDump();
+
+}
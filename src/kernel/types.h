@@ -13,7 +13,9 @@ enum : uint32_t
     CELL_EINVAL = 0x80010002,
     CELL_ENOSYS = 0x80010003,
     CELL_ENOMEM = 0x80010004,
+    CELL_ESRCH  = 0x80010005,
 	CELL_ENOENT = 0x80010006,
+    CELL_EDEADLK = 0x80010008,
     CELL_EPERM  = 0x80010009,
 	CELL_EBUSY  = 0x8001000A,
     CELL_EFAULT = 0x8001000D,
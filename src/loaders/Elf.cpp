@@ -1,12 +1,11 @@
 #include "Elf.h"
 #include "kernel/Memory.h"
+#include "kernel/ModuleManager.h"
 
 #include <cassert>
 #include <cstring>
 #include <unordered_map>
 
-std::unordered_map<uint32_t, uint32_t> syscall_nids;
-
 #define SCE_MAGIC (('S' << 16) | ('C' << 8) | 'E')
 #define ELF_MAGIC (('E' << 16) | ('L' << 8) | 'F')
 
@@ -273,14 +272,22 @@ uint64_t ElfLoader::LoadIntoMemory()
                 
                 printf("Loading module %s, %d imports (0x%x)\n", modName.c_str(), stubHdr.s_imports, stubHdr.s_nid);
 
+                // Every import gets a fresh descriptor {code, toc} whose code is a single HLE trap,
+                // the stubs load the descriptor through s_text and bctr straight into the trap
+                uint32_t descs = mman.main_mem->Alloc(stubHdr.s_imports * 16);
+
                 for (int i = 0; i < stubHdr.s_imports; i++)
                 {
                     uint32_t nid = mman.Read32(stubHdr.s_nid + i * 4);
                     uint32_t addr = mman.Read32(stubHdr.s_text + i * 4);
+                    uint32_t desc = descs + i * 16;
 
                     printf("\tLoading import 0x%08x at 0x%08x\n", nid, addr);
 
-                    syscall_nids[addr] = nid;
+                    mman.Write32(desc, desc + 8);
+                    mman.Write32(desc + 4, 0);
+                    mman.Write32(desc + 8, HLE_TRAP(Modules::RegisterImport(nid)));
+                    mman.Write32(stubHdr.s_text + i * 4, desc);
                 }
             }
         }
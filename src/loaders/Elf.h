@@ -49,8 +49,6 @@ BEGIN_BE_STRUCT(ElfPhdr)
     BE_MEMBER_64(p_align);
 END_BE_STRUCT();
 
-extern std::unordered_map<uint32_t, uint32_t> syscall_nids;
-
 class ElfLoader
 {
 private:
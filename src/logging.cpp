@@ -0,0 +1,113 @@
+#include "logging.h"
+
+#include <cpu/SpscRing.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Longer messages get truncated
+#define LOG_ENTRY_SIZE 256
+#define LOG_RING_SIZE 1024
+
+namespace Log
+{
+
+struct Entry
+{
+    char msg[LOG_ENTRY_SIZE];
+};
+
+typedef SpscRing<Entry, LOG_RING_SIZE> Ring;
+
+// Rings are never freed, the threads that log (PPU, SPUs, RSX) live as long as the process
+static std::mutex ringsLock; // Also held while draining, so output from different threads doesn't interleave mid-line
+static std::vector<Ring*> rings;
+static thread_local Ring* ring;
+
+static bool Drain()
+{
+    bool wrote = false;
+
+    Entry entry;
+    for (auto r : rings)
+    {
+        while (r->Pop(entry))
+        {
+            fputs(entry.msg, stdout);
+            wrote = true;
+        }
+    }
+
+    return wrote;
+}
+
+static void DrainThread()
+{
+    while (true)
+    {
+        bool wrote;
+        {
+            std::lock_guard<std::mutex> guard(ringsLock);
+            wrote = Drain();
+        }
+
+        if (wrote)
+            fflush(stdout);
+        else
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+static Ring* GetRing()
+{
+    if (!ring)
+    {
+        ring = new Ring();
+
+        std::lock_guard<std::mutex> guard(ringsLock);
+        if (rings.empty())
+        {
+            std::thread(DrainThread).detach();
+            atexit(Flush);
+        }
+        rings.push_back(ring);
+    }
+
+    return ring;
+}
+
+void Write(int level, const char* fmt, ...)
+{
+    Entry entry;
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(entry.msg, sizeof(entry.msg), fmt, args);
+    va_end(args);
+
+    if (level == LOG_ERROR)
+    {
+        std::lock_guard<std::mutex> guard(ringsLock);
+        Drain();
+        fputs(entry.msg, stdout);
+        fflush(stdout);
+        return;
+    }
+
+    Ring* r = GetRing();
+    r->WaitNotFull();
+    r->Push(entry);
+}
+
+void Flush()
+{
+    std::lock_guard<std::mutex> guard(ringsLock);
+    Drain();
+    fflush(stdout);
+}
+
+}
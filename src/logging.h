@@ -0,0 +1,49 @@
+#pragma once
+
+// Log levels, a channel logs everything at or below its level
+#define LOG_ERROR 0
+#define LOG_WARN 1
+#define LOG_INFO 2
+#define LOG_TRACE 3
+
+// Per-channel levels are fixed at compile time, e.g. -DLOG_LEVEL_SPU=LOG_TRACE for a full SPU trace
+#ifndef LOG_LEVEL_PPU
+#define LOG_LEVEL_PPU LOG_WARN
+#endif
+#ifndef LOG_LEVEL_SPU
+#define LOG_LEVEL_SPU LOG_WARN
+#endif
+#ifndef LOG_LEVEL_RSX
+#define LOG_LEVEL_RSX LOG_WARN
+#endif
+#ifndef LOG_LEVEL_HLE
+#define LOG_LEVEL_HLE LOG_WARN
+#endif
+#ifndef LOG_LEVEL_VFS
+#define LOG_LEVEL_VFS LOG_INFO
+#endif
+#ifndef LOG_LEVEL_MEM
+#define LOG_LEVEL_MEM LOG_INFO
+#endif
+// Guest output through sys_tty_write
+#ifndef LOG_LEVEL_TTY
+#define LOG_LEVEL_TTY LOG_INFO
+#endif
+
+#define LOG_ENABLED(channel, level) (LOG_##level <= LOG_LEVEL_##channel)
+
+// Disabled levels compile to nothing, arguments aren't even evaluated
+#define LOG(channel, level, ...) \
+    do { if constexpr (LOG_ENABLED(channel, level)) Log::Write(LOG_##level, __VA_ARGS__); } while (0)
+
+namespace Log
+{
+
+// Formats into the calling thread's ring, a background thread writes it out
+// Errors skip the ring (they're usually followed by an exit) after flushing everything before them
+void Write(int level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// Writes out everything logged so far on every thread
+void Flush();
+
+}
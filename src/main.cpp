@@ -1,25 +1,29 @@
 #include "kernel/Memory.h"
 #include "kernel/Modules/VFS.h"
 #include "kernel/Modules/CellThread.h"
+#include "kernel/Syscall.h"
 #include "loaders/Elf.h"
 #include "loaders/SFO.h"
 #include "cpu/PPU.h"
 #include "rsx/rsx.h"
+#include "logging.h"
 
 #include <exception>
 #include <cstdio>
 #include <cstdlib>
-#include <csignal>
 #include <memory>
+#include <algorithm>
 #include <string.h>
+#include <thread>
 
 bool running = false;
-extern CellPPU* dump_ppu;
 
-void signal(int)
+static void PrintError(std::exception& e)
 {
-    dump_ppu->GetManager()->DumpRam();
-    exit(1);
+    Log::Flush();
+    printf("***************************ERROR***************************\n");
+    printf("Received error: %s        \n", e.what());
+    printf("***********************************************************\n");
 }
 
 int main(int argc, char** argv)
@@ -33,35 +37,110 @@ int main(int argc, char** argv)
             printf("Usage: %s <self/elf> [path to game content] [options]\n", argv[0]);
             printf("Options:\n");
             printf("\t--help: Display this message and exit\n");
+            printf("\t--jit: Recompile PPU, SPU and vertex program code to x86-64 instead of interpreting it\n");
+            printf("\t--headless: Run without a window or vsync, printing the time each frame took\n");
+            printf("\t--dump-frames=<dir>: With --headless, write flipped frames to <dir> as PNG\n");
+            printf("\t--dump-every=<n>: Only dump every nth frame\n");
+            printf("\t--dump-raw: Dump raw big-endian ARGB frames instead of PNG\n");
+            printf("\t--capture=<file>: Record the RSX command stream and the memory it uses, for rsxreplay\n");
+            printf("\t--ppu-threads=<n>: Run guest PPU threads on n host threads (default 1)\n");
+            printf("\t--quantum=<n>: Instructions a PPU thread runs before others of its priority get a turn (default %d)\n", PPU_DEFAULT_QUANTUM);
             return 0;
         }
 
+        const char* contentPath = nullptr;
+        bool useJit = false;
+        HeadlessOptions headless;
+        const char* capturePath = nullptr;
+        int quantum = PPU_DEFAULT_QUANTUM;
+        int ppuThreads = 1;
+        for (int i = 2; i < argc; i++)
+        {
+            if (!strcmp(argv[i], "--jit"))
+                useJit = true;
+            else if (!strcmp(argv[i], "--headless"))
+                headless.enabled = true;
+            else if (!strncmp(argv[i], "--dump-frames=", 14))
+                headless.dumpPath = argv[i] + 14;
+            else if (!strncmp(argv[i], "--dump-every=", 13))
+                headless.dumpInterval = std::max(1, atoi(argv[i] + 13));
+            else if (!strcmp(argv[i], "--dump-raw"))
+                headless.dumpRaw = true;
+            else if (!strncmp(argv[i], "--capture=", 10))
+                capturePath = argv[i] + 10;
+            else if (!strncmp(argv[i], "--ppu-threads=", 14))
+                ppuThreads = std::max(1, atoi(argv[i] + 14));
+            else if (!strncmp(argv[i], "--quantum=", 10))
+                quantum = std::max(1, atoi(argv[i] + 10));
+            else if (i == 2)
+                contentPath = argv[i];
+        }
+
         MemoryManager manager = MemoryManager();
         
         ElfLoader loader = ElfLoader(argv[1], manager);
         auto entry = loader.LoadIntoMemory();
 
         VFS::InitVFS();
-        if (argc > 2)
-            VFS::Mount(argv[2], "/dev_bdvd");
+        if (contentPath)
+            VFS::Mount(contentPath, "/dev_bdvd");
 
         // Create the fallback trampoline (in case a program returns)
         uint64_t ret_addr = manager.main_mem->Alloc(4);
         manager.Write32(ret_addr, 0x44000042);
 
-        std::signal(SIGSEGV, signal);
-
         CellPPU* ppu = new CellPPU(manager);
+        ppu->SetQuantum(quantum);
+        if (useJit)
+        {
+            ppu->EnableJit();
+            for (int i = 0; i < 6; i++)
+                ppu->spus[i]->EnableJit();
+        }
 		Thread* mainThread = new Thread(entry, ret_addr, 0x10000, 0, 0, manager);
-		Reschedule()->Switch(ppu);
+		AddWorker(ppu);
 		
 
+        rsx->SetHeadless(headless);
         rsx->Init();
         rsx->SetMman(&manager);
+        if (useJit)
+            rsx->EnableJit();
+        if (capturePath)
+            rsx->StartCapture(capturePath);
+        rsx->Start();
 
-        if (argc > 2)
+        if (contentPath)
             gSFO = new SFO();
 
+        manager.PrintMemoryUsage();
+        Syscalls::InstallStatsDump();
+
+        // The other PPUs pull threads from the same scheduler, this one also keeps the vblank clock
+        // (the flip handler it queues runs on whichever PPU next has a thread)
+        for (int i = 1; i < ppuThreads; i++)
+        {
+            CellPPU* worker = new CellPPU(manager);
+            worker->SetQuantum(quantum);
+            if (useJit)
+                worker->EnableJit();
+
+            std::thread([worker]
+            {
+                try
+                {
+                    AddWorker(worker);
+                    while (1)
+                        worker->Dispatch();
+                }
+                catch (std::exception& e)
+                {
+                    PrintError(e);
+                    exit(1);
+                }
+            }).detach();
+        }
+
         int cycles = 0;
 
         while (1)
@@ -71,20 +150,13 @@ int main(int argc, char** argv)
                 rsx->Present();
                 cycles = 0;
             }
-            cycles++;
-            ppu->Run();
-            if ((cycles % 10) == 0)
-            {
-                for (int i = 0; i < 6; i++)
-                    ppu->spus[i]->Run();
-            }
+            // SPUs run on their own host threads
+            cycles += ppu->Dispatch();
         }
     }
     catch (std::exception& e)
     {
-        printf("***************************ERROR***************************\n");
-        printf("Received error: %s        \n", e.what());
-        printf("***********************************************************\n");
+        PrintError(e);
         
         return -1;
     }
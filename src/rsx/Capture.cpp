@@ -0,0 +1,105 @@
+#include "Capture.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <kernel/Memory.h>
+#include <kernel/Modules/CellGcm.h>
+#include <logging.h>
+
+CaptureWriter::CaptureWriter(const char* path, MemoryManager* manager)
+: manager(manager)
+{
+    file = fopen(path, "wb");
+    if (!file)
+    {
+        LOG(RSX, ERROR, "Couldn't open capture file %s\n", path);
+        exit(1);
+    }
+
+    CaptureHeader header = {CAPTURE_MAGIC, CAPTURE_VERSION};
+    fwrite(&header, sizeof(header), 1, file);
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    FlushMethods();
+    fclose(file);
+}
+
+void CaptureWriter::WriteRecord(uint32_t type, const void* data, uint32_t size, const void* extra, uint32_t extraSize)
+{
+    static const uint8_t padding[8] = {};
+
+    CaptureRecord record = {type, size + extraSize};
+    fwrite(&record, sizeof(record), 1, file);
+    fwrite(data, 1, size, file);
+    if (extraSize)
+        fwrite(extra, 1, extraSize, file);
+    fwrite(padding, 1, -(size + extraSize) & 7, file);
+}
+
+void CaptureWriter::FlushMethods()
+{
+    if (methods.empty())
+        return;
+
+    WriteRecord(CAPTURE_METHODS, methods.data(), methods.size() * 4);
+    methods.clear();
+}
+
+void CaptureWriter::Method(uint32_t cmd, std::span<const uint32_t> args)
+{
+    // The GCM addresses are only known once the game has called cellGcmInit, which is long done by the first method
+    if (!configWritten)
+    {
+        CaptureConfig config = {CellGcm::GetIOAddres(), CellGcm::GetControlAddress()};
+        WriteRecord(CAPTURE_CONFIG, &config, sizeof(config));
+        configWritten = true;
+    }
+
+    methods.push_back(cmd);
+    methods.push_back(args.size());
+    methods.insert(methods.end(), args.begin(), args.end());
+}
+
+void CaptureWriter::Memory(uint32_t addr, uint32_t size, bool force)
+{
+    if (!size)
+        return;
+
+    const uint8_t* data = manager->GetRawPtr(addr);
+
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (uint32_t i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+
+    uint64_t& last = memoryHashes[((uint64_t)addr << 32) | size];
+    if (last == hash && !force)
+        return;
+    last = hash;
+
+    // Methods recorded so far have to run before this memory shows up
+    FlushMethods();
+
+    CaptureMemory memory = {addr, size};
+    WriteRecord(CAPTURE_MEMORY, &memory, sizeof(memory), data, size);
+}
+
+void CaptureWriter::DisplayBuffers(const CaptureDisplayBuffers& display)
+{
+    if (!memcmp(&display, &lastDisplay, sizeof(display)))
+        return;
+    lastDisplay = display;
+
+    FlushMethods();
+    WriteRecord(CAPTURE_DISPLAY_BUFFERS, &display, sizeof(display));
+}
+
+void CaptureWriter::Flip(const CaptureFlip& flip)
+{
+    FlushMethods();
+    WriteRecord(CAPTURE_FLIP, &flip, sizeof(flip));
+
+    // Everything up to the last flip survives the emulator getting killed
+    fflush(file);
+}
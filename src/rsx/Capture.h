@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <span>
+#include <unordered_map>
+
+class MemoryManager;
+
+// Capture files are a header followed by records, everything is host-endian and 8-byte aligned,
+// so a replay can map the file and execute it in place
+#define CAPTURE_MAGIC 0x43585352 // "RSXC"
+#define CAPTURE_VERSION 1
+
+enum CaptureRecordType : uint32_t
+{
+    CAPTURE_CONFIG = 1, // CaptureConfig, written before the first method
+    CAPTURE_MEMORY, // CaptureMemory followed by the bytes, to be written to guest memory before the methods after it
+    CAPTURE_METHODS, // Methods as (cmd, count, args...), arguments already byte-swapped
+    CAPTURE_FLIP, // CaptureFlip
+    CAPTURE_DISPLAY_BUFFERS, // CaptureDisplayBuffers, written whenever the game changes them
+};
+
+struct CaptureHeader
+{
+    uint32_t magic, version;
+};
+
+struct CaptureRecord
+{
+    uint32_t type;
+    uint32_t size; // Of the payload after this, not counting padding
+};
+
+struct CaptureConfig
+{
+    uint32_t ioAddress, controlAddress;
+};
+
+struct CaptureMemory
+{
+    uint32_t addr, size;
+};
+
+// Set through cellGcmSetDisplayBuffer rather than methods, the first one doubles as the render target size
+struct CaptureDisplayBuffers
+{
+    struct
+    {
+        uint32_t offset, pitch, width, height;
+    } buffers[8];
+};
+
+struct CaptureFlip
+{
+    uint32_t buffer;
+    CaptureDisplayBuffers display;
+};
+
+// Records what the FIFO thread consumes, only ever called from that thread
+// Memory is hashed when it's referenced and only written out again if it changed
+class CaptureWriter
+{
+public:
+    CaptureWriter(const char* path, MemoryManager* manager);
+    ~CaptureWriter();
+
+    void Method(uint32_t cmd, std::span<const uint32_t> args);
+    // Forced memory is written even if it's unchanged, for things the RSX itself writes to, like semaphores
+    void Memory(uint32_t addr, uint32_t size, bool force = false);
+    void DisplayBuffers(const CaptureDisplayBuffers& display);
+    void Flip(const CaptureFlip& flip);
+private:
+    void WriteRecord(uint32_t type, const void* data, uint32_t size, const void* extra = nullptr, uint32_t extraSize = 0);
+    void FlushMethods();
+
+    FILE* file;
+    MemoryManager* manager;
+    bool configWritten = false;
+    CaptureDisplayBuffers lastDisplay = {};
+    std::vector<uint32_t> methods; // Pending CAPTURE_METHODS payload
+    std::unordered_map<uint64_t, uint64_t> memoryHashes; // (addr << 32) | size -> hash of what was written last
+};
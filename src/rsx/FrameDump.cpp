@@ -0,0 +1,127 @@
+#include "FrameDump.h"
+
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include <logging.h>
+
+static uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+{
+    static uint32_t table[256];
+    if (!table[1])
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void Put32(std::vector<uint8_t>& out, uint32_t value)
+{
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+static void WriteChunk(FILE* file, const char* type, const std::vector<uint8_t>& data)
+{
+    std::vector<uint8_t> header;
+    Put32(header, data.size());
+    header.insert(header.end(), type, type + 4);
+
+    uint32_t crc = Crc32(&header[4], 4);
+    crc = Crc32(data.data(), data.size(), crc);
+
+    std::vector<uint8_t> footer;
+    Put32(footer, crc);
+
+    fwrite(header.data(), 1, header.size(), file);
+    fwrite(data.data(), 1, data.size(), file);
+    fwrite(footer.data(), 1, footer.size(), file);
+}
+
+bool WriteFramePng(const char* path, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t pitch)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+    {
+        LOG(RSX, WARN, "Couldn't open %s for writing\n", path);
+        return false;
+    }
+
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    fwrite(signature, 1, 8, file);
+
+    std::vector<uint8_t> ihdr;
+    Put32(ihdr, width);
+    Put32(ihdr, height);
+    ihdr.insert(ihdr.end(), {8, 6, 0, 0, 0}); // 8 bits per channel, RGBA, no interlacing
+    WriteChunk(file, "IHDR", ihdr);
+
+    // Every row starts with filter type 0, ARGB gets reordered to RGBA
+    std::vector<uint8_t> raw;
+    raw.reserve((size_t)height * (width * 4 + 1));
+    for (uint32_t y = 0; y < height; y++)
+    {
+        raw.push_back(0);
+        const uint8_t* row = pixels + (size_t)y * pitch;
+        for (uint32_t x = 0; x < width; x++)
+            raw.insert(raw.end(), {row[x*4+1], row[x*4+2], row[x*4+3], row[x*4]});
+    }
+
+    // zlib stream made of stored blocks of at most 0xFFFF bytes
+    std::vector<uint8_t> idat = {0x78, 0x01};
+    uint32_t a = 1, b = 0;
+    for (size_t pos = 0; pos < raw.size() || pos == 0;)
+    {
+        uint16_t len = std::min<size_t>(raw.size() - pos, 0xFFFF);
+        bool last = pos + len == raw.size();
+        idat.insert(idat.end(), {(uint8_t)last, (uint8_t)len, (uint8_t)(len >> 8), (uint8_t)~len, (uint8_t)(~len >> 8)});
+        idat.insert(idat.end(), raw.begin() + pos, raw.begin() + pos + len);
+
+        for (size_t i = pos; i < pos + len; i++)
+        {
+            a = (a + raw[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+
+        pos += len;
+        if (last)
+            break;
+    }
+    Put32(idat, (b << 16) | a);
+    WriteChunk(file, "IDAT", idat);
+
+    WriteChunk(file, "IEND", {});
+
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+bool WriteFrameRaw(const char* path, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t pitch)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+    {
+        LOG(RSX, WARN, "Couldn't open %s for writing\n", path);
+        return false;
+    }
+
+    for (uint32_t y = 0; y < height; y++)
+        fwrite(pixels + (size_t)y * pitch, 4, width, file);
+
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+// Writers for guest framebuffers, pixels are big-endian ARGB with pitch bytes between rows
+// Both return false if the file couldn't be written
+
+// Uncompressed (stored deflate) RGBA PNG, so there's no dependency on zlib
+bool WriteFramePng(const char* path, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t pitch);
+
+// The rows as they are in guest memory, without padding
+bool WriteFrameRaw(const char* path, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t pitch);
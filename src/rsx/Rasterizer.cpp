@@ -0,0 +1,463 @@
+#include "Rasterizer.h"
+
+#include <math.h>
+#include <algorithm>
+#include <thread>
+#include <smmintrin.h>
+#include <cpu/SpscRing.h>
+#include <logging.h>
+
+enum
+{
+    DEPTH_FUNC_NEVER = 0x200,
+    DEPTH_FUNC_LESS,
+    DEPTH_FUNC_EQUAL,
+    DEPTH_FUNC_LEQUAL,
+    DEPTH_FUNC_GREATER,
+    DEPTH_FUNC_NOTEQUAL,
+    DEPTH_FUNC_GEQUAL,
+    DEPTH_FUNC_ALWAYS,
+};
+
+enum
+{
+    BLEND_ZERO = 0,
+    BLEND_ONE = 1,
+    BLEND_SRC_COLOR = 0x300,
+    BLEND_ONE_MINUS_SRC_COLOR,
+    BLEND_SRC_ALPHA,
+    BLEND_ONE_MINUS_SRC_ALPHA,
+    BLEND_DST_ALPHA,
+    BLEND_ONE_MINUS_DST_ALPHA,
+    BLEND_DST_COLOR,
+    BLEND_ONE_MINUS_DST_COLOR,
+    BLEND_SRC_ALPHA_SATURATE,
+};
+
+// Four pixels worth of a color, each channel in [0, 1]
+struct Color4
+{
+    __m128 r, g, b, a;
+};
+
+static bool is_top_left(vec4 start, vec4 end)
+{
+	vec4 edge = {end.x - start.x, end.y - start.y, 0, 0};
+	bool is_top_edge = edge.y == 0 && edge.x > 0;
+	bool is_left_edge = edge.y < 0;
+	return is_left_edge || is_top_edge;
+}
+
+static float edge_cross(vec4 a, vec4 b, vec4 p)
+{
+	vec4 ab = {b.x - a.x, b.y - a.y, 0, 0};
+	vec4 ap = {p.x - a.x, p.y - a.y, 0, 0};
+	return ab.x * ap.y - ab.y * ap.x;
+}
+
+static inline __m128 Eval(const float a, const float b, const float c, __m128 px, __m128 py)
+{
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a), px), _mm_mul_ps(_mm_set1_ps(b), py)), _mm_set1_ps(c));
+}
+
+static inline __m128 EvalEdge(float a, float b, float x, float y, __m128 px, __m128 py)
+{
+    return _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a), _mm_sub_ps(px, _mm_set1_ps(x))), _mm_mul_ps(_mm_set1_ps(b), _mm_sub_ps(py, _mm_set1_ps(y))));
+}
+
+static inline __m128 Saturate(__m128 v)
+{
+    return _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+}
+
+// Partial loads/stores for the last few pixels of a row that isn't a multiple of 4 wide
+static inline __m128i LoadPixels(const uint32_t* ptr, int n)
+{
+    if (n >= 4)
+        return _mm_loadu_si128((const __m128i*)ptr);
+
+    alignas(16) uint32_t tmp[4] = {};
+    std::copy(ptr, ptr + n, tmp);
+    return _mm_load_si128((const __m128i*)tmp);
+}
+
+static inline void StorePixels(uint32_t* ptr, __m128i v, int n)
+{
+    if (n >= 4)
+    {
+        _mm_storeu_si128((__m128i*)ptr, v);
+        return;
+    }
+
+    alignas(16) uint32_t tmp[4];
+    _mm_store_si128((__m128i*)tmp, v);
+    std::copy(tmp, tmp + n, ptr);
+}
+
+static inline Color4 Unpack(__m128i px)
+{
+    const __m128i byte = _mm_set1_epi32(0xFF);
+    const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+
+    Color4 c;
+    c.r = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 8), byte)), scale);
+    c.g = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 16), byte)), scale);
+    c.b = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(px, 24)), scale);
+    c.a = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(px, byte)), scale);
+    return c;
+}
+
+static inline __m128i Pack(const Color4& c)
+{
+    const __m128 scale = _mm_set1_ps(255.0f);
+
+    __m128i r = _mm_slli_epi32(_mm_cvtps_epi32(_mm_mul_ps(c.r, scale)), 8);
+    __m128i g = _mm_slli_epi32(_mm_cvtps_epi32(_mm_mul_ps(c.g, scale)), 16);
+    __m128i b = _mm_slli_epi32(_mm_cvtps_epi32(_mm_mul_ps(c.b, scale)), 24);
+    __m128i a = _mm_cvtps_epi32(_mm_mul_ps(c.a, scale));
+    return _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, a));
+}
+
+static Color4 BlendFactor(uint16_t func, const Color4& s, const Color4& d)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    switch (func)
+    {
+    case BLEND_ZERO: return {_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps()};
+    case BLEND_SRC_COLOR: return s;
+    case BLEND_ONE_MINUS_SRC_COLOR: return {_mm_sub_ps(one, s.r), _mm_sub_ps(one, s.g), _mm_sub_ps(one, s.b), _mm_sub_ps(one, s.a)};
+    case BLEND_SRC_ALPHA: return {s.a, s.a, s.a, s.a};
+    case BLEND_ONE_MINUS_SRC_ALPHA:
+    {
+        __m128 f = _mm_sub_ps(one, s.a);
+        return {f, f, f, f};
+    }
+    case BLEND_DST_ALPHA: return {d.a, d.a, d.a, d.a};
+    case BLEND_ONE_MINUS_DST_ALPHA:
+    {
+        __m128 f = _mm_sub_ps(one, d.a);
+        return {f, f, f, f};
+    }
+    case BLEND_DST_COLOR: return d;
+    case BLEND_ONE_MINUS_DST_COLOR: return {_mm_sub_ps(one, d.r), _mm_sub_ps(one, d.g), _mm_sub_ps(one, d.b), _mm_sub_ps(one, d.a)};
+    case BLEND_SRC_ALPHA_SATURATE:
+    {
+        __m128 f = _mm_min_ps(s.a, _mm_sub_ps(one, d.a));
+        return {f, f, f, one};
+    }
+    case BLEND_ONE:
+        return {one, one, one, one};
+    default:
+        // Constant color factors aren't tracked yet
+        LOG(RSX, WARN, "Unhandled blend factor 0x%04x\n", func);
+        return {one, one, one, one};
+    }
+}
+
+static inline __m128i DepthTest(uint32_t func, __m128i z, __m128i stored)
+{
+    const __m128i all = _mm_set1_epi32(-1);
+
+    switch (func)
+    {
+    case DEPTH_FUNC_NEVER: return _mm_setzero_si128();
+    case DEPTH_FUNC_LESS: return _mm_cmplt_epi32(z, stored);
+    case DEPTH_FUNC_EQUAL: return _mm_cmpeq_epi32(z, stored);
+    case DEPTH_FUNC_LEQUAL: return _mm_xor_si128(_mm_cmpgt_epi32(z, stored), all);
+    case DEPTH_FUNC_GREATER: return _mm_cmpgt_epi32(z, stored);
+    case DEPTH_FUNC_NOTEQUAL: return _mm_xor_si128(_mm_cmpeq_epi32(z, stored), all);
+    case DEPTH_FUNC_GEQUAL: return _mm_xor_si128(_mm_cmplt_epi32(z, stored), all);
+    default: return all;
+    }
+}
+
+bool Rasterizer::Setup(const Vertex& v0, const Vertex& v1In, const Vertex& v2In, Triangle& tri)
+{
+    const Vertex* v[3] = {&v0, &v1In, &v2In};
+
+    // Everything below expects a positive area, flip the winding instead of culling
+    float area = edge_cross(v0.pos, v1In.pos, v2In.pos);
+    if (area < 0)
+    {
+        std::swap(v[1], v[2]);
+        area = -area;
+    }
+    if (!(area > 0))
+        return false;
+
+    float minX = std::min({v[0]->pos.x, v[1]->pos.x, v[2]->pos.x});
+    float minY = std::min({v[0]->pos.y, v[1]->pos.y, v[2]->pos.y});
+    float maxX = std::max({v[0]->pos.x, v[1]->pos.x, v[2]->pos.x});
+    float maxY = std::max({v[0]->pos.y, v[1]->pos.y, v[2]->pos.y});
+
+    tri.minX = std::clamp(floorf(minX), (float)clipX0, (float)clipX1);
+    tri.minY = std::clamp(floorf(minY), (float)clipY0, (float)clipY1);
+    tri.maxX = std::clamp(ceilf(maxX), (float)clipX0, (float)clipX1);
+    tri.maxY = std::clamp(ceilf(maxY), (float)clipY0, (float)clipY1);
+    if (tri.minX >= tri.maxX || tri.minY >= tri.maxY)
+        return false;
+
+    // Edge i is opposite vertex i, so its value at a pixel is that vertex's barycentric weight times the area
+    for (int i = 0; i < 3; i++)
+    {
+        vec4 a = v[(i + 1) % 3]->pos;
+        vec4 b = v[(i + 2) % 3]->pos;
+        Edge& e = tri.edges[i];
+        e.topLeft = is_top_left(a, b);
+
+        // Evaluated from the lower endpoint and negated if need be, which keeps shared edges watertight
+        bool flip = b.y < a.y || (b.y == a.y && b.x < a.x);
+        if (flip)
+            std::swap(a, b);
+        e.a = a.y - b.y;
+        e.b = b.x - a.x;
+        e.x = a.x;
+        e.y = a.y;
+        if (flip)
+        {
+            e.a = -e.a;
+            e.b = -e.b;
+        }
+    }
+
+    auto plane = [&](float a0, float a1, float a2)
+    {
+        const float inv = 1.0f / area;
+        Plane p;
+        p.a = (tri.edges[0].a * a0 + tri.edges[1].a * a1 + tri.edges[2].a * a2) * inv;
+        p.b = (tri.edges[0].b * a0 + tri.edges[1].b * a1 + tri.edges[2].b * a2) * inv;
+        p.c = a0 - p.a * v[0]->pos.x - p.b * v[0]->pos.y;
+        return p;
+    };
+
+    // Same [-1, 1] -> window mapping as x and y, then into the depth range
+    float z[3];
+    for (int i = 0; i < 3; i++)
+        z[i] = state.depthMin + (v[i]->pos.z * 0.5f + 0.5f) * (state.depthMax - state.depthMin);
+
+    // Vertex colors come out of the VPE in [0, 255]
+    const float scale = 1.0f / 255.0f;
+    tri.z = plane(z[0], z[1], z[2]);
+    tri.r = plane(v[0]->color.x * scale, v[1]->color.x * scale, v[2]->color.x * scale);
+    tri.g = plane(v[0]->color.y * scale, v[1]->color.y * scale, v[2]->color.y * scale);
+    tri.b = plane(v[0]->color.z * scale, v[1]->color.z * scale, v[2]->color.z * scale);
+    tri.alpha = plane(v[0]->color.w * scale, v[1]->color.w * scale, v[2]->color.w * scale);
+
+    return true;
+}
+
+void Rasterizer::Bin(uint32_t index, const Triangle& tri)
+{
+    const int tileX0 = tri.minX / RASTER_TILE_SIZE, tileX1 = (tri.maxX - 1) / RASTER_TILE_SIZE;
+    const int tileY0 = tri.minY / RASTER_TILE_SIZE, tileY1 = (tri.maxY - 1) / RASTER_TILE_SIZE;
+
+    for (int ty = tileY0; ty <= tileY1; ty++)
+    {
+        for (int tx = tileX0; tx <= tileX1; tx++)
+        {
+            // Skip tiles that lie entirely outside one of the edges, checked at the tile's most inside pixel
+            float x0 = std::max(tx * RASTER_TILE_SIZE, tri.minX) + 0.5f, x1 = std::min((tx + 1) * RASTER_TILE_SIZE, tri.maxX) - 0.5f;
+            float y0 = std::max(ty * RASTER_TILE_SIZE, tri.minY) + 0.5f, y1 = std::min((ty + 1) * RASTER_TILE_SIZE, tri.maxY) - 0.5f;
+
+            bool outside = false;
+            for (auto& e : tri.edges)
+            {
+                float x = e.a > 0 ? x1 : x0;
+                float y = e.b > 0 ? y1 : y0;
+                if (e.a * (x - e.x) + e.b * (y - e.y) < 0)
+                    outside = true;
+            }
+            if (outside)
+                continue;
+
+            uint32_t tile = ty * tilesX + tx;
+            if (bins[tile].empty())
+                activeTiles.push_back(tile);
+            bins[tile].push_back(index);
+        }
+    }
+}
+
+void Rasterizer::DrawSpan(const Triangle& tri, int x0, int x1, int y)
+{
+    uint32_t* colorRow = (uint32_t*)(state.color + y * state.colorPitch);
+    uint32_t* depthRow = (uint32_t*)(state.depth + y * state.depthPitch);
+
+    const __m128 py = _mm_set1_ps(y + 0.5f);
+    const __m128i first = _mm_set1_epi32(x0 - 1), last = _mm_set1_epi32(x1);
+    const __m128i colorMask = _mm_set1_epi32(state.colorMask);
+
+    // Tiles start on a multiple of 4, so stepping from x0 & ~3 never leaves the tile
+    for (int x = x0 & ~3; x < x1; x += 4)
+    {
+        const __m128 px = _mm_add_ps(_mm_set1_ps(x), _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f));
+        const __m128i lanes = _mm_add_epi32(_mm_set1_epi32(x), _mm_setr_epi32(0, 1, 2, 3));
+        const int n = state.width - x;
+
+        __m128i mask = _mm_and_si128(_mm_cmpgt_epi32(lanes, first), _mm_cmplt_epi32(lanes, last));
+        for (auto& e : tri.edges)
+        {
+            __m128 w = EvalEdge(e.a, e.b, e.x, e.y, px, py);
+            __m128 inside = e.topLeft ? _mm_cmpge_ps(w, _mm_setzero_ps()) : _mm_cmpgt_ps(w, _mm_setzero_ps());
+            mask = _mm_and_si128(mask, _mm_castps_si128(inside));
+        }
+        if (_mm_testz_si128(mask, mask))
+            continue;
+
+        if (state.depthTest)
+        {
+            __m128 z = Saturate(Eval(tri.z.a, tri.z.b, tri.z.c, px, py));
+            __m128i zi = _mm_cvttps_epi32(_mm_mul_ps(z, _mm_set1_ps(16777215.0f)));
+
+            // Z24S8, the stencil byte is left alone
+            __m128i old = LoadPixels(&depthRow[x], n);
+            mask = _mm_and_si128(mask, DepthTest(state.depthFunc, zi, _mm_srli_epi32(old, 8)));
+            if (_mm_testz_si128(mask, mask))
+                continue;
+
+            __m128i depth = _mm_or_si128(_mm_slli_epi32(zi, 8), _mm_and_si128(old, _mm_set1_epi32(0xFF)));
+            StorePixels(&depthRow[x], _mm_blendv_epi8(old, depth, mask), n);
+        }
+
+        Color4 src;
+        src.r = Saturate(Eval(tri.r.a, tri.r.b, tri.r.c, px, py));
+        src.g = Saturate(Eval(tri.g.a, tri.g.b, tri.g.c, px, py));
+        src.b = Saturate(Eval(tri.b.a, tri.b.b, tri.b.c, px, py));
+        src.a = Saturate(Eval(tri.alpha.a, tri.alpha.b, tri.alpha.c, px, py));
+
+        __m128i dstPixels = LoadPixels(&colorRow[x], n);
+
+        if (state.blend)
+        {
+            Color4 dst = Unpack(dstPixels);
+            Color4 sRgb = BlendFactor(state.sfuncRgb, src, dst), sAlpha = BlendFactor(state.sfuncAlpha, src, dst);
+            Color4 dRgb = BlendFactor(state.dfuncRgb, src, dst), dAlpha = BlendFactor(state.dfuncAlpha, src, dst);
+
+            Color4 out;
+            out.r = Saturate(_mm_add_ps(_mm_mul_ps(src.r, sRgb.r), _mm_mul_ps(dst.r, dRgb.r)));
+            out.g = Saturate(_mm_add_ps(_mm_mul_ps(src.g, sRgb.g), _mm_mul_ps(dst.g, dRgb.g)));
+            out.b = Saturate(_mm_add_ps(_mm_mul_ps(src.b, sRgb.b), _mm_mul_ps(dst.b, dRgb.b)));
+            out.a = Saturate(_mm_add_ps(_mm_mul_ps(src.a, sAlpha.a), _mm_mul_ps(dst.a, dAlpha.a)));
+            src = out;
+        }
+
+        __m128i pixels = _mm_or_si128(_mm_andnot_si128(colorMask, dstPixels), _mm_and_si128(Pack(src), colorMask));
+        StorePixels(&colorRow[x], _mm_blendv_epi8(dstPixels, pixels, mask), n);
+    }
+}
+
+void Rasterizer::RasterizeTile(uint32_t tile)
+{
+    const int tileX = (tile % tilesX) * RASTER_TILE_SIZE;
+    const int tileY = (tile / tilesX) * RASTER_TILE_SIZE;
+
+    for (auto index : bins[tile])
+    {
+        const Triangle& tri = triangles[index];
+
+        int x0 = std::max(tri.minX, tileX), x1 = std::min(tri.maxX, tileX + RASTER_TILE_SIZE);
+        int y0 = std::max(tri.minY, tileY), y1 = std::min(tri.maxY, tileY + RASTER_TILE_SIZE);
+
+        for (int y = y0; y < y1; y++)
+            DrawSpan(tri, x0, x1, y);
+    }
+}
+
+void Rasterizer::StartWorkers()
+{
+    // The thread submitting the draw rasterizes tiles too
+    unsigned count = std::thread::hardware_concurrency();
+    for (unsigned i = 1; i < count; i++)
+        std::thread(&Rasterizer::WorkerMain, this).detach();
+    workersStarted = true;
+}
+
+void Rasterizer::WorkerMain()
+{
+    uint32_t seen = generation.load(std::memory_order_acquire);
+
+    while (true)
+    {
+        uint32_t gen = generation.load(std::memory_order_acquire);
+        if (gen == seen)
+        {
+            FutexWait(&generation, gen);
+            continue;
+        }
+
+        seen = gen;
+        RunTiles();
+    }
+}
+
+void Rasterizer::RunTiles()
+{
+    while (true)
+    {
+        // The tile count travels in the same word as the index, so a worker that's late
+        // for a batch can only ever see an exhausted index from that batch
+        uint64_t w = work.fetch_add(1, std::memory_order_acq_rel);
+        uint32_t count = w >> 32, index = w & 0xFFFFFFFF;
+        if (index >= count)
+            return;
+
+        RasterizeTile(activeTiles[index]);
+
+        if (tilesDone.fetch_add(1, std::memory_order_acq_rel) + 1 == count)
+            FutexWake(&tilesDone);
+    }
+}
+
+void Rasterizer::DrawTriangles(const RasterState& state, const Vertex* vertices, size_t count)
+{
+    this->state = state;
+
+    clipX0 = std::min(state.scissorX, state.width);
+    clipY0 = std::min(state.scissorY, state.height);
+    clipX1 = std::min(state.scissorX + state.scissorWidth, state.width);
+    clipY1 = std::min(state.scissorY + state.scissorHeight, state.height);
+    if (clipX0 >= clipX1 || clipY0 >= clipY1 || !state.color)
+        return;
+
+    tilesX = (state.width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    tilesY = (state.height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    if (bins.size() < tilesX * tilesY)
+        bins.resize(tilesX * tilesY);
+
+    triangles.clear();
+    for (size_t i = 0; i + 2 < count; i += 3)
+    {
+        Triangle tri;
+        if (!Setup(vertices[i], vertices[i + 1], vertices[i + 2], tri))
+            continue;
+
+        triangles.push_back(tri);
+        Bin(triangles.size() - 1, tri);
+    }
+
+    // Small draws that only touch one tile aren't worth waking anyone up for
+    if (activeTiles.size() == 1)
+        RasterizeTile(activeTiles[0]);
+    else if (activeTiles.size() > 1)
+    {
+        if (!workersStarted)
+            StartWorkers();
+
+        const uint32_t tileCount = activeTiles.size();
+        tilesDone.store(0, std::memory_order_relaxed);
+        work.store((uint64_t)tileCount << 32, std::memory_order_release);
+        generation.fetch_add(1, std::memory_order_release);
+        FutexWake(&generation);
+
+        RunTiles();
+
+        uint32_t done;
+        while ((done = tilesDone.load(std::memory_order_acquire)) != tileCount)
+            FutexWait(&tilesDone, done);
+    }
+
+    for (auto tile : activeTiles)
+        bins[tile].clear();
+    activeTiles.clear();
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+
+#include "VPE.h"
+
+// Tiles are square and a multiple of 4 pixels wide, so a row of a tile is a whole number of SSE steps
+#define RASTER_TILE_SIZE 64
+
+// Everything a draw needs from the RSX, captured once per draw
+struct RasterState
+{
+    uint8_t* color;
+    uint8_t* depth;
+    uint32_t colorPitch, depthPitch;
+    uint32_t width, height;
+    uint32_t scissorX, scissorY, scissorWidth, scissorHeight;
+
+    bool depthTest;
+    uint32_t depthFunc;
+    float depthMin, depthMax;
+
+    uint32_t colorMask; // Bits of each pixel that may be written, pixels are big-endian ARGB, (b << 24) | (g << 16) | (r << 8) | a on the host
+
+    bool blend;
+    uint16_t sfuncRgb, sfuncAlpha, dfuncRgb, dfuncAlpha;
+};
+
+// Bins triangles into tiles and rasterizes the tiles in parallel, four pixels at a time
+// Triangles in a tile are always drawn in submission order, so blending comes out the same as drawing them one by one
+class Rasterizer
+{
+public:
+    // Draws count/3 triangles, returns once they've all been written to the target
+    void DrawTriangles(const RasterState& state, const Vertex* vertices, size_t count);
+private:
+    // Edge function, a*(px - x) + b*(py - y) at pixel center p
+    // Both triangles sharing an edge evaluate it from the same endpoint, so they get exactly opposite values
+    struct Edge
+    {
+        float a, b, x, y;
+        bool topLeft;
+    };
+
+    // Attribute plane, a*px + b*py + c
+    struct Plane
+    {
+        float a, b, c;
+    };
+
+    struct Triangle
+    {
+        Edge edges[3];
+        Plane z, r, g, b, alpha;
+        int minX, minY, maxX, maxY;
+    };
+
+    bool Setup(const Vertex& v0, const Vertex& v1, const Vertex& v2, Triangle& tri);
+    void Bin(uint32_t index, const Triangle& tri);
+    void RasterizeTile(uint32_t tile);
+    void DrawSpan(const Triangle& tri, int x0, int x1, int y);
+
+    void StartWorkers();
+    void WorkerMain();
+    void RunTiles();
+
+    RasterState state;
+    uint32_t clipX0, clipY0, clipX1, clipY1; // Scissor intersected with the target
+    uint32_t tilesX = 0, tilesY = 0;
+
+    std::vector<Triangle> triangles;
+    std::vector<std::vector<uint32_t>> bins; // Triangle indices per tile
+    std::vector<uint32_t> activeTiles; // Tiles with something to draw in the current batch
+
+    bool workersStarted = false;
+    std::atomic<uint32_t> generation{0}; // Bumped for every batch, idle workers sleep on it
+    std::atomic<uint64_t> work{0}; // (tile count << 32) | next entry of activeTiles
+    std::atomic<uint32_t> tilesDone{0};
+};
@@ -0,0 +1,375 @@
+#include "TextureCache.h"
+#include "rsx.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <tmmintrin.h>
+#include <logging.h>
+
+static uint32_t BytesPerTexel(uint32_t format)
+{
+    switch (format)
+    {
+    case GCM_TEXTURE_B8: return 1;
+    case GCM_TEXTURE_A1R5G5B5:
+    case GCM_TEXTURE_A4R4G4B4:
+    case GCM_TEXTURE_R5G6B5: return 2;
+    case GCM_TEXTURE_A8R8G8B8: return 4;
+    default: return 0;
+    }
+}
+
+static bool IsCompressed(uint32_t format)
+{
+    return format == GCM_TEXTURE_COMPRESSED_DXT1 || format == GCM_TEXTURE_COMPRESSED_DXT23 || format == GCM_TEXTURE_COMPRESSED_DXT45;
+}
+
+static inline uint32_t MakePixel(uint32_t r, uint32_t g, uint32_t b, uint32_t a)
+{
+    return (b << 24) | (g << 16) | (r << 8) | a;
+}
+
+// Morton offsets of each coordinate, x takes the lower bit of every pair while both dimensions have bits left
+static void BuildSwizzleTables(uint32_t width, uint32_t height, std::vector<uint32_t>& xOffs, std::vector<uint32_t>& yOffs)
+{
+    uint32_t xBits = 0, yBits = 0;
+    while ((1u << xBits) < width) xBits++;
+    while ((1u << yBits) < height) yBits++;
+
+    uint32_t xMask = 0, yMask = 0, bit = 0;
+    for (uint32_t i = 0; i < std::max(xBits, yBits); i++)
+    {
+        if (i < xBits) xMask |= 1 << bit++;
+        if (i < yBits) yMask |= 1 << bit++;
+    }
+
+    auto deposit = [](uint32_t value, uint32_t mask)
+    {
+        uint32_t ret = 0;
+        for (uint32_t m = mask; m; m &= m - 1, value >>= 1)
+            if (value & 1)
+                ret |= m & -m;
+        return ret;
+    };
+
+    xOffs.resize(width);
+    yOffs.resize(height);
+    for (uint32_t x = 0; x < width; x++) xOffs[x] = deposit(x, xMask);
+    for (uint32_t y = 0; y < height; y++) yOffs[y] = deposit(y, yMask);
+}
+
+static inline uint32_t DecodeTexel(uint32_t format, const uint8_t* src)
+{
+    switch (format)
+    {
+    case GCM_TEXTURE_B8:
+        return MakePixel(src[0], src[0], src[0], src[0]);
+    case GCM_TEXTURE_A1R5G5B5:
+    {
+        uint16_t c = (src[0] << 8) | src[1];
+        uint32_t r = (c >> 10) & 0x1F, g = (c >> 5) & 0x1F, b = c & 0x1F;
+        return MakePixel((r << 3) | (r >> 2), (g << 3) | (g >> 2), (b << 3) | (b >> 2), (c & 0x8000) ? 0xFF : 0);
+    }
+    case GCM_TEXTURE_A4R4G4B4:
+    {
+        uint16_t c = (src[0] << 8) | src[1];
+        return MakePixel(((c >> 8) & 0xF) * 0x11, ((c >> 4) & 0xF) * 0x11, (c & 0xF) * 0x11, (c >> 12) * 0x11);
+    }
+    case GCM_TEXTURE_R5G6B5:
+    {
+        uint16_t c = (src[0] << 8) | src[1];
+        uint32_t r = c >> 11, g = (c >> 5) & 0x3F, b = c & 0x1F;
+        return MakePixel((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2), 0xFF);
+    }
+    case GCM_TEXTURE_A8R8G8B8:
+    default:
+        return MakePixel(src[1], src[2], src[3], src[0]);
+    }
+}
+
+// Each B8 texel becomes a pixel with the same value in every channel, four texels per pshufb
+static inline void ExpandB8(__m128i texels, uint32_t* out)
+{
+    static const __m128i masks[4] =
+    {
+        _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3),
+        _mm_setr_epi8(4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7),
+        _mm_setr_epi8(8, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 11, 11, 11, 11),
+        _mm_setr_epi8(12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15),
+    };
+
+    for (int i = 0; i < 4; i++)
+        _mm_storeu_si128((__m128i*)&out[i * 4], _mm_shuffle_epi8(texels, masks[i]));
+}
+
+static void DecodeLinear(const uint8_t* src, uint32_t format, uint32_t width, uint32_t height, uint32_t pitch, uint32_t* dst)
+{
+    const uint32_t bpp = BytesPerTexel(format);
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        const uint8_t* row = src + y * pitch;
+        uint32_t* out = dst + y * width;
+        uint32_t x = 0;
+
+        // A8R8G8B8 is already laid out like the framebuffer
+        if (format == GCM_TEXTURE_A8R8G8B8)
+        {
+            memcpy(out, row, width * 4);
+            continue;
+        }
+
+        if (format == GCM_TEXTURE_B8)
+        {
+            for (; x + 16 <= width; x += 16)
+                ExpandB8(_mm_loadu_si128((const __m128i*)&row[x]), &out[x]);
+        }
+
+        for (; x < width; x++)
+            out[x] = DecodeTexel(format, &row[x * bpp]);
+    }
+}
+
+// Once both dimensions have at least two bits, every aligned 4x4 tile is 16 consecutive texels ordered x0 y0 x1 y1,
+// so rows 0-3 of a tile are the texels {0,1,4,5}, {2,3,6,7}, {8,9,12,13} and {10,11,14,15}
+static void DeswizzleTile(const uint8_t* tile, uint32_t format, uint32_t bpp, uint32_t* out, uint32_t stride)
+{
+    if (format == GCM_TEXTURE_A8R8G8B8)
+    {
+        const __m128i* texels = (const __m128i*)tile;
+        __m128i a = _mm_loadu_si128(&texels[0]), b = _mm_loadu_si128(&texels[1]);
+        __m128i c = _mm_loadu_si128(&texels[2]), d = _mm_loadu_si128(&texels[3]);
+        _mm_storeu_si128((__m128i*)&out[0], _mm_unpacklo_epi64(a, b));
+        _mm_storeu_si128((__m128i*)&out[stride], _mm_unpackhi_epi64(a, b));
+        _mm_storeu_si128((__m128i*)&out[stride * 2], _mm_unpacklo_epi64(c, d));
+        _mm_storeu_si128((__m128i*)&out[stride * 3], _mm_unpackhi_epi64(c, d));
+        return;
+    }
+
+    if (format == GCM_TEXTURE_B8)
+    {
+        // Into row order, then each row's texels are spread over whole pixels
+        __m128i rows = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)tile), _mm_setr_epi8(0, 1, 4, 5, 2, 3, 6, 7, 8, 9, 12, 13, 10, 11, 14, 15));
+        uint32_t pixels[16];
+        ExpandB8(rows, pixels);
+        for (int y = 0; y < 4; y++)
+            memcpy(&out[y * stride], &pixels[y * 4], 16);
+        return;
+    }
+
+    // 16-bit texels, put into row order then converted one by one
+    const __m128i order = _mm_setr_epi8(0, 1, 2, 3, 8, 9, 10, 11, 4, 5, 6, 7, 12, 13, 14, 15);
+    uint8_t rows[32];
+    _mm_storeu_si128((__m128i*)&rows[0], _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)tile), order));
+    _mm_storeu_si128((__m128i*)&rows[16], _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(tile + 16)), order));
+    for (int y = 0; y < 4; y++)
+        for (int x = 0; x < 4; x++)
+            out[y * stride + x] = DecodeTexel(format, &rows[(y * 4 + x) * bpp]);
+}
+
+static void DecodeSwizzled(const uint8_t* src, uint32_t format, uint32_t width, uint32_t height, uint32_t* dst)
+{
+    const uint32_t bpp = BytesPerTexel(format);
+
+    std::vector<uint32_t> xOffs, yOffs;
+    BuildSwizzleTables(width, height, xOffs, yOffs);
+
+    // Whole tiles go through registers, the rest (narrow textures and the edges of odd sizes) texel by texel
+    const bool tiled = std::bit_ceil(width) >= 4 && std::bit_ceil(height) >= 4;
+    const uint32_t tiledWidth = tiled ? width & ~3 : 0;
+    const uint32_t tiledHeight = tiled ? height & ~3 : 0;
+
+    for (uint32_t y = 0; y < tiledHeight; y += 4)
+    {
+        for (uint32_t x = 0; x < tiledWidth; x += 4)
+            DeswizzleTile(&src[(xOffs[x] + yOffs[y]) * bpp], format, bpp, &dst[y * width + x], width);
+    }
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint32_t* out = dst + y * width;
+
+        for (uint32_t x = y < tiledHeight ? tiledWidth : 0; x < width; x++)
+            out[x] = DecodeTexel(format, &src[(xOffs[x] + yOffs[y]) * bpp]);
+    }
+}
+
+// DXT blocks keep their little-endian PC layout
+static void DecodeDxtBlock(const uint8_t* block, uint32_t format, uint32_t* out, uint32_t stride, uint32_t w, uint32_t h)
+{
+    const uint8_t* colorBlock = format == GCM_TEXTURE_COMPRESSED_DXT1 ? block : block + 8;
+
+    uint16_t c0 = colorBlock[0] | (colorBlock[1] << 8);
+    uint16_t c1 = colorBlock[2] | (colorBlock[3] << 8);
+    uint32_t bits = colorBlock[4] | (colorBlock[5] << 8) | (colorBlock[6] << 16) | ((uint32_t)colorBlock[7] << 24);
+
+    uint32_t r[4], g[4], b[4], a[4] = {0xFF, 0xFF, 0xFF, 0xFF};
+    r[0] = ((c0 >> 11) * 255 + 15) / 31; g[0] = (((c0 >> 5) & 0x3F) * 255 + 31) / 63; b[0] = ((c0 & 0x1F) * 255 + 15) / 31;
+    r[1] = ((c1 >> 11) * 255 + 15) / 31; g[1] = (((c1 >> 5) & 0x3F) * 255 + 31) / 63; b[1] = ((c1 & 0x1F) * 255 + 15) / 31;
+
+    if (c0 > c1 || format != GCM_TEXTURE_COMPRESSED_DXT1)
+    {
+        r[2] = (2 * r[0] + r[1]) / 3; g[2] = (2 * g[0] + g[1]) / 3; b[2] = (2 * b[0] + b[1]) / 3;
+        r[3] = (r[0] + 2 * r[1]) / 3; g[3] = (g[0] + 2 * g[1]) / 3; b[3] = (b[0] + 2 * b[1]) / 3;
+    }
+    else
+    {
+        r[2] = (r[0] + r[1]) / 2; g[2] = (g[0] + g[1]) / 2; b[2] = (b[0] + b[1]) / 2;
+        r[3] = g[3] = b[3] = a[3] = 0;
+    }
+
+    uint32_t alpha[16];
+    if (format == GCM_TEXTURE_COMPRESSED_DXT23)
+    {
+        for (int i = 0; i < 16; i++)
+            alpha[i] = ((block[i / 2] >> ((i & 1) * 4)) & 0xF) * 0x11;
+    }
+    else if (format == GCM_TEXTURE_COMPRESSED_DXT45)
+    {
+        uint32_t a0 = block[0], a1 = block[1];
+        uint32_t levels[8] = {a0, a1};
+        for (int i = 2; i < 8; i++)
+        {
+            if (a0 > a1)
+                levels[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+            else
+                levels[i] = i < 6 ? ((6 - i) * a0 + (i - 1) * a1) / 5 : (i == 6 ? 0 : 0xFF);
+        }
+
+        uint64_t indices = 0;
+        for (int i = 0; i < 6; i++)
+            indices |= (uint64_t)block[2 + i] << (i * 8);
+        for (int i = 0; i < 16; i++)
+            alpha[i] = levels[(indices >> (i * 3)) & 7];
+    }
+
+    for (uint32_t y = 0; y < h; y++)
+    {
+        for (uint32_t x = 0; x < w; x++)
+        {
+            int i = y * 4 + x;
+            uint32_t index = (bits >> (i * 2)) & 3;
+            uint32_t texelAlpha = format == GCM_TEXTURE_COMPRESSED_DXT1 ? a[index] : alpha[i];
+            out[y * stride + x] = MakePixel(r[index], g[index], b[index], texelAlpha);
+        }
+    }
+}
+
+static void DecodeDxt(const uint8_t* src, uint32_t format, uint32_t width, uint32_t height, uint32_t pitch, uint32_t* dst)
+{
+    const uint32_t blockSize = format == GCM_TEXTURE_COMPRESSED_DXT1 ? 8 : 16;
+
+    for (uint32_t by = 0; by < (height + 3) / 4; by++)
+    {
+        for (uint32_t bx = 0; bx < (width + 3) / 4; bx++)
+        {
+            const uint8_t* block = src + by * pitch + bx * blockSize;
+            uint32_t w = std::min(4u, width - bx * 4), h = std::min(4u, height - by * 4);
+            DecodeDxtBlock(block, format, &dst[by * 4 * width + bx * 4], width, w, h);
+        }
+    }
+}
+
+size_t TextureCache::KeyHash::operator()(const Key& key) const
+{
+    size_t hash = key.addr;
+    for (uint32_t v : {key.format, key.width, key.height, key.pitch})
+        hash = hash * 0x9E3779B97F4A7C15ULL + v;
+    return hash;
+}
+
+uint64_t TextureCache::SumWrites(uint32_t firstPage, uint32_t lastPage)
+{
+    uint64_t sum = 0;
+    for (uint32_t page = firstPage; page <= lastPage; page++)
+        sum += manager->GetPageWrites(page);
+    return sum;
+}
+
+bool TextureCache::Decode(CachedTexture& tex)
+{
+    const uint8_t* src = manager->GetRawPtr(tex.addr);
+    tex.pixels.resize(tex.width * tex.height);
+
+    // Compressed textures are never swizzled
+    if (IsCompressed(tex.format & ~(GCM_TEXTURE_LN | GCM_TEXTURE_UN)))
+        DecodeDxt(src, tex.format & ~(GCM_TEXTURE_LN | GCM_TEXTURE_UN), tex.width, tex.height, tex.pitch, tex.pixels.data());
+    else if (tex.format & GCM_TEXTURE_LN)
+        DecodeLinear(src, tex.format & ~(GCM_TEXTURE_LN | GCM_TEXTURE_UN), tex.width, tex.height, tex.pitch, tex.pixels.data());
+    else
+        DecodeSwizzled(src, tex.format & ~GCM_TEXTURE_UN, tex.width, tex.height, tex.pixels.data());
+
+    return true;
+}
+
+const CachedTexture* TextureCache::Get(uint32_t addr, const Texture& texture)
+{
+    const uint32_t format = texture.format & ~(GCM_TEXTURE_LN | GCM_TEXTURE_UN);
+    const uint32_t bpp = BytesPerTexel(format);
+    if (!bpp && !IsCompressed(format))
+    {
+        LOG(RSX, WARN, "Unhandled texture format 0x%02x\n", texture.format);
+        return nullptr;
+    }
+    if (!texture.width || !texture.height)
+        return nullptr;
+
+    uint32_t pitch, size;
+    if (IsCompressed(format))
+    {
+        pitch = ((texture.width + 3) / 4) * (format == GCM_TEXTURE_COMPRESSED_DXT1 ? 8 : 16);
+        size = pitch * ((texture.height + 3) / 4);
+    }
+    else if (texture.format & GCM_TEXTURE_LN)
+    {
+        pitch = texture.pitch ? texture.pitch : texture.width * bpp;
+        size = pitch * texture.height;
+    }
+    else
+    {
+        // Swizzled textures are packed, the Morton order runs over the power of two dimensions
+        pitch = 0;
+        size = std::bit_ceil(texture.width) * std::bit_ceil(texture.height) * bpp;
+    }
+
+    Key key = {addr, texture.format, texture.width, texture.height, pitch};
+    auto it = entries.find(key);
+    if (it != entries.end() && SumWrites(it->second.firstPage, it->second.lastPage) == it->second.writes)
+    {
+        it->second.lastUse = ++useClock;
+        return &it->second;
+    }
+
+    CachedTexture& tex = entries[key];
+    decodedBytes -= tex.pixels.size() * 4;
+    tex.addr = addr;
+    tex.format = texture.format;
+    tex.width = texture.width;
+    tex.height = texture.height;
+    tex.pitch = pitch;
+    tex.size = size;
+    tex.firstPage = addr / HOST_PAGE_SIZE;
+    tex.lastPage = (addr + size - 1) / HOST_PAGE_SIZE;
+    tex.lastUse = ++useClock;
+
+    // Watch before reading the counts and decoding, so a write that races the decode still invalidates it
+    manager->WatchWrites(addr, size);
+    tex.writes = SumWrites(tex.firstPage, tex.lastPage);
+    Decode(tex);
+    decodedBytes += tex.pixels.size() * 4;
+
+    LOG(RSX, INFO, "Decoded %dx%d texture at 0x%08x (format 0x%02x)\n", tex.width, tex.height, addr, tex.format);
+    return &tex;
+}
+
+void TextureCache::Trim()
+{
+    while (decodedBytes > TEXTURE_CACHE_MAX_BYTES)
+    {
+        auto oldest = std::min_element(entries.begin(), entries.end(), [](const auto& a, const auto& b) {return a.second.lastUse < b.second.lastUse;});
+        LOG(RSX, INFO, "Evicting %dx%d texture at 0x%08x\n", oldest->second.width, oldest->second.height, oldest->second.addr);
+        decodedBytes -= oldest->second.pixels.size() * 4;
+        entries.erase(oldest);
+    }
+}
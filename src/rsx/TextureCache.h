@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+#include <kernel/Memory.h>
+
+enum
+{
+    GCM_TEXTURE_B8 = 0x81,
+    GCM_TEXTURE_A1R5G5B5 = 0x82,
+    GCM_TEXTURE_A4R4G4B4 = 0x83,
+    GCM_TEXTURE_R5G6B5 = 0x84,
+    GCM_TEXTURE_A8R8G8B8 = 0x85,
+    GCM_TEXTURE_COMPRESSED_DXT1 = 0x86,
+    GCM_TEXTURE_COMPRESSED_DXT23 = 0x87,
+    GCM_TEXTURE_COMPRESSED_DXT45 = 0x88,
+
+    GCM_TEXTURE_SZ = 0x00,
+    GCM_TEXTURE_LN = 0x20, // Linear rather than swizzled
+    GCM_TEXTURE_UN = 0x40, // Unnormalized coordinates, doesn't change the layout
+};
+
+// Decoded pixels the cache holds on to before least recently used entries are dropped
+#define TEXTURE_CACHE_MAX_BYTES (128*1024*1024)
+
+struct Texture;
+
+// A texture decoded to the same pixel layout as the framebuffer, big-endian ARGB
+struct CachedTexture
+{
+    uint32_t addr, format, width, height, pitch;
+    uint32_t size; // Bytes of guest memory behind it
+    uint32_t firstPage, lastPage;
+    uint64_t writes; // Sum of the write counts of the pages behind it when it was decoded
+    uint64_t lastUse;
+    std::vector<uint32_t> pixels;
+};
+
+// Decoded textures keyed by their guest address, format, size and pitch
+// The pages behind every entry are write-watched, an entry gets decoded again once any of them has been written to
+class TextureCache
+{
+public:
+    void SetMman(MemoryManager* manager) {this->manager = manager;}
+
+    // nullptr for formats that can't be decoded yet
+    // Pointers stay valid until the next Trim()
+    const CachedTexture* Get(uint32_t addr, const Texture& tex);
+    // Drops least recently used entries until the cache is back under TEXTURE_CACHE_MAX_BYTES
+    void Trim();
+private:
+    struct Key
+    {
+        uint32_t addr, format, width, height, pitch;
+        bool operator==(const Key& other) const = default;
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const;
+    };
+
+    uint64_t SumWrites(uint32_t firstPage, uint32_t lastPage);
+    bool Decode(CachedTexture& tex);
+
+    MemoryManager* manager;
+    std::unordered_map<Key, CachedTexture, KeyHash> entries;
+    uint64_t useClock = 0;
+    uint64_t decodedBytes = 0;
+};
@@ -1,12 +1,15 @@
 #include "VPE.h"
+#include "VPJit.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <bitset>
 #include <math.h>
 #include <algorithm>
 #include <array>
+#include <logging.h>
+#include <smmintrin.h>
 
-// #define printf(x, ...) 0
+// #define LOG(RSX, TRACE, x, ...) 0
 
 int bitExtract(int number, int p, int k)
 {
@@ -169,21 +172,21 @@ void VertexShader::DoVertexShader(MemoryManager* manager)
                 break;
             }
             default:
-                printf("Unknown vector op %d\n", d1.vop);
+                LOG(RSX, ERROR, "Unknown vector op %d\n", d1.vop);
                 exit(1);
             }
 
             write_vec(value, dest_disasm);
 
             if (op2_disasm.size())
-                printf("%s %s,%s,%s\n", op_disasm.c_str(), dest_disasm.c_str(), op1_disasm.c_str(), op2_disasm.c_str());
+                LOG(RSX, TRACE, "%s %s,%s,%s\n", op_disasm.c_str(), dest_disasm.c_str(), op1_disasm.c_str(), op2_disasm.c_str());
             else
-                printf("%s %s,%s\n", op_disasm.c_str(), dest_disasm.c_str(), op1_disasm.c_str());
+                LOG(RSX, TRACE, "%s %s,%s\n", op_disasm.c_str(), dest_disasm.c_str(), op1_disasm.c_str());
         }
 
         if (d1.sop)
         {
-            printf("TODO: Non-zero scalar op\n");
+            LOG(RSX, ERROR, "TODO: Non-zero scalar op\n");
             exit(1);
         }
     }
@@ -191,28 +194,39 @@ void VertexShader::DoVertexShader(MemoryManager* manager)
     dest[0].x = (dest[0].x+1.0)*1280 / 2;
     dest[0].y = (1.0 - dest[0].y)*720 / 2;
 
-    printf("Output vertex: (%f, %f, %f, %f)\n", dest[0].x, dest[0].y, dest[0].z, dest[0].w);
+    LOG(RSX, TRACE, "Output vertex: (%f, %f, %f, %f)\n", dest[0].x, dest[0].y, dest[0].z, dest[0].w);
 }
 
 void VertexShader::SetVPOffs(uint32_t offs)
 {
     progOffs = progEntry = offs;
+    programDirty = true;
 }
 
 void VertexShader::AddInstruction(uint32_t instr)
 {
     *(uint32_t*)&memory[progOffs] = instr;
     progOffs += 4;
+    programDirty = true;
 }
 
 void VertexShader::SetInputMask(uint32_t mask)
 {
     inputMask = mask;
+    programDirty = true;
 }
 
 void VertexShader::SetResultMask(uint32_t mask)
 {
     resultMask = mask;
+    programDirty = true;
+}
+
+void VertexShader::EnableJit()
+{
+    if (!g_vpJit)
+        g_vpJit = new VPJit();
+    useJit = true;
 }
 
 void VertexShader::SetConstOffs(uint32_t offs)
@@ -245,7 +259,7 @@ void VertexShader::SetPosition(float pos[4])
 
     if (!position)
     {
-        printf("[WARN]: No position set\n");
+        LOG(RSX, WARN, "[WARN]: No position set\n");
         return;
     }
 
@@ -265,7 +279,7 @@ void VertexShader::SetColor(uint8_t color[4])
 
     if (!colorBinding)
     {
-        printf("[WARN]: No color set\n");
+        LOG(RSX, WARN, "[WARN]: No color set\n");
         return;
     }
 
@@ -311,13 +325,13 @@ vec4 VertexShader::read_src(int index, std::string& disasm)
                         + ", " + std::to_string(value.w) + ")";
         break;
     default:
-        printf("Unknown source type %d\n", reg_type);
+        LOG(RSX, ERROR, "Unknown source type %d\n", reg_type);
         exit(1);
     }
 
     if (GET_BITS(src, 8, 8) != 0x1B)
     {
-        printf("TODO: SWIZZLING!\n");
+        LOG(RSX, ERROR, "TODO: SWIZZLING!\n");
         exit(1);
     }
 
@@ -347,7 +361,7 @@ vec4 VertexShader::read_location(int index, std::string& disasm)
 {
     auto binding = GetBinding(index);
 
-    printf("Binding is at 0x%08x\n", binding.offset);
+    LOG(RSX, TRACE, "Binding is at 0x%08x\n", binding.offset);
 
     std::array<std::string, 16> locNames =
     {
@@ -383,7 +397,7 @@ vec4 VertexShader::read_location(int index, std::string& disasm)
             ret.z = (float&)tmp;
             tmp = BINDING_LOCATION(12);
             ret.w = (float&)tmp;
-            printf("(%f, %f, %f, %f)\n", ret.x, ret.y, ret.z, ret.w);
+            LOG(RSX, TRACE, "(%f, %f, %f, %f)\n", ret.x, ret.y, ret.z, ret.w);
         }
         else if (binding.elems == 3)
         {
@@ -394,7 +408,7 @@ vec4 VertexShader::read_location(int index, std::string& disasm)
             tmp = BINDING_LOCATION(8);
             ret.z = (float&)tmp;
             ret.w = 0.0f;
-            printf("(%f, %f, %f)\n", ret.x, ret.y, ret.z);
+            LOG(RSX, TRACE, "(%f, %f, %f)\n", ret.x, ret.y, ret.z);
         }
         else if (binding.elems == 2)
         {
@@ -404,11 +418,11 @@ vec4 VertexShader::read_location(int index, std::string& disasm)
             ret.y = (float&)tmp;
             ret.z = 0.0f;
             ret.w = 0.0f;
-            printf("%f, %f\n", ret.x, ret.y);
+            LOG(RSX, TRACE, "%f, %f\n", ret.x, ret.y);
         }
         else
         {
-            printf("Unknown F32 count %d\n", binding.elems);
+            LOG(RSX, ERROR, "Unknown F32 count %d\n", binding.elems);
             exit(1);
         }
     }
@@ -420,7 +434,7 @@ vec4 VertexShader::read_location(int index, std::string& disasm)
             ret.y = BINDING_LOCATION_U8(1);
             ret.z = BINDING_LOCATION_U8(2);
             ret.w = BINDING_LOCATION_U8(3);
-            printf("%f, %f, %f, %f\n", ret.x, ret.y, ret.z, ret.w);
+            LOG(RSX, TRACE, "%f, %f, %f, %f\n", ret.x, ret.y, ret.z, ret.w);
         }
         else if (binding.elems == 3)
         {
@@ -431,7 +445,7 @@ vec4 VertexShader::read_location(int index, std::string& disasm)
         }
         else
         {
-            printf("Unknown U8 count %d\n", binding.elems);
+            LOG(RSX, ERROR, "Unknown U8 count %d\n", binding.elems);
             exit(1);
         }
     }
@@ -456,13 +470,13 @@ void VertexShader::write_vec(vec4 value, std::string& disasm)
 
     if (d0.cond_test_enable)
     {
-        printf("TODO: Condition testing\n");
+        LOG(RSX, ERROR, "TODO: Condition testing\n");
         exit(1);
     }
 
     if (d0.dst_tmp == 0x3f && !d0.vec_result)
     {
-        printf("TODO: dst_tmp == 0x3f\n");
+        LOG(RSX, ERROR, "TODO: dst_tmp == 0x3f\n");
         exit(1);
     }
     else if (d0.vec_result && d3.dst < 16)
@@ -518,3 +532,288 @@ void VertexShader::write_vec(vec4 value, std::string& disasm)
         disasm = "R" + std::to_string(d0.dst_tmp);
     }
 }
+
+// Same limits as the interpreter, anything it would bail on is rejected here once instead of per vertex
+static VpSource DecodeSource(int index, D0 d0, D1 d1, D2 d2, D3 d3)
+{
+    uint32_t src = 0;
+    VpSource ret;
+
+    switch (index)
+    {
+    case 0:
+        src = (GET_BITS(d1.hex, 0, 8) << 9) | GET_BITS(d2.hex, 23, 9);
+        ret.abs = d0.src0_abs;
+        break;
+    case 1:
+        src = GET_BITS(d2.hex, 6, 17);
+        ret.abs = GET_BITS(d0.hex, 22, 1);
+        break;
+    }
+
+    switch (GET_BITS(src, 0, 2))
+    {
+    case 2:
+        ret.type = VP_SRC_INPUT;
+        ret.index = d1.input_src;
+        break;
+    case 3:
+        if (d3.index_const)
+        {
+            LOG(RSX, ERROR, "TODO: Indexed constants\n");
+            exit(1);
+        }
+        ret.type = VP_SRC_CONST;
+        ret.index = d1.const_src;
+        break;
+    default:
+        LOG(RSX, ERROR, "Unknown source type %d\n", GET_BITS(src, 0, 2));
+        exit(1);
+    }
+
+    if (GET_BITS(src, 8, 8) != 0x1B)
+    {
+        LOG(RSX, ERROR, "TODO: SWIZZLING!\n");
+        exit(1);
+    }
+
+    ret.neg = GET_BITS(src, 16, 1);
+    return ret;
+}
+
+void VertexShader::DecodeProgram()
+{
+    program.clear();
+    programWords.clear();
+    programInputs = 0;
+
+    D0 d0;
+    D1 d1;
+    D2 d2;
+    D3 d3;
+
+    for (int pc = progEntry; (pc-progEntry) < 512; pc += 16)
+    {
+        d0.hex = *(uint32_t*)&memory[pc];
+        d1.hex = *(uint32_t*)&memory[pc+4];
+        d2.hex = *(uint32_t*)&memory[pc+8];
+        d3.hex = *(uint32_t*)&memory[pc+12];
+        programWords.insert(programWords.end(), {d0.hex, d1.hex, d2.hex, d3.hex});
+
+        if (d1.vop != 0)
+        {
+            VpOp op{}; // Ops that write nothing (mask 0) never set dst, keep them deterministic for the JIT
+            op.vop = d1.vop;
+            op.saturate = d0.saturate;
+
+            switch (d1.vop)
+            {
+            case VP_OP_MOV:
+                op.src[0] = DecodeSource(0, d0, d1, d2, d3);
+                break;
+            case VP_OP_DP4:
+                op.src[0] = DecodeSource(0, d0, d1, d2, d3);
+                op.src[1] = DecodeSource(1, d0, d1, d2, d3);
+                break;
+            default:
+                LOG(RSX, ERROR, "Unknown vector op %d\n", d1.vop);
+                exit(1);
+            }
+
+            if (d0.cond_test_enable)
+            {
+                LOG(RSX, ERROR, "TODO: Condition testing\n");
+                exit(1);
+            }
+
+            op.mask = d3.vec_writemask_x | (d3.vec_writemask_y << 1) | (d3.vec_writemask_z << 2) | (d3.vec_writemask_w << 3);
+            if (d0.dst_tmp == 0x3f && !d0.vec_result)
+            {
+                LOG(RSX, ERROR, "TODO: dst_tmp == 0x3f\n");
+                exit(1);
+            }
+            else if (d0.vec_result && d3.dst < 16)
+            {
+                op.toOutput = true;
+                op.dst = d3.dst;
+            }
+            else if (d0.dst_tmp != 0x3f)
+            {
+                op.toOutput = false;
+                op.dst = d0.dst_tmp;
+            }
+            else
+                op.mask = 0;
+
+            for (int i = 0; i < (op.vop == VP_OP_DP4 ? 2 : 1); i++)
+            {
+                if (op.src[i].type == VP_SRC_INPUT)
+                    programInputs |= 1 << op.src[i].index;
+            }
+
+            program.push_back(op);
+        }
+
+        if (d1.sop)
+        {
+            LOG(RSX, ERROR, "TODO: Non-zero scalar op\n");
+            exit(1);
+        }
+
+        if (d3.end)
+            break;
+    }
+
+    compiled = useJit ? g_vpJit->GetProgram(programWords, inputMask, resultMask, program) : nullptr;
+    programDirty = false;
+}
+
+// Matches read_location, including the zeroed w of three component floats
+static vec4 FetchAttribute(const VertexBinding& binding, const uint8_t* data)
+{
+    vec4 ret;
+    if (binding.dtype == GCM_VERTEX_DATA_TYPE_F32)
+    {
+        uint32_t tmp[4] = {};
+        if (binding.elems < 2 || binding.elems > 4)
+        {
+            LOG(RSX, ERROR, "Unknown F32 count %d\n", binding.elems);
+            exit(1);
+        }
+
+        for (int i = 0; i < binding.elems; i++)
+            tmp[i] = __builtin_bswap32(*(const uint32_t*)&data[i*4]);
+        ret.x = (float&)tmp[0];
+        ret.y = (float&)tmp[1];
+        ret.z = (float&)tmp[2];
+        ret.w = (float&)tmp[3];
+    }
+    else
+    {
+        if (binding.elems < 3 || binding.elems > 4)
+        {
+            LOG(RSX, ERROR, "Unknown U8 count %d\n", binding.elems);
+            exit(1);
+        }
+
+        ret.x = data[0];
+        ret.y = data[1];
+        ret.z = data[2];
+        ret.w = binding.elems == 4 ? data[3] : 1.0f;
+    }
+
+    return ret;
+}
+
+// Viewport transform, then back to one vertex per struct
+static void WriteBatch(const Vec4x4* outputs, uint32_t lanes, Vertex* out)
+{
+    Vec4x4 pos = outputs[0], color = outputs[1];
+    pos.x = _mm_mul_ps(_mm_add_ps(pos.x, _mm_set1_ps(1.0f)), _mm_set1_ps(1280 / 2.0f));
+    pos.y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(1.0f), pos.y), _mm_set1_ps(720 / 2.0f));
+    _MM_TRANSPOSE4_PS(pos.x, pos.y, pos.z, pos.w);
+    _MM_TRANSPOSE4_PS(color.x, color.y, color.z, color.w);
+
+    const __m128 posRows[4] = {pos.x, pos.y, pos.z, pos.w}, colorRows[4] = {color.x, color.y, color.z, color.w};
+    for (uint32_t i = 0; i < lanes; i++)
+    {
+        _mm_storeu_ps(&out[i].pos.x, posRows[i]);
+        _mm_storeu_ps(&out[i].color.x, colorRows[i]);
+    }
+}
+
+void VertexShader::ProcessVertices(MemoryManager* manager, uint32_t first, uint32_t count, Vertex* out)
+{
+    if (programDirty)
+        DecodeProgram();
+
+    // Last binding for an attribute wins, same as GetBinding
+    const VertexBinding* inputs[16] = {};
+    for (auto& binding : bindings)
+        inputs[binding.attribute & 0xF] = &binding;
+
+    const uint8_t* vertexMem = manager->GetRawPtr(manager->RSXFBMem->GetStart());
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+
+    for (uint32_t base = 0; base < count; base += 4)
+    {
+        const uint32_t lanes = std::min(4u, count - base);
+
+        Vec4x4 in[16];
+        for (int attr = 0; attr < 16; attr++)
+        {
+            if (!(programInputs & (1 << attr)))
+                continue;
+
+            alignas(16) vec4 values[4] = {};
+            if (inputs[attr])
+            {
+                const VertexBinding& binding = *inputs[attr];
+                // Lanes past the end repeat the last vertex, their results are dropped
+                for (uint32_t i = 0; i < 4; i++)
+                    values[i] = FetchAttribute(binding, vertexMem + binding.offset + binding.stride * (first + base + std::min(i, lanes - 1)));
+            }
+
+            __m128 r0 = _mm_load_ps(&values[0].x), r1 = _mm_load_ps(&values[1].x);
+            __m128 r2 = _mm_load_ps(&values[2].x), r3 = _mm_load_ps(&values[3].x);
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+            in[attr] = {r0, r1, r2, r3};
+        }
+
+        Vec4x4 outputs[16], temps[64];
+        for (auto& reg : outputs)
+            reg = {_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_set1_ps(1.0f)};
+
+        if (compiled)
+        {
+            compiled(in, outputs, temps, (const vec4*)&memory[constBegin]);
+            WriteBatch(outputs, lanes, &out[base]);
+            continue;
+        }
+
+        auto read = [&](const VpSource& src)
+        {
+            Vec4x4 v;
+            if (src.type == VP_SRC_INPUT)
+                v = in[src.index];
+            else
+            {
+                const vec4& c = *(vec4*)&memory[constBegin + (src.index*sizeof(vec4))];
+                v = {_mm_set1_ps(c.x), _mm_set1_ps(c.y), _mm_set1_ps(c.z), _mm_set1_ps(c.w)};
+            }
+
+            if (src.abs)
+                v = {_mm_andnot_ps(signMask, v.x), _mm_andnot_ps(signMask, v.y), _mm_andnot_ps(signMask, v.z), _mm_andnot_ps(signMask, v.w)};
+            if (src.neg)
+                v = {_mm_xor_ps(signMask, v.x), _mm_xor_ps(signMask, v.y), _mm_xor_ps(signMask, v.z), _mm_xor_ps(signMask, v.w)};
+            return v;
+        };
+
+        for (auto& op : program)
+        {
+            Vec4x4 value = read(op.src[0]);
+            if (op.vop == VP_OP_DP4)
+            {
+                Vec4x4 b = read(op.src[1]);
+                __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(value.x, b.x), _mm_mul_ps(value.y, b.y)),
+                                      _mm_add_ps(_mm_mul_ps(value.z, b.z), _mm_mul_ps(value.w, b.w)));
+                value = {d, d, d, d};
+            }
+
+            if (op.saturate)
+            {
+                const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+                value = {_mm_min_ps(_mm_max_ps(value.x, zero), one), _mm_min_ps(_mm_max_ps(value.y, zero), one),
+                         _mm_min_ps(_mm_max_ps(value.z, zero), one), _mm_min_ps(_mm_max_ps(value.w, zero), one)};
+            }
+
+            Vec4x4& dst = op.toOutput ? outputs[op.dst] : temps[op.dst];
+            if (op.mask & 1) dst.x = value.x;
+            if (op.mask & 2) dst.y = value.y;
+            if (op.mask & 4) dst.z = value.z;
+            if (op.mask & 8) dst.w = value.w;
+        }
+
+        WriteBatch(outputs, lanes, &out[base]);
+    }
+}
@@ -4,6 +4,7 @@
 #include <vector>
 #include <cassert>
 #include <string>
+#include <xmmintrin.h>
 #include <kernel/Memory.h>
 
 enum
@@ -69,10 +70,74 @@ struct vec4
     float x, y, z, w;
 };
 
+struct Vertex
+{
+    vec4 pos, color;
+};
+
+// Four vertices worth of a register, one component per vector
+struct Vec4x4
+{
+    __m128 x, y, z, w;
+};
+
+// Runs a vertex program over one batch of four vertices
+typedef void (*CompiledVertexProgram)(const Vec4x4* in, Vec4x4* outputs, Vec4x4* temps, const vec4* consts);
+
+enum
+{
+    VP_SRC_INPUT,
+    VP_SRC_CONST,
+};
+
+enum
+{
+    VP_OP_MOV = 1,
+    VP_OP_DP4 = 7,
+};
+
+struct VpSource
+{
+    uint8_t type;
+    uint16_t index;
+    bool abs, neg;
+};
+
+// A vertex program instruction, decoded once when the program changes instead of once per vertex
+struct VpOp
+{
+    uint8_t vop;
+    uint8_t mask; // Components written, bit 0 = x ... bit 3 = w
+    bool saturate;
+    bool toOutput; // Writes an output register rather than a temp
+    uint8_t dst;
+    VpSource src[2];
+};
+
 class VertexShader
 {
 public:
     void DoVertexShader(MemoryManager* manager);
+    void EnableJit();
+
+    // Runs the program over vertices [first, first + count), four at a time
+    void ProcessVertices(MemoryManager* manager, uint32_t first, uint32_t count, Vertex* out);
+
+    // Calls f(offset, size) for every range of local memory ProcessVertices reads for the same vertices
+    template<class F>
+    void ForEachInputRange(uint32_t first, uint32_t count, F f)
+    {
+        if (programDirty)
+            DecodeProgram();
+
+        for (auto& binding : bindings)
+        {
+            if (!count || !(programInputs & (1 << (binding.attribute & 0xF))))
+                continue;
+            uint32_t elemSize = binding.elems * (binding.dtype == GCM_VERTEX_DATA_TYPE_F32 ? 4 : 1);
+            f(binding.offset + binding.stride * first, binding.stride * (count - 1) + elemSize);
+        }
+    }
 
     void SetVPOffs(uint32_t offs);
     void AddInstruction(uint32_t instr);
@@ -141,6 +206,15 @@ private:
     uint8_t memory[0x10000];
     std::vector<VertexBinding> bindings;
 
+    void DecodeProgram();
+
+    std::vector<VpOp> program;
+    std::vector<uint32_t> programWords; // Raw instructions up to the end bit, what the JIT cache is keyed on
+    CompiledVertexProgram compiled = nullptr;
+    bool useJit = false;
+    uint32_t programInputs = 0; // Inputs read by the program
+    bool programDirty = true;
+
     float in_pos[4]; // r0
     uint8_t in_color[4]; // r1
 
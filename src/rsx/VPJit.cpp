@@ -0,0 +1,190 @@
+#include "VPJit.h"
+
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <logging.h>
+
+#define CODE_BUFFER_SIZE (4*1024*1024)
+
+// Upper bound on the bytes emitted for a single op
+#define MAX_OP_SIZE 256
+
+// Argument registers of CompiledVertexProgram
+#define REG_IN 7 // rdi
+#define REG_OUTPUTS 6 // rsi
+#define REG_TEMPS 2 // rdx
+#define REG_CONSTS 1 // rcx
+
+// Constants kept in registers for the whole program
+#define XMM_ONE 12
+#define XMM_ZERO 13
+#define XMM_ABS 14
+#define XMM_SIGN 15
+
+VPJit* g_vpJit = nullptr;
+
+VPJit::VPJit()
+{
+    code = (uint8_t*)mmap(NULL, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (code == MAP_FAILED)
+    {
+        LOG(RSX, ERROR, "ERROR: Couldn't map %d bytes for the vertex program JIT\n", CODE_BUFFER_SIZE);
+        exit(1);
+    }
+}
+
+VPJit::~VPJit()
+{
+    munmap(code, CODE_BUFFER_SIZE);
+}
+
+void VPJit::Emit32(uint32_t data)
+{
+    for (int i = 0; i < 4; i++)
+        Emit8(data >> (i*8));
+}
+
+void VPJit::EmitMem(uint8_t prefix, uint8_t op, uint8_t xmm, uint8_t base, int32_t disp)
+{
+    if (prefix)
+        Emit8(prefix);
+    if (xmm >= 8)
+        Emit8(0x44);
+    Emit8(0x0F); Emit8(op);
+    // mod = 10 (disp32), none of the argument registers need a SIB byte
+    Emit8(0x80 | ((xmm & 7) << 3) | base);
+    Emit32(disp);
+}
+
+void VPJit::EmitReg(uint8_t prefix, uint8_t op, uint8_t dst, uint8_t src)
+{
+    if (prefix)
+        Emit8(prefix);
+    if (dst >= 8 || src >= 8)
+        Emit8(0x40 | (dst >= 8 ? 4 : 0) | (src >= 8 ? 1 : 0));
+    Emit8(0x0F); Emit8(op);
+    Emit8(0xC0 | ((dst & 7) << 3) | (src & 7));
+}
+
+void VPJit::SplatXmm(uint8_t xmm, uint32_t imm)
+{
+    // mov eax, imm
+    Emit8(0xB8); Emit32(imm);
+    // movd xmm, eax
+    EmitReg(0x66, 0x6E, xmm, 0);
+    // shufps xmm, xmm, 0
+    EmitReg(0, 0xC6, xmm, xmm); Emit8(0);
+}
+
+void VPJit::LoadSource(uint8_t xmm, const VpSource& src)
+{
+    for (int c = 0; c < 4; c++)
+    {
+        if (src.type == VP_SRC_INPUT)
+        {
+            // movaps xmm, [rdi + in[index].c]
+            EmitMem(0, 0x28, xmm + c, REG_IN, src.index*sizeof(Vec4x4) + c*sizeof(__m128));
+        }
+        else
+        {
+            // movss xmm, [rcx + consts[index].c]; shufps xmm, xmm, 0
+            EmitMem(0xF3, 0x10, xmm + c, REG_CONSTS, src.index*sizeof(vec4) + c*sizeof(float));
+            EmitReg(0, 0xC6, xmm + c, xmm + c); Emit8(0);
+        }
+
+        // andps/xorps against the abs and sign masks
+        if (src.abs)
+            EmitReg(0, 0x54, xmm + c, XMM_ABS);
+        if (src.neg)
+            EmitReg(0, 0x57, xmm + c, XMM_SIGN);
+    }
+}
+
+CompiledVertexProgram VPJit::Compile(const std::vector<VpOp>& program)
+{
+    if (codePos + (program.size() + 1) * MAX_OP_SIZE > CODE_BUFFER_SIZE)
+        return nullptr;
+
+    uint8_t* start = code + codePos;
+
+    SplatXmm(XMM_ONE, 0x3F800000);
+    // xorps xmm13, xmm13
+    EmitReg(0, 0x57, XMM_ZERO, XMM_ZERO);
+    SplatXmm(XMM_ABS, 0x7FFFFFFF);
+    SplatXmm(XMM_SIGN, 0x80000000);
+
+    for (auto& op : program)
+    {
+        // The value ends up in xmm0-3, one register per component
+        LoadSource(0, op.src[0]);
+
+        bool splat = false;
+        if (op.vop == VP_OP_DP4)
+        {
+            LoadSource(4, op.src[1]);
+            // Same order as the interpreter, (x*x + y*y) + (z*z + w*w)
+            for (int c = 0; c < 4; c++)
+                EmitReg(0, 0x59, c, 4 + c); // mulps
+            EmitReg(0, 0x58, 0, 1); // addps xmm0, xmm1
+            EmitReg(0, 0x58, 2, 3); // addps xmm2, xmm3
+            EmitReg(0, 0x58, 0, 2); // addps xmm0, xmm2
+            splat = true;
+        }
+
+        if (op.saturate)
+        {
+            for (int c = 0; c < (splat ? 1 : 4); c++)
+            {
+                EmitReg(0, 0x5F, c, XMM_ZERO); // maxps
+                EmitReg(0, 0x5D, c, XMM_ONE); // minps
+            }
+        }
+
+        uint8_t base = op.toOutput ? REG_OUTPUTS : REG_TEMPS;
+        for (int c = 0; c < 4; c++)
+        {
+            if (!(op.mask & (1 << c)))
+                continue;
+            // movaps [base + dst.c], xmm
+            EmitMem(0, 0x29, splat ? 0 : c, base, op.dst*sizeof(Vec4x4) + c*sizeof(__m128));
+        }
+    }
+
+    // ret
+    Emit8(0xC3);
+
+    return (CompiledVertexProgram)start;
+}
+
+static uint64_t HashProgram(const std::vector<uint32_t>& words, uint32_t inputMask, uint32_t resultMask)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325;
+    auto mix = [&](uint32_t value)
+    {
+        hash ^= value;
+        hash *= 0x100000001b3;
+    };
+
+    for (auto word : words)
+        mix(word);
+    mix(inputMask);
+    mix(resultMask);
+    return hash;
+}
+
+CompiledVertexProgram VPJit::GetProgram(const std::vector<uint32_t>& words, uint32_t inputMask, uint32_t resultMask, const std::vector<VpOp>& program)
+{
+    uint64_t hash = HashProgram(words, inputMask, resultMask);
+
+    auto it = programs.find(hash);
+    if (it != programs.end() && it->second.words == words && it->second.inputMask == inputMask && it->second.resultMask == resultMask)
+        return it->second.func;
+
+    CompiledVertexProgram func = Compile(program);
+    LOG(RSX, INFO, "Compiled vertex program %016lx (%ld ops)\n", hash, program.size());
+
+    programs[hash] = {words, inputMask, resultMask, func};
+    return func;
+}
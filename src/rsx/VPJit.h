@@ -0,0 +1,44 @@
+#pragma once
+
+#include "VPE.h"
+
+#include <vector>
+#include <unordered_map>
+
+// Translates decoded vertex programs into SSE code that works on a batch of four vertices in SoA layout
+// Programs are cached by a hash of their instructions and the input/result masks, most games only
+// ever use a handful of them, so each one gets compiled once and reused for every draw after that
+class VPJit
+{
+public:
+    VPJit();
+    ~VPJit();
+
+    // Returns nullptr once the code buffer is full, in which case the program stays interpreted
+    CompiledVertexProgram GetProgram(const std::vector<uint32_t>& words, uint32_t inputMask, uint32_t resultMask, const std::vector<VpOp>& program);
+private:
+    struct CachedProgram
+    {
+        std::vector<uint32_t> words; // Compared on a hash hit
+        uint32_t inputMask, resultMask;
+        CompiledVertexProgram func;
+    };
+
+    CompiledVertexProgram Compile(const std::vector<VpOp>& program);
+    void LoadSource(uint8_t xmm, const VpSource& src); // Components go into xmm..xmm+3
+
+    void Emit8(uint8_t data) {code[codePos++] = data;}
+    void Emit32(uint32_t data);
+
+    // op xmm, [base+disp32] and op dst, src with the optional mandatory prefix
+    void EmitMem(uint8_t prefix, uint8_t op, uint8_t xmm, uint8_t base, int32_t disp);
+    void EmitReg(uint8_t prefix, uint8_t op, uint8_t dst, uint8_t src);
+    void SplatXmm(uint8_t xmm, uint32_t imm);
+
+    std::unordered_map<uint64_t, CachedProgram> programs;
+
+    uint8_t* code;
+    size_t codePos = 0;
+};
+
+extern VPJit* g_vpJit;
@@ -6,48 +6,268 @@
 #include <stdexcept>
 #include <cassert>
 #include <algorithm>
+#include <cstring>
+#include <tmmintrin.h>
 #include <kernel/Modules/CellGcm.h>
-#include <iostream>
+#include <thread>
+#include <cpu/SpscRing.h>
+#include <logging.h>
+#include <chrono>
+
+#include "FrameDump.h"
 
 RSX rsxLocal;
 RSX* rsx = &rsxLocal;
 
 uint32_t start_time, frame_time;
 
+// Byte-swaps count words four at a time, used for command arguments and for presenting the display buffer
+static void SwapWords(uint32_t* dst, const uint8_t* src, uint32_t count)
+{
+    const __m128i mask = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_si128((__m128i*)&dst[i], _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&src[i*4]), mask));
+    for (; i < count; i++)
+        dst[i] = __builtin_bswap32(*(const uint32_t*)&src[i*4]);
+}
+
 void RSX::Init()
 {
+    if (headless.enabled)
+        return;
+
     SDL_Init(SDL_INIT_EVERYTHING);
     window = SDL_CreateWindow("PS3", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 1280, 720, 0);
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, 1280, 720);
 
     start_time = SDL_GetTicks();
 }
 
+void RSX::Start()
+{
+    std::thread(&RSX::ThreadMain, this).detach();
+    if (headless.enabled)
+        std::thread(&RSX::HeadlessMain, this).detach();
+    else
+        std::thread(&RSX::PresentMain, this).detach();
+}
+
+void RSX::Kick()
+{
+    kicks.fetch_add(1, std::memory_order_release);
+    FutexWake(&kicks);
+}
+
+void RSX::ThreadMain()
+{
+    // Nothing catches exceptions on this thread, so errors in the FIFO are reported here like on the PPU threads
+    try
+    {
+        while (true)
+        {
+            uint32_t kick = kicks.load(std::memory_order_acquire);
+
+            // Put can move while we're busy, so it's checked again before going to sleep
+            uint32_t control = CellGcm::GetControlAddress();
+            uint32_t put = control ? manager->Read32(control) : 0;
+            uint32_t get = control ? manager->Read32(control+4) : 0;
+
+            if (put == get)
+            {
+                FutexWait(&kicks, kick);
+                continue;
+            }
+
+            DoCommands(get, put);
+        }
+    }
+    catch (std::exception& e)
+    {
+        Log::Flush();
+        printf("***************************ERROR***************************\n");
+        printf("RSX error: %s        \n", e.what());
+        printf("***********************************************************\n");
+        exit(1);
+    }
+}
+
 void RSX::Present()
 {
-    if (!framebuffer) return;
+    presentRequests.fetch_add(1, std::memory_order_release);
+    FutexWake(&presentRequests);
 
-    // SDL_UpdateTexture(texture, NULL, framebuffer, colorPitch);
-    // SDL_RenderCopy(renderer, texture, NULL, NULL);
-    SDL_RenderPresent(renderer);
+    CellGcm::QueueFlipHandler();
+}
 
-    flipped = true;
+void RSX::Flip(uint32_t id)
+{
+    LOG(RSX, TRACE, "Flip(%d)\n", id);
 
-    frame_time = SDL_GetTicks() - start_time;
-    float fps = (frame_time > 0) ? 1000.0f / frame_time : 0.0f;
+    // The present thread reads flips before displayBuffer, so it never sees the new count with the old buffer
+    displayBuffer.store(id, std::memory_order_relaxed);
+    flips.fetch_add(1, std::memory_order_release);
 
-    start_time = SDL_GetTicks();
+    presentRequests.fetch_add(1, std::memory_order_release);
+    FutexWake(&presentRequests);
+
+    if (capture)
+        capture->Flip({id, GetCaptureDisplayBuffers()});
+}
+
+void RSX::CreatePresentTexture(uint32_t width, uint32_t height)
+{
+    if (texture)
+        SDL_DestroyTexture(texture);
+
+    // A texture in the guest's byte order can take the display buffer as is
+    SDL_RendererInfo info;
+    swapOnPresent = true;
+    if (!SDL_GetRendererInfo(renderer, &info))
+    {
+        for (uint32_t i = 0; i < info.num_texture_formats; i++)
+        {
+            if (info.texture_formats[i] == SDL_PIXELFORMAT_ARGB32)
+                swapOnPresent = false;
+        }
+    }
+
+    texture = SDL_CreateTexture(renderer, swapOnPresent ? SDL_PIXELFORMAT_ARGB8888 : SDL_PIXELFORMAT_ARGB32, SDL_TEXTUREACCESS_STREAMING, width, height);
+    textureWidth = width;
+    textureHeight = height;
+}
+
+void RSX::PresentMain()
+{
+    // The renderer is only ever touched from this thread
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    uint32_t lastRequest = 0, lastFlip = 0;
+
+    while (true)
+    {
+        uint32_t request = presentRequests.load(std::memory_order_acquire);
+        if (request == lastRequest)
+        {
+            FutexWait(&presentRequests, request);
+            continue;
+        }
+        lastRequest = request;
+
+        uint32_t flip = flips.load(std::memory_order_acquire);
+        RsxFramebuffer fb = GetFramebuffer(displayBuffer.load(std::memory_order_relaxed) & 7);
+
+        if (fb.width && fb.height)
+        {
+            if (fb.width != textureWidth || fb.height != textureHeight)
+                CreatePresentTexture(fb.width, fb.height);
+
+            // Converted straight from guest memory into the locked texture
+            void* pixels;
+            int pitch;
+            if (!SDL_LockTexture(texture, NULL, &pixels, &pitch))
+            {
+                const uint8_t* src = manager->GetRawPtr(manager->RSXFBMem->GetStart() + fb.offs);
+                for (uint32_t y = 0; y < fb.height; y++)
+                {
+                    uint8_t* dst = (uint8_t*)pixels + y * pitch;
+                    if (swapOnPresent)
+                        SwapWords((uint32_t*)dst, src + y * fb.pitch, fb.width);
+                    else
+                        memcpy(dst, src + y * fb.pitch, fb.width * 4);
+                }
+                SDL_UnlockTexture(texture);
+            }
+            else
+                LOG(RSX, WARN, "Couldn't lock the present texture: %s\n", SDL_GetError());
+
+            SDL_RenderCopy(renderer, texture, NULL, NULL);
+        }
+
+        // Blocks until vsync
+        SDL_RenderPresent(renderer);
+
+        // The display buffer has been read, the guest may draw to it again
+        if (flip != lastFlip)
+        {
+            lastFlip = flip;
+            flipped = true;
+        }
+
+        frame_time = SDL_GetTicks() - start_time;
+        float fps = (frame_time > 0) ? 1000.0f / frame_time : 0.0f;
+
+        start_time = SDL_GetTicks();
+
+        static char buf[4096];
+        snprintf(buf, 4096, "PS3 - %f fps", fps);
+        SDL_SetWindowTitle(window, buf);
+    }
+}
+
+void RSX::HeadlessMain()
+{
+    uint32_t lastRequest = 0, lastFlip = 0, frame = 0;
+    auto lastFrameTime = std::chrono::steady_clock::now();
+
+    while (true)
+    {
+        uint32_t request = presentRequests.load(std::memory_order_acquire);
+        if (request == lastRequest)
+        {
+            FutexWait(&presentRequests, request);
+            continue;
+        }
+        lastRequest = request;
+
+        // Without a display only flips matter, vblanks just queue the flip handler
+        uint32_t flip = flips.load(std::memory_order_acquire);
+        if (flip == lastFlip)
+            continue;
+        lastFlip = flip;
+
+        auto now = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(now - lastFrameTime).count();
+        lastFrameTime = now;
+        // The timings are the point of running headless, so they go to stdout at any log level, after what's been logged so far
+        Log::Flush();
+        printf("Frame %u: %.3f ms\n", frame, ms);
+
+        RsxFramebuffer fb = GetFramebuffer(displayBuffer.load(std::memory_order_relaxed) & 7);
+        if (headless.dumpPath && fb.width && fb.height && frame % headless.dumpInterval == 0)
+        {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/frame_%06u.%s", headless.dumpPath, frame, headless.dumpRaw ? "raw" : "png");
+
+            const uint8_t* pixels = manager->GetRawPtr(manager->RSXFBMem->GetStart() + fb.offs);
+            if (headless.dumpRaw)
+                WriteFrameRaw(path, pixels, fb.width, fb.height, fb.pitch);
+            else
+                WriteFramePng(path, pixels, fb.width, fb.height, fb.pitch);
+        }
 
-    static char buf[4096];
-    snprintf(buf, 4096, "PS3 - %f fps", fps);
-    SDL_SetWindowTitle(window, buf);
+        frame++;
+        flipped = true;
+    }
+}
 
-    CellGcm::RunFlipHandler();
+CaptureDisplayBuffers RSX::GetCaptureDisplayBuffers()
+{
+    CaptureDisplayBuffers display;
+    std::lock_guard<std::mutex> lock(framebufferLock);
+    for (int i = 0; i < 8; i++)
+        display.buffers[i] = {framebuffers[i].offs, framebuffers[i].pitch, framebuffers[i].width, framebuffers[i].height};
+    return display;
+}
+
+RSX::RsxFramebuffer RSX::GetFramebuffer(int id)
+{
+    std::lock_guard<std::mutex> lock(framebufferLock);
+    return framebuffers[id];
 }
 
 void RSX::SetFramebuffer(int id, uint32_t offset, uint32_t pitch, uint32_t width, uint32_t height)
 {
+    std::lock_guard<std::mutex> lock(framebufferLock);
     auto& fb = framebuffers[id];
     fb.offs = offset;
     fb.pitch = pitch;
@@ -64,35 +284,17 @@ uint32_t Read32(uint8_t* ptr, uint64_t& offs, uint32_t& get)
     return data;
 }
 
-#define case_16(a, m) \
-    case a + m: \
-    case a + m * 2: \
-    case a + m * 3: \
-    case a + m * 4: \
-    case a + m * 5: \
-    case a + m * 6: \
-    case a + m * 7: \
-    case a + m * 8: \
-    case a + m * 9: \
-    case a + m * 10: \
-    case a + m * 11: \
-    case a + m * 12: \
-    case a + m * 13: \
-    case a + m * 14: \
-    case a + m * 15: \
-    index = (cmd - a) / m; \
-    case a \
-
-void RSX::DoCommands(uint8_t *buf, uint32_t size)
+void RSX::DoCommands(uint32_t get, uint32_t put)
 {
     uint64_t offs = 0;
 
     std::vector<uint32_t> callStack;
 
-    uint32_t get =  manager->Read32(CellGcm::GetControlAddress()+4);
-    uint32_t put =  manager->Read32(CellGcm::GetControlAddress());
-    buf = manager->GetRawPtr(CellGcm::GetIOAddres() + get);
-	printf("Executing 0x%08x bytes of commands\n", put - get);
+    uint8_t* buf = manager->GetRawPtr(CellGcm::GetIOAddres() + get);
+	LOG(RSX, TRACE, "Executing 0x%08x bytes of commands\n", put - get);
+
+    if (capture)
+        capture->DisplayBuffers(GetCaptureDisplayBuffers());
 
     while (get < put)
     {
@@ -103,17 +305,17 @@ void RSX::DoCommands(uint8_t *buf, uint32_t size)
         {
             // Jump command
             offs = cmd & ~0x20000000;
-            printf("Jump to 0x%08lx\n", offs);
+            LOG(RSX, TRACE, "Jump to 0x%08lx\n", offs);
             continue;
         }
         else if (cmd & 2)
         {
-            printf("TODO: call\n");
+            LOG(RSX, ERROR, "TODO: call\n");
             exit(1);
         }
         else if (cmd == 0x20000)
         {
-            printf("RETURN\n");
+            LOG(RSX, TRACE, "RETURN\n");
             if (callStack.empty())
             {
                 throw std::runtime_error("Cannot return with empty call stack");
@@ -125,485 +327,632 @@ void RSX::DoCommands(uint8_t *buf, uint32_t size)
             }
         }
 
-        std::vector<uint32_t> args;
+        SwapWords(methodArgs, &buf[offs], count);
+        offs += count*4;
+        get += count*4;
 
-        for (int i = 0; i < count; i++)
-        {
-            args.push_back(Read32(buf, offs, get));
-        }
+        DoCmd(cmd & 0x3FFFF, std::span<const uint32_t>(methodArgs, count));
 
-        DoCmd(cmd, cmd & 0x3FFFF, args, count);
+        // Recorded after running, so the memory a method references ends up in front of it
+        // Flips are recorded on their own along with the display buffers
+        if (capture && (cmd & 0x3FFFF) != 0x3FEAD)
+            capture->Method(cmd & 0x3FFFF, std::span<const uint32_t>(methodArgs, count));
     }
 
-    std::cout << "Done processing CMD list\n";
+    LOG(RSX, TRACE, "Done processing CMD list\n");
 
     manager->Write32(CellGcm::GetControlAddress()+4, get);
 }
 
-void RSX::DoCmd(uint32_t fullCmd, uint32_t cmd, std::vector<uint32_t> &args, int argCount)
+constexpr std::array<RSX::MethodHandler, RSX_METHOD_COUNT> RSX::BuildMethodTable()
 {
-    int index = 0;
-    
-    switch (cmd)
+    std::array<MethodHandler, RSX_METHOD_COUNT> table{};
+    table.fill(&RSX::UnknownMethod);
+
+    auto set = [&](uint32_t method, MethodHandler handler) {table[method >> 2] = handler;};
+    // 16 copies of a method, one per texture/attribute, the handler works out the index from the offset
+    auto set16 = [&](uint32_t method, uint32_t stride, MethodHandler handler)
     {
-    case 0x050:
-        printf("NV406ETCL_SET_REF(0x%08x)\n", args[0]);
-        manager->Write32(CellGcm::GetControlAddress()+8, args[0]);
-        break;
-    case 0x064:
-    case 0x1d6c:
-        printf("NV406ETCL_SEMAPHORE_OFFSET(0x%08x)\n", args[0]);
-        semaphoreOffset = args[0];
-        break;
-    case 0x068:
-        printf("NV406ETCL_SEMAPHORE_ACQUIRE(0x%08x)\n", args[0]);
-        break;
-    case 0x100:
-        printf("NV40TCL_NOP()\n");
-        break;
-    case 0x110:
-        printf("NV40TCL_WAIT_FOR_IDLE()\n");
-        break;
-    case 0x18C:
-        dmaColorB = args[0];
-        printf("NV40TCL_DMA_COLOR1(0x%08x)\n", dmaColorB);
-        break;
-    case 0x194:
-        dmaColorA = args[0];
-        printf("NV40TCL_DMA_COLOR0(0x%08x)\n", dmaColorA);
-        break;
-    case 0x198:
-        dmaColorZ = args[0];
-        printf("NV40TCL_DMA_ZETA(0x%08x)\n", dmaColorZ);
-        break;
-    case 0x1B4:
+        for (uint32_t i = 0; i < 16; i++)
+            table[(method + i*stride) >> 2] = handler;
+    };
+
+    set(0x050, &RSX::SetReference);
+    set(0x064, &RSX::SetSemaphoreOffset);
+    set(0x068, &RSX::SemaphoreAcquire);
+    set(0x06C, &RSX::SemaphoreRelease);
+    set(0x100, &RSX::Nop);
+    set(0x110, &RSX::WaitForIdle);
+    set(0x18C, &RSX::SetDmaColor1);
+    set(0x194, &RSX::SetDmaColor0);
+    set(0x198, &RSX::SetDmaZeta);
+    set(0x1B4, &RSX::SetDmaColor2);
+    set(0x1D88, &RSX::IgnoreMethod);
+    set(0x200, &RSX::IgnoreMethod);
+    set(0x208, &RSX::SetRtFormat);
+    set(0x220, &RSX::SetRtEnable);
+    set(0x22C, &RSX::SetZetaPitch);
+    set(0x280, &RSX::IgnoreMethod);
+    set(0x2B8, &RSX::SetWindowOffset);
+    set(0x304, &RSX::SetAlphaTestEnable);
+    set(0x310, &RSX::SetBlendEnable);
+    set(0x314, &RSX::SetBlendFunc);
+    set(0x324, &RSX::SetColorMask);
+    set(0x370, &RSX::IgnoreMethod);
+    set(0x380, &RSX::IgnoreMethod);
+    set(0x394, &RSX::SetDepthRange);
+    set(0x8C0, &RSX::SetScissor);
+    set(0x8E4, &RSX::SetFpAddress);
+    set(0xA00, &RSX::SetViewport);
+    set(0xA20, &RSX::SetViewportOffset);
+    set(0xA6C, &RSX::SetDepthFunc);
+    set(0xA74, &RSX::SetDepthTestEnable);
+    set16(0xB40, 4, &RSX::IgnoreMethod);
+    set(0xB80, &RSX::UploadVpInstructions);
+    set16(0x1680, 4, &RSX::SetVertexBufferAddress);
+    set(0x1710, &RSX::InvalidateVertexCache);
+    set(0x1714, &RSX::InvalidateVertexCache);
+    set16(0x1740, 4, &RSX::SetVertexFormat);
+    set(0x1800, &RSX::GetReport);
+    set(0x1808, &RSX::SetBeginEnd);
+    set(0x1814, &RSX::DrawArrays);
+    set(0x1828, &RSX::SetPolygonModeFront);
+    set16(0x1840, 4, &RSX::SetTextureControl3);
+    set16(0x1A00, 0x20, &RSX::SetTextureOffset);
+    set16(0x1A08, 0x20, &RSX::SetTextureAddress);
+    set16(0x1A0C, 0x20, &RSX::SetTextureControl0);
+    set16(0x1A10, 0x20, &RSX::SetTextureSwizzle);
+    set16(0x1A14, 0x20, &RSX::SetTextureFilter);
+    set16(0x1A18, 0x20, &RSX::SetTextureRect);
+    set(0x1D60, &RSX::SetFpControl);
+    set(0x1D6C, &RSX::SetSemaphoreOffset);
+    set(0x1D70, &RSX::BackendWriteRelease);
+    set(0x1D8C, &RSX::SetZStencilClearValue);
+    set(0x1D90, &RSX::SetClearColor);
+    set(0x1D94, &RSX::ClearSurface);
+    set(0x1E9C, &RSX::SetVpUploadOffset);
+    set(0x1EF8, &RSX::SetTransformTimeout);
+    set(0x1EFC, &RSX::UploadVpConstants);
+    set(0x1FF0, &RSX::SetVpAttribEnable);
+    set(0x1FF4, &RSX::SetVpResultEnable);
+
+    return table;
+}
+
+constinit const std::array<RSX::MethodHandler, RSX_METHOD_COUNT> RSX::methodTable = RSX::BuildMethodTable();
+
+void RSX::DoCmd(uint32_t cmd, std::span<const uint32_t> args)
+{
+    if (cmd < RSX_METHOD_COUNT*4)
+        (this->*methodTable[cmd >> 2])(cmd, args);
+    else if (cmd == 0x3FEAD) // Flip marker written by cellGcmSetFlipCommand
+        Flip(args[0]);
+    else
+        UnknownMethod(cmd, args);
+}
+
+void RSX::UnknownMethod(uint32_t cmd, std::span<const uint32_t> args)
+{
+    LOG(RSX, ERROR, "Unknown RSX command 0x%05x (", cmd);
+    for (auto arg : args)
+        LOG(RSX, ERROR, "0x%08x, ", arg);
+    LOG(RSX, ERROR, "\b\b)\n");
+    throw std::runtime_error("Unknown RSX command");
+}
+
+void RSX::IgnoreMethod(uint32_t cmd, std::span<const uint32_t> args)
+{
+}
+
+void RSX::SetReference(uint32_t cmd, std::span<const uint32_t> args)
+{
+    LOG(RSX, TRACE, "NV406ETCL_SET_REF(0x%08x)\n", args[0]);
+    // Everything before this has been drawn by the time the PPU sees ref change
+    std::atomic_thread_fence(std::memory_order_release);
+    manager->Write32(CellGcm::GetControlAddress()+8, args[0]);
+}
+
+void RSX::SetSemaphoreOffset(uint32_t cmd, std::span<const uint32_t> args)
+{
+    LOG(RSX, TRACE, "NV406ETCL_SEMAPHORE_OFFSET(0x%08x)\n", args[0]);
+    semaphoreOffset = args[0];
+}
+
+void RSX::SemaphoreAcquire(uint32_t cmd, std::span<const uint32_t> args)
+{
+    LOG(RSX, TRACE, "NV406ETCL_SEMAPHORE_ACQUIRE(0x%08x)\n", args[0]);
+    // Stalls the FIFO until the PPU (or an earlier release) writes the value
+    uint32_t addr = manager->RSXCmdMem->GetStart() + semaphoreOffset;
+    while (__atomic_load_n((uint32_t*)manager->GetRawPtr(addr), __ATOMIC_ACQUIRE) != __builtin_bswap32(args[0]))
+        std::this_thread::yield();
+
+    if (capture)
+        capture->Memory(addr, 4, true);
+}
+
+void RSX::SemaphoreRelease(uint32_t cmd, std::span<const uint32_t> args)
+{
+    LOG(RSX, TRACE, "NV406ETCL_SEMAPHORE_RELEASE(0x%08x)\n", args[0]);
+    uint32_t addr = manager->RSXCmdMem->GetStart() + semaphoreOffset;
+    __atomic_store_n((uint32_t*)manager->GetRawPtr(addr), __builtin_bswap32(args[0]), __ATOMIC_RELEASE);
+}
+
+void RSX::Nop(uint32_t cmd, std::span<const uint32_t> args)
+{
+    LOG(RSX, TRACE, "NV40TCL_NOP()\n");
+}
+
+void RSX::WaitForIdle(uint32_t cmd, std::span<const uint32_t> args)
+{
+    LOG(RSX, TRACE, "NV40TCL_WAIT_FOR_IDLE()\n");
+}
+
+void RSX::SetDmaColor1(uint32_t cmd, std::span<const uint32_t> args)
+{
+    dmaColorB = args[0];
+    LOG(RSX, TRACE, "NV40TCL_DMA_COLOR1(0x%08x)\n", dmaColorB);
+}
+
+void RSX::SetDmaColor0(uint32_t cmd, std::span<const uint32_t> args)
+{
+    dmaColorA = args[0];
+    LOG(RSX, TRACE, "NV40TCL_DMA_COLOR0(0x%08x)\n", dmaColorA);
+}
+
+void RSX::SetDmaZeta(uint32_t cmd, std::span<const uint32_t> args)
+{
+    dmaColorZ = args[0];
+    LOG(RSX, TRACE, "NV40TCL_DMA_ZETA(0x%08x)\n", dmaColorZ);
+}
+
+void RSX::SetDmaColor2(uint32_t cmd, std::span<const uint32_t> args)
+{
+    dmaColorC = args[0];
+    if (args.size() == 2)
     {
-        dmaColorC = args[0];
-        if (argCount == 2)
-        {
-            dmaColorD = args[1];
-            printf("NV40TCL_DMA_COLOR2_COLOR3(0x%08x, 0x%08x)\n", dmaColorC, dmaColorD);
-        }
-        else
-            printf("NV40TCL_DMA_COLOR2(0x%08x)\n", dmaColorC);
-        break;
+        dmaColorD = args[1];
+        LOG(RSX, TRACE, "NV40TCL_DMA_COLOR2_COLOR3(0x%08x, 0x%08x)\n", dmaColorC, dmaColorD);
     }
-    case 0x1D88:
-        break;
-    case 0x200:
-        break;
-    case 0x208:
-        colorPitch = args[1];
-        color0Offset = args[2];
-        zOffset = args[3];
-        printf("NV40TCL_RT_FORMAT(0x%08x, 0x%08x, 0x%08x)\n", colorPitch, color0Offset, zOffset);
-        break;
-    case 0x220:
-        printf("NV40TCL_RT_ENABLE(0x%08x)\n", args[0]);
-        assert(args[0] == 0x1);
-        break;
-    case 0x22C:
-        zPitch = args[0];
-        printf("NV40TCL_ZETA_PITCH(0x%08x)\n", zPitch);
-        break;
-    case 0x280:
-        break;
-    case 0x2B8:
-        printf("NV40TCL_WINDOW_OFFSET\n");
-        break;
-    case 0x304:
-        alpha_test_enable = args[0];
-        printf("NV40TCL_ALPHA_TEST_ENABLE(%d)\n", alpha_test_enable);
-        break;
-    case 0x310:
-        blend_enable = args[0];
-        printf("NV40TCL_BLEND_ENABLE(%d)\n", blend_enable);
-        break;
-    case 0x314:
-    {
-        blend_sfunc_rgb = args[0] & 0xffff;
-        blend_sfunc_alpha = args[0] >> 16;
+    else
+        LOG(RSX, TRACE, "NV40TCL_DMA_COLOR2(0x%08x)\n", dmaColorC);
+}
 
-        if (argCount == 2)
-        {
-            blend_dfunc_rgb = args[1] & 0xffff;
-            blend_dfunc_alpha = args[1] >> 16;
-            printf("NV30_BLEND_SFUNC_DFUNC(%x, %x, %x, %x)\n", blend_sfunc_rgb, blend_sfunc_alpha, blend_dfunc_rgb, blend_dfunc_alpha);
-        }
-        else
-            printf("NV30_BLEND_SFUNC(%x, %x)\n", blend_sfunc_rgb, blend_sfunc_alpha);
-        break;
-    }
-    case 0x324:
+void RSX::SetRtFormat(uint32_t cmd, std::span<const uint32_t> args)
+{
+    colorPitch = args[1];
+    color0Offset = args[2];
+    zOffset = args[3];
+    framebuffer = manager->GetRawPtr(manager->RSXFBMem->GetStart() + color0Offset);
+    depthBuffer = manager->GetRawPtr(manager->RSXFBMem->GetStart() + zOffset);
+    LOG(RSX, TRACE, "NV40TCL_RT_FORMAT(0x%08x, 0x%08x, 0x%08x)\n", colorPitch, color0Offset, zOffset);
+}
+
+void RSX::SetRtEnable(uint32_t cmd, std::span<const uint32_t> args)
+{
+    LOG(RSX, TRACE, "NV40TCL_RT_ENABLE(0x%08x)\n", args[0]);
+    assert(args[0] == 0x1);
+}
+
+void RSX::SetZetaPitch(uint32_t cmd, std::span<const uint32_t> args)
+{
+    zPitch = args[0];
+    LOG(RSX, TRACE, "NV40TCL_ZETA_PITCH(0x%08x)\n", zPitch);
+}
+
+void RSX::SetWindowOffset(uint32_t cmd, std::span<const uint32_t> args)
+{
+    LOG(RSX, TRACE, "NV40TCL_WINDOW_OFFSET\n");
+}
+
+void RSX::SetAlphaTestEnable(uint32_t cmd, std::span<const uint32_t> args)
+{
+    alpha_test_enable = args[0];
+    LOG(RSX, TRACE, "NV40TCL_ALPHA_TEST_ENABLE(%d)\n", alpha_test_enable);
+}
+
+void RSX::SetBlendEnable(uint32_t cmd, std::span<const uint32_t> args)
+{
+    blend_enable = args[0];
+    LOG(RSX, TRACE, "NV40TCL_BLEND_ENABLE(%d)\n", blend_enable);
+}
+
+void RSX::SetBlendFunc(uint32_t cmd, std::span<const uint32_t> args)
+{
+    blend_sfunc_rgb = args[0] & 0xffff;
+    blend_sfunc_alpha = args[0] >> 16;
+
+    if (args.size() == 2)
     {
-        uint32_t mask = args[0];
-        r_mask = (mask & 0x01000000) ? true : false;
-        g_mask = (mask & 0x00010000) ? true : false;
-        b_mask = (mask & 0x00000100) ? true : false;
-        a_mask = (mask & 0x00000001) ? true : false;
-        printf("NV4097_SET_COLOR_MASK(%d, %d, %d, %d)\n", r_mask, g_mask, b_mask, a_mask);
-        break;
+        blend_dfunc_rgb = args[1] & 0xffff;
+        blend_dfunc_alpha = args[1] >> 16;
+        LOG(RSX, TRACE, "NV30_BLEND_SFUNC_DFUNC(%x, %x, %x, %x)\n", blend_sfunc_rgb, blend_sfunc_alpha, blend_dfunc_rgb, blend_dfunc_alpha);
     }
-    case 0x370:
-        break;
-    case 0x380:
-        break;
-    case 0x394:
-    {
-        depth_min = (float&)args[0];
+    else
+        LOG(RSX, TRACE, "NV30_BLEND_SFUNC(%x, %x)\n", blend_sfunc_rgb, blend_sfunc_alpha);
+}
 
-        if (argCount == 2)
-        {
-            depth_max = (float&)args[1];
-            printf("NV30_DEPTH_MIN_MAX(%f, %f)\n", depth_min, depth_max);
-        }
-        else
-            printf("NV30_DEPTH_MIN(%f)\n", depth_min);
-        break;
-    }
-    case 0x8C0:
-    {
-        scissor_width = (args[0] >> 16);
-        scissor_x = (args[0] & 0xffff);
+void RSX::SetColorMask(uint32_t cmd, std::span<const uint32_t> args)
+{
+    uint32_t mask = args[0];
+    r_mask = (mask & 0x01000000) ? true : false;
+    g_mask = (mask & 0x00010000) ? true : false;
+    b_mask = (mask & 0x00000100) ? true : false;
+    a_mask = (mask & 0x00000001) ? true : false;
+    LOG(RSX, TRACE, "NV4097_SET_COLOR_MASK(%d, %d, %d, %d)\n", r_mask, g_mask, b_mask, a_mask);
+}
 
-        if (argCount == 2)
-        {
-            scissor_height = (args[1] >> 16);
-            scissor_y = (args[1] & 0xffff);
-            printf("NV30_SCISSOR_HORIZ_VERT(%d, %d, %d, %d)\n", scissor_width, scissor_height, scissor_x, scissor_y);
-        }
-        else
-            printf("NV30_SCISSOR_HORIZ(%d, %d)\n", scissor_width, scissor_x);
-        break;
-    }
-    case 0x8E4:
+void RSX::SetDepthRange(uint32_t cmd, std::span<const uint32_t> args)
+{
+    depth_min = (const float&)args[0];
+
+    if (args.size() == 2)
     {
-        fpShaderOffs = args[0];
-        printf("NV40TCL_FP_ADDRESS(0x%08x)\n", args[0]);
-        break;
+        depth_max = (const float&)args[1];
+        LOG(RSX, TRACE, "NV30_DEPTH_MIN_MAX(%f, %f)\n", depth_min, depth_max);
     }
-    case 0xA00:
-    {
-        viewport_width = (args[0] >> 16);
-        viewport_x = (args[0] & 0xffff);
+    else
+        LOG(RSX, TRACE, "NV30_DEPTH_MIN(%f)\n", depth_min);
+}
 
-        if (argCount == 2)
-        {
-            viewport_height = (args[1] >> 16);
-            viewport_y = (args[1] & 0xffff);
-            printf("NV30_VIEWPORT_HORIZ_VERT(%d, %d, %d, %d)\n", viewport_width, viewport_height, viewport_x, viewport_y);
-        }
-        else
-            printf("NV30_VIEWPORT_HORIZ(%d, %d)\n", viewport_width, viewport_x);
-        break;
-    }
-    case 0xA20:
-        printf("NV30_VIEWPORT_OFFSET\n");
-        break;
-    case 0xA6C:
-        depthTestFunc = (DepthTestFunc)args[0];
-        printf("NV30_DEPTH_TEST_FUNC(%s)\n", DepthFuncToString(depthTestFunc).c_str());
-        break;
-    case 0xA74:
-        depthTestEnabled = args[0];
-        printf("NV30_DEPTH_TEST_ENABLED(%s)\n", depthTestEnabled ? "GCM_TRUE" : "GCM_FALSE");
-        break;
-    case_16(0xB40, 4):
+void RSX::SetScissor(uint32_t cmd, std::span<const uint32_t> args)
+{
+    scissor_width = (args[0] >> 16);
+    scissor_x = (args[0] & 0xffff);
+
+    if (args.size() == 2)
     {
-        break;
+        scissor_height = (args[1] >> 16);
+        scissor_y = (args[1] & 0xffff);
+        LOG(RSX, TRACE, "NV30_SCISSOR_HORIZ_VERT(%d, %d, %d, %d)\n", scissor_width, scissor_height, scissor_x, scissor_y);
     }
-    case 0xB80:
-        for (int i = 0; i < argCount; i++) vpe.AddInstruction(args[i]);
-        printf("NV30_3D_VP_UPLOAD_INST()\n");
-        break;
-    case 0x1680 ... 0x16BC:
+    else
+        LOG(RSX, TRACE, "NV30_SCISSOR_HORIZ(%d, %d)\n", scissor_width, scissor_x);
+}
+
+void RSX::SetFpAddress(uint32_t cmd, std::span<const uint32_t> args)
+{
+    fpShaderOffs = args[0];
+    LOG(RSX, TRACE, "NV40TCL_FP_ADDRESS(0x%08x)\n", args[0]);
+}
+
+void RSX::SetViewport(uint32_t cmd, std::span<const uint32_t> args)
+{
+    viewport_width = (args[0] >> 16);
+    viewport_x = (args[0] & 0xffff);
+
+    if (args.size() == 2)
     {
-        curBinding.offset = args[0] & 0xfffffff;
-        printf("NV40TCL_VTXBUF_ADDRESS(0x%08x)\n", curBinding.offset);
-        vpe.AddBinding(curBinding);
-        break;
+        viewport_height = (args[1] >> 16);
+        viewport_y = (args[1] & 0xffff);
+        LOG(RSX, TRACE, "NV30_VIEWPORT_HORIZ_VERT(%d, %d, %d, %d)\n", viewport_width, viewport_height, viewport_x, viewport_y);
     }
-    case 0x1710:
-        printf("NV40TCL_VTX_CACHE_INVALIDATE2()\n");
-        break;
-    case 0x1714:
-        printf("NV40TCL_VTX_CACHE_INVALIDATE()\n");
-        break;
-    case 0x1740 ... 0x177C:
-    {
-        curBinding.attribute = (cmd - 0x1740) / 4;
-        curBinding.stride = (args[0] >> 8) & 0xff;
-        curBinding.elems = (args[0] >> 4) & 0xf;
-        curBinding.dtype = args[0] & 0xf;
+    else
+        LOG(RSX, TRACE, "NV30_VIEWPORT_HORIZ(%d, %d)\n", viewport_width, viewport_x);
+}
 
-        printf("NV40TCL_VTXFMT(%d, %d, %d, %d)\n", curBinding.attribute, curBinding.stride, curBinding.elems, curBinding.dtype);
-        break;
-    }
-    case 0x1800:
-        printf("NV40TCL_GET_REPORT()\n");
-        break;
-    case 0x1808:
-        primitiveType = args[0];
-        printf("NV40TCL_BEGIN_END(%d)\n", primitiveType);
-        assert(primitiveType == BEGIN_END_TRIANGLES || primitiveType == BEGIN_END_STOP || primitiveType == BEGIN_END_QUADS);
-        break;
-    case 0x1814:
+void RSX::SetViewportOffset(uint32_t cmd, std::span<const uint32_t> args)
+{
+    LOG(RSX, TRACE, "NV30_VIEWPORT_OFFSET\n");
+}
+
+void RSX::SetDepthFunc(uint32_t cmd, std::span<const uint32_t> args)
+{
+    depthTestFunc = (DepthTestFunc)args[0];
+    LOG(RSX, TRACE, "NV30_DEPTH_TEST_FUNC(%s)\n", DepthFuncToString(depthTestFunc).c_str());
+}
+
+void RSX::SetDepthTestEnable(uint32_t cmd, std::span<const uint32_t> args)
+{
+    depthTestEnabled = args[0];
+    LOG(RSX, TRACE, "NV30_DEPTH_TEST_ENABLED(%s)\n", depthTestEnabled ? "GCM_TRUE" : "GCM_FALSE");
+}
+
+void RSX::UploadVpInstructions(uint32_t cmd, std::span<const uint32_t> args)
+{
+    for (auto instr : args) vpe.AddInstruction(instr);
+    LOG(RSX, TRACE, "NV30_3D_VP_UPLOAD_INST()\n");
+}
+
+void RSX::SetVertexBufferAddress(uint32_t cmd, std::span<const uint32_t> args)
+{
+    curBinding.offset = args[0] & 0xfffffff;
+    LOG(RSX, TRACE, "NV40TCL_VTXBUF_ADDRESS(0x%08x)\n", curBinding.offset);
+    vpe.AddBinding(curBinding);
+}
+
+void RSX::InvalidateVertexCache(uint32_t cmd, std::span<const uint32_t> args)
+{
+    LOG(RSX, TRACE, cmd == 0x1710 ? "NV40TCL_VTX_CACHE_INVALIDATE2()\n" : "NV40TCL_VTX_CACHE_INVALIDATE()\n");
+}
+
+void RSX::SetVertexFormat(uint32_t cmd, std::span<const uint32_t> args)
+{
+    curBinding.attribute = (cmd - 0x1740) / 4;
+    curBinding.stride = (args[0] >> 8) & 0xff;
+    curBinding.elems = (args[0] >> 4) & 0xf;
+    curBinding.dtype = args[0] & 0xf;
+
+    LOG(RSX, TRACE, "NV40TCL_VTXFMT(%d, %d, %d, %d)\n", curBinding.attribute, curBinding.stride, curBinding.elems, curBinding.dtype);
+}
+
+void RSX::GetReport(uint32_t cmd, std::span<const uint32_t> args)
+{
+    LOG(RSX, TRACE, "NV40TCL_GET_REPORT()\n");
+}
+
+void RSX::SetBeginEnd(uint32_t cmd, std::span<const uint32_t> args)
+{
+    primitiveType = args[0];
+    LOG(RSX, TRACE, "NV40TCL_BEGIN_END(%d)\n", primitiveType);
+    assert(primitiveType == BEGIN_END_TRIANGLES || primitiveType == BEGIN_END_STOP || primitiveType == BEGIN_END_QUADS);
+}
+
+void RSX::DrawArrays(uint32_t cmd, std::span<const uint32_t> args)
+{
+    uint32_t a0 = args[0];
+    LOG(RSX, TRACE, "NV40TCL_DRAW(0x%08x)\n", a0);
+    if (primitiveType == BEGIN_END_TRIANGLES)
     {
-        Vertex vertices[3];
-        uint32_t a0 = args[0];
-        printf("NV40TCL_DRAW(0x%08x)\n", a0);
-        if (primitiveType == BEGIN_END_TRIANGLES)
+        uint32_t first = a0 & 0xFFFFFF;
+        uint32_t count = ((a0 >> 24) & 0xff)+1;
+        drawVertices.resize(count);
+
+        // The per-vertex interpreter disassembles as it goes, keep it around for tracing
+        if constexpr (LOG_ENABLED(RSX, TRACE))
         {
-            int index = 0;
-            for (int i = 0; i < ((a0 >> 24) & 0xff)+1; i++)
+            for (uint32_t i = 0; i < count; i++)
             {
-                vpe.SetIndex(i);
+                vpe.SetIndex(first + i);
                 vpe.DoVertexShader(manager);
-                vertices[index].pos = vpe.GetOutputPos();
-                vertices[index].color = vpe.GetOutputColor();
-                index++;
-                if (index == 3)
-                {
-                    DrawTriangle(vertices[0], vertices[1], vertices[2]);
-                    index = 0;
-                }
+                drawVertices[i] = {vpe.GetOutputPos(), vpe.GetOutputColor()};
             }
         }
-        break;
-    }
-    case 0x1828:
-    {
-        printf("NV40TCL_POLYGON_MODE_FRONT(0x%04x)\n", args[0]);
-        break;
-    }
-    case_16(0x1840, 4):
-    {
-        uint32_t a0 = args[0];
-        textures[index].pitch = a0 & 0xFFFFF;
-        textures[index].depth = a0 >> 20;
-        printf("NV40TCL_TEXTURE_CONTROL3(%d, %d)\n", textures[index].pitch, textures[index].depth);
-        break;
-    }
-    case_16(0x1A00, 0x20):
-    {
-        Texture& tex = textures[index];
-        tex.offset = args[0];
-        uint32_t a1 = args[1];
-        uint8_t location = (a1 & 0x3) - 1;
-        bool cubemap = (a1 >> 2) & 1;
-        uint8_t dimension = (a1 >> 4) & 0xf;
-        uint8_t format = (a1 >> 8) & 0x1f;
-        uint16_t mipmap = (a1 >> 16) & 0xffff;
-        printf("NV40TCL_TEX_OFFSET(%d, 0x%08x, %d, %d, %d, %d, %d)\n", index, tex.offset, location, cubemap, dimension, format, cubemap);
-        tex.cubemap = cubemap;
-        tex.dimension = dimension;
-        tex.format = format;
-        tex.mipmap = mipmap;
-        break;
-    }
-    case_16(0x1A08, 0x20):
-    {
-        Texture& tex = textures[index];
-        printf("NV40TCL_TEX_ADDRESS(0x%08x)\n", args[0]);
-        break;
-    }
-    case_16(0x1A0C, 0x20):
-    {
-        Texture& tex = textures[index];
-        tex.enable = args[0] >> 31;
-        printf("NV40TCL_TEX_CONTROL0(%d)\n", tex.enable);
-        break;
-    }
-    case_16(0x1A10, 0x20):
-    {
-        Texture& tex = textures[index];
-        tex.swizzle = args[0];
-        printf("NV40TCL_TEX_SWIZZLE(0x%08x)\n", tex.swizzle);
-        break;
-    }
-    case_16(0x1A14, 0x20):
-    {
-        Texture& tex = textures[index];
-        printf("NV40TCL_TEX_FILTER(0x%08x)\n", args[0]);
-        break;
-    }
-    case_16(0x1A18, 0x20):
-    {
-        auto& tex = textures[index];
-        uint32_t a0 = args[0];
-        auto width = a0 >> 16;
-        auto height = a0 & 0xFFFF;
-        tex.width = width;
-        tex.height = height;
-        printf("NV40TCL_TEX_RECT(%d, %d)\n", width, height);
-        break;
-    }
-    case 0x1D60:
-    {
-        shaderControl = args[0];
-        printf("NV40TCL_FP_CONTROL(0x%08x)\n", shaderControl);
-        break;
-    }
-    case 0x1D70:
-    {
-        uint32_t value = args[0];
-        value = (value & 0xff00ff00) | ((value & 0xff) << 16) | ((value >> 16) & 0xff);
-        manager->Write32(manager->RSXCmdMem->GetStart() + semaphoreOffset, value);
-        printf("NV40TCL_SEMAPHORE_BACKENDWRITE_RELEASE(0x%08x)\n", value);
-        break;
-    }
-    case 0x1D8C:
-    {
-        printf("NV40TCL_ZSTENCIL_CLEAR_VALUE(0x%06x, 0x%02x)\n", args[0] >> 8, args[0] & 0xff);
-        break;
+        else
+            vpe.ProcessVertices(manager, first, count, drawVertices.data());
+
+        BindTextures();
+
+        if (capture)
+        {
+            uint32_t local = manager->RSXFBMem->GetStart();
+            vpe.ForEachInputRange(first, count, [&](uint32_t offset, uint32_t size) {capture->Memory(local + offset, size);});
+        }
+
+        rasterizer.DrawTriangles(GetRasterState(), drawVertices.data(), drawVertices.size());
     }
-    case 0x1D90:
+}
+
+void RSX::BindTextures()
+{
+    // Nothing from the last draw is still held, so this is where the cache makes room
+    textureCache.Trim();
+
+    for (int i = 0; i < 16; i++)
     {
-        clearColor.a = (args[0] >> 24) & 0xff;
-        clearColor.b = (args[0] >> 16) & 0xff;
-        clearColor.g = (args[0] >> 8) & 0xff;
-        clearColor.r = (args[0] >> 0) & 0xff;
-        printf("NV30_CLEAR_COLOR(%d, %d, %d, %d)\n", clearColor.r, clearColor.g, clearColor.b, clearColor.a);
-        break;
+        const Texture& tex = textures[i];
+        if (!tex.enable)
+        {
+            boundTextures[i] = nullptr;
+            continue;
+        }
+
+        uint32_t addr = tex.location ? CellGcm::GetIOAddres() + tex.offset : manager->RSXFBMem->GetStart() + tex.offset;
+        boundTextures[i] = textureCache.Get(addr, tex);
+
+        if (capture && boundTextures[i])
+            capture->Memory(addr, boundTextures[i]->size);
     }
-    case 0x1D94:
-        ClearFramebuffers(args[0]);
-        break;
-    case 0x1E9C:
+}
+
+RasterState RSX::GetRasterState()
+{
+    RasterState state;
+    state.color = framebuffer;
+    state.depth = depthBuffer;
+    state.colorPitch = colorPitch;
+    state.depthPitch = zPitch;
+    RsxFramebuffer fb = GetFramebuffer(0);
+    state.width = fb.width;
+    state.height = fb.height;
+    state.scissorX = scissor_x;
+    state.scissorY = scissor_y;
+    state.scissorWidth = scissor_width;
+    state.scissorHeight = scissor_height;
+
+    state.depthTest = depthTestEnabled && depthBuffer;
+    state.depthFunc = depthTestFunc;
+    state.depthMin = depth_min;
+    state.depthMax = depth_max;
+
+    state.colorMask = (b_mask ? 0xFF000000 : 0) | (g_mask ? 0xFF0000 : 0) | (r_mask ? 0xFF00 : 0) | (a_mask ? 0xFF : 0);
+
+    state.blend = blend_enable;
+    state.sfuncRgb = blend_sfunc_rgb;
+    state.sfuncAlpha = blend_sfunc_alpha;
+    state.dfuncRgb = blend_dfunc_rgb;
+    state.dfuncAlpha = blend_dfunc_alpha;
+    return state;
+}
+
+void RSX::SetPolygonModeFront(uint32_t cmd, std::span<const uint32_t> args)
+{
+    LOG(RSX, TRACE, "NV40TCL_POLYGON_MODE_FRONT(0x%04x)\n", args[0]);
+}
+
+void RSX::SetTextureControl3(uint32_t cmd, std::span<const uint32_t> args)
+{
+    int index = (cmd - 0x1840) / 4;
+    uint32_t a0 = args[0];
+    textures[index].pitch = a0 & 0xFFFFF;
+    textures[index].depth = a0 >> 20;
+    LOG(RSX, TRACE, "NV40TCL_TEXTURE_CONTROL3(%d, %d)\n", textures[index].pitch, textures[index].depth);
+}
+
+void RSX::SetTextureOffset(uint32_t cmd, std::span<const uint32_t> args)
+{
+    int index = (cmd - 0x1A00) / 0x20;
+    Texture& tex = textures[index];
+    tex.offset = args[0];
+    uint32_t a1 = args[1];
+    uint8_t location = (a1 & 0x3) - 1;
+    bool cubemap = (a1 >> 2) & 1;
+    uint8_t dimension = (a1 >> 4) & 0xf;
+    uint8_t format = (a1 >> 8) & 0xff;
+    uint16_t mipmap = (a1 >> 16) & 0xffff;
+    LOG(RSX, TRACE, "NV40TCL_TEX_OFFSET(%d, 0x%08x, %d, %d, %d, %d, %d)\n", index, tex.offset, location, cubemap, dimension, format, cubemap);
+    tex.location = location;
+    tex.cubemap = cubemap;
+    tex.dimension = dimension;
+    tex.format = format;
+    tex.mipmap = mipmap;
+}
+
+void RSX::SetTextureAddress(uint32_t cmd, std::span<const uint32_t> args)
+{
+    LOG(RSX, TRACE, "NV40TCL_TEX_ADDRESS(0x%08x)\n", args[0]);
+}
+
+void RSX::SetTextureControl0(uint32_t cmd, std::span<const uint32_t> args)
+{
+    Texture& tex = textures[(cmd - 0x1A0C) / 0x20];
+    tex.enable = args[0] >> 31;
+    LOG(RSX, TRACE, "NV40TCL_TEX_CONTROL0(%d)\n", tex.enable);
+}
+
+void RSX::SetTextureSwizzle(uint32_t cmd, std::span<const uint32_t> args)
+{
+    Texture& tex = textures[(cmd - 0x1A10) / 0x20];
+    tex.swizzle = args[0];
+    LOG(RSX, TRACE, "NV40TCL_TEX_SWIZZLE(0x%08x)\n", tex.swizzle);
+}
+
+void RSX::SetTextureFilter(uint32_t cmd, std::span<const uint32_t> args)
+{
+    LOG(RSX, TRACE, "NV40TCL_TEX_FILTER(0x%08x)\n", args[0]);
+}
+
+void RSX::SetTextureRect(uint32_t cmd, std::span<const uint32_t> args)
+{
+    auto& tex = textures[(cmd - 0x1A18) / 0x20];
+    uint32_t a0 = args[0];
+    auto width = a0 >> 16;
+    auto height = a0 & 0xFFFF;
+    tex.width = width;
+    tex.height = height;
+    LOG(RSX, TRACE, "NV40TCL_TEX_RECT(%d, %d)\n", width, height);
+}
+
+void RSX::SetFpControl(uint32_t cmd, std::span<const uint32_t> args)
+{
+    shaderControl = args[0];
+    LOG(RSX, TRACE, "NV40TCL_FP_CONTROL(0x%08x)\n", shaderControl);
+}
+
+void RSX::BackendWriteRelease(uint32_t cmd, std::span<const uint32_t> args)
+{
+    uint32_t value = args[0];
+    value = (value & 0xff00ff00) | ((value & 0xff) << 16) | ((value >> 16) & 0xff);
+    manager->Write32(manager->RSXCmdMem->GetStart() + semaphoreOffset, value);
+    LOG(RSX, TRACE, "NV40TCL_SEMAPHORE_BACKENDWRITE_RELEASE(0x%08x)\n", value);
+}
+
+void RSX::SetZStencilClearValue(uint32_t cmd, std::span<const uint32_t> args)
+{
+    zstencilClear = args[0];
+    LOG(RSX, TRACE, "NV40TCL_ZSTENCIL_CLEAR_VALUE(0x%06x, 0x%02x)\n", args[0] >> 8, args[0] & 0xff);
+}
+
+void RSX::SetClearColor(uint32_t cmd, std::span<const uint32_t> args)
+{
+    clearColor.a = (args[0] >> 24) & 0xff;
+    clearColor.b = (args[0] >> 16) & 0xff;
+    clearColor.g = (args[0] >> 8) & 0xff;
+    clearColor.r = (args[0] >> 0) & 0xff;
+    LOG(RSX, TRACE, "NV30_CLEAR_COLOR(%d, %d, %d, %d)\n", clearColor.r, clearColor.g, clearColor.b, clearColor.a);
+}
+
+void RSX::ClearSurface(uint32_t cmd, std::span<const uint32_t> args)
+{
+    ClearFramebuffers(args[0]);
+}
+
+void RSX::SetVpUploadOffset(uint32_t cmd, std::span<const uint32_t> args)
+{
+    vpe.SetVPOffs(args[0]);
+    LOG(RSX, TRACE, "NV30_VERTEX_PROGRAM_UPLOAD(0x%08x)\n", args[0]);
+}
+
+void RSX::SetTransformTimeout(uint32_t cmd, std::span<const uint32_t> args)
+{
+    LOG(RSX, TRACE, "NV40TCL_TRANSFORM_TIMEOUT(0x%08x)\n", args[0]);
+}
+
+void RSX::UploadVpConstants(uint32_t cmd, std::span<const uint32_t> args)
+{
+    vpe.SetConstOffs(args[0]);
+    LOG(RSX, TRACE, "NV40TCL_VP_UPLOAD_CONST_ID(0x%08x)\n", args[0]);
+    for (size_t i = 1; i < args.size(); i++) vpe.UploadConst(args[i]);
+    if constexpr (LOG_ENABLED(RSX, TRACE))
     {
-        vpe.SetVPOffs(args[0]);
-        printf("NV30_VERTEX_PROGRAM_UPLOAD(0x%08x)\n", args[0]);
-        break;
-    }
-    case 0x1EF8:
-        printf("NV40TCL_TRANSFORM_TIMEOUT(0x%08x)\n", args[0]);
-        break;
-    case 0x1EFC:
-        vpe.SetConstOffs(args[0]);
-        printf("NV40TCL_VP_UPLOAD_CONST_ID(0x%08x)\n", args[0]);
-        for (int i = 1; i < argCount; i++) vpe.UploadConst(args[i]);
-        for (int i = 1; i < argCount; i += 4)
+        for (size_t i = 1; i + 3 < args.size(); i += 4)
         {
-            float x = (float&)args[i];
-            float y = (float&)args[i+1];
-            float z = (float&)args[i+2];
-            float w = (float&)args[i+3];
-            printf("Vertex constant (%f, %f, %f, %f)\n", x, y, z, w);
+            float x = (const float&)args[i];
+            float y = (const float&)args[i+1];
+            float z = (const float&)args[i+2];
+            float w = (const float&)args[i+3];
+            LOG(RSX, TRACE, "Vertex constant (%f, %f, %f, %f)\n", x, y, z, w);
         }
-        break;
-    case 0x1FF0:
-        vpe.SetInputMask(args[0]);
-        printf("NV40TCL_VP_ATTRIB_EN(0x%08x)\n", args[0]);
-        break;
-    case 0x1FF4:
-        vpe.SetResultMask(args[0]);
-        printf("NV40TCL_VP_RESULT_EN(0x%08x)\n", args[0]);
-        break;
-    case 0x3FEAD:
-        break;
-    default:
-        printf("Unknown RSX command 0x%05x (0x%08x, ", cmd, fullCmd);
-        for (int i = 0; i < argCount; i++)
-            printf("0x%08x, ", args[i]);
-        printf("\b\b)\n");
-        throw std::runtime_error("Unknown RSX command");
     }
 }
 
+void RSX::SetVpAttribEnable(uint32_t cmd, std::span<const uint32_t> args)
+{
+    vpe.SetInputMask(args[0]);
+    LOG(RSX, TRACE, "NV40TCL_VP_ATTRIB_EN(0x%08x)\n", args[0]);
+}
+
+void RSX::SetVpResultEnable(uint32_t cmd, std::span<const uint32_t> args)
+{
+    vpe.SetResultMask(args[0]);
+    LOG(RSX, TRACE, "NV40TCL_VP_RESULT_EN(0x%08x)\n", args[0]);
+}
+
 void RSX::ClearFramebuffers(uint32_t mask)
 {
     uint32_t colorMask = 0xFFFFFFFF; // Clear none of the colors by default
 
-	SDL_SetRenderDrawColor(renderer, clearColor.r, clearColor.g, clearColor.b, clearColor.a);
-	SDL_RenderClear(renderer);
-
     framebuffer = manager->GetRawPtr(manager->RSXFBMem->GetStart() + color0Offset);
     depthBuffer = manager->GetRawPtr(manager->RSXFBMem->GetStart() + zOffset);
 
     uint32_t depthMask = 0xFFFFFFFF;
     if (mask & 1)
-        depthMask = 0;
+        depthMask &= ~0xFFFFFF00; // Clear the depth
+    if (mask & 2)
+        depthMask &= ~0xFF; // Clear the stencil
 
     if (mask & (1 << 7))
         colorMask &= ~0xFF; // Clear the A component
     if (mask & (1 << 6))
-        colorMask &= ~0xFF00; // Clear the B component
+        colorMask &= ~0xFF000000; // Clear the B component
     if (mask & (1 << 5))
         colorMask &= ~0xFF0000; // Clear the G component
     if (mask & (1 << 4))
-        colorMask &= ~0xFF000000; // Clear the R component
+        colorMask &= ~0xFF00; // Clear the R component
 
-    uint32_t color = (clearColor.r << 24) | (clearColor.g << 16) | (clearColor.b << 8) | (clearColor.a);
+    // Surfaces are stored the way the guest sees them, big-endian ARGB
+    uint32_t color = (clearColor.b << 24) | (clearColor.g << 16) | (clearColor.r << 8) | (clearColor.a);
     
-    for (uint32_t y = 0; y < framebuffers[0].height; y++)
+    RsxFramebuffer fb = GetFramebuffer(0);
+    for (uint32_t y = 0; y < fb.height; y++)
     {
-        for (uint32_t x = 0; x < framebuffers[0].width; x++)
+        for (uint32_t x = 0; x < fb.width; x++)
         {
             *(uint32_t*)&framebuffer[(x*4) + (y * colorPitch)] &= colorMask;
             *(uint32_t*)&framebuffer[(x*4) + (y * colorPitch)] |= color & ~colorMask;
-            *(uint32_t*)&depthBuffer[(x*4) + (y * zPitch)] = 0;
+            *(uint32_t*)&depthBuffer[(x*4) + (y * zPitch)] &= depthMask;
+            *(uint32_t*)&depthBuffer[(x*4) + (y * zPitch)] |= zstencilClear & ~depthMask;
         }
     }
 
-    printf("NV40TCL_CLEAR_BUFFERS(0x%08x)\n", mask);
-}
-
-bool is_top_left(vec4 start, vec4 end)
-{
-	vec4 edge = {end.x - start.x, end.y - start.y, 0, 0};
-	bool is_top_edge = edge.y == 0 && edge.x > 0;
-	bool is_left_edge = edge.y < 0;
-	return is_left_edge || is_top_edge;
-}
-
-float edge_cross(vec4 a, vec4 b, vec4 p)
-{
-	vec4 ab = {b.x - a.x, b.y - a.y, 0, 0};
-	vec4 ap = {p.x - a.x, p.y - a.y, 0, 0};
-	return ab.x * ap.y - ab.y * ap.x;
-}
-
-void RSX::DrawTriangle(Vertex vert0, Vertex vert1, Vertex vert2)
-{
-#if 0
-	// Software triangle rasterization
-#else
-	// Cheating by using SDL_RenderGeometry
-	// This sucks because we can't do depth buffering or texture mapping
-	std::vector<SDL_Vertex> vertices;
-
-	Vertex v0, v1, v2;
-	SDL_RenderWindowToLogical(renderer, vert0.pos.x, vert0.pos.y, &v0.pos.x, &v0.pos.y);
-	SDL_RenderWindowToLogical(renderer, vert1.pos.x, vert1.pos.y, &v1.pos.x, &v1.pos.y);
-	SDL_RenderWindowToLogical(renderer, vert2.pos.x, vert2.pos.y, &v2.pos.x, &v2.pos.y);
-	v0.color = vert0.color;
-	v1.color = vert1.color;
-	v2.color = vert2.color;
-
-	SDL_Vertex v;
-	v.position.x = v0.pos.x;
-	v.position.y = v0.pos.y;
-	v.color.r = v0.color.x;
-	v.color.g = v0.color.y;
-	v.color.b = v0.color.z;
-	v.color.a = SDL_ALPHA_OPAQUE;
-	vertices.push_back(v);
-	v.position.x = v1.pos.x;
-	v.position.y = v1.pos.y;
-	v.color.r = v1.color.x;
-	v.color.g = v1.color.y;
-	v.color.b = v1.color.z;
-	v.color.a = SDL_ALPHA_OPAQUE;
-	vertices.push_back(v);
-	v.position.x = v2.pos.x;
-	v.position.y = v2.pos.y;
-	v.color.r = v2.color.x;
-	v.color.g = v2.color.y;
-	v.color.b = v2.color.z;
-	v.color.a = SDL_ALPHA_OPAQUE;
-	vertices.push_back(v);
-
-	SDL_RenderGeometry(renderer, NULL, vertices.data(), vertices.size(), NULL, 0);
-	//SDL_RenderPresent(renderer);
-#endif
+    LOG(RSX, TRACE, "NV40TCL_CLEAR_BUFFERS(0x%08x)\n", mask);
 }
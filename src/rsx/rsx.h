@@ -5,19 +5,24 @@
 #include <string>
 #include <kernel/Memory.h>
 #include <SDL2/SDL.h>
+#include <atomic>
+#include <array>
+#include <span>
+#include <mutex>
 
 #include "VPE.h"
+#include "Rasterizer.h"
+#include "TextureCache.h"
+#include "Capture.h"
+
+// Methods 0x0000-0x1FFC go through the method table
+#define RSX_METHOD_COUNT 0x800
 
 struct Color
 {
     uint8_t r, g, b, a;
 };
 
-struct Vertex
-{
-    vec4 pos, color;
-};
-
 enum DepthTestFunc
 {
     NEVER = 0x200,
@@ -48,7 +53,8 @@ enum
 struct Texture
 {
     uint32_t offset;
-    uint8_t format;
+    uint8_t location; // 0 = local memory, 1 = main memory
+    uint8_t format; // Including the GCM_TEXTURE_LN/UN flags
     uint8_t dimension;
     bool cubemap;
     uint16_t mipmap;
@@ -58,48 +64,155 @@ struct Texture
     bool enable;
 };
 
+// Headless runs never touch SDL, flips are timed and optionally written to disk instead of shown
+struct HeadlessOptions
+{
+    bool enabled = false;
+    const char* dumpPath = nullptr; // Directory frames get written to, nullptr to not dump them
+    uint32_t dumpInterval = 1; // Every Nth flip gets dumped
+    bool dumpRaw = false; // Raw ARGB rows rather than PNG
+};
+
 class RSX
 {
 public:
+    void SetHeadless(const HeadlessOptions& options) {headless = options;} // Has to be called before Init
     void Init();
-    void Present();
+    void Start(); // Starts the FIFO thread, the memory manager has to be set by now
+    void EnableJit() {vpe.EnableJit();}
+    void Present(); // Called on every vblank, wakes the present thread and runs the flip handler
 
     void SetFramebuffer(int id, uint32_t offset, uint32_t pitch, uint32_t width, uint32_t height);
-    void DoCommands(uint8_t* buf, uint32_t size);
 
-    void SetMman(MemoryManager* manager) {this->manager = manager;}
+    // Called when put has been written, wakes the FIFO thread
+    void Kick();
+
+    // Records everything the FIFO thread consumes from here on, the memory manager has to be set by now
+    void StartCapture(const char* path) {capture = new CaptureWriter(path, manager);}
+
+    // Runs a single method outside of the FIFO, for replaying captures
+    void ExecuteMethod(uint32_t cmd, std::span<const uint32_t> args) {DoCmd(cmd, args);}
+
+    void SetMman(MemoryManager* manager) {this->manager = manager; textureCache.SetMman(manager);}
 
-    bool& GetFlipped() {return flipped;}
+    std::atomic<bool>& GetFlipped() {return flipped;}
 private:
-    bool flipped = false;
+    std::atomic<bool> flipped = false;
+
+    // The present thread owns the renderer and sleeps on presentRequests, which vblanks and flips bump
+    std::atomic<uint32_t> presentRequests{0};
+    std::atomic<uint32_t> flips{0};
+    std::atomic<uint32_t> displayBuffer{0}; // Id of the framebuffer shown by the last flip
+    uint32_t textureWidth = 0, textureHeight = 0;
+    bool swapOnPresent; // The texture is host-endian ARGB rather than the guest's byte order
+
+    HeadlessOptions headless;
+    CaptureWriter* capture = nullptr;
+    CaptureDisplayBuffers GetCaptureDisplayBuffers();
+
+    void PresentMain();
+    void HeadlessMain();
+    void CreatePresentTexture(uint32_t width, uint32_t height);
+    void Flip(uint32_t id);
+
+    // Bumped on every kick, the FIFO thread sleeps on it while get == put
+    std::atomic<uint32_t> kicks{0};
+
+    void ThreadMain();
+    void DoCommands(uint32_t get, uint32_t put);
 
     SDL_Window* window;
-    SDL_Renderer* renderer;
-    SDL_Texture* texture;
+    SDL_Renderer* renderer = nullptr;
+    SDL_Texture* texture = nullptr;
 
-    void DoCmd(uint32_t fullCmd, uint32_t cmd, std::vector<uint32_t>& args, int argCount);
+    // Handlers get the method's register offset and its (already byte-swapped) arguments
+    using MethodHandler = void (RSX::*)(uint32_t cmd, std::span<const uint32_t> args);
+    static const std::array<MethodHandler, RSX_METHOD_COUNT> methodTable;
+    static constexpr std::array<MethodHandler, RSX_METHOD_COUNT> BuildMethodTable();
+
+    // Arguments of the method being executed, a method carries at most 0x7FF of them
+    uint32_t methodArgs[0x800];
+
+    void DoCmd(uint32_t cmd, std::span<const uint32_t> args);
     void ClearFramebuffers(uint32_t mask);
 
-    void DrawTriangle(Vertex v0, Vertex v1, Vertex v2);
+    void UnknownMethod(uint32_t cmd, std::span<const uint32_t> args);
+    void IgnoreMethod(uint32_t cmd, std::span<const uint32_t> args);
+    void SetReference(uint32_t cmd, std::span<const uint32_t> args);
+    void SetSemaphoreOffset(uint32_t cmd, std::span<const uint32_t> args);
+    void SemaphoreAcquire(uint32_t cmd, std::span<const uint32_t> args);
+    void SemaphoreRelease(uint32_t cmd, std::span<const uint32_t> args);
+    void Nop(uint32_t cmd, std::span<const uint32_t> args);
+    void WaitForIdle(uint32_t cmd, std::span<const uint32_t> args);
+    void SetDmaColor1(uint32_t cmd, std::span<const uint32_t> args);
+    void SetDmaColor0(uint32_t cmd, std::span<const uint32_t> args);
+    void SetDmaZeta(uint32_t cmd, std::span<const uint32_t> args);
+    void SetDmaColor2(uint32_t cmd, std::span<const uint32_t> args);
+    void SetRtFormat(uint32_t cmd, std::span<const uint32_t> args);
+    void SetRtEnable(uint32_t cmd, std::span<const uint32_t> args);
+    void SetZetaPitch(uint32_t cmd, std::span<const uint32_t> args);
+    void SetWindowOffset(uint32_t cmd, std::span<const uint32_t> args);
+    void SetAlphaTestEnable(uint32_t cmd, std::span<const uint32_t> args);
+    void SetBlendEnable(uint32_t cmd, std::span<const uint32_t> args);
+    void SetBlendFunc(uint32_t cmd, std::span<const uint32_t> args);
+    void SetColorMask(uint32_t cmd, std::span<const uint32_t> args);
+    void SetDepthRange(uint32_t cmd, std::span<const uint32_t> args);
+    void SetScissor(uint32_t cmd, std::span<const uint32_t> args);
+    void SetFpAddress(uint32_t cmd, std::span<const uint32_t> args);
+    void SetViewport(uint32_t cmd, std::span<const uint32_t> args);
+    void SetViewportOffset(uint32_t cmd, std::span<const uint32_t> args);
+    void SetDepthFunc(uint32_t cmd, std::span<const uint32_t> args);
+    void SetDepthTestEnable(uint32_t cmd, std::span<const uint32_t> args);
+    void UploadVpInstructions(uint32_t cmd, std::span<const uint32_t> args);
+    void SetVertexBufferAddress(uint32_t cmd, std::span<const uint32_t> args);
+    void InvalidateVertexCache(uint32_t cmd, std::span<const uint32_t> args);
+    void SetVertexFormat(uint32_t cmd, std::span<const uint32_t> args);
+    void GetReport(uint32_t cmd, std::span<const uint32_t> args);
+    void SetBeginEnd(uint32_t cmd, std::span<const uint32_t> args);
+    void DrawArrays(uint32_t cmd, std::span<const uint32_t> args);
+    void SetPolygonModeFront(uint32_t cmd, std::span<const uint32_t> args);
+    void SetTextureControl3(uint32_t cmd, std::span<const uint32_t> args);
+    void SetTextureOffset(uint32_t cmd, std::span<const uint32_t> args);
+    void SetTextureAddress(uint32_t cmd, std::span<const uint32_t> args);
+    void SetTextureControl0(uint32_t cmd, std::span<const uint32_t> args);
+    void SetTextureSwizzle(uint32_t cmd, std::span<const uint32_t> args);
+    void SetTextureFilter(uint32_t cmd, std::span<const uint32_t> args);
+    void SetTextureRect(uint32_t cmd, std::span<const uint32_t> args);
+    void SetFpControl(uint32_t cmd, std::span<const uint32_t> args);
+    void BackendWriteRelease(uint32_t cmd, std::span<const uint32_t> args);
+    void SetZStencilClearValue(uint32_t cmd, std::span<const uint32_t> args);
+    void SetClearColor(uint32_t cmd, std::span<const uint32_t> args);
+    void ClearSurface(uint32_t cmd, std::span<const uint32_t> args);
+    void SetVpUploadOffset(uint32_t cmd, std::span<const uint32_t> args);
+    void SetTransformTimeout(uint32_t cmd, std::span<const uint32_t> args);
+    void UploadVpConstants(uint32_t cmd, std::span<const uint32_t> args);
+    void SetVpAttribEnable(uint32_t cmd, std::span<const uint32_t> args);
+    void SetVpResultEnable(uint32_t cmd, std::span<const uint32_t> args);
+
+    RasterState GetRasterState();
 
     MemoryManager* manager;
 
-    uint8_t* framebuffer;
-    uint8_t* depthBuffer;
+    uint8_t* framebuffer = nullptr;
+    uint8_t* depthBuffer = nullptr;
 
-    bool r_mask, g_mask, b_mask, a_mask;
+    bool r_mask = true, g_mask = true, b_mask = true, a_mask = true;
     Color clearColor;
+    uint32_t zstencilClear = 0xFFFFFF00;
     uint32_t viewport_width, viewport_height, viewport_x, viewport_y;
-    uint32_t scissor_width, scissor_height, scissor_x, scissor_y;
-    float depth_min, depth_max;
-    bool depthTestEnabled;
-    DepthTestFunc depthTestFunc;
+    uint32_t scissor_width = 4096, scissor_height = 4096, scissor_x = 0, scissor_y = 0;
+    float depth_min = 0.0f, depth_max = 1.0f;
+    bool depthTestEnabled = false;
+    DepthTestFunc depthTestFunc = LESS;
 
     uint64_t semaphoreOffset;
 
     VertexShader vpe;
     VertexBinding curBinding;
 
+    Rasterizer rasterizer;
+    std::vector<Vertex> drawVertices; // Reused between draws
+
     uint32_t fpShaderOffs; // Offset from the beginning of RSXCMDMem of the fragment shader
     uint32_t shaderControl;
 
@@ -120,8 +233,15 @@ private:
     {
         uint32_t offs, pitch, width, height, bpp;
     } framebuffers[8];
+    // Set from the PPU thread and read by the FIFO and present threads, which take copies through GetFramebuffer
+    std::mutex framebufferLock;
+    RsxFramebuffer GetFramebuffer(int id);
+
+    Texture textures[16] = {};
 
-    Texture textures[16];
+    TextureCache textureCache;
+    const CachedTexture* boundTextures[16] = {}; // Decoded textures of the current draw, nullptr when disabled
+    void BindTextures();
 };
 
 extern RSX* rsx;
@@ -0,0 +1,169 @@
+#include "kernel/Memory.h"
+#include "kernel/Modules/CellGcm.h"
+#include "rsx/rsx.h"
+#include "rsx/Capture.h"
+#include "rsx/FrameDump.h"
+#include "logging.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+bool running = false;
+
+// Replays a capture written with --capture through the RSX, no PPU or SPU code runs
+int main(int argc, char** argv)
+{
+    if (argc < 2 || !strcmp(argv[1], "--help"))
+    {
+        printf("Usage: %s <capture> [options]\n", argv[0]);
+        printf("Options:\n");
+        printf("\t--help: Display this message and exit\n");
+        printf("\t--jit: Compile vertex programs to x86-64 instead of interpreting them\n");
+        printf("\t--loops=<n>: Replay the capture n times\n");
+        printf("\t--dump-frames=<dir>: Write every flipped frame to <dir> as PNG\n");
+        printf("\t--dump-raw: Dump raw big-endian ARGB frames instead of PNG\n");
+        return 0;
+    }
+
+    bool useJit = false, dumpRaw = false;
+    int loops = 1;
+    const char* dumpPath = nullptr;
+    for (int i = 2; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--jit"))
+            useJit = true;
+        else if (!strncmp(argv[i], "--loops=", 8))
+            loops = std::max(1, atoi(argv[i] + 8));
+        else if (!strncmp(argv[i], "--dump-frames=", 14))
+            dumpPath = argv[i] + 14;
+        else if (!strcmp(argv[i], "--dump-raw"))
+            dumpRaw = true;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(CaptureHeader))
+    {
+        printf("Couldn't open %s\n", argv[1]);
+        return 1;
+    }
+
+    const uint8_t* capture = (const uint8_t*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (capture == MAP_FAILED)
+    {
+        printf("Couldn't map %s\n", argv[1]);
+        return 1;
+    }
+
+    const CaptureHeader* header = (const CaptureHeader*)capture;
+    if (header->magic != CAPTURE_MAGIC || header->version != CAPTURE_VERSION)
+    {
+        printf("%s isn't a version %d capture\n", argv[1], CAPTURE_VERSION);
+        return 1;
+    }
+
+    MemoryManager manager = MemoryManager();
+    rsx->SetMman(&manager);
+    if (useJit)
+        rsx->EnableJit();
+
+    uint32_t frame = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto lastFrameTime = start;
+
+    for (int loop = 0; loop < loops; loop++)
+    {
+        size_t pos = sizeof(CaptureHeader);
+        while (pos + sizeof(CaptureRecord) <= (size_t)st.st_size)
+        {
+            const size_t recordPos = pos;
+            const CaptureRecord* record = (const CaptureRecord*)&capture[pos];
+            const uint8_t* data = &capture[pos + sizeof(CaptureRecord)];
+            pos += sizeof(CaptureRecord) + ((record->size + 7) & ~7);
+
+            // A capture cut short by the emulator getting killed ends at the last whole record
+            if (pos > (size_t)st.st_size)
+                break;
+
+            switch (record->type)
+            {
+            case CAPTURE_CONFIG:
+            {
+                const CaptureConfig* config = (const CaptureConfig*)data;
+                CellGcm::SetAddresses(config->ioAddress, config->controlAddress);
+                break;
+            }
+            case CAPTURE_MEMORY:
+            {
+                const CaptureMemory* memory = (const CaptureMemory*)data;
+                memcpy(manager.GetRawPtr(memory->addr), data + sizeof(CaptureMemory), memory->size);
+                break;
+            }
+            case CAPTURE_METHODS:
+            {
+                const uint32_t* words = (const uint32_t*)data;
+                const uint32_t* end = words + record->size / 4;
+                while (words < end)
+                {
+                    uint32_t cmd = words[0], count = words[1];
+                    rsx->ExecuteMethod(cmd, std::span<const uint32_t>(words + 2, count));
+                    words += 2 + count;
+                }
+                break;
+            }
+            case CAPTURE_DISPLAY_BUFFERS:
+            {
+                const CaptureDisplayBuffers* display = (const CaptureDisplayBuffers*)data;
+                for (int i = 0; i < 8; i++)
+                {
+                    const auto& fb = display->buffers[i];
+                    if (fb.pitch)
+                        rsx->SetFramebuffer(i, fb.offset, fb.pitch, fb.width, fb.height);
+                }
+                break;
+            }
+            case CAPTURE_FLIP:
+            {
+                const CaptureFlip* flip = (const CaptureFlip*)data;
+
+                auto now = std::chrono::steady_clock::now();
+                printf("Frame %u: %.3f ms\n", frame, std::chrono::duration<double, std::milli>(now - lastFrameTime).count());
+                lastFrameTime = now;
+
+                const auto& fb = flip->display.buffers[flip->buffer & 7];
+                if (dumpPath && fb.width && fb.height)
+                {
+                    char path[4096];
+                    snprintf(path, sizeof(path), "%s/frame_%06u.%s", dumpPath, frame, dumpRaw ? "raw" : "png");
+
+                    const uint8_t* pixels = manager.GetRawPtr(manager.RSXFBMem->GetStart() + fb.offset);
+                    if (dumpRaw)
+                        WriteFrameRaw(path, pixels, fb.width, fb.height, fb.pitch);
+                    else
+                        WriteFramePng(path, pixels, fb.width, fb.height, fb.pitch);
+                }
+
+                frame++;
+                break;
+            }
+            default:
+                printf("Unknown record type %d at offset 0x%zx\n", record->type, recordPos);
+                return 1;
+            }
+        }
+    }
+
+    double total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("Replayed %u frames in %.3f ms (%.3f ms per frame)\n", frame, total, frame ? total / frame : 0.0);
+
+    Log::Flush();
+    return 0;
+}